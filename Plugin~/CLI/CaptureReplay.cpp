@@ -0,0 +1,475 @@
+#include "pch.h"
+#include "CaptureReplay.h"
+#include "ImageFile.h"
+
+using namespace rths;
+
+using nanosec = uint64_t;
+
+static nanosec Now()
+{
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+static inline double NS2MS(nanosec ns) { return (double)ns / 1000000.0; }
+
+static std::string ToString(const CaptureArray& a, const char *data)
+{
+    return std::string(data + a.offset, a.count);
+}
+
+
+bool CaptureReplay::IsCaptureFile(const char *path)
+{
+    CaptureFileHeader header{};
+    FILE *f = std::fopen(path, "rb");
+    if (!f)
+        return false;
+    bool ret = std::fread(&header, sizeof(header), 1, f) == 1 && std::memcmp(header.magic, kCaptureMagic, sizeof(header.magic)) == 0;
+    std::fclose(f);
+    return ret;
+}
+
+CaptureReplay::~CaptureReplay()
+{
+    release();
+}
+
+void CaptureReplay::release()
+{
+    for (auto& kvp : m_renderers) {
+        for (auto rt : kvp.second.render_targets)
+            rthsRenderTargetRelease(rt);
+        rthsRendererRelease(kvp.second.renderer);
+    }
+    m_renderers.clear();
+    for (auto inst : m_instances)
+        rthsMeshInstanceRelease(inst);
+    m_instances.clear();
+    for (auto mesh : m_meshes)
+        rthsMeshRelease(mesh);
+    m_meshes.clear();
+}
+
+bool CaptureReplay::open(const char *path)
+{
+    if (!m_file.open(path)) {
+        m_error = std::string("can't open ") + path;
+        return false;
+    }
+
+    auto *data = m_file.data();
+    size_t size = m_file.size();
+    CaptureFileHeader header{};
+    if (size >= sizeof(header))
+        std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.magic, kCaptureMagic, sizeof(header.magic)) != 0) {
+        m_error = std::string(path) + " is not a capture file";
+        return false;
+    }
+    if (header.version != kCaptureVersion || header.header_size < sizeof(header) || header.header_size % kCaptureAlignment != 0) {
+        m_error = std::string(path) + ": unsupported version " + std::to_string(header.version);
+        return false;
+    }
+
+    // chunks after the last FrameEnd (e.g. the application crashed while capturing) are ignored
+    Frame frame;
+    size_t pos = header.header_size;
+    while (pos + sizeof(CaptureChunkHeader) <= size) {
+        CaptureChunkHeader ch;
+        std::memcpy(&ch, data + pos, sizeof(ch));
+        pos += sizeof(ch);
+        if (ch.size > size - pos || ch.size % kCaptureAlignment != 0) {
+            m_error = std::string(path) + ": broken chunk at " + std::to_string(pos - sizeof(ch));
+            return false;
+        }
+
+        Chunk chunk{ ch.type, data + pos, (size_t)ch.size };
+        if (!validate(chunk)) {
+            m_error = std::string(path) + ": invalid chunk at " + std::to_string(pos - sizeof(ch));
+            return false;
+        }
+        pos += chunk.size;
+
+        if (chunk.type == CaptureChunkType::FrameEnd) {
+            frame.time = ((const CaptureFrameEnd*)chunk.payload)->time;
+            m_frames.push_back(std::move(frame));
+            frame = {};
+        }
+        else
+            frame.chunks.push_back(chunk);
+    }
+    if (m_frames.empty()) {
+        m_error = std::string(path) + ": no frames";
+        return false;
+    }
+    return true;
+}
+
+template<class T>
+const T* CaptureReplay::get(const Chunk& chunk, const CaptureArray& a) const
+{
+    return a.count > 0 ? (const T*)(chunk.payload + a.offset) : nullptr;
+}
+
+// everything that is passed to the API is checked here as capture files are not trusted
+bool CaptureReplay::validate(const Chunk& chunk)
+{
+    auto in_range = [&](const CaptureArray& a, size_t element_size) {
+        return a.offset % kCaptureAlignment == 0 && a.offset <= chunk.size && (uint64_t)a.count * element_size <= chunk.size - a.offset;
+    };
+
+    switch (chunk.type) {
+    case CaptureChunkType::Mesh:
+    {
+        if (chunk.size < sizeof(CaptureMesh))
+            return false;
+        auto& mesh = *(const CaptureMesh*)chunk.payload;
+        if (mesh.id > m_mesh_count || mesh.vertex_count < 0 || mesh.index_count < 0 || mesh.index_count % 3 != 0)
+            return false;
+        if (mesh.vertex_stride < (int)sizeof(float3) || (mesh.index_stride != 2 && mesh.index_stride != 4))
+            return false;
+        if (!in_range(mesh.name, 1) || !in_range(mesh.vertices, mesh.vertex_stride) || !in_range(mesh.indices, mesh.index_stride) ||
+            !in_range(mesh.bindposes, sizeof(float4x4)) || !in_range(mesh.bone_counts, 1) || !in_range(mesh.weights, sizeof(BoneWeight1)) ||
+            !in_range(mesh.blendshape_frames, sizeof(CaptureBlendshapeFrame)))
+            return false;
+        if (mesh.vertices.count != (uint32_t)mesh.vertex_count || mesh.indices.count != (uint32_t)mesh.index_count)
+            return false;
+
+        auto *indices = get<char>(chunk, mesh.indices);
+        for (int i = 0; i < mesh.index_count; ++i) {
+            uint32_t index = mesh.index_stride == 2 ? ((const uint16_t*)indices)[i] : ((const uint32_t*)indices)[i];
+            if (index >= (uint32_t)mesh.vertex_count)
+                return false;
+        }
+
+        if (mesh.bone_counts.count != 0 && mesh.bone_counts.count != (uint32_t)mesh.vertex_count)
+            return false;
+        auto *bone_counts = get<uint8_t>(chunk, mesh.bone_counts);
+        auto *weights = get<BoneWeight1>(chunk, mesh.weights);
+        uint32_t total_weights = 0;
+        for (uint32_t i = 0; i < mesh.bone_counts.count; ++i)
+            total_weights += bone_counts[i];
+        if (total_weights != mesh.weights.count)
+            return false;
+        for (uint32_t i = 0; i < mesh.weights.count; ++i) {
+            if (weights[i].index < 0 || weights[i].index >= (int)mesh.bindposes.count)
+                return false;
+        }
+
+        auto *frames = get<CaptureBlendshapeFrame>(chunk, mesh.blendshape_frames);
+        for (uint32_t i = 0; i < mesh.blendshape_frames.count; ++i) {
+            auto& frame = frames[i];
+            if (frame.blendshape_index >= mesh.blendshape_count || frame.delta.count != (uint32_t)mesh.vertex_count ||
+                !in_range(frame.delta, sizeof(float3)))
+                return false;
+        }
+        m_mesh_count = std::max(m_mesh_count, mesh.id + 1);
+        return true;
+    }
+    case CaptureChunkType::Instance:
+    {
+        if (chunk.size < sizeof(CaptureInstance))
+            return false;
+        auto& inst = *(const CaptureInstance*)chunk.payload;
+        if (inst.id > m_instance_count || (inst.mesh_id >= m_mesh_count && inst.mesh_id != ~0u))
+            return false;
+        if (!in_range(inst.name, 1) || !in_range(inst.bones, sizeof(float4x4)) || !in_range(inst.blendshape_weights, sizeof(float)))
+            return false;
+        m_instance_count = std::max(m_instance_count, inst.id + 1);
+        return true;
+    }
+    case CaptureChunkType::Scene:
+    {
+        if (chunk.size < sizeof(CaptureScene))
+            return false;
+        auto& scene = *(const CaptureScene*)chunk.payload;
+        if (!in_range(scene.views, sizeof(CaptureView)) || !in_range(scene.lights, sizeof(CaptureLight)) ||
+            !in_range(scene.instances, sizeof(uint32_t)))
+            return false;
+        auto *views = get<CaptureView>(chunk, scene.views);
+        for (uint32_t i = 0; i < scene.views.count; ++i) {
+            if (views[i].width < 0 || views[i].height < 0 || views[i].width > 16384 || views[i].height > 16384)
+                return false;
+        }
+        auto *instances = get<uint32_t>(chunk, scene.instances);
+        for (uint32_t i = 0; i < scene.instances.count; ++i) {
+            if (instances[i] >= m_instance_count)
+                return false;
+        }
+        return true;
+    }
+    case CaptureChunkType::FrameEnd:
+        return chunk.size >= sizeof(CaptureFrameEnd);
+    default:
+        // unknown chunks are skipped
+        return true;
+    }
+}
+
+int CaptureReplay::getFrameCount() const
+{
+    return (int)m_frames.size();
+}
+
+const std::string& CaptureReplay::getError() const
+{
+    return m_error;
+}
+
+void CaptureReplay::applyMesh(const Chunk& chunk)
+{
+    auto& src = *(const CaptureMesh*)chunk.payload;
+    if (src.id == m_meshes.size())
+        m_meshes.push_back(rthsMeshCreate());
+    auto mesh = m_meshes[src.id];
+
+    rthsMeshSetName(mesh, ToString(src.name, chunk.payload).c_str());
+    // points into the mapped file. chunks are kept mapped until the end of the replay
+    rthsMeshSetCPUBuffers(mesh, get<char>(chunk, src.vertices), get<char>(chunk, src.indices),
+        src.vertex_stride, src.vertex_count, 0, src.index_stride, src.index_count, 0);
+    rthsMeshMarkDyncmic(mesh, src.is_dynamic != 0);
+    rthsMeshSetSkinBindposes(mesh, get<float4x4>(chunk, src.bindposes), src.bindposes.count);
+    rthsMeshSetSkinWeights(mesh, get<uint8_t>(chunk, src.bone_counts), src.bone_counts.count,
+        get<BoneWeight1>(chunk, src.weights), src.weights.count);
+
+    rthsMeshSetBlendshapeCount(mesh, 0);
+    rthsMeshSetBlendshapeCount(mesh, src.blendshape_count);
+    auto *frames = get<CaptureBlendshapeFrame>(chunk, src.blendshape_frames);
+    for (uint32_t i = 0; i < src.blendshape_frames.count; ++i)
+        rthsMeshAddBlendshapeFrame(mesh, frames[i].blendshape_index, get<float3>(chunk, frames[i].delta), frames[i].weight);
+}
+
+void CaptureReplay::applyInstance(const Chunk& chunk)
+{
+    auto& src = *(const CaptureInstance*)chunk.payload;
+    if (src.id == m_instances.size())
+        m_instances.push_back(rthsMeshInstanceCreate(src.mesh_id != ~0u ? m_meshes[src.mesh_id] : nullptr));
+    auto inst = m_instances[src.id];
+
+    float4x4 transform;
+    std::memcpy(&transform, src.transform, sizeof(transform));
+    rthsMeshInstanceSetName(inst, ToString(src.name, chunk.payload).c_str());
+    rthsMeshInstanceSetFlags(inst, src.flags);
+    rthsMeshInstanceSetLayer(inst, src.layer);
+    rthsMeshInstanceSetTransform(inst, transform);
+    // these require the mesh to have skin / blendshapes. the capture has them only in that case
+    if (src.bones.count > 0)
+        rthsMeshInstanceSetBones(inst, get<float4x4>(chunk, src.bones), src.bones.count);
+    if (src.blendshape_weights.count > 0)
+        rthsMeshInstanceSetBlendshapeWeights(inst, get<float>(chunk, src.blendshape_weights), src.blendshape_weights.count);
+}
+
+bool CaptureReplay::applyScene(const Chunk& chunk)
+{
+    auto& src = *(const CaptureScene*)chunk.payload;
+    auto& dst = m_renderers[src.renderer_id];
+    if (!dst.renderer) {
+        dst.renderer = rthsRendererCreate();
+        if (!dst.renderer) {
+            m_error = std::string("rthsRendererCreate() failed: ") + rthsGetErrorLog();
+            m_renderers.erase(src.renderer_id);
+            return false;
+        }
+    }
+    auto renderer = dst.renderer;
+    auto *views = get<CaptureView>(chunk, src.views);
+    dst.views.assign(views, views + src.views.count);
+    while (dst.render_targets.size() < dst.views.size())
+        dst.render_targets.push_back(rthsRenderTargetCreate());
+
+    auto to_camera = [](const CaptureCamera& cam, float3& pos, float4x4& view, float4x4& proj) {
+        std::memcpy(&pos, cam.position, sizeof(pos));
+        std::memcpy(&view, cam.view, sizeof(view));
+        std::memcpy(&proj, cam.proj, sizeof(proj));
+    };
+
+    rthsRendererBeginScene(renderer);
+    rthsRendererSetRenderFlags(renderer, src.render_flags);
+    rthsRendererSetShadowRayOffset(renderer, src.shadow_ray_offset);
+    rthsRendererSetSelfShadowThreshold(renderer, src.self_shadow_threshold);
+    for (size_t vi = 0; vi < dst.views.size(); ++vi) {
+        auto& view = dst.views[vi];
+        auto rt = dst.render_targets[vi];
+        // rthsRenderTargetSetup() keeps the buffer if nothing changes
+        rthsRenderTargetSetup(rt, view.width, view.height, (RenderTargetFormat)view.format);
+        rthsRenderTargetSetOutputFormat(rt, (OutputFormat)view.output_format);
+
+        float3 pos;
+        float4x4 v, p;
+        to_camera(view.camera, pos, v, p);
+        if (vi == 0) {
+            rthsRendererSetRenderTarget(renderer, rt);
+            rthsRendererSetCamera(renderer, pos, v, p, view.camera.layer_mask);
+        }
+        else
+            rthsRendererAddView(renderer, rt, pos, v, p, view.camera.layer_mask);
+    }
+
+    auto *lights = get<CaptureLight>(chunk, src.lights);
+    for (uint32_t li = 0; li < src.lights.count; ++li) {
+        auto& light = lights[li];
+        float3 pos, dir;
+        std::memcpy(&pos, light.position, sizeof(pos));
+        std::memcpy(&dir, light.direction, sizeof(dir));
+        switch (light.type) {
+        case 1: rthsRendererAddDirectionalLight(renderer, dir, light.layer_mask); break;
+        case 2: rthsRendererAddSpotLight(renderer, pos, dir, light.range, light.spot_angle, light.layer_mask); break;
+        case 3: rthsRendererAddPointLight(renderer, pos, light.range, light.layer_mask); break;
+        case 4: rthsRendererAddReversePointLight(renderer, pos, light.range, light.layer_mask); break;
+        default: break;
+        }
+    }
+
+    auto *instances = get<uint32_t>(chunk, src.instances);
+    for (uint32_t ii = 0; ii < src.instances.count; ++ii)
+        rthsRendererAddMesh(renderer, m_instances[instances[ii]]);
+    rthsRendererEndScene(renderer);
+    dst.in_frame = true;
+    return true;
+}
+
+bool CaptureReplay::writeImages(int frame)
+{
+    bool ret = true;
+    bool multiple_renderers = m_renderers.size() > 1;
+    for (auto& kvp : m_renderers) {
+        auto& r = kvp.second;
+        if (!r.in_frame)
+            continue;
+        for (size_t vi = 0; vi < r.views.size(); ++vi) {
+            auto& view = r.views[vi];
+            // images are single channel float
+            if ((RenderTargetFormat)view.format != RenderTargetFormat::Rf32 || view.width == 0 || view.height == 0)
+                continue;
+
+            m_readback.resize((size_t)view.width * view.height);
+            if (!rthsRendererReadbackViewRenderTarget(r.renderer, (int)vi, m_readback.data())) {
+                fprintf(stderr, "frame %d: readback failed: %s\n", frame, rthsGetErrorLog());
+                ret = false;
+                continue;
+            }
+            std::string suffix;
+            if (multiple_renderers)
+                suffix += "_r" + std::to_string(kvp.first);
+            if (r.views.size() > 1)
+                suffix += "_v" + std::to_string(vi);
+            auto path = MakeOutputPath(m_output, frame, suffix);
+            if (!WriteImage(path, m_readback.data(), view.width, view.height)) {
+                fprintf(stderr, "frame %d: can't write %s\n", frame, path.c_str());
+                ret = false;
+            }
+        }
+    }
+    return ret;
+}
+
+void CaptureReplay::Stage::add(double v)
+{
+    sum += v;
+    max = std::max(max, v);
+    ++count;
+}
+
+void CaptureReplay::addStage(const std::string& name, double ms)
+{
+    auto it = std::find_if(m_stages.begin(), m_stages.end(), [&](const Stage& s) { return s.name == name; });
+    if (it == m_stages.end()) {
+        m_stages.push_back({ name });
+        it = m_stages.end() - 1;
+    }
+    it->add(ms);
+}
+
+bool CaptureReplay::replay(const CaptureReplayOptions& opt)
+{
+    int frame_count = getFrameCount();
+    int first_frame = std::max(opt.first_frame, 0);
+    int last_frame = opt.last_frame < 0 || opt.last_frame >= frame_count ? frame_count - 1 : opt.last_frame;
+    m_output = opt.output;
+
+    // "name: 1.23ms" lines of rthsRendererGetTimestampLog() are accumulated as stages
+    rthsGlobalsSetDebugFlags(rthsGlobalsGetDebugFlags() | (uint32_t)DebugFlag::Timestamp);
+
+    bool ret = true;
+    int rendered = 0;
+    for (int fi = 0; fi <= last_frame && ret; ++fi) {
+        auto& frame = m_frames[fi];
+        bool render = fi >= first_frame;
+
+        auto setup_begin = Now();
+        for (auto& kvp : m_renderers)
+            kvp.second.in_frame = false;
+        for (auto& chunk : frame.chunks) {
+            switch (chunk.type) {
+            case CaptureChunkType::Mesh: applyMesh(chunk); break;
+            case CaptureChunkType::Instance: applyInstance(chunk); break;
+            case CaptureChunkType::Scene:
+                if (render && !applyScene(chunk))
+                    ret = false;
+                break;
+            default: break;
+            }
+        }
+        auto setup_time = Now() - setup_begin;
+        if (!render || !ret)
+            continue;
+
+        // renderers keep rendering their last scene. rthsRenderAll() can be used only if all renderers are in this frame
+        int renderer_count = 0;
+        for (auto& kvp : m_renderers)
+            renderer_count += kvp.second.in_frame ? 1 : 0;
+        auto render_begin = Now();
+        if (renderer_count == (int)m_renderers.size())
+            rthsRenderAll();
+        else {
+            rthsMarkFrameBegin();
+            for (auto& kvp : m_renderers) {
+                if (kvp.second.in_frame)
+                    rthsRendererStartRender(kvp.second.renderer);
+            }
+            for (auto& kvp : m_renderers) {
+                if (kvp.second.in_frame)
+                    rthsRendererFinishRender(kvp.second.renderer);
+            }
+            rthsMarkFrameEnd();
+        }
+        auto render_time = Now() - render_begin;
+
+        addStage("setup", NS2MS(setup_time));
+        addStage("render", NS2MS(render_time));
+        for (auto& kvp : m_renderers) {
+            if (!kvp.second.in_frame)
+                continue;
+            std::istringstream log(rthsRendererGetTimestampLog(kvp.second.renderer));
+            std::string line;
+            while (std::getline(log, line)) {
+                // stats that follow the times are skipped
+                auto sep = line.rfind(": ");
+                if (sep == std::string::npos)
+                    continue;
+                const char *value = line.c_str() + sep + 2;
+                char *end = nullptr;
+                double ms = std::strtod(value, &end);
+                if (end != value && std::strcmp(end, "ms") == 0)
+                    addStage(line.substr(0, sep), ms);
+            }
+        }
+
+        if (!opt.output.empty() && !writeImages(fi))
+            ret = false;
+        if (!opt.quiet)
+            printf("frame %d: setup %.2fms, render %.2fms (%d renderers)\n", fi, NS2MS(setup_time), NS2MS(render_time), renderer_count);
+        ++rendered;
+    }
+
+    if (rendered > 0) {
+        // setup: applying chunks of the capture and scene setup. render: rthsRenderAll() or Start/FinishRender.
+        // others are from the timestamp logs of renderers. a frame can have multiple samples of them if there are multiple renderers
+        printf("%d frames:\n", rendered);
+        for (auto& stage : m_stages)
+            printf("  %s: avg %.2fms, max %.2fms (%d samples)\n", stage.name.c_str(), stage.sum / stage.count, stage.max, stage.count);
+    }
+    release();
+    return ret;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "../rths/rths.h"
+#include "../rths/rthsCaptureFormat.h"
+#include "MappedFile.h"
+
+struct CaptureReplayOptions
+{
+    int first_frame = 0;
+    int last_frame = -1;  // -1: the last frame of the capture
+    std::string output;   // empty: don't write images. see MakeOutputPath()
+    bool quiet = false;   // don't print per-frame times
+};
+
+// replays a capture file written by rthsCaptureBegin() / rthsCaptureEnd() through the C API.
+// the file is memory mapped and vertex / index buffers are passed to rthsMeshSetCPUBuffers() without copying.
+// frames before first_frame only update meshes and instances. a renderer renders at the end of each frame it appears in.
+class CaptureReplay
+{
+public:
+    static bool IsCaptureFile(const char *path);
+
+    ~CaptureReplay();
+    bool open(const char *path);
+    int getFrameCount() const;
+    const std::string& getError() const;
+    bool replay(const CaptureReplayOptions& opt);
+
+private:
+    struct Chunk
+    {
+        rths::CaptureChunkType type;
+        const char *payload;
+        size_t size;
+    };
+    struct Frame
+    {
+        std::vector<Chunk> chunks;
+        uint64_t time = 0; // CaptureFrameEnd::time
+    };
+    struct Renderer
+    {
+        rths::IRenderer *renderer = nullptr;
+        std::vector<rths::RenderTargetData*> render_targets; // one for each view
+        std::vector<rths::CaptureView> views;
+        bool in_frame = false;
+    };
+    // accumulated timings of a stage
+    struct Stage
+    {
+        std::string name;
+        double sum = 0.0, max = 0.0; // ms
+        int count = 0;
+        void add(double v);
+    };
+
+    bool validate(const Chunk& chunk);
+    template<class T> const T* get(const Chunk& chunk, const rths::CaptureArray& a) const;
+    void applyMesh(const Chunk& chunk);
+    void applyInstance(const Chunk& chunk);
+    bool applyScene(const Chunk& chunk);
+    bool writeImages(int frame);
+    void addStage(const std::string& name, double ms);
+    void release();
+
+    MappedFile m_file;
+    std::string m_error;
+    std::vector<Frame> m_frames;
+    uint32_t m_mesh_count = 0;
+    uint32_t m_instance_count = 0;
+    std::vector<rths::MeshData*> m_meshes;
+    std::vector<rths::MeshInstanceData*> m_instances;
+    std::map<uint32_t, Renderer> m_renderers; // key: CaptureScene::renderer_id
+    std::vector<Stage> m_stages;
+    std::string m_output;
+    std::vector<float> m_readback;
+};
@@ -0,0 +1,125 @@
+#include "pch.h"
+#include "ImageFile.h"
+
+std::string MakeOutputPath(const std::string& pattern, int frame, const std::string& suffix)
+{
+    auto num = std::to_string(frame);
+    std::string ret = pattern;
+    bool has_placeholder = false;
+    auto pos = pattern.find('%');
+    if (pos != std::string::npos) {
+        auto end = pattern.find('d', pos);
+        if (end != std::string::npos) {
+            int digits = std::atoi(pattern.substr(pos + 1, end - pos - 1).c_str());
+            if ((int)num.size() < digits)
+                num.insert(0, digits - num.size(), '0');
+            ret = pattern.substr(0, pos) + num + pattern.substr(end + 1);
+            has_placeholder = true;
+        }
+    }
+
+    auto ext = ret.find_last_of('.');
+    auto sep = ret.find_last_of("/\\");
+    if (ext == std::string::npos || (sep != std::string::npos && ext < sep))
+        ext = ret.size();
+    return ret.substr(0, ext) + (has_placeholder ? "" : "_" + num) + suffix + ret.substr(ext);
+}
+
+bool WriteImage(const std::string& path, const float *data, int width, int height)
+{
+    auto ext = path.substr(path.find_last_of('.') + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return (char)std::tolower(c); });
+    if (ext == "exr")
+        return WriteEXR(path, data, width, height);
+    else if (ext == "pfm")
+        return WritePFM(path, data, width, height);
+    return false;
+}
+
+bool WritePFM(const std::string& path, const float *data, int width, int height)
+{
+    std::ofstream fout(path, std::ios::binary);
+    if (!fout)
+        return false;
+
+    // "Pf": grayscale. negative scale: little endian. rows are bottom to top as render targets
+    fout << "Pf\n" << width << " " << height << "\n-1.0\n";
+    fout.write((const char*)data, sizeof(float) * width * height);
+    return (bool)fout;
+}
+
+namespace {
+
+class EXRWriter
+{
+public:
+    std::vector<char> buf;
+
+    template<class T> void write(const T& v) { auto *p = (const char*)&v; buf.insert(buf.end(), p, p + sizeof(T)); }
+    void writeString(const char *str) { buf.insert(buf.end(), str, str + std::strlen(str) + 1); }
+    void write(const void *data, size_t size) { auto *p = (const char*)data; buf.insert(buf.end(), p, p + size); }
+
+    // attributes are name, type name, size and value
+    template<class Body>
+    void attribute(const char *name, const char *type, const Body& body)
+    {
+        writeString(name);
+        writeString(type);
+        size_t pos = buf.size();
+        write(int32_t(0));
+        body();
+        int32_t size = int32_t(buf.size() - pos - sizeof(int32_t));
+        std::memcpy(&buf[pos], &size, sizeof(size));
+    }
+};
+
+} // namespace
+
+bool WriteEXR(const std::string& path, const float *data, int width, int height)
+{
+    // all values are little endian
+    EXRWriter w;
+    w.write(int32_t(20000630)); // magic number
+    w.write(int32_t(2));        // version 2, single part scanline
+    w.attribute("channels", "chlist", [&]() {
+        w.writeString("Y");
+        w.write(int32_t(2)); // FLOAT
+        w.write(uint8_t(0)); // pLinear
+        w.write(uint8_t(0)); w.write(uint8_t(0)); w.write(uint8_t(0));
+        w.write(int32_t(1)); // x sampling
+        w.write(int32_t(1)); // y sampling
+        w.write(uint8_t(0)); // end of the list
+    });
+    w.attribute("compression", "compression", [&]() { w.write(uint8_t(0)); }); // NO_COMPRESSION
+    auto write_box = [&]() {
+        w.write(int32_t(0));
+        w.write(int32_t(0));
+        w.write(int32_t(width - 1));
+        w.write(int32_t(height - 1));
+    };
+    w.attribute("dataWindow", "box2i", write_box);
+    w.attribute("displayWindow", "box2i", write_box);
+    w.attribute("lineOrder", "lineOrder", [&]() { w.write(uint8_t(0)); }); // INCREASING_Y
+    w.attribute("pixelAspectRatio", "float", [&]() { w.write(1.0f); });
+    w.attribute("screenWindowCenter", "v2f", [&]() { w.write(0.0f); w.write(0.0f); });
+    w.attribute("screenWindowWidth", "float", [&]() { w.write(1.0f); });
+    w.write(uint8_t(0)); // end of the header
+
+    // offset table and one scanline per chunk. EXR is top to bottom
+    size_t line_size = sizeof(float) * width;
+    size_t chunk_size = sizeof(int32_t) * 2 + line_size;
+    uint64_t offset = w.buf.size() + sizeof(uint64_t) * height;
+    for (int y = 0; y < height; ++y)
+        w.write(uint64_t(offset + chunk_size * y));
+    for (int y = 0; y < height; ++y) {
+        w.write(int32_t(y));
+        w.write(int32_t(line_size));
+        w.write(data + size_t(width) * (height - 1 - y), line_size);
+    }
+
+    std::ofstream fout(path, std::ios::binary);
+    if (!fout)
+        return false;
+    fout.write(w.buf.data(), w.buf.size());
+    return (bool)fout;
+}
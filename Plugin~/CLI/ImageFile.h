@@ -0,0 +1,12 @@
+#pragma once
+
+// single channel float images. rows are bottom to top, in the same order as render targets of the CPU renderer.
+// the format is chosen by the extension of path (.exr or .pfm). returns false if the file can't be written.
+bool WriteImage(const std::string& path, const float *data, int width, int height);
+bool WritePFM(const std::string& path, const float *data, int width, int height);
+// uncompressed scanline OpenEXR with one FLOAT channel "Y"
+bool WriteEXR(const std::string& path, const float *data, int width, int height);
+
+// "%d" or "%04d" in pattern is replaced by frame. no placeholder: the frame number is inserted before the extension.
+// suffix (e.g. "_r1") is inserted before the extension after that.
+std::string MakeOutputPath(const std::string& pattern, int frame, const std::string& suffix = std::string());
@@ -0,0 +1,320 @@
+#include "pch.h"
+#include "SceneFile.h"
+
+#define rthsTestImpl
+#include "../rths/Foundation/rthsMath.h"
+
+using rths::float3;
+using rths::float4x4;
+
+
+// same layout as Camera.projectionMatrix passed from Unity
+static float4x4 MakeProjection(float fov, float aspect, float near_plane, float far_plane)
+{
+    float f = 1.0f / std::tan(fov * 0.5f * rths::DegToRad);
+    return{ {
+        {f / aspect, 0, 0, 0},
+        {0, f, 0, 0},
+        {0, 0, -(far_plane + near_plane) / (far_plane - near_plane), -1},
+        {0, 0, -2.0f * far_plane * near_plane / (far_plane - near_plane), 0},
+    } };
+}
+
+static void MakePlane(SceneMesh& dst, float size)
+{
+    float h = size * 0.5f;
+    dst.vertices = { {-h, 0, h}, {h, 0, h}, {h, 0, -h}, {-h, 0, -h} };
+    dst.indices = { 0, 1, 2, 0, 2, 3 };
+}
+
+static void MakeBox(SceneMesh& dst, const float3& size)
+{
+    float3 h = size * 0.5f;
+    for (int i = 0; i < 8; ++i)
+        dst.vertices.push_back({ (i & 1) ? h.x : -h.x, (i & 2) ? h.y : -h.y, (i & 4) ? h.z : -h.z });
+    // counter clockwise seen from outside
+    dst.indices = {
+        0, 4, 6, 0, 6, 2, // -X
+        1, 3, 7, 1, 7, 5, // +X
+        0, 1, 5, 0, 5, 4, // -Y
+        2, 6, 7, 2, 7, 3, // +Y
+        0, 2, 3, 0, 3, 1, // -Z
+        4, 5, 7, 4, 7, 6, // +Z
+    };
+}
+
+static void MakeSphere(SceneMesh& dst, float radius, int segments)
+{
+    int rings = std::max(segments / 2, 2);
+    segments = std::max(segments, 3);
+    for (int ri = 0; ri <= rings; ++ri) {
+        float v = rths::PI * (float)ri / (float)rings;
+        for (int si = 0; si <= segments; ++si) {
+            float u = 2.0f * rths::PI * (float)si / (float)segments;
+            dst.vertices.push_back({ std::sin(v) * std::cos(u) * radius, std::cos(v) * radius, std::sin(v) * std::sin(u) * radius });
+        }
+    }
+    int stride = segments + 1;
+    for (int ri = 0; ri < rings; ++ri) {
+        for (int si = 0; si < segments; ++si) {
+            int i0 = stride * ri + si;
+            int i1 = i0 + stride;
+            dst.indices.insert(dst.indices.end(), { i0, i0 + 1, i1 + 1, i0, i1 + 1, i1 });
+        }
+    }
+}
+
+bool SceneFile::loadOBJ(SceneMesh& dst, const std::string& path)
+{
+    std::ifstream fin(path);
+    if (!fin)
+        return false;
+
+    std::string line, cmd, token;
+    std::vector<int> face;
+    while (std::getline(fin, line)) {
+        std::istringstream ss(line);
+        if (!(ss >> cmd))
+            continue;
+        if (cmd == "v") {
+            float3 v{};
+            ss >> v.x >> v.y >> v.z;
+            dst.vertices.push_back(v);
+        }
+        else if (cmd == "f") {
+            // "v", "v/vt", "v//vn" or "v/vt/vn". negative indices are relative to the end. polygons are triangulated as fans
+            face.clear();
+            while (ss >> token) {
+                int i = std::atoi(token.c_str());
+                face.push_back(i < 0 ? (int)dst.vertices.size() + i : i - 1);
+            }
+            for (size_t i = 2; i < face.size(); ++i)
+                dst.indices.insert(dst.indices.end(), { face[0], face[i - 1], face[i] });
+        }
+    }
+    for (int i : dst.indices) {
+        if (i < 0 || i >= (int)dst.vertices.size())
+            return false;
+    }
+    return !dst.indices.empty();
+}
+
+int SceneFile::findMesh(const std::string& name) const
+{
+    auto it = std::find_if(meshes.begin(), meshes.end(), [&](const SceneMesh& m) { return m.name == name; });
+    return it != meshes.end() ? (int)std::distance(meshes.begin(), it) : -1;
+}
+
+int SceneFile::findInstance(const std::string& name) const
+{
+    auto it = std::find_if(instances.begin(), instances.end(), [&](const SceneInstance& m) { return m.name == name; });
+    return it != instances.end() ? (int)std::distance(instances.begin(), it) : -1;
+}
+
+const std::string& SceneFile::getError() const
+{
+    return m_error;
+}
+
+bool SceneFile::load(const char *path)
+{
+    std::ifstream fin(path);
+    if (!fin) {
+        m_error = std::string("can't open ") + path;
+        return false;
+    }
+    std::string dir = path;
+    auto sep = dir.find_last_of("/\\");
+    dir = sep != std::string::npos ? dir.substr(0, sep + 1) : "";
+
+    SceneFrame state;
+    float fov = 60.0f, near_plane = 0.1f, far_plane = 1000.0f;
+    bool has_frame_command = false;
+    int line_number = 0;
+    std::string line;
+
+    // the projection is made when a frame is added as size can be changed after camera
+    auto add_frame = [&]() {
+        state.camera.proj = MakeProjection(fov, (float)width / (float)height, near_plane, far_plane);
+        frames.push_back(state);
+    };
+    auto fail = [&](const std::string& message) {
+        m_error = std::string(path) + "(" + std::to_string(line_number) + "): " + message;
+        return false;
+    };
+
+    while (std::getline(fin, line)) {
+        ++line_number;
+        auto comment = line.find('#');
+        if (comment != std::string::npos)
+            line.resize(comment);
+
+        std::istringstream ss(line);
+        std::string cmd;
+        if (!(ss >> cmd))
+            continue;
+
+        auto read_uint = [&](uint32_t& dst) {
+            std::string token;
+            if (!(ss >> token))
+                return false;
+            dst = (uint32_t)std::strtoul(token.c_str(), nullptr, 0);
+            return true;
+        };
+        auto read_float3 = [&](float3& dst) {
+            return (bool)(ss >> dst.x >> dst.y >> dst.z);
+        };
+
+        if (cmd == "size") {
+            if (!(ss >> width >> height) || width <= 0 || height <= 0)
+                return fail("size needs width and height");
+        }
+        else if (cmd == "render_flags") {
+            if (!read_uint(render_flags))
+                return fail("render_flags needs a value");
+        }
+        else if (cmd == "shadow_ray_offset") {
+            if (!(ss >> shadow_ray_offset))
+                return fail("shadow_ray_offset needs a value");
+        }
+        else if (cmd == "self_shadow_threshold") {
+            if (!(ss >> self_shadow_threshold))
+                return fail("self_shadow_threshold needs a value");
+        }
+        else if (cmd == "mesh") {
+            SceneMesh mesh;
+            std::string type;
+            if (!(ss >> mesh.name >> type))
+                return fail("mesh needs a name and a type");
+            if (findMesh(mesh.name) >= 0)
+                return fail("mesh " + mesh.name + " already exists");
+
+            if (type == "obj") {
+                std::string file;
+                if (!(ss >> file))
+                    return fail("mesh obj needs a path");
+                if (!loadOBJ(mesh, dir + file))
+                    return fail("can't load " + dir + file);
+            }
+            else if (type == "plane") {
+                float size;
+                if (!(ss >> size))
+                    return fail("mesh plane needs size");
+                MakePlane(mesh, size);
+            }
+            else if (type == "box") {
+                float3 size;
+                if (!read_float3(size))
+                    return fail("mesh box needs size");
+                MakeBox(mesh, size);
+            }
+            else if (type == "sphere") {
+                float radius;
+                int segments;
+                if (!(ss >> radius >> segments))
+                    return fail("mesh sphere needs radius and segments");
+                MakeSphere(mesh, radius, segments);
+            }
+            else {
+                return fail("unknown mesh type " + type);
+            }
+            meshes.push_back(std::move(mesh));
+        }
+        else if (cmd == "instance") {
+            SceneInstance inst;
+            std::string mesh, opt;
+            if (!(ss >> inst.name >> mesh))
+                return fail("instance needs a name and a mesh");
+            // frames have a transform for each instance. earlier frames would not have one for this
+            if (has_frame_command)
+                return fail("instance must be before the first frame");
+            if (findInstance(inst.name) >= 0)
+                return fail("instance " + inst.name + " already exists");
+            inst.mesh = findMesh(mesh);
+            if (inst.mesh < 0)
+                return fail("unknown mesh " + mesh);
+            while (ss >> opt) {
+                if (opt == "flags") {
+                    if (!read_uint(inst.flags))
+                        return fail("flags needs a value");
+                }
+                else if (opt == "layer") {
+                    if (!read_uint(inst.layer) || inst.layer >= 32)
+                        return fail("layer must be 0-31");
+                }
+                else {
+                    return fail("unknown instance option " + opt);
+                }
+            }
+            instances.push_back(inst);
+            state.transforms.push_back(float4x4::identity());
+        }
+        else if (cmd == "transform" || cmd == "translate") {
+            std::string name;
+            ss >> name;
+            int ii = findInstance(name);
+            if (ii < 0)
+                return fail("unknown instance " + name);
+            auto& dst = state.transforms[ii];
+            if (cmd == "transform") {
+                for (int i = 0; i < 16; ++i) {
+                    if (!(ss >> dst[i / 4][i % 4]))
+                        return fail("transform needs 16 values");
+                }
+            }
+            else {
+                float3 t;
+                if (!read_float3(t))
+                    return fail("translate needs 3 values");
+                dst[3] = { t.x, t.y, t.z, 1.0f };
+            }
+        }
+        else if (cmd == "camera") {
+            float3 target, up;
+            auto& cam = state.camera;
+            if (!read_float3(cam.position) || !read_float3(target) || !read_float3(up) || !(ss >> fov >> near_plane >> far_plane))
+                return fail("camera needs position, target, up, fov, near and far");
+            cam.view = rths::lookat_rh(cam.position, target, up);
+        }
+        else if (cmd == "directional_light") {
+            SceneLight light;
+            light.type = SceneLightType::Directional;
+            if (!read_float3(light.direction))
+                return fail("directional_light needs direction");
+            light.direction = rths::normalize(light.direction);
+            state.lights.push_back(light);
+        }
+        else if (cmd == "spot_light") {
+            SceneLight light;
+            light.type = SceneLightType::Spot;
+            if (!read_float3(light.position) || !read_float3(light.direction) || !(ss >> light.range >> light.spot_angle))
+                return fail("spot_light needs position, direction, range and angle");
+            light.direction = rths::normalize(light.direction);
+            state.lights.push_back(light);
+        }
+        else if (cmd == "point_light" || cmd == "reverse_point_light") {
+            SceneLight light;
+            light.type = cmd == "point_light" ? SceneLightType::Point : SceneLightType::ReversePoint;
+            if (!read_float3(light.position) || !(ss >> light.range))
+                return fail(cmd + " needs position and range");
+            state.lights.push_back(light);
+        }
+        else if (cmd == "clear_lights") {
+            state.lights.clear();
+        }
+        else if (cmd == "frame") {
+            int count = 1;
+            ss >> count;
+            for (int i = 0; i < count; ++i)
+                add_frame();
+            has_frame_command = true;
+        }
+        else {
+            return fail("unknown command " + cmd);
+        }
+    }
+
+    if (!has_frame_command)
+        add_frame();
+    return true;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "../rths/rths.h"
+
+enum class SceneLightType
+{
+    Directional,
+    Spot,
+    Point,
+    ReversePoint,
+};
+
+struct SceneLight
+{
+    SceneLightType type = SceneLightType::Directional;
+    rths::float3 position{};
+    rths::float3 direction{};
+    float range = 0.0f;
+    float spot_angle = 0.0f; // degree
+};
+
+struct SceneCamera
+{
+    rths::float3 position{};
+    rths::float4x4 view = rths::float4x4::identity();
+    rths::float4x4 proj = rths::float4x4::identity();
+};
+
+struct SceneMesh
+{
+    std::string name;
+    std::vector<rths::float3> vertices;
+    std::vector<int> indices;
+};
+
+struct SceneInstance
+{
+    std::string name;
+    int mesh = 0;
+    uint32_t flags = (uint32_t)rths::InstanceFlag::Default;
+    uint32_t layer = 0;
+};
+
+// snapshot of everything that can change between frames
+struct SceneFrame
+{
+    SceneCamera camera;
+    std::vector<SceneLight> lights;
+    std::vector<rths::float4x4> transforms; // one for each instance
+};
+
+// scene description for rths-cli. text file of one command per line. '#' starts a comment.
+//
+//   size <width> <height>                       render target size (default 512 512)
+//   render_flags <flags>                        combination of RenderFlag. hex (0x...) is accepted
+//   shadow_ray_offset <v>
+//   self_shadow_threshold <v>
+//   mesh <name> obj <path>                      triangles of a Wavefront OBJ file (v and f). path is relative to the scene file
+//   mesh <name> plane <size>                    square on the XZ plane facing +Y
+//   mesh <name> box <x> <y> <z>                 box centered at the origin
+//   mesh <name> sphere <radius> <segments>
+//   instance <name> <mesh> [flags <v>] [layer <v>]   must be before the first frame command
+//   transform <instance> <16 floats>            float4x4 rows. translation is in the last row
+//   translate <instance> <x> <y> <z>            sets the translation of the transform
+//   camera <position> <target> <up> <fov> <near> <far>   fov: vertical, in degree
+//   directional_light <direction>
+//   spot_light <position> <direction> <range> <angle>
+//   point_light <position> <range>
+//   reverse_point_light <position> <range>
+//   clear_lights
+//   frame [count]                               renders the current state as the next frame(s)
+//
+// the state is kept across frames, so a sequence only needs to describe what changes.
+// if there is no frame command, the state at the end of the file is one frame.
+class SceneFile
+{
+public:
+    int width = 512;
+    int height = 512;
+    uint32_t render_flags = 0;
+    float shadow_ray_offset = 0.0001f;
+    float self_shadow_threshold = 0.0001f;
+    std::vector<SceneMesh> meshes;
+    std::vector<SceneInstance> instances;
+    std::vector<SceneFrame> frames;
+
+    // returns false on errors. getError() tells the line and the reason.
+    bool load(const char *path);
+    const std::string& getError() const;
+
+private:
+    bool loadOBJ(SceneMesh& dst, const std::string& path);
+    int findMesh(const std::string& name) const;
+    int findInstance(const std::string& name) const;
+
+    std::string m_error;
+};
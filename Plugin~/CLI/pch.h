@@ -0,0 +1,32 @@
+#pragma once
+
+#ifdef _WIN32
+    #define NOMINMAX
+    #include <windows.h>
+#endif
+
+#ifndef _countof
+    #define _countof(a) (sizeof(a) / sizeof(a[0]))
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cstdarg>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <thread>
+#include <future>
+#include <random>
+#include <regex>
+#include <iterator>
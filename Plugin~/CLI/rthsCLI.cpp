@@ -0,0 +1,274 @@
+#include "pch.h"
+#include "SceneFile.h"
+#include "ImageFile.h"
+#include "CaptureReplay.h"
+
+using rths::float3;
+using rths::float4x4;
+
+using nanosec = uint64_t;
+
+static nanosec Now()
+{
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+static inline float NS2MS(nanosec ns) { return float((double)ns / 1000000.0); }
+
+static void PrintUsage()
+{
+    printf(
+        "usage: rths-cli [options] <scene file or capture file>\n"
+        "  -o <path>          output path. %%d (with optional width, e.g. %%04d) is replaced by the frame number.\n"
+        "                     the extension selects the format: .exr or .pfm (default: frame_%%04d.exr)\n"
+        "  -f <first>-<last>  range of frames to render (default: all frames of the scene)\n"
+        "  -j <n>             frames rendered in parallel. they are submitted together to rthsRenderAll() (default: 1)\n"
+        "  -t <n>             thread count of the job system. 0: hardware concurrency (default: 0)\n"
+        "  -s <i>/<n>         render only frames where frame %% n == i. to split a sequence across n processes\n"
+        "  -n                 don't write images (benchmark)\n"
+        "  -q                 don't print per-frame times\n"
+        "capture files (rthsCaptureBegin()) are replayed frame by frame and per-stage times are reported. -j and -s are ignored.\n");
+}
+
+// one renderer and its own instances. instances can't be shared by renderers of different frames as transforms differ.
+struct RenderSlot
+{
+    rths::IRenderer *renderer = nullptr;
+    rths::RenderTargetData *render_target = nullptr;
+    std::vector<rths::MeshInstanceData*> instances;
+    std::vector<float> result;
+    int frame = -1;
+
+    void release()
+    {
+        for (auto inst : instances)
+            rthsMeshInstanceRelease(inst);
+        instances.clear();
+        rthsRenderTargetRelease(render_target);
+        rthsRendererRelease(renderer);
+        render_target = nullptr;
+        renderer = nullptr;
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    std::string scene_path;
+    std::string output = "frame_%04d.exr";
+    int first_frame = 0, last_frame = -1;
+    int parallel_frames = 1;
+    int thread_count = 0;
+    int shard_index = 0, shard_count = 1;
+    bool write_images = true;
+    bool quiet = false;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "-o" && has_value)
+            output = argv[++i];
+        else if (arg == "-f" && has_value) {
+            if (std::sscanf(argv[++i], "%d-%d", &first_frame, &last_frame) < 1) {
+                PrintUsage();
+                return 1;
+            }
+            if (last_frame < 0)
+                last_frame = first_frame;
+        }
+        else if (arg == "-j" && has_value)
+            parallel_frames = std::max(std::atoi(argv[++i]), 1);
+        else if (arg == "-t" && has_value)
+            thread_count = std::atoi(argv[++i]);
+        else if (arg == "-s" && has_value) {
+            if (std::sscanf(argv[++i], "%d/%d", &shard_index, &shard_count) != 2 ||
+                shard_count <= 0 || shard_index < 0 || shard_index >= shard_count) {
+                PrintUsage();
+                return 1;
+            }
+        }
+        else if (arg == "-n")
+            write_images = false;
+        else if (arg == "-q")
+            quiet = true;
+        else if (arg[0] != '-' && scene_path.empty())
+            scene_path = arg;
+        else {
+            PrintUsage();
+            return 1;
+        }
+    }
+    if (scene_path.empty()) {
+        PrintUsage();
+        return 1;
+    }
+
+    if (CaptureReplay::IsCaptureFile(scene_path.c_str())) {
+        CaptureReplay replay;
+        if (!replay.open(scene_path.c_str())) {
+            fprintf(stderr, "%s\n", replay.getError().c_str());
+            return 1;
+        }
+        printf("%s: capture, %d frames\n", scene_path.c_str(), replay.getFrameCount());
+        rthsGlobalsSetThreadCount(thread_count);
+
+        CaptureReplayOptions opt;
+        opt.first_frame = first_frame;
+        opt.last_frame = last_frame;
+        opt.output = write_images ? output : std::string();
+        opt.quiet = quiet;
+        if (!replay.replay(opt)) {
+            if (!replay.getError().empty())
+                fprintf(stderr, "%s\n", replay.getError().c_str());
+            return 1;
+        }
+        return 0;
+    }
+
+    SceneFile scene;
+    if (!scene.load(scene_path.c_str())) {
+        fprintf(stderr, "%s\n", scene.getError().c_str());
+        return 1;
+    }
+    int frame_count = (int)scene.frames.size();
+    if (last_frame < 0 || last_frame >= frame_count)
+        last_frame = frame_count - 1;
+
+    std::vector<int> frames;
+    for (int f = first_frame; f <= last_frame; ++f) {
+        if (f % shard_count == shard_index)
+            frames.push_back(f);
+    }
+    if (frames.empty()) {
+        fprintf(stderr, "no frames to render\n");
+        return 1;
+    }
+
+    rthsGlobalsSetThreadCount(thread_count);
+
+    // meshes are shared by all renderers. their BLAS are built once
+    std::vector<rths::MeshData*> meshes;
+    for (auto& src : scene.meshes) {
+        auto mesh = rthsMeshCreate();
+        rthsMeshSetName(mesh, src.name.c_str());
+        rthsMeshSetCPUBuffers(mesh, src.vertices.data(), src.indices.data(), sizeof(float3), (int)src.vertices.size(), 0,
+            sizeof(int), (int)src.indices.size(), 0);
+        meshes.push_back(mesh);
+    }
+
+    auto create_slot = [&](RenderSlot& slot) {
+        slot.renderer = rthsRendererCreate();
+        if (!slot.renderer)
+            return false;
+        slot.render_target = rthsRenderTargetCreate();
+        rthsRenderTargetSetup(slot.render_target, scene.width, scene.height, rths::RenderTargetFormat::Rf32);
+        for (auto& src : scene.instances) {
+            auto inst = rthsMeshInstanceCreate(meshes[src.mesh]);
+            rthsMeshInstanceSetName(inst, src.name.c_str());
+            rthsMeshInstanceSetFlags(inst, src.flags);
+            rthsMeshInstanceSetLayer(inst, src.layer);
+            slot.instances.push_back(inst);
+        }
+        slot.result.resize(scene.width * scene.height);
+        return true;
+    };
+    auto setup_scene = [&](RenderSlot& slot) {
+        auto& frame = scene.frames[slot.frame];
+        auto renderer = slot.renderer;
+        rthsRendererBeginScene(renderer);
+        rthsRendererSetRenderTarget(renderer, slot.render_target);
+        rthsRendererSetRenderFlags(renderer, scene.render_flags);
+        rthsRendererSetShadowRayOffset(renderer, scene.shadow_ray_offset);
+        rthsRendererSetSelfShadowThreshold(renderer, scene.self_shadow_threshold);
+        rthsRendererSetCamera(renderer, frame.camera.position, frame.camera.view, frame.camera.proj);
+        for (auto& light : frame.lights) {
+            switch (light.type) {
+            case SceneLightType::Directional:
+                rthsRendererAddDirectionalLight(renderer, light.direction);
+                break;
+            case SceneLightType::Spot:
+                rthsRendererAddSpotLight(renderer, light.position, light.direction, light.range, light.spot_angle);
+                break;
+            case SceneLightType::Point:
+                rthsRendererAddPointLight(renderer, light.position, light.range);
+                break;
+            case SceneLightType::ReversePoint:
+                rthsRendererAddReversePointLight(renderer, light.position, light.range);
+                break;
+            }
+        }
+        for (size_t ii = 0; ii < slot.instances.size(); ++ii) {
+            rthsMeshInstanceSetTransform(slot.instances[ii], frame.transforms[ii]);
+            rthsRendererAddMesh(renderer, slot.instances[ii]);
+        }
+        rthsRendererEndScene(renderer);
+    };
+
+    printf("%s: %d meshes, %d instances, %dx%d, %d of %d frames\n", scene_path.c_str(),
+        (int)scene.meshes.size(), (int)scene.instances.size(), scene.width, scene.height, (int)frames.size(), frame_count);
+
+    int result = 0;
+    std::vector<RenderSlot> slots;
+    nanosec render_time = 0;
+    auto begin = Now();
+    for (size_t fi = 0; fi < frames.size() && result == 0; fi += parallel_frames) {
+        // renderers keep their scene once it is set. ones that are not needed in the last batch are released
+        int batch = std::min(parallel_frames, (int)(frames.size() - fi));
+        while ((int)slots.size() > batch) {
+            slots.back().release();
+            slots.pop_back();
+        }
+        while ((int)slots.size() < batch) {
+            slots.emplace_back();
+            if (!create_slot(slots.back())) {
+                fprintf(stderr, "rthsRendererCreate() failed: %s\n", rthsGetErrorLog());
+                slots.pop_back();
+                result = 1;
+                break;
+            }
+        }
+        if (result != 0)
+            break;
+
+        for (int si = 0; si < batch; ++si) {
+            slots[si].frame = frames[fi + si];
+            setup_scene(slots[si]);
+        }
+        auto render_begin = Now();
+        rthsRenderAll();
+        auto elapsed = Now() - render_begin;
+        render_time += elapsed;
+
+        for (auto& slot : slots) {
+            if (!rthsRendererReadbackRenderTarget(slot.renderer, slot.result.data())) {
+                fprintf(stderr, "frame %d: readback failed: %s\n", slot.frame, rthsGetErrorLog());
+                result = 1;
+                continue;
+            }
+            if (write_images) {
+                auto path = MakeOutputPath(output, slot.frame);
+                if (!WriteImage(path, slot.result.data(), scene.width, scene.height)) {
+                    fprintf(stderr, "frame %d: can't write %s\n", slot.frame, path.c_str());
+                    result = 1;
+                }
+            }
+        }
+        if (!quiet) {
+            if (batch == 1)
+                printf("frame %d: %.2fms\n", slots[0].frame, NS2MS(elapsed));
+            else
+                printf("frames %d-%d: %.2fms\n", slots[0].frame, slots[batch - 1].frame, NS2MS(elapsed));
+        }
+    }
+    auto total = Now() - begin;
+
+    // render: rthsRenderAll() only. total: including scene setup, readback and writing images
+    int rendered = (int)frames.size();
+    printf("%d frames: render %.2fms (%.2fms/frame, %.2f frames/s), total %.2fms\n", rendered,
+        NS2MS(render_time), NS2MS(render_time) / rendered, rendered * 1000.0f / std::max(NS2MS(render_time), 0.001f), NS2MS(total));
+
+    for (auto& slot : slots)
+        slot.release();
+    for (auto mesh : meshes)
+        rthsMeshRelease(mesh);
+    return result;
+}
@@ -69,10 +69,125 @@ template bool GetArg(const char *name, float& dst);
 
 
 
+struct BenchmarkRecord
+{
+    std::string name;
+    BenchmarkParams params;
+    int warmup = 0;
+    std::vector<float> samples;
+    BenchmarkStats stats;
+};
+
+static std::vector<BenchmarkRecord>& GetBenchmarkRecords()
+{
+    static std::vector<BenchmarkRecord> s_instance;
+    return s_instance;
+}
+
+BenchmarkStats ComputeBenchmarkStats(std::vector<float> samples)
+{
+    BenchmarkStats ret;
+    size_t n = samples.size();
+    if (n == 0)
+        return ret;
+
+    std::sort(samples.begin(), samples.end());
+    double sum = 0.0;
+    for (float v : samples)
+        sum += v;
+    double mean = sum / n;
+    double var = 0.0;
+    for (float v : samples)
+        var += (v - mean) * (v - mean);
+
+    ret.count = (int)n;
+    ret.mean = (float)mean;
+    ret.median = n % 2 == 1 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) * 0.5f;
+    // nearest rank
+    ret.p95 = samples[(size_t)std::ceil(0.95 * n) - 1];
+    ret.stddev = n > 1 ? (float)std::sqrt(var / (n - 1)) : 0.0f;
+    ret.min = samples.front();
+    ret.max = samples.back();
+    return ret;
+}
+
+BenchmarkStats Benchmark(const char *name, const BenchmarkParams& params, const std::function<void()>& body)
+{
+    int warmup = 2, repeat = 10;
+    GetArg("warmup", warmup);
+    GetArg("repeat", repeat);
+    warmup = std::max(warmup, 0);
+    repeat = std::max(repeat, 1);
+
+    for (int i = 0; i < warmup; ++i)
+        body();
+    BenchmarkRecord rec;
+    rec.name = name;
+    rec.params = params;
+    rec.warmup = warmup;
+    for (int i = 0; i < repeat; ++i) {
+        auto begin = Now();
+        body();
+        rec.samples.push_back(NS2MS(Now() - begin));
+    }
+    rec.stats = ComputeBenchmarkStats(rec.samples);
+
+    std::string param_str;
+    for (auto& p : params)
+        param_str += (param_str.empty() ? "" : ", ") + p.first + "=" + std::to_string(p.second);
+    auto& st = rec.stats;
+    Print("    %s (%s): median %.2fms, p95 %.2fms, mean %.2fms, stddev %.2fms, min %.2fms, max %.2fms\n",
+        name, param_str.c_str(), st.median, st.p95, st.mean, st.stddev, st.min, st.max);
+
+    GetBenchmarkRecords().push_back(std::move(rec));
+    return st;
+}
+
+static std::string EscapeJSON(const std::string& v)
+{
+    std::string ret;
+    for (char c : v) {
+        if (c == '"' || c == '\\')
+            ret += '\\';
+        ret += c;
+    }
+    return ret;
+}
+
+static bool WriteBenchmarkJSON(const std::string& path)
+{
+    std::ofstream fout(path);
+    if (!fout)
+        return false;
+
+    auto& records = GetBenchmarkRecords();
+    fout << "{\n  \"results\": [";
+    for (size_t ri = 0; ri < records.size(); ++ri) {
+        auto& rec = records[ri];
+        auto& st = rec.stats;
+        fout << (ri == 0 ? "\n" : ",\n");
+        fout << "    {\"name\": \"" << EscapeJSON(rec.name) << "\", \"params\": {";
+        for (size_t pi = 0; pi < rec.params.size(); ++pi)
+            fout << (pi == 0 ? "" : ", ") << "\"" << EscapeJSON(rec.params[pi].first) << "\": " << rec.params[pi].second;
+        fout << "}, \"warmup\": " << rec.warmup << ", \"repeat\": " << st.count
+            << ", \"median_ms\": " << st.median << ", \"p95_ms\": " << st.p95 << ", \"mean_ms\": " << st.mean
+            << ", \"stddev_ms\": " << st.stddev << ", \"min_ms\": " << st.min << ", \"max_ms\": " << st.max
+            << ", \"samples_ms\": [";
+        for (size_t si = 0; si < rec.samples.size(); ++si)
+            fout << (si == 0 ? "" : ", ") << rec.samples[si];
+        fout << "]}";
+    }
+    fout << "\n  ]\n}\n";
+    return (bool)fout;
+}
+
+
+
 struct TestEntry
 {
     std::string name;
     std::function<void()> body;
+    bool benchmark;
 };
 
 static std::vector<TestEntry>& GetTests()
@@ -81,9 +196,9 @@ static std::vector<TestEntry>& GetTests()
     return s_instance;
 }
 
-void RegisterTestEntryImpl(const char *name, const std::function<void()>& body)
+void RegisterTestEntryImpl(const char *name, const std::function<void()>& body, bool benchmark)
 {
-    GetTests().push_back({name, body});
+    GetTests().push_back({name, body, benchmark});
 }
 
 static void RunTestImpl(const TestEntry& v)
@@ -114,7 +229,8 @@ testExport void RunAllTests()
 {
     g_log.clear();
     for (auto& entry : GetTests()) {
-        RunTestImpl(entry);
+        if (!entry.benchmark)
+            RunTestImpl(entry);
     }
 }
 
@@ -134,4 +250,12 @@ int main(int argc, char *argv[])
     if (run_count == 0) {
         RunAllTests();
     }
+
+    std::string json_path;
+    if (GetArg("json", json_path) && !GetBenchmarkRecords().empty()) {
+        if (WriteBenchmarkJSON(json_path))
+            Print("benchmark results: %s\n", json_path.c_str());
+        else
+            Print("can't write %s\n", json_path.c_str());
+    }
 }
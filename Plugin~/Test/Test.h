@@ -9,7 +9,7 @@ using nanosec = uint64_t;
 nanosec Now();
 inline float NS2MS(nanosec ns) { return float((double)ns / 1000000.0); }
 
-void RegisterTestEntryImpl(const char *name, const std::function<void()>& body);
+void RegisterTestEntryImpl(const char *name, const std::function<void()>& body, bool benchmark = false);
 void PrintImpl(const char *format, ...);
 
 
@@ -20,24 +20,54 @@ void PrintImpl(const char *format, ...);
         Register##Name() { RegisterTestEntryImpl(#Name, Name); }\
     } g_Register##Name;
 
+#define RegisterBenchmarkEntry(Name)\
+    struct Register##Name {\
+        Register##Name() { RegisterTestEntryImpl(#Name, Name, true); }\
+    } g_Register##Name;
+
 
 #define TestCase(Name) testExport void Name(); RegisterTestEntry(Name); testExport void Name()
+// benchmarks are not run by RunAllTests(). they run only when named on the command line
+#define BenchmarkCase(Name) testExport void Name(); RegisterBenchmarkEntry(Name); testExport void Name()
 #define Expect(Body) if(!(Body)) { Print("%s(%d): failed - " #Body "\n", __FILE__, __LINE__); }
 
+template<class T> bool GetArg(const char *name, T& dst);
+
+
+// benchmark mode. arguments (before test names): warmup=<n> (default 2), repeat=<n> (default 10), json=<path>.
+// all results of the run are written to the json file when the runner exits.
+// e.g. "Test repeat=20 json=bench.json BenchmarkSuite"
+struct BenchmarkStats
+{
+    int count = 0;
+    // ms
+    float mean = 0.0f;
+    float median = 0.0f;
+    float p95 = 0.0f;
+    float stddev = 0.0f;
+    float min = 0.0f;
+    float max = 0.0f;
+};
+using BenchmarkParams = std::vector<std::pair<std::string, int>>;
+
+BenchmarkStats ComputeBenchmarkStats(std::vector<float> samples);
+// runs body warmup times, then repeat times measuring each run
+BenchmarkStats Benchmark(const char *name, const BenchmarkParams& params, const std::function<void()>& body);
+
 template<class Body>
 inline void TestScope(const char *name, const Body& body, int num_try = 1)
 {
-    auto begin = Now();
-    for (int i = 0; i < num_try; ++i)
+    std::vector<float> samples;
+    for (int i = 0; i < num_try; ++i) {
+        auto begin = Now();
         body();
-    auto end = Now();
+        samples.push_back(NS2MS(Now() - begin));
+    }
 
-    float elapsed = NS2MS(end - begin);
-    Print("    %s: %.2fms", name, elapsed / num_try);
+    auto stats = ComputeBenchmarkStats(samples);
+    Print("    %s: %.2fms", name, stats.mean);
     if (num_try > 1) {
-        Print(" (%.2fms in total)", elapsed);
+        Print(" (%.2fms in total, median %.2fms, p95 %.2fms, stddev %.2fms)", stats.mean * num_try, stats.median, stats.p95, stats.stddev);
     }
     Print("\n");
 }
-
-template<class T> bool GetArg(const char *name, T& dst);
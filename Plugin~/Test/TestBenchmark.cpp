@@ -0,0 +1,332 @@
+#include "pch.h"
+#include "Test.h"
+#include "MeshGenerator.h"
+#include "TestUtils.h"
+#include "../rths/rths.h"
+
+#define rthsTestImpl
+#include "../rths/Foundation/rthsMath.h"
+
+
+using rths::float3;
+using rths::float4x4;
+
+// same as kMaxLights of rthsTypes.h
+static const int kBenchmarkMaxLights = 32;
+
+struct BenchmarkSceneParams
+{
+    int sphere_iteration = 3; // ico sphere of iteration n has 20 * 4^n triangles
+    int instances = 64;
+    int lights = 1;
+    int rt_size = 256;
+    int skinned = 0;          // instances of a skinned sphere. bones are updated every frame
+    int blendshape = 0;       // instances of a sphere with a blendshape. weights are updated every frame
+    int update_percent = 0;   // percentage of instances that move every frame
+};
+
+// ground, a grid of spheres and lights. one frame is scene setup, render and finish as applications do every frame.
+class BenchmarkScene
+{
+public:
+    BenchmarkScene(const BenchmarkSceneParams& params);
+    ~BenchmarkScene();
+    bool valid() const;
+    int getTriangleCount() const;
+    void renderFrame();
+
+private:
+    void placeInstance(rths::MeshInstanceData *inst, int index, int total, float time);
+
+    BenchmarkSceneParams m_params;
+    rths::IRenderer *m_renderer = nullptr;
+    rths::RenderTargetData *m_render_target = nullptr;
+    std::vector<rths::MeshData*> m_meshes;
+    std::vector<rths::MeshInstanceData*> m_instances; // [0]: ground
+    std::vector<rths::MeshInstanceData*> m_skinned;
+    std::vector<rths::MeshInstanceData*> m_blendshape;
+
+    std::vector<int> m_sphere_indices;
+    std::vector<float3> m_sphere_points;
+    std::vector<float3> m_blendshape_delta;
+    std::vector<uint8_t> m_bone_counts;
+    std::vector<BoneWeight1> m_weights;
+    int m_frame = 0;
+};
+
+
+BenchmarkScene::BenchmarkScene(const BenchmarkSceneParams& params)
+    : m_params(params)
+{
+    m_renderer = CreateTestRenderer();
+    if (!m_renderer)
+        return;
+    m_render_target = rthsRenderTargetCreate();
+    rthsRenderTargetSetup(m_render_target, params.rt_size, params.rt_size, RenderTargetFormat::Rf32);
+
+    std::vector<int> counts;
+    GenerateIcoSphereMesh(counts, m_sphere_indices, m_sphere_points, 0.15f, params.sphere_iteration);
+    int vertex_count = (int)m_sphere_points.size();
+    int index_count = (int)m_sphere_indices.size();
+
+    auto quad = CreateFloorQuad();
+    m_meshes.push_back(quad);
+    m_instances.push_back(rthsMeshInstanceCreate(quad));
+
+    auto sphere = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(sphere, m_sphere_points.data(), m_sphere_indices.data(), sizeof(float3), vertex_count, 0, sizeof(int), index_count, 0);
+    m_meshes.push_back(sphere);
+
+    // two bones. the upper half of the sphere follows the second one
+    float4x4 bindposes[2]{ float4x4::identity(), float4x4::identity() };
+    bindposes[1][3] = { 0.0f, -0.1f, 0.0f, 1.0f };
+    for (auto& p : m_sphere_points) {
+        float t = clamp01(p.y / 0.15f * 0.5f + 0.5f);
+        if (t < 1.0f && t > 0.0f) {
+            m_bone_counts.push_back(2);
+            m_weights.push_back({ 1.0f - t, 0 });
+            m_weights.push_back({ t, 1 });
+        }
+        else {
+            m_bone_counts.push_back(1);
+            m_weights.push_back({ 1.0f, t > 0.0f ? 1 : 0 });
+        }
+        m_blendshape_delta.push_back(normalize(p) * 0.05f);
+    }
+    auto skinned_sphere = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(skinned_sphere, m_sphere_points.data(), m_sphere_indices.data(), sizeof(float3), vertex_count, 0, sizeof(int), index_count, 0);
+    rthsMeshSetSkinBindposes(skinned_sphere, bindposes, 2);
+    rthsMeshSetSkinWeights(skinned_sphere, m_bone_counts.data(), (int)m_bone_counts.size(), m_weights.data(), (int)m_weights.size());
+    m_meshes.push_back(skinned_sphere);
+
+    auto blendshape_sphere = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(blendshape_sphere, m_sphere_points.data(), m_sphere_indices.data(), sizeof(float3), vertex_count, 0, sizeof(int), index_count, 0);
+    rthsMeshSetBlendshapeCount(blendshape_sphere, 1);
+    rthsMeshAddBlendshapeFrame(blendshape_sphere, 0, m_blendshape_delta.data(), 100.0f);
+    m_meshes.push_back(blendshape_sphere);
+
+    int total = params.instances + params.skinned + params.blendshape;
+    for (int i = 0; i < params.instances; ++i)
+        m_instances.push_back(rthsMeshInstanceCreate(sphere));
+    for (int i = 0; i < params.skinned; ++i) {
+        m_skinned.push_back(rthsMeshInstanceCreate(skinned_sphere));
+        m_instances.push_back(m_skinned.back());
+    }
+    for (int i = 0; i < params.blendshape; ++i) {
+        m_blendshape.push_back(rthsMeshInstanceCreate(blendshape_sphere));
+        m_instances.push_back(m_blendshape.back());
+    }
+    for (int i = 1; i < (int)m_instances.size(); ++i)
+        placeInstance(m_instances[i], i - 1, total, 0.0f);
+}
+
+BenchmarkScene::~BenchmarkScene()
+{
+    for (auto inst : m_instances)
+        rthsMeshInstanceRelease(inst);
+    for (auto mesh : m_meshes)
+        rthsMeshRelease(mesh);
+    rthsRenderTargetRelease(m_render_target);
+    rthsRendererRelease(m_renderer);
+}
+
+bool BenchmarkScene::valid() const
+{
+    return m_renderer != nullptr;
+}
+
+int BenchmarkScene::getTriangleCount() const
+{
+    return (int)m_sphere_indices.size() / 3;
+}
+
+void BenchmarkScene::placeInstance(rths::MeshInstanceData *inst, int index, int total, float time)
+{
+    int grid = (int)std::ceil(std::sqrt((float)total));
+    float4x4 trans = float4x4::identity();
+    trans[3] = { (float)(index % grid) / grid * 8.0f - 4.0f, 0.3f + 0.1f * std::sin(time + index), (float)(index / grid) / grid * 8.0f - 4.0f, 1.0f };
+    rthsMeshInstanceSetTransform(inst, trans);
+}
+
+void BenchmarkScene::renderFrame()
+{
+    ++m_frame;
+    float time = m_frame * 0.1f;
+    int total = (int)m_instances.size() - 1;
+
+    // the same instances move in every frame
+    int moving = total * m_params.update_percent / 100;
+    for (int i = 0; i < moving; ++i)
+        placeInstance(m_instances[i + 1], i, total, time);
+
+    // the second bone bends around Z
+    float4x4 bones[2]{ float4x4::identity(), float4x4::identity() };
+    for (size_t i = 0; i < m_skinned.size(); ++i) {
+        float a = 0.5f * std::sin(time + i);
+        float c = std::cos(a), sn = std::sin(a);
+        bones[1] = { {
+            {   c,   sn, 0.0f, 0.0f},
+            { -sn,    c, 0.0f, 0.0f},
+            {0.0f, 0.0f, 1.0f, 0.0f},
+            {0.0f, 0.1f, 0.0f, 1.0f},
+        } };
+        rthsMeshInstanceSetBones(m_skinned[i], bones, 2);
+    }
+    for (size_t i = 0; i < m_blendshape.size(); ++i) {
+        float weight = 50.0f + 50.0f * std::sin(time + i);
+        rthsMeshInstanceSetBlendshapeWeights(m_blendshape[i], &weight, 1);
+    }
+
+    float3 cam_pos{ 0.0f, 6.0f, -7.0f };
+    auto proj = MakeTestProjection();
+
+    RenderFrame(m_renderer, [&]() {
+        rthsRendererSetRenderTarget(m_renderer, m_render_target);
+        rthsRendererSetCamera(m_renderer, cam_pos, lookat_rh(cam_pos, { 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }), proj);
+        // a directional light and point / spot lights over the ground
+        rthsRendererAddDirectionalLight(m_renderer, normalize(float3{ -1.0f, -1.0f, 1.0f }));
+        for (int li = 1; li < m_params.lights; ++li) {
+            float a = (float)li / m_params.lights * 2.0f * PI;
+            float3 pos{ std::cos(a) * 3.0f, 2.0f, std::sin(a) * 3.0f };
+            if (li % 2 == 1)
+                rthsRendererAddPointLight(m_renderer, pos, 8.0f);
+            else
+                rthsRendererAddSpotLight(m_renderer, pos, normalize(-pos), 8.0f, 60.0f);
+        }
+        for (auto inst : m_instances)
+            rthsRendererAddMesh(m_renderer, inst);
+    }, nullptr);
+}
+
+
+BenchmarkCase(BenchmarkSuite)
+{
+    // scaling curves. each scenario changes one parameter of BenchmarkSceneParams from the defaults.
+    // "scenario=<name>" runs only one of them. "max_iteration" and "max_instances" limit the largest scenes.
+    std::string scenario;
+    GetArg("scenario", scenario);
+    int max_iteration = 5, max_instances = 1024;
+    GetArg("max_iteration", max_iteration);
+    GetArg("max_instances", max_instances);
+
+    auto run = [&](const char *name, const BenchmarkSceneParams& params) {
+        BenchmarkScene scene(params);
+        if (!scene.valid())
+            return;
+        BenchmarkParams bp{
+            { "triangles", scene.getTriangleCount() },
+            { "instances", params.instances },
+            { "lights", params.lights },
+            { "rt_size", params.rt_size },
+            { "skinned", params.skinned },
+            { "blendshape", params.blendshape },
+            { "update_percent", params.update_percent },
+        };
+        Benchmark(name, bp, [&]() { scene.renderFrame(); });
+    };
+    auto enabled = [&](const char *name) {
+        return scenario.empty() || scenario == name;
+    };
+
+    if (enabled("triangles")) {
+        for (int i = 1; i <= max_iteration; ++i) {
+            BenchmarkSceneParams params;
+            params.sphere_iteration = i;
+            run("triangles", params);
+        }
+    }
+    if (enabled("instances")) {
+        for (int n = 16; n <= max_instances; n *= 4) {
+            BenchmarkSceneParams params;
+            params.instances = n;
+            run("instances", params);
+        }
+    }
+    if (enabled("lights")) {
+        for (int n : { 1, 4, 8, 16, kBenchmarkMaxLights }) {
+            BenchmarkSceneParams params;
+            params.lights = n;
+            run("lights", params);
+        }
+    }
+    if (enabled("rt_size")) {
+        for (int n : { 128, 256, 512, 1024 }) {
+            BenchmarkSceneParams params;
+            params.rt_size = n;
+            run("rt_size", params);
+        }
+    }
+    if (enabled("skinned")) {
+        for (int n = 16; n <= max_instances / 4; n *= 4) {
+            BenchmarkSceneParams params;
+            params.skinned = n;
+            run("skinned", params);
+        }
+    }
+    if (enabled("blendshape")) {
+        for (int n = 16; n <= max_instances / 4; n *= 4) {
+            BenchmarkSceneParams params;
+            params.blendshape = n;
+            run("blendshape", params);
+        }
+    }
+    if (enabled("update")) {
+        for (int n : { 0, 10, 50, 100 }) {
+            BenchmarkSceneParams params;
+            params.update_percent = n;
+            run("update", params);
+        }
+    }
+}
+
+BenchmarkCase(BenchmarkDeform)
+{
+    // rthsMeshInstanceDeformCPU() of a skinned sphere with a blendshape. "max_iteration" limits the largest sphere.
+    int max_iteration = 7;
+    GetArg("max_iteration", max_iteration);
+
+    for (int iteration = 3; iteration <= max_iteration; ++iteration) {
+        std::vector<int> counts, indices;
+        std::vector<float3> points;
+        GenerateIcoSphereMesh(counts, indices, points, 0.15f, iteration);
+        int vertex_count = (int)points.size();
+
+        // the same rig as BenchmarkScene
+        float4x4 bindposes[2]{ float4x4::identity(), float4x4::identity() };
+        bindposes[1][3] = { 0.0f, -0.1f, 0.0f, 1.0f };
+        std::vector<uint8_t> bone_counts;
+        std::vector<BoneWeight1> weights;
+        std::vector<float3> delta;
+        for (auto& p : points) {
+            float t = clamp01(p.y / 0.15f * 0.5f + 0.5f);
+            bone_counts.push_back(2);
+            weights.push_back({ 1.0f - t, 0 });
+            weights.push_back({ t, 1 });
+            delta.push_back(normalize(p) * 0.05f);
+        }
+
+        auto mesh = rthsMeshCreate();
+        rthsMeshSetCPUBuffers(mesh, points.data(), indices.data(), sizeof(float3), vertex_count, 0, sizeof(int), (int)indices.size(), 0);
+        rthsMeshSetSkinBindposes(mesh, bindposes, 2);
+        rthsMeshSetSkinWeights(mesh, bone_counts.data(), vertex_count, weights.data(), (int)weights.size());
+        rthsMeshSetBlendshapeCount(mesh, 1);
+        rthsMeshAddBlendshapeFrame(mesh, 0, delta.data(), 100.0f);
+        auto inst = rthsMeshInstanceCreate(mesh);
+
+        float4x4 bones[2]{ float4x4::identity(), float4x4::identity() };
+        bones[1][3] = { 0.0f, 0.1f, 0.0f, 1.0f };
+        float weight = 50.0f;
+        rthsMeshInstanceSetBones(inst, bones, 2);
+        rthsMeshInstanceSetBlendshapeWeights(inst, &weight, 1);
+
+        std::vector<rths::float4> dst(vertex_count);
+        auto stats = Benchmark("deform", { { "vertices", vertex_count } }, [&]() {
+            rthsMeshInstanceDeformCPU(inst, dst.data(), vertex_count, false);
+        });
+        if (stats.median > 0.0f)
+            Print("    %d vertices: %.2fM vertices/s\n", vertex_count, (double)vertex_count / stats.median / 1000.0);
+
+        rthsMeshInstanceRelease(inst);
+        rthsMeshRelease(mesh);
+    }
+}
@@ -1,10 +1,13 @@
 #include "pch.h"
 #include "Test.h"
 #include "MeshGenerator.h"
+#include "TestUtils.h"
 #include "../rths/rths.h"
+#include "../rths/rthsCaptureFormat.h"
 
 #define rthsTestImpl
 #include "../rths/Foundation/rthsMath.h"
+#include "../rths/Foundation/rthsHalf.h"
 
 
 using rths::float3;
@@ -140,3 +143,3458 @@ TestCase(TestMinimum)
     rthsRendererRelease(renderer);
 }
 
+
+
+TestCase(TestLightTypes)
+{
+    auto renderer = CreateTestRenderer();
+    if (!renderer)
+        return;
+
+    const int rt_width = 128;
+    const int rt_height = 128;
+    auto render_target = rthsRenderTargetCreate();
+    rthsRenderTargetSetup(render_target, rt_width, rt_height, RenderTargetFormat::Rf32);
+
+    // standing triangle on a floor quad
+    static const float3 triangle_vertices[]{
+        {-1.0f, 0.0f, 0.0f},
+        { 1.0f, 0.0f, 0.0f},
+        { 0.0f, 2.0f, 0.0f},
+    };
+    static const int triangle_indices[]{
+        0, 1, 2,
+    };
+    auto triangle = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(triangle, triangle_vertices, triangle_indices, sizeof(float3), _countof(triangle_vertices), 0, sizeof(int), _countof(triangle_indices), 0);
+    auto quad = CreateFloorQuad();
+    rths::MeshInstanceData *instances[]{
+        rthsMeshInstanceCreate(triangle),
+        rthsMeshInstanceCreate(quad),
+    };
+
+    float3 cam_pos{ 0.0f, 5.0f, -6.0f };
+    auto view = lookat_rh(cam_pos, { 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f });
+    auto proj = MakeTestProjection();
+
+    // count lit and shadowed pixels. both must be non-zero for each light type.
+    auto render = [&](const char *name, const std::function<void()>& add_light) {
+        std::vector<float> rt_buf(rt_width * rt_height);
+        if (RenderFrame(renderer, [&]() {
+            rthsRendererSetRenderTarget(renderer, render_target);
+            rthsRendererSetCamera(renderer, cam_pos, view, proj);
+            add_light();
+            for (auto inst : instances)
+                rthsRendererAddMesh(renderer, inst);
+        }, rt_buf.data())) {
+            int lit = 0, shadowed = 0;
+            for (float v : rt_buf) {
+                if (v == 1.0f)
+                    ++lit;
+                else if (v == 0.0f)
+                    ++shadowed;
+            }
+            Print("    %s: lit %d, shadowed %d\n", name, lit, shadowed);
+            Expect(lit > 0 && shadowed > 0);
+        }
+    };
+
+    render("directional", [&]() {
+        rthsRendererAddDirectionalLight(renderer, normalize(float3{ -1.0f, -1.0f, 1.0f }));
+    });
+    render("spot", [&]() {
+        float3 pos{ 0.0f, 3.0f, -3.0f };
+        rthsRendererAddSpotLight(renderer, pos, normalize(-pos), 20.0f, 90.0f);
+    });
+    render("point", [&]() {
+        rthsRendererAddPointLight(renderer, { 0.0f, 1.0f, -2.0f }, 20.0f);
+    });
+    render("reverse point", [&]() {
+        rthsRendererAddReversePointLight(renderer, { 0.0f, 1.0f, 3.0f }, 20.0f);
+    });
+
+    for (auto inst : instances)
+        rthsMeshInstanceRelease(inst);
+    rthsMeshRelease(triangle);
+    rthsMeshRelease(quad);
+    rthsRenderTargetRelease(render_target);
+    rthsRendererRelease(renderer);
+}
+
+
+
+TestCase(TestBVHBuild)
+{
+    auto renderer = CreateTestRenderer();
+    if (!renderer)
+        return;
+
+    // wave mesh has (resolution - 1)^2 * 2 triangles. 725 -> about 1M triangles
+    int resolution = 725;
+    GetArg("resolution", resolution);
+
+    const int rt_width = 128;
+    const int rt_height = 128;
+    auto render_target = rthsRenderTargetCreate();
+    rthsRenderTargetSetup(render_target, rt_width, rt_height, RenderTargetFormat::Rf32);
+
+    std::vector<int> wave_counts, wave_indices;
+    std::vector<float3> wave_points;
+    GenerateWaveMesh(wave_counts, wave_indices, wave_points, 10.0f, 1.0f, resolution, 0.0f, true);
+
+    // sphere with 16 bit indices and interleaved vertices to test strides
+    struct Vertex
+    {
+        float3 position;
+        float3 normal;
+    };
+    std::vector<int> sphere_counts, sphere_indices;
+    std::vector<float3> sphere_points;
+    GenerateIcoSphereMesh(sphere_counts, sphere_indices, sphere_points, 0.5f, 3);
+    std::vector<Vertex> sphere_vertices(sphere_points.size());
+    for (size_t i = 0; i < sphere_points.size(); ++i)
+        sphere_vertices[i] = { sphere_points[i] + float3{ 0.0f, 1.5f, 0.0f }, normalize(sphere_points[i]) };
+    std::vector<uint16_t> sphere_indices16(sphere_indices.begin(), sphere_indices.end());
+
+    auto wave = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(wave, wave_points.data(), wave_indices.data(), sizeof(float3), (int)wave_points.size(), 0, sizeof(int), (int)wave_indices.size(), 0);
+    auto wave_dynamic = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(wave_dynamic, wave_points.data(), wave_indices.data(), sizeof(float3), (int)wave_points.size(), 0, sizeof(int), (int)wave_indices.size(), 0);
+    rthsMeshMarkDyncmic(wave_dynamic, true);
+    auto sphere = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(sphere, sphere_vertices.data(), sphere_indices16.data(), sizeof(Vertex), (int)sphere_vertices.size(), 0, sizeof(uint16_t), (int)sphere_indices16.size(), 0);
+
+    auto inst_wave = rthsMeshInstanceCreate(wave);
+    auto inst_wave_dynamic = rthsMeshInstanceCreate(wave_dynamic);
+    auto inst_sphere = rthsMeshInstanceCreate(sphere);
+
+    float3 cam_pos{ 0.0f, 5.0f, -6.0f };
+    auto view = lookat_rh(cam_pos, { 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f });
+    auto proj = MakeTestProjection();
+
+    // FastTrace (static) and Linear (dynamic) BVH must give the same result
+    auto render = [&](rths::MeshInstanceData *inst, std::vector<float>& rt_buf) {
+        rt_buf.resize(rt_width * rt_height);
+        RenderFrame(renderer, [&]() {
+            rthsRendererSetRenderTarget(renderer, render_target);
+            rthsRendererSetCamera(renderer, cam_pos, view, proj);
+            rthsRendererAddDirectionalLight(renderer, normalize(float3{ -1.0f, -1.0f, 1.0f }));
+            rthsRendererAddMesh(renderer, inst);
+            rthsRendererAddMesh(renderer, inst_sphere);
+        }, rt_buf.data());
+        Print("%s", rthsRendererGetTimestampLog(renderer));
+    };
+
+    auto debug_flags = rthsGlobalsGetDebugFlags();
+    rthsGlobalsSetDebugFlags(debug_flags | (uint32_t)DebugFlag::Timestamp);
+
+    std::vector<float> result_fast_trace, result_fast_build;
+    Print("    FastTrace:\n");
+    render(inst_wave, result_fast_trace);
+    Print("    Linear (dynamic):\n");
+    render(inst_wave_dynamic, result_fast_build);
+    Expect(result_fast_trace == result_fast_build);
+
+    rthsGlobalsSetDebugFlags(debug_flags);
+
+    rthsMeshInstanceRelease(inst_wave);
+    rthsMeshInstanceRelease(inst_wave_dynamic);
+    rthsMeshInstanceRelease(inst_sphere);
+    rthsMeshRelease(wave);
+    rthsMeshRelease(wave_dynamic);
+    rthsMeshRelease(sphere);
+    rthsRenderTargetRelease(render_target);
+    rthsRendererRelease(renderer);
+}
+
+
+
+TestCase(TestTLASUpdate)
+{
+    auto renderer = CreateTestRenderer();
+    if (!renderer)
+        return;
+
+    const int rt_width = 128;
+    const int rt_height = 128;
+    auto render_target = rthsRenderTargetCreate();
+    rthsRenderTargetSetup(render_target, rt_width, rt_height, RenderTargetFormat::Rf32);
+
+    // grid of spheres on a floor quad
+    std::vector<int> sphere_counts, sphere_indices;
+    std::vector<float3> sphere_points;
+    GenerateIcoSphereMesh(sphere_counts, sphere_indices, sphere_points, 0.1f, 1);
+    auto sphere = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(sphere, sphere_points.data(), sphere_indices.data(), sizeof(float3), (int)sphere_points.size(), 0, sizeof(int), (int)sphere_indices.size(), 0);
+    auto quad = CreateFloorQuad();
+
+    const int grid = 32;
+    auto translate = [](float3 pos) {
+        auto ret = float4x4::identity();
+        ret[3] = { pos.x, pos.y, pos.z, 1.0f };
+        return ret;
+    };
+    auto grid_position = [&](int i) {
+        return float3{ (float)(i % grid) / (grid - 1) * 8.0f - 4.0f, 0.3f, (float)(i / grid) / (grid - 1) * 8.0f - 4.0f };
+    };
+    std::vector<rths::MeshInstanceData*> instances;
+    instances.push_back(rthsMeshInstanceCreate(quad));
+    for (int i = 0; i < grid * grid; ++i) {
+        auto inst = rthsMeshInstanceCreate(sphere);
+        rthsMeshInstanceSetTransform(inst, translate(grid_position(i)));
+        instances.push_back(inst);
+    }
+
+    float3 cam_pos{ 0.0f, 8.0f, -8.0f };
+    auto view = lookat_rh(cam_pos, { 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f });
+    auto proj = MakeTestProjection();
+
+    auto render = [&](rths::IRenderer *r, std::vector<float>& rt_buf) {
+        rt_buf.resize(rt_width * rt_height);
+        RenderFrame(r, [&]() {
+            rthsRendererSetRenderTarget(r, render_target);
+            rthsRendererSetCamera(r, cam_pos, view, proj);
+            rthsRendererAddDirectionalLight(r, normalize(float3{ -1.0f, -1.0f, 1.0f }));
+            for (auto inst : instances)
+                rthsRendererAddMesh(r, inst);
+        }, rt_buf.data());
+        return std::string(rthsRendererGetTimestampLog(r));
+    };
+
+    // render the same scene with a new renderer (TLAS is built from scratch) and compare the result
+    auto compare_with_new_renderer = [&](const std::vector<float>& result) {
+        auto r = CreateTestRenderer();
+        std::vector<float> tmp;
+        render(r, tmp);
+        rthsRendererRelease(r);
+        Expect(tmp == result);
+    };
+
+    auto debug_flags = rthsGlobalsGetDebugFlags();
+    rthsGlobalsSetDebugFlags(debug_flags | (uint32_t)DebugFlag::Timestamp);
+
+    std::vector<float> result;
+    std::string log;
+
+    log = render(renderer, result);
+    Print("    initial:\n%s", log.c_str());
+    Expect(log.find("TLAS build") != std::string::npos);
+
+    // move a few instances. TLAS should be refitted.
+    for (int i = 0; i < 16; ++i) {
+        int ii = i * 61 % (grid * grid);
+        rthsMeshInstanceSetTransform(instances[ii + 1], translate(grid_position(ii) + float3{ 0.05f, 0.2f, 0.0f }));
+    }
+    log = render(renderer, result);
+    Print("    move 16 instances:\n%s", log.c_str());
+    Expect(log.find("TLAS refit: 16 /") != std::string::npos);
+    compare_with_new_renderer(result);
+
+    // nothing changed. TLAS should be kept as is.
+    log = render(renderer, result);
+    Expect(log.find("TLAS build") == std::string::npos && log.find("TLAS refit") == std::string::npos);
+
+    // shuffle all instances. TLAS should be degraded and rebuilt.
+    for (int i = 0; i < grid * grid; ++i)
+        rthsMeshInstanceSetTransform(instances[i + 1], translate(grid_position(i * 523 % (grid * grid))));
+    log = render(renderer, result);
+    Print("    shuffle all instances:\n%s", log.c_str());
+    Expect(log.find("TLAS build") != std::string::npos);
+    compare_with_new_renderer(result);
+
+    // remove an instance. TLAS should be rebuilt.
+    rthsMeshInstanceRelease(instances.back());
+    instances.pop_back();
+    log = render(renderer, result);
+    Expect(log.find("TLAS build") != std::string::npos);
+    compare_with_new_renderer(result);
+
+    rthsGlobalsSetDebugFlags(debug_flags);
+
+    for (auto inst : instances)
+        rthsMeshInstanceRelease(inst);
+    rthsMeshRelease(sphere);
+    rthsMeshRelease(quad);
+    rthsRenderTargetRelease(render_target);
+    rthsRendererRelease(renderer);
+}
+
+
+TestCase(TestRayPackets)
+{
+    auto renderer = CreateTestRenderer();
+    if (!renderer)
+        return;
+
+    int resolution = 512;
+    int iteration = 6;
+    GetArg("resolution", resolution);
+    GetArg("iteration", iteration);
+
+    const int rt_width = 512;
+    const int rt_height = 512;
+    auto render_target = rthsRenderTargetCreate();
+    rthsRenderTargetSetup(render_target, rt_width, rt_height, RenderTargetFormat::Rf32);
+
+    std::vector<int> wave_counts, wave_indices;
+    std::vector<float3> wave_points;
+    GenerateWaveMesh(wave_counts, wave_indices, wave_points, 10.0f, 1.0f, resolution, 0.0f, true);
+    std::vector<int> sphere_counts, sphere_indices;
+    std::vector<float3> sphere_points;
+    GenerateIcoSphereMesh(sphere_counts, sphere_indices, sphere_points, 2.0f, iteration);
+
+    auto wave = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(wave, wave_points.data(), wave_indices.data(), sizeof(float3), (int)wave_points.size(), 0, sizeof(int), (int)wave_indices.size(), 0);
+    auto sphere = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(sphere, sphere_points.data(), sphere_indices.data(), sizeof(float3), (int)sphere_points.size(), 0, sizeof(int), (int)sphere_indices.size(), 0);
+    auto inst_wave = rthsMeshInstanceCreate(wave);
+    auto inst_sphere = rthsMeshInstanceCreate(sphere);
+
+    float3 cam_pos{ 0.0f, 5.0f, -6.0f };
+    auto view = lookat_rh(cam_pos, { 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f });
+    auto proj = MakeTestProjection();
+
+    // without lights only camera rays are traced. returns time of DispatchRays in milliseconds.
+    auto render = [&](rths::MeshInstanceData *inst, bool light, std::vector<float>& rt_buf) {
+        rt_buf.resize(rt_width * rt_height);
+        RenderFrame(renderer, [&]() {
+            rthsRendererSetRenderTarget(renderer, render_target);
+            rthsRendererSetCamera(renderer, cam_pos, view, proj);
+            if (light)
+                rthsRendererAddDirectionalLight(renderer, normalize(float3{ -1.0f, -1.0f, 1.0f }));
+            rthsRendererAddMesh(renderer, inst);
+        }, rt_buf.data());
+
+        std::string log = rthsRendererGetTimestampLog(renderer);
+        auto pos = log.find("DispatchRays: ");
+        return pos != std::string::npos ? std::atof(log.c_str() + pos + 14) : 0.0;
+    };
+
+    struct Mode
+    {
+        const char *name;
+        uint32_t flags;
+    };
+    const Mode modes[]{
+        { "single ray", (uint32_t)DebugFlag::NoRayPackets },
+        { "4-wide packet", (uint32_t)DebugFlag::NoAVX2 },
+        { "8-wide packet", 0 },
+    };
+    const int num_frames = 4;
+
+    auto debug_flags = rthsGlobalsGetDebugFlags();
+    auto bench = [&](const char *scene, rths::MeshInstanceData *inst) {
+        Print("    %s:\n", scene);
+        std::vector<float> reference, result;
+        for (auto& mode : modes) {
+            rthsGlobalsSetDebugFlags(debug_flags | (uint32_t)DebugFlag::Timestamp | mode.flags);
+
+            // the first frame includes BVH build
+            render(inst, false, result);
+            double best = 0.0;
+            for (int i = 0; i < num_frames; ++i) {
+                double t = render(inst, false, result);
+                if (best == 0.0 || t < best)
+                    best = t;
+            }
+            double mrays = best > 0.0 ? (double)(rt_width * rt_height) / (best * 1000.0) : 0.0;
+            Print("      %s: %.2lfms, %.2lf Mrays/s\n", mode.name, best, mrays);
+
+            // packets must give the same result as single rays (except ties of triangles at the same distance)
+            render(inst, true, result);
+            if (reference.empty()) {
+                reference = result;
+            }
+            else {
+                int mismatch = 0;
+                for (size_t i = 0; i < result.size(); ++i) {
+                    if (result[i] != reference[i])
+                        ++mismatch;
+                }
+                Expect(mismatch <= (int)result.size() / 1000);
+            }
+        }
+    };
+    bench("ico sphere", inst_sphere);
+    bench("wave", inst_wave);
+
+    rthsGlobalsSetDebugFlags(debug_flags);
+
+    rthsMeshInstanceRelease(inst_wave);
+    rthsMeshInstanceRelease(inst_sphere);
+    rthsMeshRelease(wave);
+    rthsMeshRelease(sphere);
+    rthsRenderTargetRelease(render_target);
+    rthsRendererRelease(renderer);
+}
+
+
+TestCase(TestShadowOcclusion)
+{
+    auto renderer = CreateTestRenderer();
+    if (!renderer)
+        return;
+
+    int resolution = 256;
+    GetArg("resolution", resolution);
+
+    const int rt_width = 256;
+    const int rt_height = 256;
+    auto render_target = rthsRenderTargetCreate();
+    rthsRenderTargetSetup(render_target, rt_width, rt_height, RenderTargetFormat::Rf32);
+    rthsRenderTargetSetOutputFormat(render_target, OutputFormat::BitMask);
+
+    // spheres floating over a wave. spheres cast shadows on the wave and on themselves.
+    std::vector<int> wave_counts, wave_indices;
+    std::vector<float3> wave_points;
+    GenerateWaveMesh(wave_counts, wave_indices, wave_points, 10.0f, 0.5f, resolution, 0.0f, true);
+    std::vector<int> sphere_counts, sphere_indices;
+    std::vector<float3> sphere_points;
+    GenerateIcoSphereMesh(sphere_counts, sphere_indices, sphere_points, 0.5f, 4);
+
+    auto wave = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(wave, wave_points.data(), wave_indices.data(), sizeof(float3), (int)wave_points.size(), 0, sizeof(int), (int)wave_indices.size(), 0);
+    auto sphere = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(sphere, sphere_points.data(), sphere_indices.data(), sizeof(float3), (int)sphere_points.size(), 0, sizeof(int), (int)sphere_indices.size(), 0);
+
+    std::vector<rths::MeshInstanceData*> instances;
+    instances.push_back(rthsMeshInstanceCreate(wave));
+    for (int i = 0; i < 9; ++i) {
+        auto inst = rthsMeshInstanceCreate(sphere);
+        auto trans = float4x4::identity();
+        trans[3] = { (float)(i % 3) * 3.0f - 3.0f, 1.5f, (float)(i / 3) * 3.0f - 3.0f, 1.0f };
+        rthsMeshInstanceSetTransform(inst, trans);
+        instances.push_back(inst);
+    }
+
+    float3 cam_pos{ 0.0f, 6.0f, -8.0f };
+    auto view = lookat_rh(cam_pos, { 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f });
+    auto proj = MakeTestProjection();
+
+    // 32 lights. bit mask output tells which lights are visible from each pixel.
+    auto render = [&](uint32_t render_flags, std::vector<float>& rt_buf) {
+        rt_buf.resize(rt_width * rt_height);
+        RenderFrame(renderer, [&]() {
+            rthsRendererSetRenderTarget(renderer, render_target);
+            rthsRendererSetRenderFlags(renderer, render_flags);
+            rthsRendererSetCamera(renderer, cam_pos, view, proj);
+            for (int i = 0; i < 32; ++i) {
+                float a = (float)i / 32.0f * 2.0f * 3.14159265f;
+                float3 pos{ std::cos(a) * 5.0f, 3.0f + (float)(i % 4), std::sin(a) * 5.0f };
+                switch (i % 4) {
+                case 0: rthsRendererAddDirectionalLight(renderer, normalize(-pos)); break;
+                case 1: rthsRendererAddPointLight(renderer, pos, 20.0f); break;
+                case 2: rthsRendererAddSpotLight(renderer, pos, normalize(-pos), 20.0f, 1.5f); break;
+                case 3: rthsRendererAddReversePointLight(renderer, pos * 0.2f, 20.0f); break;
+                }
+            }
+            for (auto inst : instances)
+                rthsRendererAddMesh(renderer, inst);
+        }, rt_buf.data());
+
+        std::string log = rthsRendererGetTimestampLog(renderer);
+        auto pos = log.find("DispatchRays: ");
+        return pos != std::string::npos ? std::atof(log.c_str() + pos + 14) : 0.0;
+    };
+
+    const uint32_t render_flags[]{
+        0,
+        (uint32_t)RenderFlag::IgnoreSelfShadow,
+        (uint32_t)RenderFlag::IgnoreSelfShadow | (uint32_t)RenderFlag::KeepSelfDropShadow,
+    };
+    auto debug_flags = rthsGlobalsGetDebugFlags();
+    int num_try = 5;
+    GetArg("num_try", num_try);
+    for (auto rflags : render_flags) {
+        // best of a few frames. the first frame includes BVH build.
+        // the two paths are measured alternately so that both see the same load of the machine.
+        std::vector<float> result_any, result_closest;
+        uint32_t dflags_closest = debug_flags | (uint32_t)DebugFlag::Timestamp | (uint32_t)DebugFlag::NoOcclusionQuery;
+        uint32_t dflags_any = debug_flags | (uint32_t)DebugFlag::Timestamp;
+        rthsGlobalsSetDebugFlags(dflags_any);
+        render(rflags, result_any);
+        double time_closest = 0.0, time_any = 0.0;
+        for (int i = 0; i < num_try; ++i) {
+            rthsGlobalsSetDebugFlags(dflags_closest);
+            double t = render(rflags, result_closest);
+            if (time_closest == 0.0 || t < time_closest)
+                time_closest = t;
+            rthsGlobalsSetDebugFlags(dflags_any);
+            t = render(rflags, result_any);
+            if (time_any == 0.0 || t < time_any)
+                time_any = t;
+        }
+
+        Print("    render flags 0x%x: closest hit %.2lfms, any hit %.2lfms\n", rflags, time_closest, time_any);
+        // timings are only reported. wall clock asserts would fail on loaded machines.
+        // any hit should not be slower, and much faster with IgnoreSelfShadow as the receiver itself is not traversed.
+        Expect(result_any == result_closest);
+    }
+    rthsGlobalsSetDebugFlags(debug_flags);
+
+    for (auto inst : instances)
+        rthsMeshInstanceRelease(inst);
+    rthsMeshRelease(wave);
+    rthsMeshRelease(sphere);
+    rthsRenderTargetRelease(render_target);
+    rthsRendererRelease(renderer);
+}
+
+
+TestCase(TestCompressedBVH)
+{
+    auto renderer = CreateTestRenderer();
+    if (!renderer)
+        return;
+
+    // wave mesh has (resolution - 1)^2 * 2 triangles. 725 -> about 1M triangles
+    int resolution = 725;
+    GetArg("resolution", resolution);
+
+    const int rt_width = 256;
+    const int rt_height = 256;
+    auto render_target = rthsRenderTargetCreate();
+    rthsRenderTargetSetup(render_target, rt_width, rt_height, RenderTargetFormat::Rf32);
+
+    std::vector<int> wave_counts, wave_indices;
+    std::vector<float3> wave_points;
+    GenerateWaveMesh(wave_counts, wave_indices, wave_points, 10.0f, 1.0f, resolution, 0.0f, true);
+    std::vector<int> sphere_counts, sphere_indices;
+    std::vector<float3> sphere_points;
+    GenerateIcoSphereMesh(sphere_counts, sphere_indices, sphere_points, 1.0f, 6);
+    for (auto& p : sphere_points)
+        p.y += 2.0f;
+
+    float3 cam_pos{ 0.0f, 5.0f, -6.0f };
+    auto view = lookat_rh(cam_pos, { 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f });
+    auto proj = MakeTestProjection();
+
+    // returns time of DispatchRays in milliseconds
+    auto render = [&](std::vector<rths::MeshInstanceData*>& instances, std::vector<float>& rt_buf) {
+        rt_buf.resize(rt_width * rt_height);
+        RenderFrame(renderer, [&]() {
+            rthsRendererSetRenderTarget(renderer, render_target);
+            rthsRendererSetCamera(renderer, cam_pos, view, proj);
+            rthsRendererAddDirectionalLight(renderer, normalize(float3{ -1.0f, -1.0f, 1.0f }));
+            rthsRendererAddPointLight(renderer, { 2.0f, 3.0f, -1.0f }, 10.0f);
+            for (auto inst : instances)
+                rthsRendererAddMesh(renderer, inst);
+        }, rt_buf.data());
+
+        std::string log = rthsRendererGetTimestampLog(renderer);
+        auto pos = log.find("DispatchRays: ");
+        return pos != std::string::npos ? std::atof(log.c_str() + pos + 14) : 0.0;
+    };
+
+    struct Result
+    {
+        std::vector<float> image;
+        double time_single = 0.0;
+        double time_packet = 0.0;
+        double ratio = 0.0;
+    };
+    // BLAS is built when the mesh is rendered first time. so meshes are created for each mode.
+    auto run = [&](bool compress) {
+        auto flags = rthsGlobalsGetFlags();
+        rthsGlobalsSetFlags(compress ? flags | (uint32_t)GlobalFlag::CompressBVH : flags & ~(uint32_t)GlobalFlag::CompressBVH);
+
+        auto wave = rthsMeshCreate();
+        rthsMeshSetCPUBuffers(wave, wave_points.data(), wave_indices.data(), sizeof(float3), (int)wave_points.size(), 0, sizeof(int), (int)wave_indices.size(), 0);
+        auto sphere = rthsMeshCreate();
+        rthsMeshSetCPUBuffers(sphere, sphere_points.data(), sphere_indices.data(), sizeof(float3), (int)sphere_points.size(), 0, sizeof(int), (int)sphere_indices.size(), 0);
+        std::vector<rths::MeshInstanceData*> instances{ rthsMeshInstanceCreate(wave), rthsMeshInstanceCreate(sphere) };
+
+        Result ret;
+        auto debug_flags = rthsGlobalsGetDebugFlags();
+        auto bench = [&](uint32_t dflags) {
+            rthsGlobalsSetDebugFlags(debug_flags | (uint32_t)DebugFlag::Timestamp | dflags);
+            double best = 0.0;
+            for (int i = 0; i < 3; ++i) {
+                double t = render(instances, ret.image);
+                if (best == 0.0 || t < best)
+                    best = t;
+            }
+            return best;
+        };
+        render(instances, ret.image); // build BLAS
+        ret.time_single = bench((uint32_t)DebugFlag::NoRayPackets);
+        ret.time_packet = bench(0);
+        rthsGlobalsSetDebugFlags(debug_flags);
+
+        std::string report = rthsRendererGetMemoryReport(renderer);
+        Print("    %s:\n%s", compress ? "compressed" : "uncompressed", report.c_str());
+        Print("      DispatchRays: %.2lfms (single ray), %.2lfms (ray packets)\n", ret.time_single, ret.time_packet);
+        auto pos = report.find("MB (");
+        if (pos != std::string::npos)
+            ret.ratio = std::atof(report.c_str() + pos + 4);
+
+        for (auto inst : instances)
+            rthsMeshInstanceRelease(inst);
+        rthsMeshRelease(wave);
+        rthsMeshRelease(sphere);
+        rthsGlobalsSetFlags(flags);
+        return ret;
+    };
+
+    auto uncompressed = run(false);
+    auto compressed = run(true);
+    Expect(compressed.ratio >= 3.0);
+    // compressed BLAS has its own packet traversal. ray packets should stay the fast path with it.
+    // timings are only reported: packets falling back to one ray at a time show up as about 2x here.
+    Print("    compressed / uncompressed: %.2lfx (single ray), %.2lfx (ray packets)\n",
+        compressed.time_single / uncompressed.time_single, compressed.time_packet / uncompressed.time_packet);
+    Print("    compressed: single ray %.2lfms, ray packets %.2lfms\n", compressed.time_single, compressed.time_packet);
+
+    // quantized bounds are conservative. results must be the same except ties of triangles at the same distance.
+    int mismatch = 0;
+    for (size_t i = 0; i < compressed.image.size(); ++i) {
+        if (compressed.image[i] != uncompressed.image[i])
+            ++mismatch;
+    }
+    Expect(mismatch <= (int)compressed.image.size() / 1000);
+
+    rthsRenderTargetRelease(render_target);
+    rthsRendererRelease(renderer);
+}
+
+
+TestCase(TestDeformedBLAS)
+{
+    auto renderer = CreateTestRenderer();
+    if (!renderer)
+        return;
+
+    // 'characters' dynamic meshes deformed every frame. ico sphere of iteration 4 has 5120 triangles.
+    int characters = 200;
+    GetArg("characters", characters);
+    const int grid = (int)std::ceil(std::sqrt((float)characters));
+
+    const int rt_width = 256;
+    const int rt_height = 256;
+    auto render_target = rthsRenderTargetCreate();
+    rthsRenderTargetSetup(render_target, rt_width, rt_height, RenderTargetFormat::Rf32);
+
+    std::vector<int> sphere_counts, sphere_indices;
+    std::vector<float3> sphere_points;
+    GenerateIcoSphereMesh(sphere_counts, sphere_indices, sphere_points, 0.15f, 4);
+    auto quad = CreateFloorQuad();
+    auto inst_quad = rthsMeshInstanceCreate(quad);
+
+    // deformed vertices are float4 (same layout as rthsDeform.hlsl writes)
+    using float4 = rths::float4;
+    int vertex_count = (int)sphere_points.size();
+    std::vector<std::vector<float4>> deformed(characters, std::vector<float4>(vertex_count));
+    auto deform = [&](float time, bool scramble) {
+        for (int ci = 0; ci < characters; ++ci) {
+            float3 pos{ (float)(ci % grid) / grid * 8.0f - 4.0f, 0.3f, (float)(ci / grid) / grid * 8.0f - 4.0f };
+            for (int vi = 0; vi < vertex_count; ++vi) {
+                // scramble moves vertices to positions of unrelated vertices. this makes refit degrade the tree badly.
+                float3 p = sphere_points[scramble ? vi * 7919 % vertex_count : vi];
+                float s = 1.0f + 0.2f * std::sin(time + p.y * 20.0f + ci);
+                p = p * s + pos;
+                deformed[ci][vi] = { p.x, p.y, p.z, 1.0f };
+            }
+        }
+    };
+
+    std::vector<rths::MeshData*> meshes;
+    std::vector<rths::MeshInstanceData*> instances{ inst_quad };
+    deform(0.0f, false);
+    for (int ci = 0; ci < characters; ++ci) {
+        auto mesh = rthsMeshCreate();
+        rthsMeshSetCPUBuffers(mesh, deformed[ci].data(), sphere_indices.data(), sizeof(float4), vertex_count, 0, sizeof(int), (int)sphere_indices.size(), 0);
+        rthsMeshMarkDyncmic(mesh, true);
+        meshes.push_back(mesh);
+        instances.push_back(rthsMeshInstanceCreate(mesh));
+    }
+
+    float3 cam_pos{ 0.0f, 6.0f, -7.0f };
+    auto view = lookat_rh(cam_pos, { 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f });
+    auto proj = MakeTestProjection();
+
+    auto render = [&](rths::IRenderer *r, std::vector<rths::MeshInstanceData*>& insts, std::vector<float>& rt_buf) {
+        rt_buf.resize(rt_width * rt_height);
+        RenderFrame(r, [&]() {
+            rthsRendererSetRenderTarget(r, render_target);
+            rthsRendererSetCamera(r, cam_pos, view, proj);
+            rthsRendererAddDirectionalLight(r, normalize(float3{ -1.0f, -1.0f, 1.0f }));
+            for (auto inst : insts)
+                rthsRendererAddMesh(r, inst);
+        }, rt_buf.data());
+        return std::string(rthsRendererGetTimestampLog(r));
+    };
+
+    // render the current vertices as static meshes (FastTrace SAH) with a new renderer and compare the result
+    auto compare_with_static_meshes = [&](const std::vector<float>& result) {
+        std::vector<rths::MeshData*> static_meshes;
+        std::vector<rths::MeshInstanceData*> static_instances{ inst_quad };
+        for (int ci = 0; ci < characters; ++ci) {
+            auto mesh = rthsMeshCreate();
+            rthsMeshSetCPUBuffers(mesh, deformed[ci].data(), sphere_indices.data(), sizeof(float4), vertex_count, 0, sizeof(int), (int)sphere_indices.size(), 0);
+            static_meshes.push_back(mesh);
+            static_instances.push_back(rthsMeshInstanceCreate(mesh));
+        }
+        auto r = CreateTestRenderer();
+        std::vector<float> tmp;
+        render(r, static_instances, tmp);
+        rthsRendererRelease(r);
+        for (size_t i = 1; i < static_instances.size(); ++i)
+            rthsMeshInstanceRelease(static_instances[i]);
+        for (auto mesh : static_meshes)
+            rthsMeshRelease(mesh);
+
+        // ties of triangles at the same distance can be resolved differently
+        int mismatch = 0;
+        for (size_t i = 0; i < result.size(); ++i) {
+            if (tmp[i] != result[i])
+                ++mismatch;
+        }
+        Expect(mismatch <= (int)result.size() / 1000);
+    };
+
+    auto debug_flags = rthsGlobalsGetDebugFlags();
+    rthsGlobalsSetDebugFlags(debug_flags | (uint32_t)DebugFlag::Timestamp);
+
+    char expected[64];
+    std::vector<float> result;
+    std::string log;
+
+    // first frame builds LBVH (and FastTrace SAH for the quad)
+    log = render(renderer, instances, result);
+    Print("    initial:\n%s", log.c_str());
+    snprintf(expected, sizeof(expected), "BLAS build: %d meshes", characters + 1);
+    Expect(log.find(expected) != std::string::npos);
+
+    // small deformations. BLAS should be refitted.
+    snprintf(expected, sizeof(expected), "BLAS refit: %d meshes", characters);
+    for (int frame = 1; frame <= 3; ++frame) {
+        deform(frame * 0.3f, false);
+        log = render(renderer, instances, result);
+        Print("    deform (frame %d):\n%s", frame, log.c_str());
+        Expect(log.find(expected) != std::string::npos);
+        Expect(log.find("BLAS build") == std::string::npos);
+    }
+    compare_with_static_meshes(result);
+
+    // compare refit, LBVH and SAH rebuild
+    rthsGlobalsSetDebugFlags(debug_flags | (uint32_t)DebugFlag::Timestamp | (uint32_t)DebugFlag::BLASUpdateReport);
+    deform(1.2f, false);
+    log = render(renderer, instances, result);
+    Print("    report:\n%s", log.c_str());
+    Expect(log.find("BLAS update report") != std::string::npos && log.find("best:") != std::string::npos);
+    rthsGlobalsSetDebugFlags(debug_flags | (uint32_t)DebugFlag::Timestamp);
+
+    // large deformation degrades refitted trees too much. BLAS should be rebuilt.
+    deform(1.5f, true);
+    log = render(renderer, instances, result);
+    Print("    scramble:\n%s", log.c_str());
+    snprintf(expected, sizeof(expected), "BLAS build: %d meshes", characters);
+    Expect(log.find(expected) != std::string::npos);
+    compare_with_static_meshes(result);
+
+    rthsGlobalsSetDebugFlags(debug_flags);
+
+    for (auto inst : instances)
+        rthsMeshInstanceRelease(inst);
+    for (auto mesh : meshes)
+        rthsMeshRelease(mesh);
+    rthsMeshRelease(quad);
+    rthsRenderTargetRelease(render_target);
+    rthsRendererRelease(renderer);
+}
+
+
+TestCase(TestDeformCPU)
+{
+    using float4 = rths::float4;
+    using rths::BoneWeight1;
+
+    // ico sphere of iteration 4 has 2562 vertices. more than one chunk of the deformer, and not a multiple of 4
+    std::vector<int> sphere_counts, sphere_indices;
+    std::vector<float3> sphere_points;
+    GenerateIcoSphereMesh(sphere_counts, sphere_indices, sphere_points, 0.5f, 4);
+    int vertex_count = (int)sphere_points.size();
+    int index_count = (int)sphere_indices.size();
+
+    // a blendshape of 3 frames and a blendshape of 1 frame. weights are 0-100
+    std::mt19937 rand(777);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    const float frame_weights[] = { 25.0f, 50.0f, 100.0f };
+    std::vector<std::vector<float3>> deltas(4, std::vector<float3>(vertex_count));
+    for (auto& frame : deltas)
+        for (auto& d : frame)
+            d = { dist(rand) * 0.1f, dist(rand) * 0.1f, dist(rand) * 0.1f };
+
+    // 4 bones. 1-4 weights per vertex
+    const int bone_count = 4;
+    std::vector<uint8_t> bone_counts;
+    std::vector<BoneWeight1> weights;
+    for (int vi = 0; vi < vertex_count; ++vi) {
+        int n = 1 + vi % 4;
+        float total = 0.0f;
+        size_t first = weights.size();
+        for (int bi = 0; bi < n; ++bi) {
+            float w = 0.1f + std::abs(dist(rand));
+            weights.push_back({ w, (vi + bi) % bone_count });
+            total += w;
+        }
+        for (size_t wi = first; wi < weights.size(); ++wi)
+            weights[wi].weight /= total;
+        bone_counts.push_back((uint8_t)n);
+    }
+    auto translation = [](float x, float y, float z) {
+        float4x4 m = float4x4::identity();
+        m[3] = { x, y, z, 1.0f };
+        return m;
+    };
+    auto rotation_y = [](float a) {
+        float c = std::cos(a), s = std::sin(a);
+        float4x4 m = float4x4::identity();
+        m[0] = { c, 0.0f, -s, 0.0f };
+        m[2] = { s, 0.0f, c, 0.0f };
+        return m;
+    };
+    std::vector<float4x4> bindposes(bone_count), bones(bone_count);
+    for (int bi = 0; bi < bone_count; ++bi)
+        bindposes[bi] = translation(0.0f, -0.2f * bi, 0.0f);
+
+    auto mesh = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(mesh, sphere_points.data(), sphere_indices.data(), sizeof(float3), vertex_count, 0, sizeof(int), index_count, 0);
+    rthsMeshSetSkinBindposes(mesh, bindposes.data(), bone_count);
+    rthsMeshSetSkinWeights(mesh, bone_counts.data(), vertex_count, weights.data(), (int)weights.size());
+    rthsMeshSetBlendshapeCount(mesh, 2);
+    for (int fi = 0; fi < 3; ++fi)
+        rthsMeshAddBlendshapeFrame(mesh, 0, deltas[fi].data(), frame_weights[fi]);
+    rthsMeshAddBlendshapeFrame(mesh, 1, deltas[3].data(), 80.0f);
+    auto inst = rthsMeshInstanceCreate(mesh);
+
+    // straight port of ApplyBlendshape() and ApplySkinning() of rthsDeform.hlsl
+    auto reference = [&](const float *bs_weights, bool skinning, const float4x4& root, bool clamp_weights) {
+        std::vector<float4> ret(vertex_count);
+        float4x4 iroot = rths::invert(root);
+        std::vector<float4x4> matrices(bone_count);
+        for (int bi = 0; bi < bone_count; ++bi)
+            matrices[bi] = rths::mul_scalar(rths::mul_scalar(bindposes[bi], bones[bi]), iroot);
+
+        struct BS { std::vector<const std::vector<float3>*> deltas; std::vector<float> weights; };
+        BS bs[2];
+        for (int fi = 0; fi < 3; ++fi) {
+            bs[0].deltas.push_back(&deltas[fi]);
+            bs[0].weights.push_back(frame_weights[fi] / 100.0f);
+        }
+        bs[1].deltas.push_back(&deltas[3]);
+        bs[1].weights.push_back(0.8f);
+
+        size_t weight_offset = 0;
+        for (int vi = 0; vi < vertex_count; ++vi) {
+            float3 result = sphere_points[vi];
+            for (int bsi = 0; bsi < 2; ++bsi) {
+                float weight = bs_weights[bsi];
+                if (clamp_weights)
+                    weight = clamp(weight, 0.0f, bs[bsi].weights.back() * 100.0f);
+                weight /= 100.0f;
+                if (weight == 0.0f)
+                    continue;
+                auto& fw = bs[bsi].weights;
+                auto delta = [&](size_t fi) { return (*bs[bsi].deltas[fi])[vi]; };
+                size_t frame_count = fw.size();
+                float last_weight = fw[frame_count - 1];
+                if (weight < 0.0f) {
+                    result += delta(0) * (weight / fw[0]);
+                }
+                else if (weight > last_weight) {
+                    float s = frame_count >= 2 ?
+                        (weight - fw[frame_count - 2]) / (last_weight - fw[frame_count - 2]) : weight / last_weight;
+                    result += delta(frame_count - 1) * s;
+                }
+                else {
+                    float3 p1{}, p2{};
+                    float w1 = 0.0f, w2 = 0.0f;
+                    for (size_t fi = 0; fi < frame_count; ++fi) {
+                        if (weight <= fw[fi]) {
+                            p2 = delta(fi);
+                            w2 = fw[fi];
+                            break;
+                        }
+                        p1 = delta(fi);
+                        w1 = fw[fi];
+                    }
+                    float s = (weight - w1) / (w2 - w1);
+                    result += p1 + (p2 - p1) * s;
+                }
+            }
+            if (skinning) {
+                float3 skinned{};
+                for (int bi = 0; bi < bone_counts[vi]; ++bi) {
+                    auto& w = weights[weight_offset + bi];
+                    skinned += rths::mul_p(matrices[w.index], result) * w.weight;
+                }
+                result = skinned;
+            }
+            weight_offset += bone_counts[vi];
+            ret[vi] = { result.x, result.y, result.z, 1.0f };
+        }
+        return ret;
+    };
+    auto max_error = [&](const std::vector<float4>& a, const std::vector<float4>& b) {
+        float ret = 0.0f;
+        for (int vi = 0; vi < vertex_count; ++vi) {
+            ret = std::max(ret, std::abs(a[vi].x - b[vi].x));
+            ret = std::max(ret, std::abs(a[vi].y - b[vi].y));
+            ret = std::max(ret, std::abs(a[vi].z - b[vi].z));
+            ret = std::max(ret, std::abs(a[vi].w - b[vi].w));
+        }
+        return ret;
+    };
+
+    std::vector<float4> result(vertex_count);
+
+    // nothing to deform yet
+    Expect(rthsMeshInstanceDeformCPU(inst, result.data(), vertex_count, false) == 0);
+
+    // blendshapes only. negative, between frames, exactly on a frame, over the last frame, and zero weights
+    {
+        const float cases[][2] = {
+            { -30.0f, 0.0f }, { 10.0f, 40.0f }, { 25.0f, 80.0f }, { 40.0f, 120.0f },
+            { 75.0f, -10.0f }, { 100.0f, 0.0f }, { 150.0f, 200.0f }, { 0.0f, 0.0f },
+        };
+        float errors = 0.0f;
+        for (auto& c : cases) {
+            rthsMeshInstanceSetBlendshapeWeights(inst, c, 2);
+            for (bool clamp_weights : { false, true }) {
+                int n = rthsMeshInstanceDeformCPU(inst, result.data(), vertex_count, clamp_weights);
+                Expect(n == vertex_count);
+                errors = std::max(errors, max_error(result, reference(c, false, float4x4::identity(), clamp_weights)));
+            }
+        }
+        Print("    blendshape: max error %g\n", errors);
+        Expect(errors < 1e-6f);
+    }
+
+    // skinning, and blendshapes + skinning. bones are in the space of the instance's transform
+    {
+        float4x4 root = rths::mul_scalar(rotation_y(0.3f), translation(1.0f, 0.5f, -2.0f));
+        rthsMeshInstanceSetTransform(inst, root);
+        for (int bi = 0; bi < bone_count; ++bi)
+            bones[bi] = rths::mul_scalar(rths::mul_scalar(rotation_y(0.4f * bi), translation(0.0f, 0.2f * bi, 0.1f * bi)), root);
+        rthsMeshInstanceSetBones(inst, bones.data(), bone_count);
+
+        const float bs_zero[2]{};
+        rthsMeshInstanceSetBlendshapeWeights(inst, bs_zero, 2);
+        Expect(rthsMeshInstanceDeformCPU(inst, result.data(), vertex_count, false) == vertex_count);
+        float error_skin = max_error(result, reference(bs_zero, true, root, false));
+
+        const float bs_weights[2]{ 60.0f, -20.0f };
+        rthsMeshInstanceSetBlendshapeWeights(inst, bs_weights, 2);
+        Expect(rthsMeshInstanceDeformCPU(inst, result.data(), vertex_count, false) == vertex_count);
+        float error_both = max_error(result, reference(bs_weights, true, root, false));
+        Print("    skinning: max error %g, blendshape + skinning: max error %g\n", error_skin, error_both);
+        Expect(error_skin < 1e-5f && error_both < 1e-5f);
+
+        // dst too small
+        Expect(rthsMeshInstanceDeformCPU(inst, result.data(), vertex_count - 1, false) == 0);
+    }
+
+    // the CPU renderer traces deformed instances. compare with static meshes made of the deformed vertices
+    {
+        auto quad = CreateFloorQuad();
+        auto inst_quad = rthsMeshInstanceCreate(quad);
+
+        const int rt_size = 256;
+        auto render_target = rthsRenderTargetCreate();
+        rthsRenderTargetSetup(render_target, rt_size, rt_size, RenderTargetFormat::Rf32);
+        float3 cam_pos{ 0.0f, 4.0f, -5.0f };
+        auto view = lookat_rh(cam_pos, { 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f });
+        auto proj = MakeTestProjection();
+        auto render = [&](rths::IRenderer *r, rths::MeshInstanceData *caster, std::vector<float>& rt_buf) {
+            rt_buf.resize(rt_size * rt_size);
+            RenderFrame(r, [&]() {
+                rthsRendererSetRenderTarget(r, render_target);
+                rthsRendererSetCamera(r, cam_pos, view, proj);
+                rthsRendererAddDirectionalLight(r, normalize(float3{ -1.0f, -1.0f, 1.0f }));
+                rthsRendererAddMesh(r, inst_quad);
+                rthsRendererAddMesh(r, caster);
+            }, rt_buf.data());
+            return std::string(rthsRendererGetTimestampLog(r));
+        };
+        auto compare_with_static_mesh = [&](const std::vector<float>& rt_result) {
+            std::vector<float4> vertices(vertex_count);
+            rthsMeshInstanceDeformCPU(inst, vertices.data(), vertex_count, false);
+            auto static_mesh = rthsMeshCreate();
+            rthsMeshSetCPUBuffers(static_mesh, vertices.data(), sphere_indices.data(), sizeof(float4), vertex_count, 0, sizeof(int), index_count, 0);
+            auto static_inst = rthsMeshInstanceCreate(static_mesh);
+            rthsMeshInstanceSetTransform(static_inst, rths::mul_scalar(rotation_y(0.3f), translation(1.0f, 0.5f, -2.0f)));
+            auto r = CreateTestRenderer();
+            std::vector<float> tmp;
+            render(r, static_inst, tmp);
+            rthsRendererRelease(r);
+            rthsMeshInstanceRelease(static_inst);
+            rthsMeshRelease(static_mesh);
+
+            // ties of triangles at the same distance can be resolved differently
+            int mismatch = 0;
+            for (size_t i = 0; i < rt_result.size(); ++i) {
+                if (tmp[i] != rt_result[i])
+                    ++mismatch;
+            }
+            Expect(mismatch <= (int)rt_result.size() / 1000);
+        };
+
+        auto debug_flags = rthsGlobalsGetDebugFlags();
+        rthsGlobalsSetDebugFlags(debug_flags | (uint32_t)DebugFlag::Timestamp);
+        auto renderer = CreateTestRenderer();
+        std::vector<float> rt_result, rt_prev;
+        std::string log;
+
+        log = render(renderer, inst, rt_result);
+        Print("    initial:\n%s", log.c_str());
+        Expect(log.find("Deform: 1 instances") != std::string::npos);
+        compare_with_static_mesh(rt_result);
+
+        // nothing has changed. not deformed again
+        rt_prev = rt_result;
+        log = render(renderer, inst, rt_result);
+        Expect(log.find("Deform:") == std::string::npos);
+        Expect(rt_prev == rt_result);
+
+        // bones have moved. deformed and refitted
+        bones[1] = rths::mul_scalar(translation(0.3f, 0.0f, 0.0f), bones[1]);
+        rthsMeshInstanceSetBones(inst, bones.data(), bone_count);
+        log = render(renderer, inst, rt_result);
+        Print("    bones moved:\n%s", log.c_str());
+        Expect(log.find("Deform: 1 instances") != std::string::npos);
+        Expect(log.find("BLAS refit: 1 meshes") != std::string::npos);
+        Expect(rt_prev != rt_result);
+        compare_with_static_mesh(rt_result);
+
+        // no bones and no blendshape weights. the instance goes back to the BLAS of the mesh
+        rthsMeshInstanceSetBones(inst, nullptr, 0);
+        rthsMeshInstanceSetBlendshapeWeights(inst, nullptr, 0);
+        log = render(renderer, inst, rt_result);
+        Expect(log.find("Deform:") == std::string::npos);
+        Expect(rt_prev != rt_result);
+
+        rthsGlobalsSetDebugFlags(debug_flags);
+        rthsRendererRelease(renderer);
+        rthsRenderTargetRelease(render_target);
+        rthsMeshInstanceRelease(inst_quad);
+        rthsMeshRelease(quad);
+    }
+
+    rthsMeshInstanceRelease(inst);
+    rthsMeshRelease(mesh);
+}
+
+TestCase(TestSparseBlendshape)
+{
+    using float4 = rths::float4;
+
+    std::vector<int> sphere_counts, sphere_indices;
+    std::vector<float3> sphere_points;
+    GenerateIcoSphereMesh(sphere_counts, sphere_indices, sphere_points, 0.5f, 5);
+    int vertex_count = (int)sphere_points.size();
+    int index_count = (int)sphere_indices.size();
+
+    // deltas touch a few percent of vertices, as facial blendshapes do: a region around +z, a few isolated vertices,
+    // and the first and last vertices. the second frame touches a different region.
+    std::vector<float3> deltas[2];
+    for (auto& d : deltas)
+        d.resize(vertex_count);
+    for (int vi = 0; vi < vertex_count; ++vi) {
+        auto& p = sphere_points[vi];
+        if (p.z > 0.45f)
+            deltas[0][vi] = { 0.0f, 0.0f, p.z * 0.2f };
+        if (p.y > 0.45f)
+            deltas[1][vi] = { p.x * 0.1f, 0.05f, 0.0f };
+        if (vi % 997 == 0)
+            deltas[0][vi].x = 0.01f;
+    }
+    deltas[0][vertex_count - 1] = { 0.0f, -0.01f, 0.0f };
+    deltas[1][0] = { 0.02f, 0.0f, 0.0f };
+    const float frame_weights[] = { 50.0f, 100.0f };
+
+    auto mesh = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(mesh, sphere_points.data(), sphere_indices.data(), sizeof(float3), vertex_count, 0, sizeof(int), index_count, 0);
+    rthsMeshSetBlendshapeCount(mesh, 1);
+    for (int fi = 0; fi < 2; ++fi)
+        rthsMeshAddBlendshapeFrame(mesh, 0, deltas[fi].data(), frame_weights[fi]);
+    auto inst = rthsMeshInstanceCreate(mesh);
+
+    uint64_t sparse_size = 0, dense_size = 0;
+    rthsMeshGetBlendshapeMemoryUsage(mesh, &sparse_size, &dense_size);
+    Print("    %d vertices: sparse %.1lfKB, dense %.1lfKB (%.1lf%%)\n", vertex_count,
+        sparse_size / 1024.0, dense_size / 1024.0, 100.0 * sparse_size / dense_size);
+    Expect(dense_size == sizeof(float3) * vertex_count * 2);
+    Expect(sparse_size * 10 < dense_size);
+
+    // same as ApplyBlendshape() with dense deltas
+    auto reference = [&](float weight) {
+        std::vector<float4> ret(vertex_count);
+        float w = weight / 100.0f, w1 = frame_weights[0] / 100.0f, w2 = frame_weights[1] / 100.0f;
+        for (int vi = 0; vi < vertex_count; ++vi) {
+            float3 r = sphere_points[vi];
+            if (w < 0.0f)
+                r += deltas[0][vi] * (w / w1);
+            else if (w > w2)
+                r += deltas[1][vi] * ((w - w1) / (w2 - w1));
+            else if (w <= w1)
+                r += deltas[0][vi] * (w / w1);
+            else
+                r += deltas[0][vi] + (deltas[1][vi] - deltas[0][vi]) * ((w - w1) / (w2 - w1));
+            ret[vi] = { r.x, r.y, r.z, 1.0f };
+        }
+        return ret;
+    };
+
+    std::vector<float4> result(vertex_count);
+    float error = 0.0f;
+    for (float weight : { -40.0f, 20.0f, 50.0f, 70.0f, 100.0f, 130.0f }) {
+        rthsMeshInstanceSetBlendshapeWeights(inst, &weight, 1);
+        Expect(rthsMeshInstanceDeformCPU(inst, result.data(), vertex_count, false) == vertex_count);
+        auto expected = reference(weight);
+        for (int vi = 0; vi < vertex_count; ++vi) {
+            error = std::max(error, std::abs(result[vi].x - expected[vi].x));
+            error = std::max(error, std::abs(result[vi].y - expected[vi].y));
+            error = std::max(error, std::abs(result[vi].z - expected[vi].z));
+        }
+    }
+    Print("    max error %g\n", error);
+    Expect(error < 1e-6f);
+
+    // all-zero frames have no deltas at all
+    {
+        std::vector<float3> zero(vertex_count);
+        auto empty = rthsMeshCreate();
+        rthsMeshSetCPUBuffers(empty, sphere_points.data(), sphere_indices.data(), sizeof(float3), vertex_count, 0, sizeof(int), index_count, 0);
+        rthsMeshSetBlendshapeCount(empty, 1);
+        rthsMeshAddBlendshapeFrame(empty, 0, zero.data(), 100.0f);
+        rthsMeshGetBlendshapeMemoryUsage(empty, &sparse_size, &dense_size);
+        Expect(sparse_size == 0 && dense_size == sizeof(float3) * vertex_count);
+
+        auto empty_inst = rthsMeshInstanceCreate(empty);
+        float weight = 100.0f;
+        rthsMeshInstanceSetBlendshapeWeights(empty_inst, &weight, 1);
+        Expect(rthsMeshInstanceDeformCPU(empty_inst, result.data(), vertex_count, false) == vertex_count);
+        bool same = true;
+        for (int vi = 0; vi < vertex_count; ++vi)
+            same &= result[vi].x == sphere_points[vi].x && result[vi].y == sphere_points[vi].y && result[vi].z == sphere_points[vi].z;
+        Expect(same);
+        rthsMeshInstanceRelease(empty_inst);
+        rthsMeshRelease(empty);
+    }
+
+    // the memory report of the CPU renderer has the saving of each mesh
+    {
+        rthsMeshSetName(mesh, "sparse");
+        auto render_target = rthsRenderTargetCreate();
+        rthsRenderTargetSetup(render_target, 64, 64, RenderTargetFormat::Rf32);
+        float3 cam_pos{ 0.0f, 2.0f, -3.0f };
+        auto renderer = CreateTestRenderer();
+        RenderFrame(renderer, [&]() {
+            rthsRendererSetRenderTarget(renderer, render_target);
+            rthsRendererSetCamera(renderer, cam_pos, lookat_rh(cam_pos, { 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }), float4x4::identity());
+            rthsRendererAddDirectionalLight(renderer, normalize(float3{ -1.0f, -1.0f, 1.0f }));
+            rthsRendererAddMesh(renderer, inst);
+        }, nullptr);
+        std::string report = rthsRendererGetMemoryReport(renderer);
+        Print("%s", report.c_str());
+        Expect(report.find("Blendshape deltas of sparse:") != std::string::npos);
+        rthsRendererRelease(renderer);
+        rthsRenderTargetRelease(render_target);
+    }
+
+    rthsMeshInstanceRelease(inst);
+    rthsMeshRelease(mesh);
+}
+
+TestCase(TestTriangleBlocks)
+{
+    auto renderer = CreateTestRenderer();
+    if (!renderer)
+        return;
+
+    int resolution = 725; // ~1M triangles
+    GetArg("resolution", resolution);
+
+    const int rt_width = 512;
+    const int rt_height = 512;
+    auto render_target = rthsRenderTargetCreate();
+    rthsRenderTargetSetup(render_target, rt_width, rt_height, RenderTargetFormat::Rf32);
+
+    std::vector<int> wave_counts, wave_indices;
+    std::vector<float3> wave_points;
+    GenerateWaveMesh(wave_counts, wave_indices, wave_points, 10.0f, 0.5f, resolution, 0.0f, true);
+    std::vector<int> sphere_counts, sphere_indices;
+    std::vector<float3> sphere_points;
+    GenerateIcoSphereMesh(sphere_counts, sphere_indices, sphere_points, 1.0f, 4);
+
+    auto wave = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(wave, wave_points.data(), wave_indices.data(), sizeof(float3), (int)wave_points.size(), 0, sizeof(int), (int)wave_indices.size(), 0);
+    auto sphere = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(sphere, sphere_points.data(), sphere_indices.data(), sizeof(float3), (int)sphere_points.size(), 0, sizeof(int), (int)sphere_indices.size(), 0);
+
+    auto wave_inst = rthsMeshInstanceCreate(wave);
+    auto sphere_inst = rthsMeshInstanceCreate(sphere);
+    auto trans = float4x4::identity();
+    trans[3] = { 0.0f, 1.5f, 0.0f, 1.0f };
+    rthsMeshInstanceSetTransform(sphere_inst, trans);
+
+    float3 cam_pos{ 0.0f, 6.0f, -8.0f };
+    auto view = lookat_rh(cam_pos, { 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f });
+    auto proj = MakeTestProjection();
+
+    auto render = [&](std::vector<float>& rt_buf) {
+        rt_buf.resize(rt_width * rt_height);
+        RenderFrame(renderer, [&]() {
+            rthsRendererSetRenderTarget(renderer, render_target);
+            rthsRendererSetRenderFlags(renderer, (uint32_t)RenderFlag::CullBackFaces);
+            rthsRendererSetCamera(renderer, cam_pos, view, proj);
+            rthsRendererAddDirectionalLight(renderer, normalize(float3{ -1.0f, -2.0f, 1.0f }));
+            rthsRendererAddMesh(renderer, wave_inst);
+            rthsRendererAddMesh(renderer, sphere_inst);
+        }, rt_buf.data());
+
+        std::string log = rthsRendererGetTimestampLog(renderer);
+        auto pos = log.find("DispatchRays: ");
+        return pos != std::string::npos ? std::atof(log.c_str() + pos + 14) : 0.0;
+    };
+
+    auto debug_flags = rthsGlobalsGetDebugFlags();
+    auto bench = [&](uint32_t dflags, std::vector<float>& result) {
+        rthsGlobalsSetDebugFlags(debug_flags | (uint32_t)DebugFlag::Timestamp | dflags);
+        render(result);
+        double best = 0.0;
+        for (int i = 0; i < 3; ++i) {
+            double t = render(result);
+            if (best == 0.0 || t < best)
+                best = t;
+        }
+        return best;
+    };
+
+    // strided source buffers vs. triangle blocks. both trace the same rays one by one.
+    std::vector<float> result_strided, result_blocks, result_packets;
+    double time_strided = bench((uint32_t)DebugFlag::NoTriangleBlocks, result_strided);
+    double time_blocks = bench((uint32_t)DebugFlag::NoRayPackets, result_blocks);
+    double time_packets = bench(0, result_packets);
+
+    // camera ray + shadow ray per pixel
+    double mrays = (double)(rt_width * rt_height * 2) / 1000000.0;
+    Print("    %d triangles\n", (int)(wave_indices.size() + sphere_indices.size()) / 3);
+    Print("    strided: %.2lfms (%.2lf Mrays/s)\n", time_strided, mrays / (time_strided / 1000.0));
+    Print("    blocks: %.2lfms (%.2lf Mrays/s)\n", time_blocks, mrays / (time_blocks / 1000.0));
+    Print("    blocks + ray packets: %.2lfms (%.2lf Mrays/s)\n", time_packets, mrays / (time_packets / 1000.0));
+    Expect(result_blocks == result_strided);
+
+    // packets may differ on ties of triangles at the same distance
+    int mismatch = 0;
+    for (size_t i = 0; i < result_packets.size(); ++i) {
+        if (result_packets[i] != result_strided[i])
+            ++mismatch;
+    }
+    Expect(mismatch <= (int)result_packets.size() / 1000);
+
+    rthsGlobalsSetDebugFlags(debug_flags);
+
+    rthsMeshInstanceRelease(wave_inst);
+    rthsMeshInstanceRelease(sphere_inst);
+    rthsMeshRelease(wave);
+    rthsMeshRelease(sphere);
+    rthsRenderTargetRelease(render_target);
+    rthsRendererRelease(renderer);
+}
+
+
+TestCase(TestWatertight)
+{
+    auto renderer = CreateTestRenderer();
+    if (!renderer)
+        return;
+
+    const int rt_width = 512;
+    const int rt_height = 512;
+    auto render_target = rthsRenderTargetCreate();
+    rthsRenderTargetSetup(render_target, rt_width, rt_height, RenderTargetFormat::Rf32);
+
+    // a disk made of thin triangles around a shared center vertex, and a point light just above the center.
+    // all shadow rays from the floor go through the disk close to the center vertex, where rounding errors of
+    // a non-watertight test let rays slip between neighboring triangles. every pixel of the floor must be in shadow.
+    int segments = 256;
+    float gap = 0.0001f;
+    GetArg("segments", segments);
+    GetArg("gap", gap);
+    const float3 light_pos{ 0.0f, 3.0f, 0.0f };
+    std::vector<int> fan_indices;
+    std::vector<float3> fan_points{ { light_pos.x, light_pos.y - gap, light_pos.z } };
+    for (int i = 0; i < segments; ++i) {
+        float a = 2.0f * 3.14159265f * (float)i / (float)segments;
+        fan_points.push_back({ std::cos(a) * 5.0f, light_pos.y - gap, std::sin(a) * 5.0f });
+        fan_indices.insert(fan_indices.end(), { 0, 1 + i, 1 + (i + 1) % segments });
+    }
+    std::vector<int> floor_counts, floor_indices;
+    std::vector<float3> floor_points;
+    GenerateWaveMesh(floor_counts, floor_indices, floor_points, 10.0f, 0.0f, 16, 0.0f, true);
+
+    auto fan = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(fan, fan_points.data(), fan_indices.data(), sizeof(float3), (int)fan_points.size(), 0, sizeof(int), (int)fan_indices.size(), 0);
+    auto floor = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(floor, floor_points.data(), floor_indices.data(), sizeof(float3), (int)floor_points.size(), 0, sizeof(int), (int)floor_indices.size(), 0);
+    auto fan_inst = rthsMeshInstanceCreate(fan);
+    auto floor_inst = rthsMeshInstanceCreate(floor);
+
+    float3 cam_pos{ 0.0f, 2.0f, -2.0f };
+    auto view = lookat_rh(cam_pos, { 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f });
+    auto proj = MakeTestProjection();
+
+    auto render = [&](std::vector<float>& rt_buf) {
+        rt_buf.resize(rt_width * rt_height);
+        RenderFrame(renderer, [&]() {
+            rthsRendererSetRenderTarget(renderer, render_target);
+            rthsRendererSetCamera(renderer, cam_pos, view, proj);
+            rthsRendererAddPointLight(renderer, light_pos, 10.0f);
+            rthsRendererAddMesh(renderer, fan_inst);
+            rthsRendererAddMesh(renderer, floor_inst);
+        }, rt_buf.data());
+    };
+
+    struct Mode
+    {
+        const char *name;
+        uint32_t flags;
+    };
+    const Mode modes[]{
+        { "strided", (uint32_t)DebugFlag::NoTriangleBlocks },
+        { "blocks", (uint32_t)DebugFlag::NoRayPackets },
+        { "4-wide packet", (uint32_t)DebugFlag::NoAVX2 },
+        { "8-wide packet", 0 },
+    };
+    auto debug_flags = rthsGlobalsGetDebugFlags();
+    for (auto& mode : modes) {
+        rthsGlobalsSetDebugFlags(debug_flags | mode.flags);
+        std::vector<float> result;
+        render(result);
+        int leaks = 0;
+        for (float v : result) {
+            if (v != 0.0f)
+                ++leaks;
+        }
+        Print("    %s: %d lit pixels\n", mode.name, leaks);
+        Expect(leaks == 0);
+    }
+    rthsGlobalsSetDebugFlags(debug_flags);
+
+    rthsMeshInstanceRelease(fan_inst);
+    rthsMeshInstanceRelease(floor_inst);
+    rthsMeshRelease(fan);
+    rthsMeshRelease(floor);
+    rthsRenderTargetRelease(render_target);
+    rthsRendererRelease(renderer);
+}
+
+
+TestCase(TestLayerMask)
+{
+    auto renderer = CreateTestRenderer();
+    if (!renderer)
+        return;
+
+    // grid x grid spheres. each row of spheres is on its own layer (1-31), and the floor is on layer 0.
+    int grid = 31;
+    GetArg("grid", grid);
+    grid = std::min(grid, 31);
+
+    const int rt_width = 256;
+    const int rt_height = 256;
+    auto render_target = rthsRenderTargetCreate();
+    rthsRenderTargetSetup(render_target, rt_width, rt_height, RenderTargetFormat::Rf32);
+
+    std::vector<int> sphere_counts, sphere_indices;
+    std::vector<float3> sphere_points;
+    GenerateIcoSphereMesh(sphere_counts, sphere_indices, sphere_points, 0.12f, 3);
+    auto quad = CreateFloorQuad();
+    auto sphere = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(sphere, sphere_points.data(), sphere_indices.data(), sizeof(float3), (int)sphere_points.size(), 0, sizeof(int), (int)sphere_indices.size(), 0);
+
+    auto inst_quad = rthsMeshInstanceCreate(quad);
+    std::vector<rths::MeshInstanceData*> spheres;
+    for (int i = 0; i < grid * grid; ++i) {
+        auto inst = rthsMeshInstanceCreate(sphere);
+        auto trans = float4x4::identity();
+        trans[3] = { (float)(i % grid) / grid * 8.0f - 4.0f, 0.5f, (float)(i / grid) / grid * 8.0f - 4.0f, 1.0f };
+        rthsMeshInstanceSetTransform(inst, trans);
+        spheres.push_back(inst);
+    }
+    auto set_layers = [&](int single_layer) {
+        for (int i = 0; i < grid * grid; ++i)
+            rthsMeshInstanceSetLayer(spheres[i], single_layer >= 0 ? single_layer : 1 + i / grid);
+    };
+
+    float3 cam_pos{ 0.0f, 6.0f, -7.0f };
+    auto view = lookat_rh(cam_pos, { 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f });
+    auto proj = MakeTestProjection();
+
+    std::string log;
+    auto render = [&](const std::vector<rths::MeshInstanceData*>& insts, uint32_t camera_mask, std::vector<float>& rt_buf) {
+        rt_buf.resize(rt_width * rt_height);
+        RenderFrame(renderer, [&]() {
+            rthsRendererSetRenderTarget(renderer, render_target);
+            rthsRendererSetRenderFlags(renderer, (uint32_t)RenderFlag::CullBackFaces);
+            rthsRendererSetCamera(renderer, cam_pos, view, proj, camera_mask);
+            rthsRendererAddDirectionalLight(renderer, normalize(float3{ -1.0f, -2.0f, 1.0f }));
+            rthsRendererAddPointLight(renderer, { 0.0f, 3.0f, 0.0f }, 10.0f);
+            rthsRendererAddMesh(renderer, inst_quad);
+            for (auto inst : insts)
+                rthsRendererAddMesh(renderer, inst);
+        }, rt_buf.data());
+
+        log = rthsRendererGetTimestampLog(renderer);
+        auto pos = log.find("DispatchRays: ");
+        return pos != std::string::npos ? std::atof(log.c_str() + pos + 14) : 0.0;
+    };
+    auto bench = [&](const std::vector<rths::MeshInstanceData*>& insts, uint32_t camera_mask, std::vector<float>& result) {
+        // the first frame includes BVH build
+        render(insts, camera_mask, result);
+        double best = 0.0;
+        for (int i = 0; i < 3; ++i) {
+            double t = render(insts, camera_mask, result);
+            if (best == 0.0 || t < best)
+                best = t;
+        }
+        return best;
+    };
+
+    auto debug_flags = rthsGlobalsGetDebugFlags();
+    rthsGlobalsSetDebugFlags(debug_flags | (uint32_t)DebugFlag::Timestamp);
+
+    // reference: single layer scene that has only the visible row
+    const int visible_row = grid / 2;
+    const uint32_t camera_mask = 0x1 | (0x1 << (1 + visible_row));
+    std::vector<rths::MeshInstanceData*> visible_spheres(spheres.begin() + visible_row * grid, spheres.begin() + (visible_row + 1) * grid);
+    std::vector<float> reference, result;
+    set_layers(0);
+    double time_single = bench(visible_spheres, ~0u, reference);
+    double time_all = bench(spheres, ~0u, result);
+
+    // all spheres on their own layers, but only the floor and one row match the camera (and so the lights).
+    // TLAS subtrees of the other rows are skipped without visiting their instances.
+    set_layers(-1);
+    double time_masked = bench(spheres, camera_mask, result);
+    Print("    %d instances\n", grid * grid + 1);
+    Print("    single layer, %d instances: %.2lfms\n", grid + 1, time_single);
+    Print("    single layer, all instances: %.2lfms\n", time_all);
+    Print("    %d layers, camera mask 0x%08x: %.2lfms\n", grid + 1, camera_mask, time_masked);
+    Expect(result == reference);
+
+    // moving the visible row to another layer only refits the TLAS. the row should disappear.
+    std::vector<float> floor_only;
+    render({}, ~0u, floor_only);
+    render(spheres, camera_mask, result);
+    for (auto inst : visible_spheres)
+        rthsMeshInstanceSetLayer(inst, 1 + (visible_row + 1) % grid);
+    render(spheres, camera_mask, result);
+    Expect(log.find("TLAS refit") != std::string::npos);
+    Expect(result == floor_only);
+
+    rthsGlobalsSetDebugFlags(debug_flags);
+
+    rthsMeshInstanceRelease(inst_quad);
+    for (auto inst : spheres)
+        rthsMeshInstanceRelease(inst);
+    rthsMeshRelease(quad);
+    rthsMeshRelease(sphere);
+    rthsRenderTargetRelease(render_target);
+    rthsRendererRelease(renderer);
+}
+
+
+TestCase(TestLightCulling)
+{
+    auto renderer = CreateTestRenderer();
+    if (!renderer)
+        return;
+
+    int resolution = 256;
+    GetArg("resolution", resolution);
+
+    const int rt_width = 512;
+    const int rt_height = 512;
+    auto render_target = rthsRenderTargetCreate();
+    rthsRenderTargetSetup(render_target, rt_width, rt_height, RenderTargetFormat::Rf32);
+    rthsRenderTargetSetOutputFormat(render_target, OutputFormat::BitMask);
+
+    std::vector<int> wave_counts, wave_indices;
+    std::vector<float3> wave_points;
+    GenerateWaveMesh(wave_counts, wave_indices, wave_points, 12.0f, 0.2f, resolution, 0.0f, true);
+    std::vector<int> sphere_counts, sphere_indices;
+    std::vector<float3> sphere_points;
+    GenerateIcoSphereMesh(sphere_counts, sphere_indices, sphere_points, 0.3f, 3);
+
+    auto wave = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(wave, wave_points.data(), wave_indices.data(), sizeof(float3), (int)wave_points.size(), 0, sizeof(int), (int)wave_indices.size(), 0);
+    auto sphere = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(sphere, sphere_points.data(), sphere_indices.data(), sizeof(float3), (int)sphere_points.size(), 0, sizeof(int), (int)sphere_indices.size(), 0);
+
+    std::vector<rths::MeshInstanceData*> instances;
+    instances.push_back(rthsMeshInstanceCreate(wave));
+    for (int i = 0; i < 64; ++i) {
+        auto inst = rthsMeshInstanceCreate(sphere);
+        auto trans = float4x4::identity();
+        trans[3] = { (float)(i % 8) * 1.4f - 4.9f, 0.8f, (float)(i / 8) * 1.4f - 4.9f, 1.0f };
+        rthsMeshInstanceSetTransform(inst, trans);
+        instances.push_back(inst);
+    }
+
+    float3 cam_pos{ 0.0f, 7.0f, -9.0f };
+    auto view = lookat_rh(cam_pos, { 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f });
+    auto proj = MakeTestProjection();
+
+    // 32 lights on a 8x4 grid. each of them reaches only a small part of the screen.
+    auto render = [&](bool spot_lights, std::vector<uint32_t>& rt_buf) {
+        rt_buf.resize(rt_width * rt_height);
+        RenderFrame(renderer, [&]() {
+            rthsRendererSetRenderTarget(renderer, render_target);
+            rthsRendererSetRenderFlags(renderer, (uint32_t)RenderFlag::CullBackFaces);
+            rthsRendererSetCamera(renderer, cam_pos, view, proj);
+            for (int i = 0; i < 32; ++i) {
+                float3 pos{ (float)(i % 8) * 1.4f - 4.9f + 0.7f, 2.0f, (float)(i / 8) * 2.8f - 4.2f };
+                if (spot_lights && i % 2 == 1)
+                    rthsRendererAddSpotLight(renderer, pos, normalize(float3{ 0.3f, -1.0f, 0.2f }), 4.0f, 60.0f);
+                else
+                    rthsRendererAddPointLight(renderer, pos, 2.5f);
+            }
+            for (auto inst : instances)
+                rthsRendererAddMesh(renderer, inst);
+        }, rt_buf.data());
+
+        std::string log = rthsRendererGetTimestampLog(renderer);
+        auto pos = log.find("DispatchRays: ");
+        return pos != std::string::npos ? std::atof(log.c_str() + pos + 14) : 0.0;
+    };
+
+    auto debug_flags = rthsGlobalsGetDebugFlags();
+    auto bench = [&](bool spot_lights, uint32_t dflags, std::vector<uint32_t>& result) {
+        rthsGlobalsSetDebugFlags(debug_flags | (uint32_t)DebugFlag::Timestamp | dflags);
+        render(spot_lights, result);
+        double best = 0.0;
+        for (int i = 0; i < 3; ++i) {
+            double t = render(spot_lights, result);
+            if (best == 0.0 || t < best)
+                best = t;
+        }
+        return best;
+    };
+
+    for (bool spot_lights : { false, true }) {
+        std::vector<uint32_t> result_all, result_culled;
+        double time_all = bench(spot_lights, (uint32_t)DebugFlag::NoLightCulling, result_all);
+        double time_culled = bench(spot_lights, 0, result_culled);
+        Print("    %s: all lights %.2lfms, tile light culling %.2lfms\n",
+            spot_lights ? "16 point + 16 spot lights" : "32 point lights", time_all, time_culled);
+        Expect(result_culled == result_all);
+
+        // per-tile light lists. lights visible from each pixel must be in the list of its tile.
+        int tile_size = 0, tiles_x = 0, tiles_y = 0;
+        Expect(rthsRendererReadbackTileLights(renderer, &tile_size, &tiles_x, &tiles_y, nullptr));
+        std::vector<uint32_t> tile_lights(tiles_x * tiles_y);
+        rthsRendererReadbackTileLights(renderer, &tile_size, &tiles_x, &tiles_y, tile_lights.data());
+        int sum = 0, violations = 0;
+        for (auto bits : tile_lights) {
+            for (; bits != 0; bits &= bits - 1)
+                ++sum;
+        }
+        for (int y = 0; y < rt_height; ++y) {
+            for (int x = 0; x < rt_width; ++x) {
+                uint32_t bits = result_culled[rt_width * y + x];
+                uint32_t tile = tile_lights[tiles_x * (y / tile_size) + (x / tile_size)];
+                if ((bits & ~tile) != 0)
+                    ++violations;
+            }
+        }
+        Print("    %dx%d tiles, %.2f lights per tile\n", tiles_x, tiles_y, (float)sum / (float)tile_lights.size());
+        Expect(violations == 0);
+        Expect(sum < (int)tile_lights.size() * 32);
+    }
+    rthsGlobalsSetDebugFlags(debug_flags);
+
+    for (auto inst : instances)
+        rthsMeshInstanceRelease(inst);
+    rthsMeshRelease(wave);
+    rthsMeshRelease(sphere);
+    rthsRenderTargetRelease(render_target);
+    rthsRendererRelease(renderer);
+}
+
+
+TestCase(TestShadowRayBinning)
+{
+    auto renderer = CreateTestRenderer();
+    if (!renderer)
+        return;
+
+    int resolution = 256;
+    GetArg("resolution", resolution);
+
+    const int rt_width = 512;
+    const int rt_height = 512;
+    auto render_target = rthsRenderTargetCreate();
+    rthsRenderTargetSetup(render_target, rt_width, rt_height, RenderTargetFormat::Rf32);
+    rthsRenderTargetSetOutputFormat(render_target, OutputFormat::BitMask);
+
+    std::vector<int> wave_counts, wave_indices;
+    std::vector<float3> wave_points;
+    GenerateWaveMesh(wave_counts, wave_indices, wave_points, 12.0f, 0.2f, resolution, 0.0f, true);
+    std::vector<int> sphere_counts, sphere_indices;
+    std::vector<float3> sphere_points;
+    GenerateIcoSphereMesh(sphere_counts, sphere_indices, sphere_points, 0.3f, 3);
+
+    auto wave = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(wave, wave_points.data(), wave_indices.data(), sizeof(float3), (int)wave_points.size(), 0, sizeof(int), (int)wave_indices.size(), 0);
+    auto sphere = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(sphere, sphere_points.data(), sphere_indices.data(), sizeof(float3), (int)sphere_points.size(), 0, sizeof(int), (int)sphere_indices.size(), 0);
+
+    std::vector<rths::MeshInstanceData*> instances;
+    instances.push_back(rthsMeshInstanceCreate(wave));
+    for (int i = 0; i < 64; ++i) {
+        auto inst = rthsMeshInstanceCreate(sphere);
+        auto trans = float4x4::identity();
+        trans[3] = { (float)(i % 8) * 1.4f - 4.9f, 0.8f, (float)(i / 8) * 1.4f - 4.9f, 1.0f };
+        rthsMeshInstanceSetTransform(inst, trans);
+        instances.push_back(inst);
+    }
+
+    float3 cam_pos{ 0.0f, 7.0f, -9.0f };
+    auto view = lookat_rh(cam_pos, { 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f });
+    auto proj = MakeTestProjection();
+
+    // 8 lights that cover the whole scene. rays of neighboring pixels go to different lights and directions.
+    std::string log;
+    auto render = [&](bool spot_lights, uint32_t render_flags, std::vector<uint32_t>& rt_buf) {
+        rt_buf.resize(rt_width * rt_height);
+        RenderFrame(renderer, [&]() {
+            rthsRendererSetRenderTarget(renderer, render_target);
+            rthsRendererSetRenderFlags(renderer, render_flags);
+            rthsRendererSetCamera(renderer, cam_pos, view, proj);
+            for (int i = 0; i < 8; ++i) {
+                float a = (float)i / 8.0f * 2.0f * 3.14159265f;
+                float3 pos{ std::cos(a) * 4.0f, 2.5f, std::sin(a) * 4.0f };
+                if (spot_lights)
+                    rthsRendererAddSpotLight(renderer, pos, normalize(float3{ 0.0f, 0.5f, 0.0f } - pos), 20.0f, 100.0f);
+                else
+                    rthsRendererAddPointLight(renderer, pos, 20.0f);
+            }
+            for (auto inst : instances)
+                rthsRendererAddMesh(renderer, inst);
+        }, rt_buf.data());
+
+        log = rthsRendererGetTimestampLog(renderer);
+        auto pos = log.find("DispatchRays: ");
+        return pos != std::string::npos ? std::atof(log.c_str() + pos + 14) : 0.0;
+    };
+
+    auto debug_flags = rthsGlobalsGetDebugFlags();
+    auto bench = [&](bool spot_lights, uint32_t render_flags, uint32_t dflags, std::vector<uint32_t>& result) {
+        rthsGlobalsSetDebugFlags(debug_flags | (uint32_t)DebugFlag::Timestamp | dflags);
+        render(spot_lights, render_flags, result);
+        double best = 0.0;
+        for (int i = 0; i < 3; ++i) {
+            double t = render(spot_lights, render_flags, result);
+            if (best == 0.0 || t < best)
+                best = t;
+        }
+        return best;
+    };
+
+    struct Mode
+    {
+        const char *name;
+        bool spot_lights;
+        uint32_t render_flags;
+        bool binned;
+    };
+    const Mode modes[]{
+        { "point", false, (uint32_t)RenderFlag::CullBackFaces, true },
+        { "spot", true, (uint32_t)RenderFlag::CullBackFaces, true },
+        // self shadow filtering needs per-ray filters and bins can't be traced with packets. binning is skipped.
+        { "point + IgnoreSelfShadow", false, (uint32_t)RenderFlag::CullBackFaces | (uint32_t)RenderFlag::IgnoreSelfShadow, false },
+    };
+    for (auto& mode : modes) {
+        std::vector<uint32_t> result_pixel, result_binned;
+        double time_pixel = bench(mode.spot_lights, mode.render_flags, (uint32_t)DebugFlag::NoShadowRayBinning, result_pixel);
+        double time_binned = bench(mode.spot_lights, mode.render_flags, 0, result_binned);
+
+        // the number of shadow rays is the same in both modes
+        double rays = 0.0;
+        auto pos = log.find("Shadow rays: ");
+        if (pos != std::string::npos)
+            rays = std::atof(log.c_str() + pos + 13);
+        if (mode.binned) {
+            Print("    %s: %.2lfM shadow rays. per pixel %.2lfms (%.2lf Mrays/s), binned %.2lfms (%.2lf Mrays/s)\n",
+                mode.name, rays / 1000000.0,
+                time_pixel, rays / (time_pixel * 1000.0),
+                time_binned, rays / (time_binned * 1000.0));
+            Expect(rays > 0.0);
+        }
+        else {
+            Print("    %s: per pixel %.2lfms, binning skipped %.2lfms\n", mode.name, time_pixel, time_binned);
+            Expect(rays == 0.0);
+        }
+
+        // packets and scalar traversal can disagree on rays that graze triangle edges
+        int mismatch = 0;
+        for (size_t i = 0; i < result_pixel.size(); ++i) {
+            if (result_binned[i] != result_pixel[i])
+                ++mismatch;
+        }
+        Expect(mismatch <= (int)result_pixel.size() / 1000);
+    }
+    rthsGlobalsSetDebugFlags(debug_flags);
+
+    for (auto inst : instances)
+        rthsMeshInstanceRelease(inst);
+    rthsMeshRelease(wave);
+    rthsMeshRelease(sphere);
+    rthsRenderTargetRelease(render_target);
+    rthsRendererRelease(renderer);
+}
+
+TestCase(TestJobSystem)
+{
+    // 4 renderers in RenderAll(). each traces on the job system, and they run in parallel until finish.
+    const int num_renderers = 4;
+    const int rt_width = 384;
+    const int rt_height = 384;
+    std::vector<rths::IRenderer*> renderers;
+    std::vector<rths::RenderTargetData*> render_targets;
+    for (int i = 0; i < num_renderers; ++i) {
+        auto renderer = CreateTestRenderer();
+        if (!renderer)
+            return;
+        auto render_target = rthsRenderTargetCreate();
+        rthsRenderTargetSetup(render_target, rt_width, rt_height, RenderTargetFormat::Rf32);
+        renderers.push_back(renderer);
+        render_targets.push_back(render_target);
+    }
+
+    int resolution = 256;
+    GetArg("resolution", resolution);
+
+    std::vector<int> wave_counts, wave_indices;
+    std::vector<float3> wave_points;
+    GenerateWaveMesh(wave_counts, wave_indices, wave_points, 12.0f, 0.2f, resolution, 0.0f, true);
+    std::vector<int> sphere_counts, sphere_indices;
+    std::vector<float3> sphere_points;
+    GenerateIcoSphereMesh(sphere_counts, sphere_indices, sphere_points, 0.3f, 3);
+
+    auto wave = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(wave, wave_points.data(), wave_indices.data(), sizeof(float3), (int)wave_points.size(), 0, sizeof(int), (int)wave_indices.size(), 0);
+    auto sphere = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(sphere, sphere_points.data(), sphere_indices.data(), sizeof(float3), (int)sphere_points.size(), 0, sizeof(int), (int)sphere_indices.size(), 0);
+
+    std::vector<rths::MeshInstanceData*> instances;
+    instances.push_back(rthsMeshInstanceCreate(wave));
+    for (int i = 0; i < 64; ++i) {
+        auto inst = rthsMeshInstanceCreate(sphere);
+        auto trans = float4x4::identity();
+        trans[3] = { (float)(i % 8) * 1.4f - 4.9f, 0.8f, (float)(i / 8) * 1.4f - 4.9f, 1.0f };
+        rthsMeshInstanceSetTransform(inst, trans);
+        instances.push_back(inst);
+    }
+
+    auto proj = MakeTestProjection();
+
+    auto render = [&](std::vector<std::vector<float>>& results) {
+        for (int ri = 0; ri < num_renderers; ++ri) {
+            auto renderer = renderers[ri];
+            float a = (float)ri / num_renderers * 2.0f * 3.14159265f;
+            float3 cam_pos{ std::cos(a) * 9.0f, 7.0f, std::sin(a) * 9.0f };
+            rthsRendererBeginScene(renderer);
+            rthsRendererSetRenderTarget(renderer, render_targets[ri]);
+            rthsRendererSetRenderFlags(renderer, (uint32_t)RenderFlag::CullBackFaces);
+            rthsRendererSetShadowRayOffset(renderer, 0.0001f);
+            rthsRendererSetSelfShadowThreshold(renderer, 0.0001f);
+            rthsRendererSetCamera(renderer, cam_pos, lookat_rh(cam_pos, { 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }), proj);
+            rthsRendererAddPointLight(renderer, { 3.0f, 3.0f, 0.0f }, 20.0f);
+            rthsRendererAddPointLight(renderer, { -3.0f, 3.0f, 0.0f }, 20.0f);
+            rthsRendererAddDirectionalLight(renderer, normalize(float3{ -1.0f, -1.0f, 1.0f }));
+            for (auto inst : instances)
+                rthsRendererAddMesh(renderer, inst);
+            rthsRendererEndScene(renderer);
+        }
+
+        auto begin = Now();
+        rthsRenderAll();
+        auto elapsed = NS2MS(Now() - begin);
+
+        results.resize(num_renderers);
+        for (int ri = 0; ri < num_renderers; ++ri) {
+            results[ri].resize(rt_width * rt_height);
+            rthsRendererReadbackRenderTarget(renderers[ri], results[ri].data());
+        }
+        return elapsed;
+    };
+
+    int default_threads = rthsGlobalsGetThreadCount();
+    std::vector<int> thread_counts{ 1, 2, 0 };
+    int threads = 0;
+    if (GetArg("threads", threads))
+        thread_counts.push_back(threads);
+
+    std::vector<std::vector<float>> reference;
+    for (int tc : thread_counts) {
+        rthsGlobalsSetThreadCount(tc);
+        int actual = rthsGlobalsGetThreadCount();
+        if (tc > 0)
+            Expect(actual == tc);
+
+        // the first frame builds acceleration structures
+        std::vector<std::vector<float>> results;
+        render(results);
+
+        rthsGlobalsResetWorkerStats();
+        float best = 0.0f;
+        for (int i = 0; i < 3; ++i) {
+            float t = render(results);
+            if (best == 0.0f || t < best)
+                best = t;
+        }
+        Print("    %d threads: RenderAll() %.2fms\n", actual, best);
+
+        std::vector<WorkerStats> stats(rthsGlobalsGetWorkerStats(nullptr, 0));
+        Expect((int)stats.size() == actual);
+        rthsGlobalsGetWorkerStats(stats.data(), (int)stats.size());
+        uint32_t total_tasks = 0;
+        for (size_t wi = 0; wi < stats.size(); ++wi) {
+            auto& s = stats[wi];
+            Print("        %s %d: %u tasks, %u stolen, busy %.2fms\n",
+                wi == 0 ? "caller" : "worker", (int)wi, s.task_count, s.steal_count, NS2MS(s.busy_time) / 3.0f);
+            total_tasks += s.task_count;
+        }
+        Expect(total_tasks > 0);
+
+        // the result must not depend on the number of threads
+        if (reference.empty())
+            reference = results;
+        else
+            Expect(results == reference);
+    }
+    rthsGlobalsSetThreadCount(default_threads);
+
+    for (auto inst : instances)
+        rthsMeshInstanceRelease(inst);
+    rthsMeshRelease(wave);
+    rthsMeshRelease(sphere);
+    for (int ri = 0; ri < num_renderers; ++ri) {
+        rthsRenderTargetRelease(render_targets[ri]);
+        rthsRendererRelease(renderers[ri]);
+    }
+}
+
+TestCase(TestTemporalReprojection)
+{
+    // the history belongs to the renderer. rendering without the flag discards it. so the reference has its own renderer.
+    auto renderer = CreateTestRenderer();
+    auto renderer_ref = CreateTestRenderer();
+    if (!renderer || !renderer_ref)
+        return;
+
+    int resolution = 256;
+    GetArg("resolution", resolution);
+
+    const int rt_width = 512;
+    const int rt_height = 512;
+    auto render_target = rthsRenderTargetCreate();
+    rthsRenderTargetSetup(render_target, rt_width, rt_height, RenderTargetFormat::Rf32);
+
+    std::vector<int> wave_counts, wave_indices;
+    std::vector<float3> wave_points;
+    GenerateWaveMesh(wave_counts, wave_indices, wave_points, 12.0f, 0.2f, resolution, 0.0f, true);
+    std::vector<int> sphere_counts, sphere_indices;
+    std::vector<float3> sphere_points;
+    GenerateIcoSphereMesh(sphere_counts, sphere_indices, sphere_points, 0.3f, 3);
+
+    auto wave = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(wave, wave_points.data(), wave_indices.data(), sizeof(float3), (int)wave_points.size(), 0, sizeof(int), (int)wave_indices.size(), 0);
+    auto sphere = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(sphere, sphere_points.data(), sphere_indices.data(), sizeof(float3), (int)sphere_points.size(), 0, sizeof(int), (int)sphere_indices.size(), 0);
+
+    std::vector<rths::MeshInstanceData*> instances;
+    instances.push_back(rthsMeshInstanceCreate(wave));
+    for (int i = 0; i < 64; ++i) {
+        auto inst = rthsMeshInstanceCreate(sphere);
+        auto trans = float4x4::identity();
+        trans[3] = { (float)(i % 8) * 1.4f - 4.9f, 0.8f, (float)(i / 8) * 1.4f - 4.9f, 1.0f };
+        rthsMeshInstanceSetTransform(inst, trans);
+        instances.push_back(inst);
+    }
+
+    auto proj = MakeTestProjection();
+
+    // the camera slowly orbits around the scene. about a pixel per frame.
+    std::string log;
+    float3 light_pos{ 2.0f, 4.0f, 1.0f };
+    auto render = [&](rths::IRenderer *renderer, int frame, uint32_t render_flags, std::vector<float>& rt_buf) {
+        float a = (float)frame * 0.002f;
+        float3 cam_pos{ std::sin(a) * 9.0f, 7.0f, -std::cos(a) * 9.0f };
+
+        rt_buf.resize(rt_width * rt_height);
+        RenderFrame(renderer, [&]() {
+            rthsRendererSetRenderTarget(renderer, render_target);
+            rthsRendererSetRenderFlags(renderer, render_flags);
+            rthsRendererSetCamera(renderer, cam_pos, lookat_rh(cam_pos, { 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }), proj);
+            rthsRendererAddPointLight(renderer, light_pos, 20.0f);
+            rthsRendererAddPointLight(renderer, { -3.0f, 3.0f, -2.0f }, 20.0f);
+            rthsRendererAddDirectionalLight(renderer, normalize(float3{ -1.0f, -1.0f, 1.0f }));
+            for (auto inst : instances)
+                rthsRendererAddMesh(renderer, inst);
+        }, rt_buf.data());
+
+        log = rthsRendererGetTimestampLog(renderer);
+        auto pos = log.find("DispatchRays: ");
+        return pos != std::string::npos ? std::atof(log.c_str() + pos + 14) : 0.0;
+    };
+    auto retraced_ratio = [&]() {
+        unsigned retraced = 0, pixels = 0;
+        auto pos = log.find("Temporal reprojection: ");
+        if (pos == std::string::npos || std::sscanf(log.c_str() + pos, "Temporal reprojection: shadow rays of %u / %u", &retraced, &pixels) != 2 || pixels == 0)
+            return -1.0;
+        return (double)retraced / (double)pixels;
+    };
+    auto mismatch_ratio = [&](const std::vector<float>& a, const std::vector<float>& b) {
+        int mismatch = 0;
+        for (size_t i = 0; i < a.size(); ++i) {
+            if (a[i] != b[i])
+                ++mismatch;
+        }
+        return (double)mismatch / (double)a.size();
+    };
+
+    auto debug_flags = rthsGlobalsGetDebugFlags();
+    rthsGlobalsSetDebugFlags(debug_flags | (uint32_t)DebugFlag::Timestamp);
+
+    const uint32_t flags = (uint32_t)RenderFlag::CullBackFaces;
+    const uint32_t flags_temporal = flags | (uint32_t)RenderFlag::TemporalReprojection;
+    std::vector<float> reference, result;
+    double time_reference = 0.0, time_temporal = 0.0, max_mismatch = 0.0, sum_ratio = 0.0;
+    const int num_frames = 16;
+    for (int frame = 0; frame < num_frames; ++frame) {
+        time_reference += render(renderer_ref, frame, flags, reference);
+        time_temporal += render(renderer, frame, flags_temporal, result);
+        double ratio = retraced_ratio();
+        double mismatch = mismatch_ratio(reference, result);
+        if (frame == 0) {
+            // no history. every pixel is traced.
+            Expect(ratio == 1.0);
+            Expect(mismatch == 0.0);
+        }
+        else {
+            // reused values were traced at other points in the same pixel. shadow edges can differ.
+            sum_ratio += ratio;
+            max_mismatch = std::max(max_mismatch, mismatch);
+            Expect(ratio > 0.0 && ratio < 0.5);
+            Expect(mismatch < 0.03);
+        }
+    }
+    // camera rays are traced for all pixels. the ratio is of pixels whose shadow rays are traced again.
+    Print("    %d frames: full trace %.2fms, temporal reprojection %.2fms. %.2f%% shadow rays retraced, %.3f%% pixels differ at most\n",
+        num_frames, time_reference / num_frames, time_temporal / num_frames,
+        sum_ratio / (num_frames - 1) * 100.0, max_mismatch * 100.0);
+
+    // shadows of moved casters on static receivers are updated by the rotating refresh.
+    // with a still camera, every pixel is traced again within 8 frames and the result matches the reference.
+    {
+        auto trans = float4x4::identity();
+        trans[3] = { 0.0f, 1.5f, 0.0f, 1.0f };
+        rthsMeshInstanceSetTransform(instances[28], trans);
+        render(renderer_ref, num_frames, flags, reference);
+        double max_ratio = 0.0;
+        for (int i = 0; i < 8; ++i) {
+            render(renderer, num_frames, flags_temporal, result);
+            if (i > 0)
+                max_ratio = std::max(max_ratio, retraced_ratio());
+        }
+        Expect(max_ratio < 0.2);
+        Expect(mismatch_ratio(reference, result) == 0.0);
+    }
+
+    // changes of lights invalidate the history
+    {
+        int frame = num_frames;
+        light_pos = { 1.0f, 4.0f, 2.0f };
+        render(renderer_ref, frame, flags, reference);
+        render(renderer, frame, flags_temporal, result);
+        Expect(retraced_ratio() == 1.0);
+        Expect(mismatch_ratio(reference, result) == 0.0);
+    }
+    rthsGlobalsSetDebugFlags(debug_flags);
+
+    for (auto inst : instances)
+        rthsMeshInstanceRelease(inst);
+    rthsMeshRelease(wave);
+    rthsMeshRelease(sphere);
+    rthsRenderTargetRelease(render_target);
+    rthsRendererRelease(renderer_ref);
+    rthsRendererRelease(renderer);
+}
+
+TestCase(TestDirtyRegions)
+{
+    // the reference is rendered by another renderer without the flag
+    auto renderer = CreateTestRenderer();
+    auto renderer_ref = CreateTestRenderer();
+    if (!renderer || !renderer_ref)
+        return;
+
+    int resolution = 256;
+    GetArg("resolution", resolution);
+
+    const int rt_width = 512;
+    const int rt_height = 512;
+    auto render_target = rthsRenderTargetCreate();
+    rthsRenderTargetSetup(render_target, rt_width, rt_height, RenderTargetFormat::Rf32);
+    auto render_target_ref = rthsRenderTargetCreate();
+    rthsRenderTargetSetup(render_target_ref, rt_width, rt_height, RenderTargetFormat::Rf32);
+
+    std::vector<int> wave_counts, wave_indices;
+    std::vector<float3> wave_points;
+    GenerateWaveMesh(wave_counts, wave_indices, wave_points, 12.0f, 0.2f, resolution, 0.0f, true);
+    std::vector<int> sphere_counts, sphere_indices;
+    std::vector<float3> sphere_points;
+    GenerateIcoSphereMesh(sphere_counts, sphere_indices, sphere_points, 0.3f, 3);
+
+    auto wave = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(wave, wave_points.data(), wave_indices.data(), sizeof(float3), (int)wave_points.size(), 0, sizeof(int), (int)wave_indices.size(), 0);
+    auto sphere = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(sphere, sphere_points.data(), sphere_indices.data(), sizeof(float3), (int)sphere_points.size(), 0, sizeof(int), (int)sphere_indices.size(), 0);
+
+    auto sphere_transform = [](float x, float y, float z) {
+        auto trans = float4x4::identity();
+        trans[3] = { x, y, z, 1.0f };
+        return trans;
+    };
+    std::vector<rths::MeshInstanceData*> instances;
+    instances.push_back(rthsMeshInstanceCreate(wave));
+    for (int i = 0; i < 64; ++i) {
+        auto inst = rthsMeshInstanceCreate(sphere);
+        rthsMeshInstanceSetTransform(inst, sphere_transform((float)(i % 8) * 1.4f - 4.9f, 0.8f, (float)(i / 8) * 1.4f - 4.9f));
+        instances.push_back(inst);
+    }
+
+    auto proj = MakeTestProjection();
+    float3 cam_pos{ 0.0f, 7.0f, -9.0f };
+
+    std::string log;
+    float3 light_pos{ 2.0f, 4.0f, 1.0f };
+    auto render = [&](rths::IRenderer *renderer, rths::RenderTargetData *rt, uint32_t render_flags, std::vector<float>& rt_buf) {
+        rt_buf.resize(rt_width * rt_height);
+        RenderFrame(renderer, [&]() {
+            rthsRendererSetRenderTarget(renderer, rt);
+            rthsRendererSetRenderFlags(renderer, render_flags);
+            rthsRendererSetCamera(renderer, cam_pos, lookat_rh(cam_pos, { 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }), proj);
+            rthsRendererAddPointLight(renderer, light_pos, 20.0f);
+            rthsRendererAddSpotLight(renderer, { -3.0f, 4.0f, -2.0f }, normalize(float3{ 0.3f, -1.0f, 0.2f }), 20.0f, 90.0f);
+            rthsRendererAddReversePointLight(renderer, { 3.0f, 1.0f, -3.0f }, 8.0f);
+            rthsRendererAddDirectionalLight(renderer, normalize(float3{ -1.0f, -1.0f, 1.0f }));
+            for (auto inst : instances)
+                rthsRendererAddMesh(renderer, inst);
+        }, rt_buf.data());
+
+        log = rthsRendererGetTimestampLog(renderer);
+        auto pos = log.find("DispatchRays: ");
+        return pos != std::string::npos ? std::atof(log.c_str() + pos + 14) : 0.0;
+    };
+    auto traced_ratio = [&]() {
+        unsigned traced = 0, tiles = 0;
+        auto pos = log.find("Dirty regions: ");
+        if (pos == std::string::npos || std::sscanf(log.c_str() + pos, "Dirty regions: %u / %u", &traced, &tiles) != 2 || tiles == 0)
+            return -1.0;
+        return (double)traced / (double)tiles;
+    };
+
+    auto debug_flags = rthsGlobalsGetDebugFlags();
+    rthsGlobalsSetDebugFlags(debug_flags | (uint32_t)DebugFlag::Timestamp);
+
+    const uint32_t flags = (uint32_t)RenderFlag::CullBackFaces;
+    const uint32_t flags_dirty = flags | (uint32_t)RenderFlag::DirtyRegions;
+    std::vector<float> reference, result;
+    double time_reference = 0.0, time_dirty = 0.0, sum_ratio = 0.0;
+
+    // first frame traces everything
+    render(renderer_ref, render_target_ref, flags, reference);
+    render(renderer, render_target, flags_dirty, result);
+    Expect(traced_ratio() == 1.0);
+    Expect(reference == result);
+
+    // nothing changes. nothing is traced.
+    render(renderer_ref, render_target_ref, flags, reference);
+    render(renderer, render_target, flags_dirty, result);
+    Expect(traced_ratio() == 0.0);
+    Expect(reference == result);
+
+    // one sphere moves around. the result must be exactly the same as the full trace.
+    const int num_frames = 16;
+    for (int frame = 0; frame < num_frames; ++frame) {
+        float a = (float)frame * 0.3f;
+        rthsMeshInstanceSetTransform(instances[20], sphere_transform(std::cos(a) * 1.5f - 1.0f, 0.8f + std::sin(a) * 0.3f, std::sin(a) * 1.5f));
+        time_reference += render(renderer_ref, render_target_ref, flags, reference);
+        time_dirty += render(renderer, render_target, flags_dirty, result);
+        double ratio = traced_ratio();
+        sum_ratio += ratio;
+        Expect(ratio > 0.0 && ratio < 0.5);
+        Expect(reference == result);
+    }
+    Print("    %d frames: full trace %.2fms, dirty regions %.2fms. %.2f%% tiles traced\n",
+        num_frames, time_reference / num_frames, time_dirty / num_frames, sum_ratio / num_frames * 100.0);
+
+    // instances are removed and added. flags of an instance are changed.
+    {
+        auto removed = instances[30];
+        instances.erase(instances.begin() + 30);
+        render(renderer_ref, render_target_ref, flags, reference);
+        render(renderer, render_target, flags_dirty, result);
+        Expect(traced_ratio() < 1.0);
+        Expect(reference == result);
+
+        instances.push_back(removed);
+        render(renderer_ref, render_target_ref, flags, reference);
+        render(renderer, render_target, flags_dirty, result);
+        Expect(traced_ratio() < 1.0);
+        Expect(reference == result);
+
+        rthsMeshInstanceSetFlags(instances[10], (uint32_t)InstanceFlag::ReceiveShadows | (uint32_t)InstanceFlag::CullBack);
+        render(renderer_ref, render_target_ref, flags, reference);
+        render(renderer, render_target, flags_dirty, result);
+        Expect(traced_ratio() < 1.0);
+        Expect(reference == result);
+    }
+
+    // changes of lights need the full trace
+    {
+        light_pos = { 1.0f, 4.0f, 2.0f };
+        render(renderer_ref, render_target_ref, flags, reference);
+        render(renderer, render_target, flags_dirty, result);
+        Expect(traced_ratio() == 1.0);
+        Expect(reference == result);
+    }
+
+    // with TemporalReprojection, reprojected values of a moving camera are traced again once the camera stops
+    {
+        const uint32_t flags_both = flags_dirty | (uint32_t)RenderFlag::TemporalReprojection;
+        for (int frame = 0; frame < 3; ++frame) {
+            cam_pos = { 0.02f * (float)frame, 7.0f, -9.0f };
+            render(renderer, render_target, flags_both, result);
+        }
+        render(renderer_ref, render_target_ref, flags, reference);
+        render(renderer, render_target, flags_both, result);
+        Expect(traced_ratio() > 0.0);
+        Expect(reference == result);
+        render(renderer, render_target, flags_both, result);
+        Expect(traced_ratio() == 0.0);
+        Expect(reference == result);
+    }
+
+    // another renderer writes the render target. the previous result is lost.
+    {
+        render(renderer_ref, render_target, flags, reference);
+        render(renderer, render_target, flags_dirty, result);
+        Expect(traced_ratio() == 1.0);
+        Expect(reference == result);
+    }
+    rthsGlobalsSetDebugFlags(debug_flags);
+
+    for (auto inst : instances)
+        rthsMeshInstanceRelease(inst);
+    rthsMeshRelease(wave);
+    rthsMeshRelease(sphere);
+    rthsRenderTargetRelease(render_target_ref);
+    rthsRenderTargetRelease(render_target);
+    rthsRendererRelease(renderer_ref);
+    rthsRendererRelease(renderer);
+}
+
+TestCase(TestGBuffer)
+{
+    // the reference traces camera rays. the G-buffer is made by intersecting camera rays with the scene analytically.
+    auto renderer = CreateTestRenderer();
+    auto renderer_ref = CreateTestRenderer();
+    if (!renderer || !renderer_ref)
+        return;
+
+    const int rt_width = 512;
+    const int rt_height = 512;
+    auto render_target = rthsRenderTargetCreate();
+    rthsRenderTargetSetup(render_target, rt_width, rt_height, RenderTargetFormat::Rf32);
+    auto render_target_ref = rthsRenderTargetCreate();
+    rthsRenderTargetSetup(render_target_ref, rt_width, rt_height, RenderTargetFormat::Rf32);
+
+    // flat ground of 12 x 12 and unit cubes floating above it
+    const float ground_size = 12.0f;
+    std::vector<int> ground_counts, ground_indices;
+    std::vector<float3> ground_points;
+    GenerateWaveMesh(ground_counts, ground_indices, ground_points, ground_size, 0.0f, 64, 0.0f, true);
+    std::vector<float3> cube_points;
+    for (int i = 0; i < 8; ++i)
+        cube_points.push_back({ (i & 1) ? 0.5f : -0.5f, (i & 2) ? 0.5f : -0.5f, (i & 4) ? 0.5f : -0.5f });
+    std::vector<int> cube_indices{
+        0,2,1, 1,2,3,  4,5,6, 5,7,6,  0,1,4, 1,5,4,
+        2,6,3, 3,6,7,  0,4,2, 2,4,6,  1,3,5, 3,7,5,
+    };
+
+    auto ground = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(ground, ground_points.data(), ground_indices.data(), sizeof(float3), (int)ground_points.size(), 0, sizeof(int), (int)ground_indices.size(), 0);
+    auto cube = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(cube, cube_points.data(), cube_indices.data(), sizeof(float3), (int)cube_points.size(), 0, sizeof(int), (int)cube_indices.size(), 0);
+    auto empty = rthsMeshCreate(); // has no buffers. skipped by the renderer, but still has an instance ID
+
+    std::vector<rths::MeshInstanceData*> instances;
+    std::vector<float3> cube_positions;
+    instances.push_back(rthsMeshInstanceCreate(ground));
+    instances.push_back(rthsMeshInstanceCreate(empty));
+    for (int i = 0; i < 9; ++i) {
+        float3 pos{ (float)(i % 3) * 2.5f - 2.5f, 0.9f + (float)(i % 2) * 0.4f, (float)(i / 3) * 2.5f - 2.5f };
+        auto trans = float4x4::identity();
+        trans[3] = { pos.x, pos.y, pos.z, 1.0f };
+        auto inst = rthsMeshInstanceCreate(cube);
+        rthsMeshInstanceSetTransform(inst, trans);
+        instances.push_back(inst);
+        cube_positions.push_back(pos);
+    }
+
+    auto proj = MakeTestProjection();
+    float3 cam_pos{ 1.0f, 7.0f, -9.0f };
+    float4x4 view = lookat_rh(cam_pos, { 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f });
+
+    // depth and instance IDs of the closest hit of each camera ray. same ray directions as the renderer.
+    std::vector<float> gbuffer_depth(rt_width * rt_height, 0.0f);
+    std::vector<uint32_t> gbuffer_ids(rt_width * rt_height, ~0u);
+    int gbuffer_pixels = 0;
+    {
+        float3 right{ view[0][0], view[1][0], view[2][0] };
+        float3 up{ view[0][1], view[1][1], view[2][1] };
+        float3 forward = -float3{ view[0][2], view[1][2], view[2][2] };
+        float focal = proj[1][1];
+        float aspect = (float)rt_width / (float)rt_height;
+        for (int y = 0; y < rt_height; ++y) {
+            for (int x = 0; x < rt_width; ++x) {
+                float sx = ((((float)x + 0.5f) / (float)rt_width) * 2.0f - 1.0f) * aspect;
+                float sy = (((float)y + 0.5f) / (float)rt_height) * 2.0f - 1.0f;
+                float3 dir = normalize(right * sx + up * sy + forward * focal);
+
+                float t = std::numeric_limits<float>::max();
+                uint32_t id = ~0u;
+                float tg = -cam_pos.y / dir.y;
+                float3 pg = cam_pos + dir * tg;
+                if (tg > 0.0f && std::abs(pg.x) <= ground_size * 0.5f && std::abs(pg.z) <= ground_size * 0.5f) {
+                    t = tg;
+                    id = 0;
+                }
+                for (size_t ci = 0; ci < cube_positions.size(); ++ci) {
+                    float tmin = 0.0f, tmax = std::numeric_limits<float>::max();
+                    for (int a = 0; a < 3; ++a) {
+                        float t0 = (cube_positions[ci][a] - 0.5f - cam_pos[a]) / dir[a];
+                        float t1 = (cube_positions[ci][a] + 0.5f - cam_pos[a]) / dir[a];
+                        tmin = std::max(tmin, std::min(t0, t1));
+                        tmax = std::min(tmax, std::max(t0, t1));
+                    }
+                    if (tmin <= tmax && tmin < t) {
+                        t = tmin;
+                        id = (uint32_t)ci + 2;
+                    }
+                }
+                if (id != ~0u) {
+                    int pi = rt_width * y + x;
+                    gbuffer_depth[pi] = t * dot(dir, forward);
+                    gbuffer_ids[pi] = id;
+                    ++gbuffer_pixels;
+                }
+            }
+        }
+    }
+
+    std::string log;
+    auto render = [&](rths::IRenderer *renderer, rths::RenderTargetData *rt, uint32_t render_flags,
+        const float *depth, const uint32_t *ids, std::vector<float>& rt_buf)
+    {
+        rt_buf.resize(rt_width * rt_height);
+        RenderFrame(renderer, [&]() {
+            rthsRendererSetRenderTarget(renderer, rt);
+            rthsRendererSetGBuffer(renderer, depth, ids);
+            rthsRendererSetRenderFlags(renderer, render_flags);
+            rthsRendererSetCamera(renderer, cam_pos, view, proj);
+            rthsRendererAddPointLight(renderer, { 2.0f, 5.0f, 1.0f }, 20.0f);
+            rthsRendererAddDirectionalLight(renderer, normalize(float3{ -1.0f, -1.0f, 1.0f }));
+            for (auto inst : instances)
+                rthsRendererAddMesh(renderer, inst);
+        }, rt_buf.data());
+
+        log = rthsRendererGetTimestampLog(renderer);
+        auto pos = log.find("DispatchRays: ");
+        return pos != std::string::npos ? std::atof(log.c_str() + pos + 14) : 0.0;
+    };
+    // reconstructed positions are not bit exact. a few pixels on shadow edges can differ.
+    auto mismatch_ratio = [](const std::vector<float>& a, const std::vector<float>& b) {
+        size_t mismatch = 0;
+        for (size_t i = 0; i < a.size(); ++i) {
+            if (a[i] != b[i])
+                ++mismatch;
+        }
+        return (double)mismatch / (double)a.size();
+    };
+
+    auto debug_flags = rthsGlobalsGetDebugFlags();
+    rthsGlobalsSetDebugFlags(debug_flags | (uint32_t)DebugFlag::Timestamp);
+
+    std::vector<float> reference, result;
+    {
+        const int num_frames = 8;
+        double time_reference = 0.0, time_gbuffer = 0.0, sum_mismatch = 0.0;
+        for (int frame = 0; frame < num_frames; ++frame) {
+            time_reference += render(renderer_ref, render_target_ref, 0, nullptr, nullptr, reference);
+            time_gbuffer += render(renderer, render_target, 0, gbuffer_depth.data(), gbuffer_ids.data(), result);
+            double mismatch = mismatch_ratio(reference, result);
+            sum_mismatch += mismatch;
+            Expect(mismatch < 0.005);
+
+            unsigned pixels = 0, total = 0;
+            auto pos = log.find("G-buffer: ");
+            Expect(pos != std::string::npos && std::sscanf(log.c_str() + pos, "G-buffer: %u / %u", &pixels, &total) == 2);
+            Expect(pixels == (unsigned)gbuffer_pixels && total == (unsigned)(rt_width * rt_height));
+        }
+        Print("    %d frames: camera rays %.2fms, G-buffer %.2fms. %.3f%% pixels mismatch\n",
+            num_frames, time_reference / num_frames, time_gbuffer / num_frames, sum_mismatch / num_frames * 100.0);
+    }
+
+    // IgnoreSelfShadow needs receivers. without instance IDs, faces of cubes are shadowed by themselves.
+    {
+        const uint32_t flags = (uint32_t)RenderFlag::IgnoreSelfShadow;
+        std::vector<float> reference_self_shadow;
+        render(renderer_ref, render_target_ref, 0, nullptr, nullptr, reference_self_shadow);
+        render(renderer_ref, render_target_ref, flags, nullptr, nullptr, reference);
+        Expect(mismatch_ratio(reference, reference_self_shadow) > 0.01);
+
+        render(renderer, render_target, flags, gbuffer_depth.data(), gbuffer_ids.data(), result);
+        Expect(mismatch_ratio(reference, result) < 0.005);
+        render(renderer, render_target, flags, gbuffer_depth.data(), nullptr, result);
+        Expect(mismatch_ratio(reference_self_shadow, result) < 0.005);
+    }
+
+    // the G-buffer is reset by rthsRendererBeginScene(). camera rays are traced again.
+    {
+        render(renderer_ref, render_target_ref, 0, nullptr, nullptr, reference);
+        render(renderer, render_target, 0, nullptr, nullptr, result);
+        Expect(log.find("G-buffer: ") == std::string::npos);
+        Expect(reference == result);
+    }
+    rthsGlobalsSetDebugFlags(debug_flags);
+
+    for (auto inst : instances)
+        rthsMeshInstanceRelease(inst);
+    rthsMeshRelease(ground);
+    rthsMeshRelease(cube);
+    rthsMeshRelease(empty);
+    rthsRenderTargetRelease(render_target_ref);
+    rthsRenderTargetRelease(render_target);
+    rthsRendererRelease(renderer_ref);
+    rthsRendererRelease(renderer);
+}
+
+TestCase(TestConversion)
+{
+    using rths::half;
+    using rths::unorm8;
+
+    // reference conversions with double precision arithmetic. nearbyint() rounds to nearest even by default.
+    auto ref_half_to_float = [](uint16_t h) {
+        int exponent = (h >> 10) & 0x1f;
+        int mantissa = h & 0x3ff;
+        double r;
+        if (exponent == 0)
+            r = std::ldexp((double)mantissa, -24);
+        else if (exponent == 31)
+            r = mantissa == 0 ? (double)INFINITY : (double)NAN;
+        else
+            r = std::ldexp((double)(mantissa + 1024), exponent - 25);
+        return (float)((h & 0x8000) ? -r : r);
+    };
+    auto ref_float_to_half = [](float f) -> uint16_t {
+        if (std::isnan(f))
+            return 0x7e00;
+        uint16_t sign = std::signbit(f) ? 0x8000 : 0;
+        double a = std::abs((double)f);
+        uint32_t r;
+        if (a >= 65520.0) {
+            r = 0x7c00; // >= the midpoint of 65504 and 65536 rounds to Inf
+        }
+        else if (a < std::ldexp(1.0, -14)) {
+            r = (uint32_t)std::nearbyint(std::ldexp(a, 24)); // denormal. 1024 becomes the smallest normal
+        }
+        else {
+            int e;
+            std::frexp(a, &e);
+            e -= 1;
+            auto m = (uint32_t)std::nearbyint(std::ldexp(a, 10 - e));
+            if (m == 2048) {
+                m = 1024;
+                ++e;
+            }
+            r = ((uint32_t)(e + 15) << 10) | (m - 1024);
+        }
+        return (uint16_t)(sign | r);
+    };
+    auto is_half_nan = [](uint16_t h) { return (h & 0x7c00) == 0x7c00 && (h & 0x3ff) != 0; };
+    auto same_float = [](float a, float b) {
+        return (std::isnan(a) && std::isnan(b)) || std::memcmp(&a, &b, sizeof(float)) == 0;
+    };
+    auto same_half = [&](uint16_t a, uint16_t b) {
+        return (is_half_nan(a) && is_half_nan(b)) || a == b;
+    };
+
+    auto debug_flags = rthsGlobalsGetDebugFlags();
+    auto set_f16c = [debug_flags](bool v) {
+        rthsGlobalsSetDebugFlags(v ? debug_flags & ~(uint32_t)DebugFlag::NoF16C : debug_flags | (uint32_t)DebugFlag::NoF16C);
+    };
+
+    // all half values. odd count to go through the scalar tail too
+    std::vector<uint16_t> halfs(65535);
+    for (size_t i = 0; i < halfs.size(); ++i)
+        halfs[i] = (uint16_t)i;
+
+    // floats: a sparse sweep of all bit patterns, values around midpoints of adjacent halfs (ties), and special values
+    std::vector<float> floats;
+    for (uint64_t bits = 0; bits <= 0xffffffffull; bits += 4099) {
+        floats.push_back(rths::asfloat((uint32_t)bits));
+    }
+    for (uint32_t h = 0; h < 0x7c00; ++h) {
+        float mid = (float)(((double)ref_half_to_float((uint16_t)h) + (double)ref_half_to_float((uint16_t)(h + 1))) * 0.5);
+        uint32_t b = rths::asuint(mid);
+        for (uint32_t d : { b - 1, b, b + 1 }) {
+            floats.push_back(rths::asfloat(d));
+            floats.push_back(-rths::asfloat(d));
+        }
+    }
+    for (float f : { 0.0f, -0.0f, 1.0f, -1.0f, 65504.0f, 65519.0f, 65520.0f, 65536.0f, 1e-8f, 5.96e-8f, 2.98e-8f, 3.0e-8f, INFINITY, -INFINITY, NAN, std::numeric_limits<float>::min(), std::numeric_limits<float>::max() })
+        floats.push_back(f);
+
+    int num_paths = 2;
+    for (int path = 0; path < num_paths; ++path) {
+        set_f16c(path == 0);
+
+        std::vector<float> f(halfs.size());
+        rthsConvertHalfToFloat(f.data(), halfs.data(), (int)halfs.size());
+        size_t errors = 0;
+        for (size_t i = 0; i < halfs.size(); ++i) {
+            if (!same_float(f[i], ref_half_to_float(halfs[i])))
+                ++errors;
+        }
+        Expect(errors == 0);
+
+        std::vector<uint16_t> h(floats.size());
+        rthsConvertFloatToHalf(h.data(), floats.data(), (int)floats.size());
+        errors = 0;
+        for (size_t i = 0; i < floats.size(); ++i) {
+            if (!same_half(h[i], ref_float_to_half(floats[i])))
+                ++errors;
+        }
+        Expect(errors == 0);
+    }
+    set_f16c(true);
+
+    // scalar types of rthsHalf.h give the same results
+    {
+        size_t errors = 0;
+        for (auto v : halfs) {
+            half hv;
+            hv.value = v;
+            if (!same_float((float)hv, ref_half_to_float(v)))
+                ++errors;
+        }
+        for (auto v : floats) {
+            if (!same_half(half(v).value, ref_float_to_half(v)))
+                ++errors;
+        }
+        Expect(errors == 0);
+    }
+
+    // unorm8: rounds to nearest, clamps, and NaN becomes 0
+    {
+        std::vector<float> src;
+        for (int i = 0; i <= 255 * 16; ++i)
+            src.push_back((float)i / (255.0f * 16.0f));
+        for (float f : { -1.0f, -0.0f, 2.0f, 1.0001f, INFINITY, -INFINITY, NAN, 0.5f / 255.0f, 254.5f / 255.0f })
+            src.push_back(f);
+        std::vector<uint8_t> dst(src.size());
+        rthsConvertFloatToUnorm8(dst.data(), src.data(), (int)src.size());
+        size_t errors = 0;
+        for (size_t i = 0; i < src.size(); ++i) {
+            // the error of the float multiplication can move values just next to .5 to either side
+            double v = std::isnan(src[i]) ? 0.0 : std::min(std::max((double)src[i], 0.0), 1.0);
+            if (std::abs((double)dst[i] - v * 255.0) > 0.5 + 1e-4 || unorm8(src[i]).value != dst[i])
+                ++errors;
+        }
+        Expect(errors == 0);
+
+        std::vector<uint8_t> all(256);
+        for (int i = 0; i < 256; ++i)
+            all[i] = (uint8_t)i;
+        std::vector<float> f(256);
+        std::vector<uint8_t> back(256);
+        rthsConvertUnorm8ToFloat(f.data(), all.data(), 256);
+        rthsConvertFloatToUnorm8(back.data(), f.data(), 256);
+        Expect(back == all);
+        Expect(f[0] == 0.0f && f[255] == 1.0f);
+    }
+
+    // bitmask -> planes
+    {
+        const int n = 1000;
+        const int num_planes = 32;
+        std::mt19937 rand(12345);
+        std::vector<uint32_t> src(n);
+        for (auto& v : src)
+            v = rand();
+        std::vector<uint8_t> dst(n * num_planes);
+        rthsConvertBitMaskToPlanes(dst.data(), src.data(), n, num_planes);
+        size_t errors = 0;
+        for (int pi = 0; pi < num_planes; ++pi) {
+            for (int i = 0; i < n; ++i) {
+                if (dst[n * pi + i] != ((src[i] >> pi) & 1 ? 0xff : 0))
+                    ++errors;
+            }
+        }
+        Expect(errors == 0);
+    }
+
+    // microbenchmarks. scalar loops of rthsHalf.h vs batch conversions
+    {
+        int num = 1024 * 1024 * 4;
+        GetArg("num", num);
+        const int num_try = 10;
+        std::mt19937 rand(0);
+        std::uniform_real_distribution<float> dist(-2.0f, 2.0f);
+        std::vector<float> src(num), dst_f(num);
+        for (auto& v : src)
+            v = dist(rand);
+        std::vector<uint16_t> dst_h(num);
+        std::vector<uint8_t> dst_u8(num);
+        std::vector<uint32_t> bits(num);
+        for (auto& v : bits)
+            v = rand();
+        std::vector<uint8_t> planes((size_t)num * 8);
+
+        Print("    %d elements\n", num);
+        TestScope("float -> half (scalar)", [&]() {
+            for (int i = 0; i < num; ++i)
+                dst_h[i] = half(src[i]).value;
+        }, num_try);
+        set_f16c(false);
+        TestScope("float -> half (SSE2)", [&]() { rthsConvertFloatToHalf(dst_h.data(), src.data(), num); }, num_try);
+        set_f16c(true);
+        TestScope("float -> half (F16C if available)", [&]() { rthsConvertFloatToHalf(dst_h.data(), src.data(), num); }, num_try);
+
+        TestScope("half -> float (scalar)", [&]() {
+            for (int i = 0; i < num; ++i) {
+                half h;
+                h.value = dst_h[i];
+                dst_f[i] = h;
+            }
+        }, num_try);
+        set_f16c(false);
+        TestScope("half -> float (SSE2)", [&]() { rthsConvertHalfToFloat(dst_f.data(), dst_h.data(), num); }, num_try);
+        set_f16c(true);
+        TestScope("half -> float (F16C if available)", [&]() { rthsConvertHalfToFloat(dst_f.data(), dst_h.data(), num); }, num_try);
+
+        TestScope("float -> unorm8 (scalar)", [&]() {
+            for (int i = 0; i < num; ++i)
+                dst_u8[i] = unorm8(src[i]).value;
+        }, num_try);
+        TestScope("float -> unorm8 (SSE2)", [&]() { rthsConvertFloatToUnorm8(dst_u8.data(), src.data(), num); }, num_try);
+        TestScope("unorm8 -> float (SSE2)", [&]() { rthsConvertUnorm8ToFloat(dst_f.data(), dst_u8.data(), num); }, num_try);
+
+        TestScope("bitmask -> 8 planes (scalar)", [&]() {
+            for (int pi = 0; pi < 8; ++pi) {
+                for (int i = 0; i < num; ++i)
+                    planes[(size_t)num * pi + i] = (bits[i] & (1u << pi)) != 0 ? 0xff : 0;
+            }
+        }, num_try);
+        TestScope("bitmask -> 8 planes (SSE2)", [&]() { rthsConvertBitMaskToPlanes(planes.data(), bits.data(), num, 8); }, num_try);
+    }
+    rthsGlobalsSetDebugFlags(debug_flags);
+}
+
+TestCase(TestMatrix)
+{
+    using rths::float4;
+
+    auto debug_flags = rthsGlobalsGetDebugFlags();
+    auto set_avx = [debug_flags](bool v) {
+        rthsGlobalsSetDebugFlags(v ? debug_flags & ~(uint32_t)DebugFlag::NoMatrixAVX : debug_flags | (uint32_t)DebugFlag::NoMatrixAVX);
+    };
+    auto same = [](const void *a, const void *b, size_t size) { return std::memcmp(a, b, size) == 0; };
+
+    // random TRS matrices. row vector convention: rows 0-2 are scaled axes, row 3 is translation
+    std::mt19937 rand(4321);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    auto random_trs = [&]() {
+        float4 q{ dist(rand), dist(rand), dist(rand), dist(rand) };
+        float ql = std::sqrt(q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+        if (ql < 1e-3f)
+            q = { 0, 0, 0, 1 };
+        else
+            q = { q.x / ql, q.y / ql, q.z / ql, q.w / ql };
+        float3 scale{ std::pow(10.0f, dist(rand)), std::pow(10.0f, dist(rand)), std::pow(10.0f, dist(rand)) };
+        if (dist(rand) < -0.5f)
+            scale.x = -scale.x;
+        float4x4 m = float4x4::identity();
+        float x = q.x, y = q.y, z = q.z, w = q.w;
+        float rot[3][3] = {
+            { 1 - 2 * (y * y + z * z), 2 * (x * y + z * w), 2 * (x * z - y * w) },
+            { 2 * (x * y - z * w), 1 - 2 * (x * x + z * z), 2 * (y * z + x * w) },
+            { 2 * (x * z + y * w), 2 * (y * z - x * w), 1 - 2 * (x * x + y * y) },
+        };
+        for (int i = 0; i < 3; ++i) {
+            for (int j = 0; j < 3; ++j)
+                m[i][j] = rot[i][j] * scale[i];
+        }
+        m[3] = { dist(rand) * 100.0f, dist(rand) * 100.0f, dist(rand) * 100.0f, 1.0f };
+        return m;
+    };
+
+    // odd count to go through the tails of the AVX paths
+    const int n = 1003;
+    std::vector<float4x4> a(n), b(n);
+    for (int i = 0; i < n; ++i) {
+        a[i] = random_trs();
+        b[i] = random_trs();
+    }
+    // a singular matrix, and a matrix that doesn't fit in the float range after inversion. both become identity
+    a[10] = float4x4::identity();
+    a[10][1] = { 0, 0, 0, 0 };
+    a[11] = float4x4::identity();
+    a[11][0][0] = a[11][1][1] = a[11][2][2] = 1e-20f;
+    float4x4 root = random_trs();
+
+    std::vector<float3> points(n);
+    for (auto& p : points)
+        p = { dist(rand) * 100.0f, dist(rand) * 100.0f, dist(rand) * 100.0f };
+
+    // scalar references
+    std::vector<float4x4> ref_mul(n), ref_mul_const(n), ref_palette(n), ref_inv(n);
+    std::vector<float3> ref_points(n), ref_vectors(n);
+    for (int i = 0; i < n; ++i) {
+        ref_mul[i] = rths::mul_scalar(a[i], b[i]);
+        ref_mul_const[i] = rths::mul_scalar(a[i], root);
+        ref_palette[i] = rths::mul_scalar(rths::mul_scalar(a[i], b[i]), root);
+        ref_inv[i] = rths::invert_scalar(a[i]);
+        ref_points[i] = rths::mul_p(root, points[i]);
+        ref_vectors[i] = rths::mul_v(root, points[i]);
+    }
+    const float4x4 identity = float4x4::identity();
+    Expect(same(&ref_inv[10], &identity, sizeof(float4x4)));
+    Expect(same(&ref_inv[11], &identity, sizeof(float4x4)));
+
+    // operator*() and invert() of rthsMath.h (SSE) are bitwise identical to the scalar versions
+    {
+        size_t errors = 0;
+        for (int i = 0; i < n; ++i) {
+            float4x4 m = a[i] * b[i];
+            float4x4 inv = rths::invert(a[i]);
+            if (!same(&m, &ref_mul[i], sizeof(m)) || !same(&inv, &ref_inv[i], sizeof(inv)))
+                ++errors;
+        }
+        Expect(errors == 0);
+    }
+
+    // the inverses are accurate. compared with double precision inverses of the upper 3x3
+    {
+        double max_error = 0.0;
+        for (int i = 0; i < n; ++i) {
+            if (i == 10 || i == 11)
+                continue;
+            auto& x = a[i];
+            double c[3][3], det = 0.0;
+            for (int r = 0; r < 3; ++r) {
+                for (int k = 0; k < 3; ++k) {
+                    int r1 = (r + 1) % 3, r2 = (r + 2) % 3, k1 = (k + 1) % 3, k2 = (k + 2) % 3;
+                    c[k][r] = (double)x[r1][k1] * x[r2][k2] - (double)x[r1][k2] * x[r2][k1];
+                }
+            }
+            for (int k = 0; k < 3; ++k)
+                det += (double)x[0][k] * c[k][0];
+            double max_value = 0.0, error = 0.0;
+            for (int r = 0; r < 3; ++r) {
+                for (int k = 0; k < 3; ++k) {
+                    double v = c[r][k] / det;
+                    max_value = std::max(max_value, std::abs(v));
+                    error = std::max(error, std::abs(v - (double)ref_inv[i][r][k]));
+                }
+            }
+            max_error = std::max(max_error, error / max_value);
+        }
+        Print("    max relative error of invert(): %g\n", max_error);
+        Expect(max_error < 1e-5);
+    }
+
+    int num_paths = 2;
+    for (int path = 0; path < num_paths; ++path) {
+        set_avx(path == 0);
+
+        std::vector<float4x4> dst(n);
+        rthsMatrixMul(dst.data(), a.data(), b.data(), n);
+        Expect(same(dst.data(), ref_mul.data(), sizeof(float4x4) * n));
+        rthsMatrixMulConst(dst.data(), a.data(), &root, n);
+        Expect(same(dst.data(), ref_mul_const.data(), sizeof(float4x4) * n));
+        rthsMatrixMulPalette(dst.data(), a.data(), b.data(), &root, n);
+        Expect(same(dst.data(), ref_palette.data(), sizeof(float4x4) * n));
+        rthsMatrixInvertAffine(dst.data(), a.data(), n);
+        Expect(same(dst.data(), ref_inv.data(), sizeof(float4x4) * n));
+
+        // in place
+        dst = a;
+        rthsMatrixMul(dst.data(), dst.data(), b.data(), n);
+        Expect(same(dst.data(), ref_mul.data(), sizeof(float4x4) * n));
+        dst = a;
+        rthsMatrixInvertAffine(dst.data(), dst.data(), n);
+        Expect(same(dst.data(), ref_inv.data(), sizeof(float4x4) * n));
+
+        std::vector<float3> dst_p(n);
+        rthsMatrixTransformPoints(dst_p.data(), points.data(), &root, n);
+        Expect(same(dst_p.data(), ref_points.data(), sizeof(float3) * n));
+        rthsMatrixTransformVectors(dst_p.data(), points.data(), &root, n);
+        Expect(same(dst_p.data(), ref_vectors.data(), sizeof(float3) * n));
+        dst_p = points;
+        rthsMatrixTransformPoints(dst_p.data(), dst_p.data(), &root, n);
+        Expect(same(dst_p.data(), ref_points.data(), sizeof(float3) * n));
+    }
+
+    // microbenchmarks. scalar loops vs SSE vs AVX
+    {
+        int num = 1024 * 256;
+        GetArg("num", num);
+        const int num_try = 10;
+        std::vector<float4x4> src_a(num), src_b(num), dst(num);
+        for (int i = 0; i < num; ++i) {
+            src_a[i] = a[i % n];
+            src_b[i] = b[i % n];
+        }
+        std::vector<float3> src_p(num), dst_p(num);
+        for (int i = 0; i < num; ++i)
+            src_p[i] = points[i % n];
+
+        Print("    %d elements\n", num);
+        TestScope("a * b * root (scalar)", [&]() {
+            for (int i = 0; i < num; ++i)
+                dst[i] = rths::mul_scalar(rths::mul_scalar(src_a[i], src_b[i]), root);
+        }, num_try);
+        TestScope("a * b * root (SSE)", [&]() {
+            for (int i = 0; i < num; ++i)
+                dst[i] = src_a[i] * src_b[i] * root;
+        }, num_try);
+        set_avx(false);
+        TestScope("a * b * root (batch SSE)", [&]() { rthsMatrixMulPalette(dst.data(), src_a.data(), src_b.data(), &root, num); }, num_try);
+        set_avx(true);
+        TestScope("a * b * root (batch AVX if available)", [&]() { rthsMatrixMulPalette(dst.data(), src_a.data(), src_b.data(), &root, num); }, num_try);
+
+        TestScope("invert (scalar)", [&]() {
+            for (int i = 0; i < num; ++i)
+                dst[i] = rths::invert_scalar(src_a[i]);
+        }, num_try);
+        TestScope("invert (batch SSE)", [&]() { rthsMatrixInvertAffine(dst.data(), src_a.data(), num); }, num_try);
+
+        TestScope("transform points (scalar)", [&]() {
+            for (int i = 0; i < num; ++i)
+                dst_p[i] = rths::mul_p(root, src_p[i]);
+        }, num_try);
+        set_avx(false);
+        TestScope("transform points (batch SSE)", [&]() { rthsMatrixTransformPoints(dst_p.data(), src_p.data(), &root, num); }, num_try);
+        set_avx(true);
+        TestScope("transform points (batch AVX if available)", [&]() { rthsMatrixTransformPoints(dst_p.data(), src_p.data(), &root, num); }, num_try);
+    }
+    rthsGlobalsSetDebugFlags(debug_flags);
+}
+
+TestCase(TestSharedScene)
+{
+    // renderers in RenderAll() share one scene pass. dynamic meshes are refitted once and renderers with
+    // the same instances trace the same TLAS. the cost of the scene pass should not grow with renderer count.
+    int max_renderers = 8;
+    GetArg("renderers", max_renderers);
+    int characters = 200;
+    GetArg("characters", characters);
+    const int grid = (int)std::ceil(std::sqrt((float)characters));
+    const int rt_width = 64;
+    const int rt_height = 64;
+
+    std::vector<rths::IRenderer*> renderers;
+    std::vector<rths::RenderTargetData*> render_targets;
+    for (int i = 0; i < max_renderers; ++i) {
+        auto renderer = CreateTestRenderer();
+        if (!renderer)
+            return;
+        auto render_target = rthsRenderTargetCreate();
+        rthsRenderTargetSetup(render_target, rt_width, rt_height, RenderTargetFormat::Rf32);
+        renderers.push_back(renderer);
+        render_targets.push_back(render_target);
+    }
+
+    std::vector<int> sphere_counts, sphere_indices;
+    std::vector<float3> sphere_points;
+    GenerateIcoSphereMesh(sphere_counts, sphere_indices, sphere_points, 0.15f, 3);
+    auto quad = CreateFloorQuad();
+
+    int vertex_count = (int)sphere_points.size();
+    std::vector<std::vector<float3>> deformed(characters, std::vector<float3>(vertex_count));
+    auto deform = [&](float time) {
+        for (int ci = 0; ci < characters; ++ci) {
+            float3 pos{ (float)(ci % grid) / grid * 8.0f - 4.0f, 0.3f, (float)(ci / grid) / grid * 8.0f - 4.0f };
+            for (int vi = 0; vi < vertex_count; ++vi) {
+                float3 p = sphere_points[vi];
+                p = p * (1.0f + 0.2f * std::sin(time + p.y * 20.0f + ci)) + pos;
+                deformed[ci][vi] = p;
+            }
+        }
+    };
+
+    // the last renderer doesn't see the ground. it has its own TLAS.
+    std::vector<rths::MeshData*> meshes;
+    std::vector<rths::MeshInstanceData*> instances{ rthsMeshInstanceCreate(quad) };
+    deform(0.0f);
+    for (int ci = 0; ci < characters; ++ci) {
+        auto mesh = rthsMeshCreate();
+        rthsMeshSetCPUBuffers(mesh, deformed[ci].data(), sphere_indices.data(), sizeof(float3), vertex_count, 0, sizeof(int), (int)sphere_indices.size(), 0);
+        rthsMeshMarkDyncmic(mesh, true);
+        meshes.push_back(mesh);
+        instances.push_back(rthsMeshInstanceCreate(mesh));
+    }
+
+    auto proj = MakeTestProjection();
+
+    auto setup = [&](int num_renderers) {
+        for (int ri = 0; ri < num_renderers; ++ri) {
+            auto renderer = renderers[ri];
+            float a = (float)ri / num_renderers * 2.0f * 3.14159265f;
+            float3 cam_pos{ std::cos(a) * 8.0f, 6.0f, std::sin(a) * 8.0f };
+            rthsRendererBeginScene(renderer);
+            rthsRendererSetRenderTarget(renderer, render_targets[ri]);
+            rthsRendererSetShadowRayOffset(renderer, 0.0001f);
+            rthsRendererSetSelfShadowThreshold(renderer, 0.0001f);
+            rthsRendererSetCamera(renderer, cam_pos, lookat_rh(cam_pos, { 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }), proj);
+            rthsRendererAddDirectionalLight(renderer, normalize(float3{ -1.0f, -1.0f, 1.0f }));
+            bool last = ri == num_renderers - 1 && num_renderers > 1;
+            for (size_t i = last ? 1 : 0; i < instances.size(); ++i)
+                rthsRendererAddMesh(renderer, instances[i]);
+            rthsRendererEndScene(renderer);
+        }
+    };
+    auto readback = [&](int num_renderers, std::vector<std::vector<float>>& results) {
+        results.resize(num_renderers);
+        for (int ri = 0; ri < num_renderers; ++ri) {
+            results[ri].resize(rt_width * rt_height);
+            rthsRendererReadbackRenderTarget(renderers[ri], results[ri].data());
+        }
+    };
+    auto render_all = [&](int num_renderers, std::vector<std::vector<float>>& results) {
+        setup(num_renderers);
+        auto begin = Now();
+        rthsRenderAll();
+        auto elapsed = NS2MS(Now() - begin);
+        readback(num_renderers, results);
+        return elapsed;
+    };
+    // without the shared scene pass. each renderer builds its own TLAS
+    auto render_each = [&](int num_renderers, std::vector<std::vector<float>>& results) {
+        setup(num_renderers);
+        auto begin = Now();
+        rthsMarkFrameBegin();
+        for (int ri = 0; ri < num_renderers; ++ri)
+            rthsRendererStartRender(renderers[ri]);
+        for (int ri = 0; ri < num_renderers; ++ri)
+            rthsRendererFinishRender(renderers[ri]);
+        rthsMarkFrameEnd();
+        auto elapsed = NS2MS(Now() - begin);
+        readback(num_renderers, results);
+        return elapsed;
+    };
+
+    auto debug_flags = rthsGlobalsGetDebugFlags();
+    rthsGlobalsSetDebugFlags(debug_flags | (uint32_t)DebugFlag::Timestamp);
+
+    char expected[64];
+    std::vector<std::vector<float>> results, reference;
+    int frame = 0;
+    for (int num_renderers = 1; num_renderers <= max_renderers; num_renderers *= 2) {
+        // the first frame builds acceleration structures
+        deform(frame++ * 0.3f);
+        render_all(num_renderers, results);
+
+        float best_shared = 0.0f;
+        for (int i = 0; i < 3; ++i) {
+            deform(frame++ * 0.3f);
+            float t = render_all(num_renderers, results);
+            if (best_shared == 0.0f || t < best_shared)
+                best_shared = t;
+        }
+
+        // BLAS are refitted once for all renderers
+        snprintf(expected, sizeof(expected), "BLAS refit: %d meshes", characters);
+        int sharing = num_renderers > 1 ? num_renderers - 1 : 1;
+        for (int ri = 0; ri < num_renderers; ++ri) {
+            std::string log = rthsRendererGetTimestampLog(renderers[ri]);
+            if (ri == 0 && num_renderers == max_renderers)
+                Print("%s", log.c_str());
+            Expect(log.find(expected) != std::string::npos);
+            Expect(log.find("BLAS build") == std::string::npos);
+
+            bool last = ri == num_renderers - 1 && num_renderers > 1;
+            snprintf(expected, sizeof(expected), "Shared scene: %d instances, %d renderers",
+                last ? characters : characters + 1, last ? 1 : sharing);
+            Expect(log.find(expected) != std::string::npos);
+            snprintf(expected, sizeof(expected), "BLAS refit: %d meshes", characters);
+        }
+
+        // without the shared scene pass. the first frame builds TLAS of each renderer. BLAS are refitted in every frame as above
+        deform(frame++ * 0.3f);
+        render_each(num_renderers, reference);
+        float best_each = 0.0f;
+        for (int i = 0; i < 3; ++i) {
+            deform(frame++ * 0.3f);
+            float t = render_each(num_renderers, reference);
+            if (best_each == 0.0f || t < best_each)
+                best_each = t;
+        }
+        Print("    %d renderers: shared scene %.2fms, each renderer %.2fms\n", num_renderers, best_shared, best_each);
+
+        // the same frame rendered by both. ties of triangles at the same distance can be resolved differently
+        deform(frame++ * 0.3f);
+        render_all(num_renderers, results);
+        render_each(num_renderers, reference);
+        for (int ri = 0; ri < num_renderers; ++ri) {
+            Expect(rthsRendererGetTimestampLog(renderers[ri]) != nullptr &&
+                std::string(rthsRendererGetTimestampLog(renderers[ri])).find("Shared scene") == std::string::npos);
+            int mismatch = 0;
+            for (size_t i = 0; i < results[ri].size(); ++i) {
+                if (results[ri][i] != reference[ri][i])
+                    ++mismatch;
+            }
+            Expect(mismatch <= (int)results[ri].size() / 1000);
+        }
+    }
+    rthsGlobalsSetDebugFlags(debug_flags);
+
+    for (auto inst : instances)
+        rthsMeshInstanceRelease(inst);
+    for (auto mesh : meshes)
+        rthsMeshRelease(mesh);
+    rthsMeshRelease(quad);
+    for (int ri = 0; ri < max_renderers; ++ri) {
+        rthsRenderTargetRelease(render_targets[ri]);
+        rthsRendererRelease(renderers[ri]);
+    }
+}
+
+TestCase(TestMultiView)
+{
+    // many cameras in one scene submission. views are traced in one pass over the acceleration structures of view 0
+    // and should give the same results as rendering each camera separately.
+    // the scene is submitted and prepared once instead of once per camera. that is what multi-view saves, so the scene
+    // has many instances and the views are small (like previs thumbnails) to make it visible in the timings.
+    int num_views = 32;
+    GetArg("views", num_views);
+    int characters = 2500;
+    GetArg("characters", characters);
+    int rt_size = 32;
+    GetArg("rt_size", rt_size);
+    const int grid = (int)std::ceil(std::sqrt((float)characters));
+    const int rt_width = rt_size;
+    const int rt_height = rt_size;
+
+    auto renderer = CreateTestRenderer();
+    if (!renderer)
+        return;
+    std::vector<rths::RenderTargetData*> render_targets;
+    for (int vi = 0; vi < num_views; ++vi) {
+        auto render_target = rthsRenderTargetCreate();
+        rthsRenderTargetSetup(render_target, rt_width, rt_height, RenderTargetFormat::Rf32);
+        render_targets.push_back(render_target);
+    }
+
+    std::vector<int> sphere_counts, sphere_indices;
+    std::vector<float3> sphere_points;
+    GenerateIcoSphereMesh(sphere_counts, sphere_indices, sphere_points, 1.5f / grid, 2);
+    auto quad = CreateFloorQuad();
+    auto sphere = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(sphere, sphere_points.data(), sphere_indices.data(), sizeof(float3), (int)sphere_points.size(), 0, sizeof(int), (int)sphere_indices.size(), 0);
+
+    std::vector<rths::MeshInstanceData*> instances{ rthsMeshInstanceCreate(quad) };
+    for (int ci = 0; ci < characters; ++ci) {
+        auto inst = rthsMeshInstanceCreate(sphere);
+        float4x4 trans = float4x4::identity();
+        trans[3] = { (float)(ci % grid) / grid * 8.0f - 4.0f, 0.3f, (float)(ci / grid) / grid * 8.0f - 4.0f, 1.0f };
+        rthsMeshInstanceSetTransform(inst, trans);
+        instances.push_back(inst);
+    }
+
+    auto proj = MakeTestProjection();
+    auto camera_pos = [&](int vi) {
+        float a = (float)vi / num_views * 2.0f * 3.14159265f;
+        return float3{ std::cos(a) * 8.0f, 6.0f, std::sin(a) * 8.0f };
+    };
+    auto camera_view = [&](int vi) {
+        return lookat_rh(camera_pos(vi), { 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f });
+    };
+    std::vector<rths::CameraData> cameras(num_views);
+    for (int vi = 0; vi < num_views; ++vi) {
+        auto pos = camera_pos(vi);
+        auto& cam = cameras[vi];
+        cam.view = camera_view(vi);
+        cam.proj = proj;
+        cam.position = { pos.x, pos.y, pos.z, 1.0f };
+        // what SetCamera() derives from proj
+        float m22 = -proj[2][2], m32 = -proj[3][2];
+        float a = std::abs((2.0f * m32) / (2.0f * m22 - 2.0f));
+        float b = std::abs(((m22 - 1.0f) * a) / (m22 + 1.0f));
+        cam.near_plane = std::min(a, b);
+        cam.far_plane = std::max(a, b);
+        cam.layer_mask = ~0u;
+    }
+
+    auto begin_scene = [&](int vi) {
+        rthsRendererBeginScene(renderer);
+        rthsRendererSetRenderTarget(renderer, render_targets[vi]);
+        rthsRendererSetShadowRayOffset(renderer, 0.0001f);
+        rthsRendererSetSelfShadowThreshold(renderer, 0.0001f);
+        rthsRendererSetCamera(renderer, camera_pos(vi), camera_view(vi), proj);
+        rthsRendererAddDirectionalLight(renderer, normalize(float3{ -1.0f, -1.0f, 1.0f }));
+        for (auto inst : instances)
+            rthsRendererAddMesh(renderer, inst);
+    };
+    auto render = [&]() {
+        auto begin = Now();
+        rthsMarkFrameBegin();
+        rthsRendererStartRender(renderer);
+        rthsRendererFinishRender(renderer);
+        rthsMarkFrameEnd();
+        return NS2MS(Now() - begin);
+    };
+    // use_array: rthsRendererSetViews(). otherwise views are added one by one with rthsRendererAddView()
+    auto render_multi_view = [&](std::vector<std::vector<float>>& results, bool use_array) {
+        begin_scene(0);
+        if (use_array) {
+            rthsRendererSetViews(renderer, cameras.data(), render_targets.data(), num_views);
+        }
+        else {
+            for (int vi = 1; vi < num_views; ++vi)
+                rthsRendererAddView(renderer, render_targets[vi], camera_pos(vi), camera_view(vi), proj);
+        }
+        rthsRendererEndScene(renderer);
+        float elapsed = render();
+
+        results.resize(num_views);
+        for (int vi = 0; vi < num_views; ++vi) {
+            results[vi].resize(rt_width * rt_height);
+            Expect(rthsRendererReadbackViewRenderTarget(renderer, vi, results[vi].data()));
+        }
+        return elapsed;
+    };
+    auto render_each = [&](std::vector<std::vector<float>>& results) {
+        float elapsed = 0.0f;
+        results.resize(num_views);
+        for (int vi = 0; vi < num_views; ++vi) {
+            begin_scene(vi);
+            rthsRendererEndScene(renderer);
+            elapsed += render();
+            results[vi].resize(rt_width * rt_height);
+            rthsRendererReadbackRenderTarget(renderer, results[vi].data());
+        }
+        return elapsed;
+    };
+
+    auto debug_flags = rthsGlobalsGetDebugFlags();
+    rthsGlobalsSetDebugFlags(debug_flags | (uint32_t)DebugFlag::Timestamp);
+
+    std::vector<std::vector<float>> results, results_added, reference;
+    float best_multi = 0.0f, best_each = 0.0f;
+    for (int i = 0; i < 4; ++i) {
+        float t = render_multi_view(results, true);
+        // the first frame builds acceleration structures
+        if (i > 0 && (best_multi == 0.0f || t < best_multi))
+            best_multi = t;
+    }
+    std::string log = rthsRendererGetTimestampLog(renderer);
+    Print("%s", log.c_str());
+    char expected[64];
+    snprintf(expected, sizeof(expected), "Multi-view: %d views", num_views);
+    Expect(num_views == 1 || log.find(expected) != std::string::npos);
+
+    // results stay readable after the next BeginScene() clears the views
+    std::vector<float> view_result(rt_width * rt_height);
+    begin_scene(0);
+    Expect(num_views == 1 || rthsRendererReadbackViewRenderTarget(renderer, num_views - 1, view_result.data()));
+    Expect(num_views == 1 || view_result == results[num_views - 1]);
+    rthsRendererEndScene(renderer);
+
+    render_multi_view(results_added, false);
+
+    for (int i = 0; i < 3; ++i) {
+        float t = render_each(reference);
+        if (best_each == 0.0f || t < best_each)
+            best_each = t;
+    }
+    Print("    %d views, %d instances: multi-view %.2fms, separately %.2fms\n", num_views, characters + 1, best_multi, best_each);
+
+    for (int vi = 0; vi < num_views; ++vi) {
+        int mismatch = 0, shadowed = 0;
+        for (size_t i = 0; i < results[vi].size(); ++i) {
+            if (results[vi][i] != reference[vi][i] || results_added[vi][i] != reference[vi][i])
+                ++mismatch;
+            if (reference[vi][i] != 0.0f)
+                ++shadowed;
+        }
+        Expect(mismatch == 0);
+        Expect(shadowed > 0);
+    }
+
+    // views are reset by BeginScene()
+    begin_scene(0);
+    rthsRendererEndScene(renderer);
+    render();
+    std::vector<float> tmp(rt_width * rt_height);
+    Expect(!rthsRendererReadbackViewRenderTarget(renderer, 1, tmp.data()));
+    Expect(std::string(rthsRendererGetTimestampLog(renderer)).find("Multi-view") == std::string::npos);
+    rthsGlobalsSetDebugFlags(debug_flags);
+
+    for (auto inst : instances)
+        rthsMeshInstanceRelease(inst);
+    rthsMeshRelease(sphere);
+    rthsMeshRelease(quad);
+    for (auto rt : render_targets)
+        rthsRenderTargetRelease(rt);
+    rthsRendererRelease(renderer);
+}
+
+TestCase(TestCubeMap)
+{
+    // omnidirectional shadow output. 6 faces are traced in one render and should be the same as rendering
+    // each face with SetCamera(). faces are in the layout of D3D / Unity cube maps.
+    // like multi-view, the saving is the scene prepared once instead of once per face. so the scene has many instances.
+    int face_size = 64;
+    GetArg("face_size", face_size);
+    int characters = 2500;
+    GetArg("characters", characters);
+    const int grid = (int)std::ceil(std::sqrt((float)characters));
+
+    auto renderer = CreateTestRenderer();
+    if (!renderer)
+        return;
+    rths::RenderTargetData *faces[6];
+    for (auto& face : faces) {
+        face = rthsRenderTargetCreate();
+        rthsRenderTargetSetup(face, face_size, face_size, RenderTargetFormat::Rf32);
+    }
+
+    std::vector<int> sphere_counts, sphere_indices;
+    std::vector<float3> sphere_points;
+    GenerateIcoSphereMesh(sphere_counts, sphere_indices, sphere_points, 0.5f, 3);
+    std::vector<int> small_counts, small_indices;
+    std::vector<float3> small_points;
+    GenerateIcoSphereMesh(small_counts, small_indices, small_points, 0.15f, 1);
+    auto quad = CreateFloorQuad(20.0f);
+    auto sphere = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(sphere, sphere_points.data(), sphere_indices.data(), sizeof(float3), (int)sphere_points.size(), 0, sizeof(int), (int)sphere_indices.size(), 0);
+    auto small_sphere = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(small_sphere, small_points.data(), small_indices.data(), sizeof(float3), (int)small_points.size(), 0, sizeof(int), (int)small_indices.size(), 0);
+
+    // the probe is 1 above the ground. the sphere is above the probe and toward +Z. its shadow is on the ground
+    // around (0, 0, 1) that is on the edge of the -Y and +Z faces, and is in the upper half of the -Y face.
+    const float3 probe{ 0.0f, 1.0f, 0.0f };
+    auto ground = rthsMeshInstanceCreate(quad);
+    auto occluder = rthsMeshInstanceCreate(sphere);
+    float4x4 trans = float4x4::identity();
+    trans[3] = { 0.0f, 3.0f, 1.0f, 1.0f };
+    rthsMeshInstanceSetTransform(occluder, trans);
+
+    // small spheres around the probe. none of them is near the part of the ground seen by the -Y face.
+    std::vector<rths::MeshInstanceData*> instances{ ground, occluder };
+    for (int ci = 0; ci < characters; ++ci) {
+        float x = (float)(ci % grid) / grid * 36.0f - 18.0f;
+        float z = (float)(ci / grid) / grid * 36.0f - 18.0f;
+        if (std::abs(x) < 2.5f && std::abs(z) < 2.5f)
+            continue;
+        auto inst = rthsMeshInstanceCreate(small_sphere);
+        trans = float4x4::identity();
+        trans[3] = { x, 0.3f, z, 1.0f };
+        rthsMeshInstanceSetTransform(inst, trans);
+        instances.push_back(inst);
+    }
+
+    auto begin_scene = [&]() {
+        rthsRendererBeginScene(renderer);
+        rthsRendererSetShadowRayOffset(renderer, 0.0001f);
+        rthsRendererSetSelfShadowThreshold(renderer, 0.0001f);
+        rthsRendererAddDirectionalLight(renderer, float3{ 0.0f, -1.0f, 0.0f });
+        for (auto inst : instances)
+            rthsRendererAddMesh(renderer, inst);
+    };
+    auto render = [&]() {
+        auto begin = Now();
+        rthsMarkFrameBegin();
+        rthsRendererStartRender(renderer);
+        rthsRendererFinishRender(renderer);
+        rthsMarkFrameEnd();
+        return NS2MS(Now() - begin);
+    };
+
+    const float near_plane = 0.01f, far_plane = 100.0f;
+    std::vector<std::vector<float>> results(6), reference(6);
+    float best_cube = 0.0f, best_each = 0.0f;
+    for (int i = 0; i < 4; ++i) {
+        begin_scene();
+        rthsRendererSetCubeCamera(renderer, faces, probe, near_plane, far_plane);
+        rthsRendererEndScene(renderer);
+        float t = render();
+        if (i > 0 && (best_cube == 0.0f || t < best_cube))
+            best_cube = t;
+    }
+    for (int fi = 0; fi < 6; ++fi) {
+        results[fi].resize(face_size * face_size);
+        Expect(rthsRendererReadbackViewRenderTarget(renderer, fi, results[fi].data()));
+    }
+
+    // each face with SetCamera(). the first row of a face is its top edge, so the camera's up is the face's down
+    static const float3 face_axes[6][3]{
+        // right, down, forward
+        { { 0, 0,-1}, { 0,-1, 0}, { 1, 0, 0} },
+        { { 0, 0, 1}, { 0,-1, 0}, {-1, 0, 0} },
+        { { 1, 0, 0}, { 0, 0, 1}, { 0, 1, 0} },
+        { { 1, 0, 0}, { 0, 0,-1}, { 0,-1, 0} },
+        { { 1, 0, 0}, { 0,-1, 0}, { 0, 0, 1} },
+        { {-1, 0, 0}, { 0,-1, 0}, { 0, 0,-1} },
+    };
+    float4x4 proj{ {
+        {1, 0, 0, 0},
+        {0, 1, 0, 0},
+        {0, 0, -(far_plane + near_plane) / (far_plane - near_plane), -1},
+        {0, 0, -2.0f * far_plane * near_plane / (far_plane - near_plane), 0},
+    } };
+    for (int i = 0; i < 3; ++i) {
+        float t = 0.0f;
+        for (int fi = 0; fi < 6; ++fi) {
+            begin_scene();
+            rthsRendererSetRenderTarget(renderer, faces[fi]);
+            rthsRendererSetCamera(renderer, probe, lookat_rh(probe, probe + face_axes[fi][2], face_axes[fi][1]), proj);
+            rthsRendererEndScene(renderer);
+            t += render();
+            reference[fi].resize(face_size * face_size);
+            rthsRendererReadbackRenderTarget(renderer, reference[fi].data());
+        }
+        if (best_each == 0.0f || t < best_each)
+            best_each = t;
+    }
+    Print("    %dx%d faces, %d instances: cube %.2fms, separately %.2fms\n", face_size, face_size, (int)instances.size(), best_cube, best_each);
+
+    for (int fi = 0; fi < 6; ++fi) {
+        // near / far planes calculated from the projection matrix can differ in the last bits
+        int mismatch = 0;
+        for (size_t i = 0; i < results[fi].size(); ++i) {
+            if (results[fi][i] != reference[fi][i])
+                ++mismatch;
+        }
+        Expect(mismatch <= (int)results[fi].size() / 1000);
+    }
+
+    // the -Y face sees only the ground. the shadow is in its upper half (+Z side)
+    int lit = 0, shadowed[2]{};
+    auto& bottom = results[3];
+    for (int y = 0; y < face_size; ++y) {
+        for (int x = 0; x < face_size; ++x) {
+            if (bottom[face_size * y + x] == 1.0f)
+                ++lit;
+            else
+                ++shadowed[y < face_size / 2 ? 0 : 1];
+        }
+    }
+    Print("    -Y face: lit %d, shadowed %d (upper half) %d (lower half)\n", lit, shadowed[0], shadowed[1]);
+    Expect(lit > 0 && shadowed[0] > 0 && shadowed[0] > shadowed[1] * 4);
+
+    // seam. the top row of the -Y face and the bottom row of the +Z face are next to their shared edge.
+    // both faces have +X as right, so texels in the same column are symmetric about the edge and see the ground
+    // at about z = 1, where the shadow crosses the edge at right angles. each pair must agree.
+    auto texel_dir = [&](int fi, int x, int y) {
+        auto& axes = face_axes[fi];
+        float u = ((float)x + 0.5f) / face_size * 2.0f - 1.0f;
+        float v = ((float)y + 0.5f) / face_size * 2.0f - 1.0f;
+        return normalize(axes[2] + axes[0] * u + axes[1] * v);
+    };
+    int seam_shadowed = 0, seam_mismatch = 0;
+    float max_angle = 0.0f;
+    for (int x = 0; x < face_size; ++x) {
+        max_angle = std::max(max_angle, std::acos(std::min(dot(texel_dir(3, x, 0), texel_dir(4, x, face_size - 1)), 1.0f)));
+        float v = results[3][x], v_next = results[4][face_size * (face_size - 1) + x];
+        if (v != 1.0f)
+            ++seam_shadowed;
+        if (v != v_next)
+            ++seam_mismatch;
+    }
+    Print("    -Y / +Z seam: %d texels, %d shadowed, %d mismatches\n", face_size, seam_shadowed, seam_mismatch);
+    // a texel is about 1 / face_size radians at the edge
+    Expect(max_angle < 1.5f / face_size);
+    Expect(seam_shadowed > 0 && seam_shadowed < face_size);
+    Expect(seam_mismatch <= 2);
+
+    // views added before SetCubeCamera() are replaced by the faces
+    begin_scene();
+    rthsRendererAddView(renderer, faces[0], probe, float4x4::identity(), proj);
+    rthsRendererSetCubeCamera(renderer, faces, probe, near_plane, far_plane);
+    rthsRendererEndScene(renderer);
+    render();
+    std::vector<float> tmp(face_size * face_size);
+    Expect(!rthsRendererReadbackViewRenderTarget(renderer, 6, tmp.data()));
+    Expect(rthsRendererReadbackViewRenderTarget(renderer, 5, tmp.data()) && tmp == results[5]);
+
+    // faces must be square
+    auto non_square = rthsRenderTargetCreate();
+    rthsRenderTargetSetup(non_square, face_size, face_size / 2, RenderTargetFormat::Rf32);
+    rths::RenderTargetData *bad_faces[6]{ faces[0], faces[1], faces[2], faces[3], faces[4], non_square };
+    begin_scene();
+    rthsRendererSetCubeCamera(renderer, bad_faces, probe, near_plane, far_plane);
+    rthsRendererEndScene(renderer);
+    Expect(std::string(rthsGetErrorLog()).find("square") != std::string::npos);
+    rthsRenderTargetRelease(non_square);
+
+    for (auto inst : instances)
+        rthsMeshInstanceRelease(inst);
+    rthsMeshRelease(sphere);
+    rthsMeshRelease(small_sphere);
+    rthsMeshRelease(quad);
+    for (auto face : faces)
+        rthsRenderTargetRelease(face);
+    rthsRendererRelease(renderer);
+}
+
+TestCase(TestCapture)
+{
+    // captures a few frames of a static ground and a dynamic mesh and checks the chunks of the file.
+    // static meshes are written once and dynamic ones in every frame. the capture is replayed by rths-cli.
+    std::string path = "rths_capture_test.rthscap";
+    GetArg("path", path);
+    int num_frames = 4;
+    GetArg("frames", num_frames);
+
+    auto renderer = CreateTestRenderer();
+    if (!renderer)
+        return;
+    auto render_target = rthsRenderTargetCreate();
+    rthsRenderTargetSetup(render_target, 64, 64, RenderTargetFormat::Rf32);
+
+    std::vector<int> sphere_counts, sphere_indices;
+    std::vector<float3> sphere_points, deformed;
+    GenerateIcoSphereMesh(sphere_counts, sphere_indices, sphere_points, 0.5f, 2);
+    auto quad = CreateFloorQuad();
+    rthsMeshSetName(quad, "ground");
+    auto sphere = rthsMeshCreate();
+    rthsMeshSetName(sphere, "sphere");
+    rthsMeshMarkDyncmic(sphere, true);
+    deformed = sphere_points;
+    rthsMeshSetCPUBuffers(sphere, deformed.data(), sphere_indices.data(), sizeof(float3), (int)deformed.size(), 0, sizeof(int), (int)sphere_indices.size(), 0);
+
+    auto ground = rthsMeshInstanceCreate(quad);
+    auto ball = rthsMeshInstanceCreate(sphere);
+    auto proj = MakeTestProjection();
+    float3 camera_pos{ 0.0f, 5.0f, 8.0f };
+
+    Expect(!rthsCaptureBegin(""));
+    Expect(!rthsCaptureIsCapturing());
+    Expect(rthsCaptureBegin(path.c_str()));
+    Expect(rthsCaptureIsCapturing());
+    for (int fi = 0; fi < num_frames; ++fi) {
+        // the dynamic mesh is deformed in place
+        for (size_t vi = 0; vi < deformed.size(); ++vi)
+            deformed[vi] = sphere_points[vi] * (1.0f + 0.1f * fi) + float3{ 0.0f, 1.0f, 0.0f };
+        float4x4 trans = float4x4::identity();
+        trans[3] = { 0.2f * fi, 0.0f, 0.0f, 1.0f };
+        rthsMeshInstanceSetTransform(ball, trans);
+
+        RenderFrame(renderer, [&]() {
+            rthsRendererSetRenderTarget(renderer, render_target);
+            rthsRendererSetCamera(renderer, camera_pos, lookat_rh(camera_pos, { 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }), proj);
+            rthsRendererAddDirectionalLight(renderer, normalize(float3{ -1.0f, -1.0f, 1.0f }));
+            rthsRendererAddSpotLight(renderer, { 0.0f, 4.0f, 0.0f }, { 0.0f, -1.0f, 0.0f }, 10.0f, 60.0f);
+            rthsRendererAddMesh(renderer, ground);
+            rthsRendererAddMesh(renderer, ball);
+        }, nullptr);
+    }
+    rthsCaptureEnd();
+    Expect(!rthsCaptureIsCapturing());
+
+    std::vector<char> data;
+    {
+        std::ifstream fin(path, std::ios::binary);
+        data.assign(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+    }
+    Expect(data.size() > sizeof(rths::CaptureFileHeader));
+    if (data.size() > sizeof(rths::CaptureFileHeader)) {
+        auto& header = *(const rths::CaptureFileHeader*)data.data();
+        Expect(std::memcmp(header.magic, rths::kCaptureMagic, sizeof(header.magic)) == 0);
+        Expect(header.version == rths::kCaptureVersion);
+
+        int counts[5]{};
+        int sphere_chunks = 0, frame_ends = 0;
+        bool sphere_ok = true, light_ok = true;
+        size_t pos = header.header_size;
+        while (pos + sizeof(rths::CaptureChunkHeader) <= data.size()) {
+            auto& ch = *(const rths::CaptureChunkHeader*)(data.data() + pos);
+            pos += sizeof(ch);
+            auto *payload = data.data() + pos;
+            pos += ch.size;
+            Expect(ch.size % rths::kCaptureAlignment == 0 && pos <= data.size());
+            if (pos > data.size() || (int)ch.type < 1 || (int)ch.type > 4)
+                break;
+            ++counts[(int)ch.type];
+
+            if (ch.type == rths::CaptureChunkType::Mesh) {
+                auto& mesh = *(const rths::CaptureMesh*)payload;
+                if (std::string(payload + mesh.name.offset, mesh.name.count) != "sphere")
+                    continue;
+                // contents of the dynamic mesh at the frame
+                auto *vertices = (const float3*)(payload + mesh.vertices.offset);
+                for (size_t vi = 0; vi < sphere_points.size(); ++vi) {
+                    float3 expected = sphere_points[vi] * (1.0f + 0.1f * frame_ends) + float3{ 0.0f, 1.0f, 0.0f };
+                    if (vertices[vi].x != expected.x || vertices[vi].y != expected.y || vertices[vi].z != expected.z)
+                        sphere_ok = false;
+                }
+                Expect(mesh.is_dynamic == 1 && mesh.vertices.offset % rths::kCaptureAlignment == 0);
+                ++sphere_chunks;
+            }
+            else if (ch.type == rths::CaptureChunkType::Scene) {
+                auto& scene = *(const rths::CaptureScene*)payload;
+                auto *lights = (const rths::CaptureLight*)(payload + scene.lights.offset);
+                light_ok = light_ok && scene.lights.count == 2 && scene.instances.count == 2 && scene.views.count == 1 &&
+                    std::abs(lights[1].spot_angle - 60.0f) < 0.001f;
+            }
+            else if (ch.type == rths::CaptureChunkType::FrameEnd)
+                ++frame_ends;
+        }
+        Print("    %d frames: %d mesh, %d instance, %d scene chunks, %d bytes\n",
+            frame_ends, counts[1], counts[2], counts[3], (int)data.size());
+        Expect(frame_ends == num_frames);
+        Expect(counts[(int)rths::CaptureChunkType::Mesh] == 1 + num_frames);
+        Expect(counts[(int)rths::CaptureChunkType::Instance] == 2 * num_frames);
+        Expect(counts[(int)rths::CaptureChunkType::Scene] == num_frames);
+        Expect(sphere_chunks == num_frames && sphere_ok && light_ok);
+    }
+
+    // nothing is written after rthsCaptureEnd()
+    rthsMarkFrameBegin();
+    rthsRendererStartRender(renderer);
+    rthsRendererFinishRender(renderer);
+    rthsMarkFrameEnd();
+    {
+        std::ifstream fin(path, std::ios::binary | std::ios::ate);
+        Expect((size_t)fin.tellg() == data.size());
+    }
+
+    rthsMeshInstanceRelease(ball);
+    rthsMeshInstanceRelease(ground);
+    rthsMeshRelease(sphere);
+    rthsMeshRelease(quad);
+    rthsRenderTargetRelease(render_target);
+    rthsRendererRelease(renderer);
+}
@@ -0,0 +1,59 @@
+#include "pch.h"
+#include "Test.h"
+#include "TestUtils.h"
+
+
+IRenderer* CreateTestRenderer()
+{
+    auto renderer = rthsRendererCreate();
+    if (!renderer)
+        Print("rthsRendererCreate() returned null: %s\n", rthsGetErrorLog());
+    return renderer;
+}
+
+float4x4 MakeTestProjection()
+{
+    return { {
+        {1.73205078f, 0, 0, 0},
+        {0, 1.73205078f, 0, 0},
+        {0, 0, -1.00060010f, -1.0f},
+        {0, 0, -0.600180030f, 0},
+    } };
+}
+
+MeshData* CreateFloorQuad(float half_size)
+{
+    // meshes refer to CPU buffers without copying them. keep vertices of each size alive.
+    static std::map<float, std::vector<float3>> s_vertices;
+    static const int indices[]{
+        0, 1, 2, 0, 2, 3,
+    };
+    auto& vertices = s_vertices[half_size];
+    if (vertices.empty()) {
+        const float s = half_size;
+        vertices = {
+            {-s, 0.0f, s},
+            { s, 0.0f, s},
+            { s, 0.0f,-s},
+            {-s, 0.0f,-s},
+        };
+    }
+    auto quad = rthsMeshCreate();
+    rthsMeshSetCPUBuffers(quad, vertices.data(), indices, sizeof(float3), (int)vertices.size(), 0, sizeof(int), _countof(indices), 0);
+    return quad;
+}
+
+bool RenderFrame(IRenderer *renderer, const std::function<void()>& setup, void *dst)
+{
+    rthsMarkFrameBegin();
+    rthsRendererBeginScene(renderer);
+    rthsRendererSetShadowRayOffset(renderer, 0.0001f);
+    rthsRendererSetSelfShadowThreshold(renderer, 0.0001f);
+    setup();
+    rthsRendererEndScene(renderer);
+    rthsRendererStartRender(renderer);
+    rthsRendererFinishRender(renderer);
+    bool ret = dst ? rthsRendererReadbackRenderTarget(renderer, dst) : true;
+    rthsMarkFrameEnd();
+    return ret;
+}
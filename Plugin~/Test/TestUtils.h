@@ -0,0 +1,20 @@
+#pragma once
+
+#include "rths/rths.h"
+using namespace rths;
+
+// helpers shared by tests
+
+// prints the error log and returns null if the renderer can't be created
+IRenderer* CreateTestRenderer();
+
+// perspective projection used by most tests. fov 60, aspect 1, near 0.3, far 100
+float4x4 MakeTestProjection();
+
+// quad on the xz plane. (-half_size, 0, -half_size) - (half_size, 0, half_size)
+MeshData* CreateFloorQuad(float half_size = 5.0f);
+
+// renders a frame: marks the frame begin, calls setup() between BeginScene() and EndScene(), renders,
+// reads back the render target to dst (if not null) and marks the frame end.
+// shadow ray offset and self shadow threshold are set to 0.0001 before setup(), which can override them.
+bool RenderFrame(IRenderer *renderer, const std::function<void()>& setup, void *dst);
@@ -5,6 +5,10 @@
     #include <windows.h>
 #endif
 
+#ifndef _countof
+    #define _countof(a) (sizeof(a) / sizeof(a[0]))
+#endif
+
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
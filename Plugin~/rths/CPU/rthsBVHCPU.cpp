@@ -0,0 +1,1023 @@
+#include "pch.h"
+#include <emmintrin.h>
+#include "Foundation/rthsParallel.h"
+#include "Foundation/rthsMatrix.h"
+#include "rthsBVHCPU.h"
+
+namespace rths {
+
+AABB TransformAABB(const AABB& v, const float4x4& m)
+{
+    AABB ret;
+    if (!v.valid())
+        return ret;
+    float3 corners[8];
+    for (int i = 0; i < 8; ++i) {
+        corners[i] = {
+            (i & 1) ? v.bmax.x : v.bmin.x,
+            (i & 2) ? v.bmax.y : v.bmin.y,
+            (i & 4) ? v.bmax.z : v.bmin.z,
+        };
+    }
+    // 8 points are one iteration of the AVX path
+    TransformPoints(corners, corners, m, 8, !GetGlobals().hasDebugFlag(DebugFlag::NoMatrixAVX));
+    for (auto& p : corners)
+        ret.expand(p);
+    return ret;
+}
+
+
+namespace {
+
+struct BuildPrimitive
+{
+    AABB bounds;
+    float3 center;
+    uint32_t id;
+};
+
+struct BuildSettings
+{
+    int num_bins;
+    int max_leaf_size;   // nodes up to this size become leaves if SAH says so
+    int force_leaf_size; // nodes up to this size become leaves without evaluating SAH
+    int block_width;     // primitives tested at once in leaves. SAH counts intersection costs per block
+};
+
+const int kMaxBins = 32;
+const float kTraversalCost = 1.0f;
+const float kIntersectionCost = 1.0f;
+const int kParallelBuildThreshold = 1024 * 4;   // subtrees larger than this are built in parallel
+const int kParallelBinningThreshold = 1024 * 64; // nodes larger than this compute bins in parallel
+
+// bounds of bins are kept in SSE registers as binning and SAH sweep are the hottest part of the build.
+// 4th lanes are garbage and ignored.
+struct BinSet
+{
+    int num_bins = 0;
+    __m128 bmin[3][kMaxBins];
+    __m128 bmax[3][kMaxBins];
+    uint32_t count[3][kMaxBins];
+
+    BinSet(int n = kMaxBins)
+    {
+        num_bins = n;
+        for (int a = 0; a < 3; ++a) {
+            for (int b = 0; b < num_bins; ++b) {
+                bmin[a][b] = _mm_set1_ps(FLT_MAX);
+                bmax[a][b] = _mm_set1_ps(-FLT_MAX);
+                count[a][b] = 0;
+            }
+        }
+    }
+
+    void merge(const BinSet& v)
+    {
+        for (int a = 0; a < 3; ++a) {
+            for (int b = 0; b < num_bins; ++b) {
+                bmin[a][b] = _mm_min_ps(bmin[a][b], v.bmin[a][b]);
+                bmax[a][b] = _mm_max_ps(bmax[a][b], v.bmax[a][b]);
+                count[a][b] += v.count[a][b];
+            }
+        }
+    }
+};
+
+inline float AreaSSE(__m128 bmin, __m128 bmax)
+{
+    alignas(16) float s[4];
+    _mm_store_ps(s, _mm_sub_ps(bmax, bmin));
+    return 2.0f * (s[0] * s[1] + s[1] * s[2] + s[2] * s[0]);
+}
+
+inline AABB ToAABB(__m128 bmin, __m128 bmax)
+{
+    alignas(16) float t[4];
+    AABB ret;
+    _mm_store_ps(t, bmin);
+    ret.bmin = { t[0], t[1], t[2] };
+    _mm_store_ps(t, bmax);
+    ret.bmax = { t[0], t[1], t[2] };
+    return ret;
+}
+
+struct RangeBounds
+{
+    AABB bounds, cbounds;
+
+    void merge(const RangeBounds& v)
+    {
+        bounds.expand(v.bounds);
+        cbounds.expand(v.cbounds);
+    }
+};
+
+inline int GetBinIndex(float c, float cmin, float scale, int num_bins)
+{
+    return std::min(std::max(int((c - cmin) * scale), 0), num_bins - 1);
+}
+
+// Body: [](int begin, int end, T& dst) -> void
+// each chunk accumulates into its own copy of init and they are merged in order.
+template<class T, class Body>
+inline T ParallelReduce(int begin, int end, int grain, const T& init, const Body& body)
+{
+    int num_chunks = ceildiv(end - begin, grain);
+    std::vector<T> tmp(num_chunks, init);
+    parallel_for_blocked(begin, end, grain, [&](int b, int e) {
+        body(b, e, tmp[(b - begin) / grain]);
+    });
+    for (int i = 1; i < num_chunks; ++i)
+        tmp[0].merge(tmp[i]);
+    return tmp[0];
+}
+
+class BVHBuilder
+{
+public:
+    BVHBuilder(std::vector<BuildPrimitive>& prims, std::vector<BVHNodeCPU>& nodes, const BuildSettings& settings)
+        : m_prims(prims), m_nodes(nodes), m_settings(settings)
+    {
+        m_nodes.resize(std::max<size_t>(prims.size() * 2 - 1, 1));
+    }
+
+    uint32_t build()
+    {
+        uint32_t n = (uint32_t)m_prims.size();
+        auto body = [this](int b, int e, RangeBounds& dst) {
+            for (int i = b; i < e; ++i) {
+                dst.bounds.expand(m_prims[i].bounds);
+                dst.cbounds.expand(m_prims[i].center);
+            }
+        };
+        auto rb = ParallelReduce(0, n, kParallelBinningThreshold / 4, RangeBounds(), body);
+
+        m_node_count = 1;
+        buildNode(0, 0, n, 0, rb);
+        return m_node_count;
+    }
+
+private:
+    void computeBins(uint32_t begin, uint32_t end, const AABB& cbounds, int num_bins, BinSet& dst)
+    {
+        float3 cmin = cbounds.bmin;
+        float3 csize = cbounds.size();
+        float scale[3];
+        for (int a = 0; a < 3; ++a)
+            scale[a] = csize[a] > 0.0f ? (float)num_bins / csize[a] : 0.0f;
+
+        auto body = [&](int b, int e, BinSet& bins) {
+            const __m128 vcmin = _mm_setr_ps(cmin.x, cmin.y, cmin.z, 0.0f);
+            const __m128 vscale = _mm_setr_ps(scale[0], scale[1], scale[2], 0.0f);
+            const __m128 vlast = _mm_set1_ps((float)(num_bins - 1));
+            alignas(16) int idx[4];
+            for (int i = b; i < e; ++i) {
+                auto& prim = m_prims[i];
+                // BuildPrimitive is {bmin, bmax, center, id}. so 4 floats can be loaded from each of them.
+                __m128 pmin = _mm_loadu_ps(&prim.bounds.bmin.x);
+                __m128 pmax = _mm_loadu_ps(&prim.bounds.bmax.x);
+                __m128 pc = _mm_loadu_ps(&prim.center.x);
+                __m128 fi = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_sub_ps(pc, vcmin), vscale), _mm_setzero_ps()), vlast);
+                _mm_store_si128((__m128i*)idx, _mm_cvttps_epi32(fi));
+                for (int a = 0; a < 3; ++a) {
+                    int bi = idx[a];
+                    bins.bmin[a][bi] = _mm_min_ps(bins.bmin[a][bi], pmin);
+                    bins.bmax[a][bi] = _mm_max_ps(bins.bmax[a][bi], pmax);
+                    bins.count[a][bi]++;
+                }
+            }
+        };
+        if (end - begin >= kParallelBinningThreshold)
+            dst = ParallelReduce(begin, end, kParallelBinningThreshold / 4, dst, body);
+        else
+            body(begin, end, dst);
+    }
+
+    uint32_t getBlockCount(uint32_t n) const
+    {
+        return (n + m_settings.block_width - 1) / m_settings.block_width;
+    }
+
+    void makeLeaf(uint32_t ni, uint32_t begin, uint32_t end)
+    {
+        m_nodes[ni].offset = begin;
+        m_nodes[ni].count = end - begin;
+    }
+
+    // rb: bounds and centroid bounds of [begin, end). computed by the parent to avoid extra passes over primitives.
+    void buildNode(uint32_t ni, uint32_t begin, uint32_t end, int depth, const RangeBounds& rb)
+    {
+        uint32_t n = end - begin;
+        m_nodes[ni].bounds = rb.bounds;
+
+        if ((int)n <= m_settings.force_leaf_size || depth >= BLASCPU::kMaxDepth - 1) {
+            makeLeaf(ni, begin, end);
+            return;
+        }
+
+        // find the best split with binned SAH
+        // small nodes don't need many bins
+        int num_bins = std::min<int>(m_settings.num_bins, std::max<int>(n, 4));
+        float3 csize = rb.cbounds.size();
+        int best_axis = -1;
+        int best_bin = 0;
+        float best_cost = FLT_MAX;
+        RangeBounds child_rb[2];
+        if (csize.x > 0.0f || csize.y > 0.0f || csize.z > 0.0f) {
+            BinSet bins(num_bins);
+            computeBins(begin, end, rb.cbounds, num_bins, bins);
+
+            __m128 right_min[kMaxBins], right_max[kMaxBins];
+            float right_area[kMaxBins];
+            uint32_t right_count[kMaxBins];
+            for (int a = 0; a < 3; ++a) {
+                if (csize[a] <= 0.0f)
+                    continue;
+
+                // sweep from right to left, then left to right
+                __m128 acc_min = _mm_set1_ps(FLT_MAX);
+                __m128 acc_max = _mm_set1_ps(-FLT_MAX);
+                uint32_t cnt = 0;
+                for (int b = num_bins - 1; b > 0; --b) {
+                    acc_min = _mm_min_ps(acc_min, bins.bmin[a][b]);
+                    acc_max = _mm_max_ps(acc_max, bins.bmax[a][b]);
+                    cnt += bins.count[a][b];
+                    right_min[b] = acc_min;
+                    right_max[b] = acc_max;
+                    right_area[b] = cnt ? AreaSSE(acc_min, acc_max) : 0.0f;
+                    right_count[b] = cnt;
+                }
+                acc_min = _mm_set1_ps(FLT_MAX);
+                acc_max = _mm_set1_ps(-FLT_MAX);
+                cnt = 0;
+                for (int b = 0; b < num_bins - 1; ++b) {
+                    acc_min = _mm_min_ps(acc_min, bins.bmin[a][b]);
+                    acc_max = _mm_max_ps(acc_max, bins.bmax[a][b]);
+                    cnt += bins.count[a][b];
+                    uint32_t rc = right_count[b + 1];
+                    if (cnt == 0 || rc == 0)
+                        continue;
+                    float cost = AreaSSE(acc_min, acc_max) * getBlockCount(cnt) + right_area[b + 1] * getBlockCount(rc);
+                    if (cost < best_cost) {
+                        best_cost = cost;
+                        best_axis = a;
+                        best_bin = b;
+                        child_rb[0].bounds = ToAABB(acc_min, acc_max);
+                        child_rb[1].bounds = ToAABB(right_min[b + 1], right_max[b + 1]);
+                    }
+                }
+            }
+        }
+
+        float area = rb.bounds.area();
+        float leaf_cost = kIntersectionCost * getBlockCount(n);
+        float split_cost = best_axis >= 0 && area > 0.0f ?
+            kTraversalCost + kIntersectionCost * best_cost / area :
+            FLT_MAX;
+        if ((int)n <= m_settings.max_leaf_size && leaf_cost <= split_cost) {
+            makeLeaf(ni, begin, end);
+            return;
+        }
+
+        uint32_t mid;
+        if (best_axis >= 0) {
+            // partition and compute centroid bounds of children at the same time
+            float cmin = rb.cbounds.bmin[best_axis];
+            float scale = (float)num_bins / csize[best_axis];
+            uint32_t i = begin, j = end;
+            while (i < j) {
+                auto& prim = m_prims[i];
+                if (GetBinIndex(prim.center[best_axis], cmin, scale, num_bins) <= best_bin) {
+                    child_rb[0].cbounds.expand(prim.center);
+                    ++i;
+                }
+                else {
+                    --j;
+                    std::swap(prim, m_prims[j]);
+                    child_rb[1].cbounds.expand(m_prims[j].center);
+                }
+            }
+            mid = i;
+        }
+        else {
+            // all centers are at the same position. just split in half.
+            mid = begin + n / 2;
+            for (uint32_t i = begin; i < end; ++i) {
+                auto& dst = child_rb[i < mid ? 0 : 1];
+                dst.bounds.expand(m_prims[i].bounds);
+                dst.cbounds.expand(m_prims[i].center);
+            }
+        }
+
+        uint32_t c = m_node_count.fetch_add(2);
+        m_nodes[ni].offset = c;
+        m_nodes[ni].count = 0;
+
+        if (n >= kParallelBuildThreshold) {
+            parallel_for(0, 2, 1, [&](int i) {
+                if (i == 0)
+                    buildNode(c, begin, mid, depth + 1, child_rb[0]);
+                else
+                    buildNode(c + 1, mid, end, depth + 1, child_rb[1]);
+            });
+        }
+        else {
+            buildNode(c, begin, mid, depth + 1, child_rb[0]);
+            buildNode(c + 1, mid, end, depth + 1, child_rb[1]);
+        }
+    }
+
+    std::vector<BuildPrimitive>& m_prims;
+    std::vector<BVHNodeCPU>& m_nodes;
+    BuildSettings m_settings;
+    std::atomic<uint32_t> m_node_count{ 0 };
+};
+
+
+// 10 bits per axis. bit 3n+2 is x, 3n+1 is y and 3n is z.
+inline uint32_t ExpandBits10(uint32_t v)
+{
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+inline int HighestBit(uint32_t v)
+{
+    int ret = 0;
+    while (v >>= 1)
+        ++ret;
+    return ret;
+}
+
+// stable LSD radix sort of 64 bit keys by [bit_begin, bit_end). 10 bits per pass.
+// each pass counts digits of chunks in parallel, then scatters them in parallel to the offsets given by the prefix sum.
+void RadixSort(std::vector<uint64_t>& keys, std::vector<uint64_t>& tmp, int bit_begin, int bit_end)
+{
+    const int kDigitBits = 10;
+    const int kDigits = 1 << kDigitBits;
+    const int kGrain = 1024 * 16;
+
+    int n = (int)keys.size();
+    int num_chunks = ceildiv(n, kGrain);
+    std::vector<uint32_t> offsets(num_chunks * kDigits);
+    tmp.resize(n);
+    for (int shift = bit_begin; shift < bit_end; shift += kDigitBits) {
+        std::fill(offsets.begin(), offsets.end(), 0);
+        parallel_for_blocked(0, n, kGrain, [&](int b, int e) {
+            uint32_t *counts = &offsets[(b / kGrain) * kDigits];
+            for (int i = b; i < e; ++i)
+                counts[(keys[i] >> shift) & (kDigits - 1)]++;
+        });
+
+        // digit major, chunk minor to keep the order of equal digits
+        uint32_t sum = 0;
+        for (int d = 0; d < kDigits; ++d) {
+            for (int c = 0; c < num_chunks; ++c) {
+                uint32_t count = offsets[c * kDigits + d];
+                offsets[c * kDigits + d] = sum;
+                sum += count;
+            }
+        }
+
+        parallel_for_blocked(0, n, kGrain, [&](int b, int e) {
+            uint32_t *pos = &offsets[(b / kGrain) * kDigits];
+            for (int i = b; i < e; ++i)
+                tmp[pos[(keys[i] >> shift) & (kDigits - 1)]++] = keys[i];
+        });
+        keys.swap(tmp);
+    }
+}
+
+// linear BVH. primitives are sorted by Morton codes of their centers, and each node is split at the highest bit
+// that differs in its range (equivalent of Karras 2012, but top-down to keep children adjacent as BVHBuilder does).
+class LinearBVHBuilder
+{
+public:
+    LinearBVHBuilder(std::vector<BuildPrimitive>& prims, std::vector<BVHNodeCPU>& nodes, int leaf_size)
+        : m_prims(prims), m_nodes(nodes), m_leaf_size(leaf_size)
+    {
+        m_nodes.resize(std::max<size_t>(prims.size() * 2 - 1, 1));
+    }
+
+    uint32_t build()
+    {
+        int n = (int)m_prims.size();
+        const int grain = kParallelBinningThreshold / 4;
+
+        auto cb = ParallelReduce(0, n, grain, RangeBounds(), [this](int b, int e, RangeBounds& dst) {
+            for (int i = b; i < e; ++i)
+                dst.cbounds.expand(m_prims[i].center);
+        }).cbounds;
+
+        // key: Morton code in upper 32 bits, primitive index in lower 32 bits
+        float3 cmin = cb.bmin;
+        float3 csize = cb.size();
+        float3 scale;
+        for (int a = 0; a < 3; ++a)
+            scale[a] = csize[a] > 0.0f ? 1023.0f / csize[a] : 0.0f;
+        std::vector<uint64_t> keys(n), tmp;
+        parallel_for_blocked(0, n, grain, [&](int b, int e) {
+            for (int i = b; i < e; ++i) {
+                float3 q = (m_prims[i].center - cmin) * scale;
+                uint32_t code =
+                    (ExpandBits10((uint32_t)clamp(q.x, 0.0f, 1023.0f)) << 2) |
+                    (ExpandBits10((uint32_t)clamp(q.y, 0.0f, 1023.0f)) << 1) |
+                    (ExpandBits10((uint32_t)clamp(q.z, 0.0f, 1023.0f)));
+                keys[i] = ((uint64_t)code << 32) | (uint32_t)i;
+            }
+        });
+        RadixSort(keys, tmp, 32, 62);
+
+        // reorder primitives
+        std::vector<BuildPrimitive> sorted(n);
+        m_codes.resize(n);
+        parallel_for_blocked(0, n, grain, [&](int b, int e) {
+            for (int i = b; i < e; ++i) {
+                sorted[i] = m_prims[(uint32_t)keys[i]];
+                m_codes[i] = (uint32_t)(keys[i] >> 32);
+            }
+        });
+        m_prims.swap(sorted);
+
+        m_node_count = 1;
+        buildNode(0, 0, n, 0);
+        return m_node_count;
+    }
+
+private:
+    // returns bounds of the node
+    AABB buildNode(uint32_t ni, uint32_t begin, uint32_t end, int depth)
+    {
+        auto& node = m_nodes[ni];
+        uint32_t n = end - begin;
+        if ((int)n <= m_leaf_size || depth >= BLASCPU::kMaxDepth - 1) {
+            AABB bounds;
+            for (uint32_t i = begin; i < end; ++i)
+                bounds.expand(m_prims[i].bounds);
+            node.bounds = bounds;
+            node.offset = begin;
+            node.count = n;
+            return bounds;
+        }
+
+        uint32_t mid;
+        uint32_t first = m_codes[begin], last = m_codes[end - 1];
+        if (first == last) {
+            // all codes are the same. just split in half
+            mid = begin + n / 2;
+        }
+        else {
+            // codes in the range share bits above 'bit'. the lower child is where 'bit' is 0.
+            int bit = HighestBit(first ^ last);
+            uint32_t mask = 1u << bit;
+            mid = (uint32_t)(std::partition_point(m_codes.begin() + begin, m_codes.begin() + end,
+                [mask](uint32_t c) { return (c & mask) == 0; }) - m_codes.begin());
+        }
+
+        uint32_t c = m_node_count.fetch_add(2);
+        node.offset = c;
+        node.count = 0;
+
+        AABB bounds[2];
+        if (n >= kParallelBuildThreshold) {
+            parallel_for(0, 2, 1, [&](int i) {
+                if (i == 0)
+                    bounds[0] = buildNode(c, begin, mid, depth + 1);
+                else
+                    bounds[1] = buildNode(c + 1, mid, end, depth + 1);
+            });
+        }
+        else {
+            bounds[0] = buildNode(c, begin, mid, depth + 1);
+            bounds[1] = buildNode(c + 1, mid, end, depth + 1);
+        }
+        bounds[0].expand(bounds[1]);
+        node.bounds = bounds[0];
+        return bounds[0];
+    }
+
+    std::vector<BuildPrimitive>& m_prims;
+    std::vector<BVHNodeCPU>& m_nodes;
+    std::vector<uint32_t> m_codes; // sorted Morton codes of m_prims
+    int m_leaf_size;
+    std::atomic<uint32_t> m_node_count{ 0 };
+};
+
+} // namespace
+
+
+void TriangleBlockCPU::clear()
+{
+    std::memset(this, 0, sizeof(*this));
+    for (auto& id : prim_id)
+        id = ~0u;
+}
+
+void TriangleBlockCPU::set(int lane, const float3 *p, uint32_t prim)
+{
+    for (int a = 0; a < 3; ++a) {
+        p0[a][lane] = p[0][a];
+        p1[a][lane] = p[1][a];
+        p2[a][lane] = p[2][a];
+    }
+    prim_id[lane] = prim;
+}
+
+
+void BLASCPU::build(const void *vertices, int vertex_stride, int vertex_count,
+    const void *indices, int index_stride, int index_count, BVHBuildQuality quality)
+{
+    clear();
+    if (!vertices || !indices || vertex_count == 0 || index_count < 3)
+        return;
+
+    auto begin_time = Now();
+    TriangleSourceCPU src{ (const char*)vertices, vertex_stride, vertex_count, (const char*)indices, index_stride, index_count };
+
+    // gather triangles
+    int triangle_count = src.getTriangleCount();
+    std::vector<BuildPrimitive> prims(triangle_count);
+    std::atomic<int> num_broken{ 0 };
+    parallel_for_blocked(0, triangle_count, 1024 * 16, [&](int begin, int end) {
+        float3 p[3];
+        for (int ti = begin; ti < end; ++ti) {
+            auto& prim = prims[ti];
+            prim.id = (uint32_t)ti;
+            if (!src.getTriangle(ti, p)) {
+                prim.id = ~0u; // broken index
+                ++num_broken;
+                continue;
+            }
+            prim.bounds.expand(p[0]);
+            prim.bounds.expand(p[1]);
+            prim.bounds.expand(p[2]);
+            prim.center = prim.bounds.center();
+        }
+    });
+    if (num_broken > 0)
+        prims.erase(std::remove_if(prims.begin(), prims.end(), [](auto& p) { return p.id == ~0u; }), prims.end());
+    if (prims.empty())
+        return;
+
+    if (quality == BVHBuildQuality::Linear) {
+        LinearBVHBuilder builder(prims, m_nodes, 4);
+        m_nodes.resize(builder.build());
+    }
+    else {
+        BuildSettings settings;
+        if (quality == BVHBuildQuality::FastBuild) {
+            settings.num_bins = 8;
+            settings.max_leaf_size = kMaxLeafSize;
+            settings.force_leaf_size = 4;
+        }
+        else {
+            settings.num_bins = kMaxBins;
+            settings.max_leaf_size = 4;
+            settings.force_leaf_size = 1;
+        }
+        // a leaf of 1 to 4 triangles costs one block test
+        settings.block_width = TriangleBlockCPU::kWidth;
+        BVHBuilder builder(prims, m_nodes, settings);
+        m_nodes.resize(builder.build());
+    }
+    m_bounds = m_nodes[0].bounds;
+
+    // leaves point to ranges of prims at this point. assign blocks to them in the same order,
+    // so that triangles of a subtree stay contiguous (CompressedBLASCPU relies on it).
+    uint32_t num_prims = (uint32_t)prims.size();
+    uint32_t node_count = (uint32_t)m_nodes.size();
+    std::vector<uint32_t> leaf_at(num_prims, ~0u); // leaf that starts at each prim
+    for (uint32_t ni = 0; ni < node_count; ++ni) {
+        if (m_nodes[ni].count != 0)
+            leaf_at[m_nodes[ni].offset] = ni;
+    }
+    std::vector<std::pair<uint32_t, uint32_t>> leaves; // node index, first prim
+    uint32_t block_count = 0;
+    for (uint32_t pi = 0; pi < num_prims; ++pi) {
+        uint32_t ni = leaf_at[pi];
+        if (ni == ~0u)
+            continue;
+        auto& leaf = m_nodes[ni];
+        leaves.push_back({ ni, pi });
+        leaf.offset = block_count;
+        block_count += getBlockCount(leaf);
+    }
+
+    // store triangles in leaf order
+    m_blocks.resize(block_count);
+    parallel_for_blocked(0, (int)leaves.size(), 1024 * 4, [&](int begin, int end) {
+        float3 p[3];
+        for (int li = begin; li < end; ++li) {
+            auto& leaf = m_nodes[leaves[li].first];
+            uint32_t first = leaves[li].second;
+            for (uint32_t bi = 0; bi < getBlockCount(leaf); ++bi)
+                m_blocks[leaf.offset + bi].clear();
+            for (uint32_t i = 0; i < leaf.count; ++i) {
+                uint32_t ti = prims[first + i].id;
+                src.getTriangle(ti, p);
+                m_blocks[leaf.offset + i / TriangleBlockCPU::kWidth].set(i % TriangleBlockCPU::kWidth, p, ti);
+            }
+        }
+    });
+
+    m_triangle_count = num_prims;
+    m_source_triangle_count = (uint32_t)triangle_count;
+    m_stats.build_time = Now() - begin_time;
+    m_stats.triangle_count = num_prims;
+    m_stats.node_count = node_count;
+    updateSAHCost();
+    m_built_sah_cost = m_stats.sah_cost;
+}
+
+bool BLASCPU::refit(const void *vertices, int vertex_stride, int vertex_count,
+    const void *indices, int index_stride, int index_count)
+{
+    if (m_nodes.empty() || !vertices || !indices || (uint32_t)(index_count / 3) != m_source_triangle_count)
+        return false;
+
+    auto begin_time = Now();
+    TriangleSourceCPU src{ (const char*)vertices, vertex_stride, vertex_count, (const char*)indices, index_stride, index_count };
+
+    // update triangles and bounds of leaves. leaves don't share blocks so this can be done in parallel.
+    // only nodes whose bounds have changed are updated, and parents of unchanged nodes are not visited.
+    std::atomic<int> num_broken{ 0 };
+    uint32_t node_count = (uint32_t)m_nodes.size();
+    std::vector<uint8_t> changed(node_count, 0);
+    parallel_for_blocked(0, (int)node_count, 1024 * 4, [&](int begin, int end) {
+        float3 p[3];
+        for (int ni = begin; ni < end; ++ni) {
+            auto& node = m_nodes[ni];
+            if (node.count == 0)
+                continue;
+            AABB bounds;
+            bool blocks_changed = false;
+            uint32_t block_count = getBlockCount(node);
+            for (uint32_t bi = 0; bi < block_count; ++bi) {
+                auto& block = m_blocks[node.offset + bi];
+                TriangleBlockCPU tmp = block;
+                int lanes = std::min((int)TriangleBlockCPU::kWidth, (int)(node.count - bi * TriangleBlockCPU::kWidth));
+                for (int lane = 0; lane < lanes; ++lane) {
+                    if (!src.getTriangle(tmp.prim_id[lane], p)) {
+                        ++num_broken;
+                        break;
+                    }
+                    bounds.expand(p[0]);
+                    bounds.expand(p[1]);
+                    bounds.expand(p[2]);
+                    tmp.set(lane, p, tmp.prim_id[lane]);
+                }
+                if (std::memcmp(&tmp, &block, sizeof(tmp)) != 0) {
+                    block = tmp;
+                    blocks_changed = true;
+                }
+            }
+            if (blocks_changed || node.bounds != bounds) {
+                node.bounds = bounds;
+                changed[ni] = 1;
+            }
+        }
+    });
+    if (num_broken > 0)
+        return false;
+
+    // children are always allocated after their parent. so visiting nodes in reverse order updates children first.
+    for (uint32_t ni = node_count; ni-- > 0; ) {
+        auto& node = m_nodes[ni];
+        if (node.count == 0 && (changed[node.offset] || changed[node.offset + 1])) {
+            AABB bounds = m_nodes[node.offset].bounds;
+            bounds.expand(m_nodes[node.offset + 1].bounds);
+            if (node.bounds != bounds) {
+                node.bounds = bounds;
+                changed[ni] = 1;
+            }
+        }
+    }
+    m_bounds = m_nodes[0].bounds;
+
+    m_stats.build_time = Now() - begin_time;
+    m_stats.refit = true;
+    if (std::find(changed.begin(), changed.end(), 1) != changed.end())
+        updateSAHCost();
+    return m_stats.sah_cost <= m_built_sah_cost * kRebuildThreshold;
+}
+
+void BLASCPU::updateSAHCost()
+{
+    m_stats.depth = 0;
+    m_stats.leaf_count = 0;
+    float root_area = m_bounds.area();
+    m_stats.sah_cost = computeSAHCost(0, 1) / (root_area > 0.0f ? root_area : 1.0f);
+}
+
+float BLASCPU::computeSAHCost(uint32_t ni, uint32_t depth)
+{
+    auto& node = m_nodes[ni];
+    m_stats.depth = std::max(m_stats.depth, depth);
+    if (node.count != 0) {
+        m_stats.leaf_count++;
+        return node.bounds.area() * kIntersectionCost * getBlockCount(node);
+    }
+    return node.bounds.area() * kTraversalCost +
+        computeSAHCost(node.offset, depth + 1) +
+        computeSAHCost(node.offset + 1, depth + 1);
+}
+
+void BLASCPU::clear()
+{
+    m_nodes.clear();
+    m_blocks.clear();
+    m_triangle_count = 0;
+    m_bounds = {};
+    m_stats = {};
+    m_source_triangle_count = 0;
+    m_built_sah_cost = 0.0f;
+}
+
+bool BLASCPU::empty() const
+{
+    return m_nodes.empty();
+}
+
+const AABB& BLASCPU::getBounds() const
+{
+    return m_bounds;
+}
+
+size_t BLASCPU::getTriangleCount() const
+{
+    return m_triangle_count;
+}
+
+const BVHBuildStatsCPU& BLASCPU::getBuildStats() const
+{
+    return m_stats;
+}
+
+size_t BLASCPU::getMemoryUsage() const
+{
+    return sizeof(BVHNodeCPU) * m_nodes.size() +
+        sizeof(TriangleBlockCPU) * m_blocks.size();
+}
+
+
+void BLASUpdateReportCPU::merge(const BLASUpdateReportCPU& v)
+{
+    uint32_t total = triangle_count + v.triangle_count;
+    for (int m = 0; m < MethodCount; ++m) {
+        auto& dst = entries[m];
+        auto& src = v.entries[m];
+        dst.build_time += src.build_time;
+        dst.trace_time += src.trace_time;
+        dst.hit_count += src.hit_count;
+        if (total > 0)
+            dst.sah_cost = (dst.sah_cost * triangle_count + src.sah_cost * v.triangle_count) / total;
+    }
+    mesh_count += v.mesh_count;
+    triangle_count = total;
+    ray_count += v.ray_count;
+}
+
+std::string BLASUpdateReportCPU::toString() const
+{
+    static const char *names[MethodCount]{ "refit", "LBVH", "SAH" };
+
+    char buf[256];
+    std::string ret;
+    snprintf(buf, sizeof(buf), "BLAS update report: %u meshes, %u triangles, %u rays\n", mesh_count, triangle_count, ray_count);
+    ret += buf;
+    for (int m = 0; m < MethodCount; ++m) {
+        auto& e = entries[m];
+        snprintf(buf, sizeof(buf), "  %s: build %.2fms, trace %.2fms (%u hits), SAH cost %.2f\n",
+            names[m], NS2MS(e.build_time), NS2MS(e.trace_time), e.hit_count, e.sah_cost);
+        ret += buf;
+    }
+    if (ray_count == 0)
+        return ret;
+
+    // the cheapest method for each range of ray count is the lower envelope of build_time + rays * (trace_time / ray_count).
+    auto slope = [&](int m) { return (double)entries[m].trace_time / ray_count; };
+    int cur = 0;
+    for (int m = 1; m < MethodCount; ++m) {
+        auto& a = entries[m];
+        auto& b = entries[cur];
+        if (a.build_time < b.build_time || (a.build_time == b.build_time && a.trace_time < b.trace_time))
+            cur = m;
+    }
+    ret += "  best:";
+    double rays = 0.0;
+    for (;;) {
+        int next = -1;
+        double next_rays = DBL_MAX;
+        for (int m = 0; m < MethodCount; ++m) {
+            if (slope(m) >= slope(cur))
+                continue;
+            double r = ((double)entries[m].build_time - (double)entries[cur].build_time) / (slope(cur) - slope(m));
+            if (r >= rays && r < next_rays) {
+                next = m;
+                next_rays = r;
+            }
+        }
+        if (next < 0) {
+            snprintf(buf, sizeof(buf), rays == 0.0 ? " %s at any ray count\n" : " %s above\n", names[cur]);
+            ret += buf;
+            break;
+        }
+        snprintf(buf, sizeof(buf), " %s below %.0f rays per frame,", names[cur], next_rays);
+        ret += buf;
+        cur = next;
+        rays = next_rays;
+    }
+    return ret;
+}
+
+BLASUpdateReportCPU EvaluateBLASUpdateCPU(const BLASCPU& blas,
+    const void *vertices, int vertex_stride, int vertex_count,
+    const void *indices, int index_stride, int index_count)
+{
+    const int kRayCount = 1024;
+
+    BLASUpdateReportCPU ret;
+    if (blas.empty())
+        return ret;
+
+    BLASCPU candidates[BLASUpdateReportCPU::MethodCount];
+    candidates[BLASUpdateReportCPU::Refit] = blas;
+    candidates[BLASUpdateReportCPU::Refit].refit(vertices, vertex_stride, vertex_count, indices, index_stride, index_count);
+    candidates[BLASUpdateReportCPU::Linear].build(vertices, vertex_stride, vertex_count, indices, index_stride, index_count, BVHBuildQuality::Linear);
+    candidates[BLASUpdateReportCPU::SAH].build(vertices, vertex_stride, vertex_count, indices, index_stride, index_count, BVHBuildQuality::FastTrace);
+    auto& bounds = candidates[BLASUpdateReportCPU::SAH].getBounds();
+    if (!bounds.valid())
+        return ret;
+
+    // rays from a sphere around the mesh toward random points in the bounds. the same rays for all candidates.
+    std::vector<RayCPU> rays(kRayCount);
+    {
+        std::mt19937 rng(0);
+        std::uniform_real_distribution<float> d01(0.0f, 1.0f);
+        float3 center = bounds.center();
+        float3 size = bounds.size();
+        float radius = length(size);
+        for (auto& ray : rays) {
+            float3 dir = normalize(float3{ d01(rng) - 0.5f, d01(rng) - 0.5f, d01(rng) - 0.5f } + float3{ 1e-6f, 0.0f, 0.0f });
+            float3 target = bounds.bmin + size * float3{ d01(rng), d01(rng), d01(rng) };
+            ray.origin = center + dir * radius;
+            ray.direction = normalize(target - ray.origin);
+        }
+    }
+
+    ret.mesh_count = 1;
+    ret.triangle_count = (uint32_t)blas.getTriangleCount();
+    ret.ray_count = kRayCount;
+    for (int m = 0; m < BLASUpdateReportCPU::MethodCount; ++m) {
+        auto& c = candidates[m];
+        auto& e = ret.entries[m];
+        e.build_time = c.getBuildStats().build_time;
+        e.sah_cost = c.getBuildStats().sah_cost;
+
+        auto begin_time = Now();
+        for (auto ray : rays) {
+            RayHitCPU hit;
+            if (c.intersect(ray, hit, CullMode::None, [](RayHitCPU&) { return true; }))
+                ++e.hit_count;
+        }
+        e.trace_time = Now() - begin_time;
+    }
+    return ret;
+}
+
+
+
+void TLASCPU::build(const AABB *bounds, const InstanceMaskCPU *masks, uint32_t instance_count)
+{
+    clear();
+    if (instance_count == 0)
+        return;
+
+    std::vector<BuildPrimitive> prims(instance_count);
+    for (uint32_t i = 0; i < instance_count; ++i)
+        prims[i] = { bounds[i], bounds[i].center(), i };
+
+    // one instance per leaf. multiple instances go to a leaf only when the tree reaches kMaxDepth.
+    BuildSettings settings{ kMaxBins, 1, 1, 1 };
+    BVHBuilder builder(prims, m_nodes, settings);
+    m_nodes.resize(builder.build());
+
+    uint32_t node_count = (uint32_t)m_nodes.size();
+    m_masks.assign(node_count, InstanceMaskCPU());
+    m_parents.assign(node_count, ~0u);
+    m_leaves.resize(instance_count);
+    m_instances.resize(instance_count);
+    for (uint32_t i = 0; i < instance_count; ++i)
+        m_instances[i] = prims[i].id;
+    for (uint32_t ni = 0; ni < node_count; ++ni) {
+        auto& node = m_nodes[ni];
+        if (node.count == 0) {
+            m_parents[node.offset] = ni;
+            m_parents[node.offset + 1] = ni;
+        }
+        else {
+            for (uint32_t i = node.offset; i < node.offset + node.count; ++i) {
+                m_leaves[m_instances[i]] = ni;
+                m_masks[ni].expand(masks[m_instances[i]]);
+            }
+        }
+        m_cost_sum += getNodeCost(ni);
+    }
+    // children are always after their parent. aggregate masks bottom-up
+    for (uint32_t ni = node_count; ni-- > 0; ) {
+        auto& node = m_nodes[ni];
+        if (node.count == 0) {
+            m_masks[ni].expand(m_masks[node.offset]);
+            m_masks[ni].expand(m_masks[node.offset + 1]);
+        }
+    }
+    m_built_sah_cost = getSAHCost();
+}
+
+bool TLASCPU::refit(const AABB *bounds, const InstanceMaskCPU *masks, const uint32_t *updated, uint32_t update_count)
+{
+    if (m_nodes.empty())
+        return false;
+
+    for (uint32_t ui = 0; ui < update_count; ++ui) {
+        uint32_t ii = updated[ui];
+        if (ii >= m_leaves.size())
+            return false;
+
+        uint32_t ni = m_leaves[ii];
+        AABB b;
+        InstanceMaskCPU m;
+        auto& leaf = m_nodes[ni];
+        for (uint32_t i = leaf.offset; i < leaf.offset + leaf.count; ++i) {
+            b.expand(bounds[m_instances[i]]);
+            m.expand(masks[m_instances[i]]);
+        }
+
+        // walk up to the root. stop when neither bounds nor masks change as ancestors are not affected in that case.
+        for (;;) {
+            auto& node = m_nodes[ni];
+            if (node.bounds == b && m_masks[ni] == m)
+                break;
+            m_cost_sum -= getNodeCost(ni);
+            node.bounds = b;
+            m_masks[ni] = m;
+            m_cost_sum += getNodeCost(ni);
+
+            ni = m_parents[ni];
+            if (ni == ~0u)
+                break;
+            auto& parent = m_nodes[ni];
+            b = m_nodes[parent.offset].bounds;
+            b.expand(m_nodes[parent.offset + 1].bounds);
+            m = m_masks[parent.offset];
+            m.expand(m_masks[parent.offset + 1]);
+        }
+    }
+    return getSAHCost() <= m_built_sah_cost * kRebuildThreshold;
+}
+
+void TLASCPU::clear()
+{
+    m_nodes.clear();
+    m_masks.clear();
+    m_parents.clear();
+    m_leaves.clear();
+    m_instances.clear();
+    m_cost_sum = 0.0;
+    m_built_sah_cost = 0.0f;
+}
+
+bool TLASCPU::empty() const
+{
+    return m_nodes.empty();
+}
+
+uint32_t TLASCPU::getInstanceCount() const
+{
+    return (uint32_t)m_instances.size();
+}
+
+size_t TLASCPU::getMemoryUsage() const
+{
+    return sizeof(BVHNodeCPU) * m_nodes.size() + sizeof(InstanceMaskCPU) * m_masks.size() +
+        sizeof(uint32_t) * (m_parents.size() + m_leaves.size() + m_instances.size());
+}
+
+float TLASCPU::getSAHCost() const
+{
+    if (m_nodes.empty())
+        return 0.0f;
+    float root_area = m_nodes[0].bounds.area();
+    return float(m_cost_sum / (root_area > 0.0f ? root_area : 1.0f));
+}
+
+float TLASCPU::getNodeCost(uint32_t ni) const
+{
+    auto& node = m_nodes[ni];
+    return node.bounds.area() * (node.count == 0 ? kTraversalCost : kIntersectionCost * node.count);
+}
+
+} // namespace rths
@@ -0,0 +1,779 @@
+#pragma once
+#include "rthsTypes.h"
+#include "Foundation/rthsMisc.h"
+#include "Foundation/rthsSIMD.h"
+
+namespace rths {
+
+struct AABB
+{
+    float3 bmin{ FLT_MAX, FLT_MAX, FLT_MAX };
+    float3 bmax{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+    bool valid() const { return bmin.x <= bmax.x && bmin.y <= bmax.y && bmin.z <= bmax.z; }
+    float3 center() const { return (bmin + bmax) * 0.5f; }
+    float3 size() const { return bmax - bmin; }
+    float area() const
+    {
+        if (!valid())
+            return 0.0f;
+        auto s = size();
+        return 2.0f * (s.x * s.y + s.y * s.z + s.z * s.x);
+    }
+    void expand(const float3& p)
+    {
+        bmin = min(bmin, p);
+        bmax = max(bmax, p);
+    }
+    void expand(const AABB& v)
+    {
+        bmin = min(bmin, v.bmin);
+        bmax = max(bmax, v.bmax);
+    }
+    bool operator==(const AABB& v) const { return bmin == v.bmin && bmax == v.bmax; }
+    bool operator!=(const AABB& v) const { return !((*this) == v); }
+};
+
+// transform all 8 corners and take bounds of them
+AABB TransformAABB(const AABB& v, const float4x4& m);
+
+enum class CullMode : uint32_t
+{
+    None,
+    Back,
+    Front,
+};
+
+struct RayCPU
+{
+    float3 origin{};
+    float tmin = 0.0f;
+    float3 direction{};
+    float tmax = FLT_MAX;
+};
+
+struct RayHitCPU
+{
+    float t = FLT_MAX;
+    float u = 0.0f;
+    float v = 0.0f;
+    uint32_t prim_id = ~0u;
+    uint32_t instance_id = ~0u;
+    bool front_face = true;
+
+    bool valid() const { return prim_id != ~0u; }
+};
+
+// precomputed values for ray vs AABB slab test
+struct RayBoxTestCPU
+{
+    float3 origin;
+    float3 inv_dir;
+
+    RayBoxTestCPU(const RayCPU& ray)
+    {
+        origin = ray.origin;
+        inv_dir = { 1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z };
+    }
+
+    // returns entry distance. FLT_MAX if not intersected
+    float test(const AABB& box, float tmin, float tmax) const
+    {
+        float3 t0 = (box.bmin - origin) * inv_dir;
+        float3 t1 = (box.bmax - origin) * inv_dir;
+        float3 tn = min(t0, t1);
+        float3 tf = max(t0, t1);
+        float enter = std::max(std::max(tn.x, tn.y), std::max(tn.z, tmin));
+        float exit = std::min(std::min(tf.x, tf.y), std::min(tf.z, tmax));
+        return enter <= exit ? enter : FLT_MAX;
+    }
+};
+
+// precomputed values for the watertight ray vs triangle test (Woop, Benthin and Wald 2013).
+// triangles are translated to the ray origin, the axes are permuted so that kz is the largest component of the direction,
+// and sheared so that the ray goes along +z. edge functions then depend only on the two vertices of the edge, so neighboring
+// triangles agree on which side of a shared edge a ray passes and no ray slips through between them.
+// kx and ky are swapped if the direction on kz is negative to keep the winding.
+struct RayTriangleTestCPU
+{
+    float3 origin;
+    int kx, ky, kz;
+    float sx, sy, sz;
+    // broadcasts of the above for IntersectTriangleBlock(). made once per ray instead of once per block
+    simd4f ox4, oy4, oz4, sx4, sy4, sz4;
+
+    RayTriangleTestCPU(const RayCPU& ray)
+    {
+        const float3& d = ray.direction;
+        float3 ad{ std::abs(d.x), std::abs(d.y), std::abs(d.z) };
+        kz = ad.x > ad.y ? (ad.x > ad.z ? 0 : 2) : (ad.y > ad.z ? 1 : 2);
+        kx = kz == 2 ? 0 : kz + 1;
+        ky = kx == 2 ? 0 : kx + 1;
+        if (d[kz] < 0.0f)
+            std::swap(kx, ky);
+        origin = ray.origin;
+        sx = d[kx] / d[kz];
+        sy = d[ky] / d[kz];
+        sz = 1.0f / d[kz];
+        ox4 = simd4f(origin[kx]);
+        oy4 = simd4f(origin[ky]);
+        oz4 = simd4f(origin[kz]);
+        sx4 = simd4f(sx);
+        sy4 = simd4f(sy);
+        sz4 = simd4f(sz);
+    }
+};
+
+// watertight test. front face is clockwise when viewed from the ray origin (same as DXR's default).
+// u and v are barycentrics of p1 and p2. rays exactly on an edge hit both triangles of the edge.
+inline bool IntersectTriangle(const RayCPU& ray, const RayTriangleTestCPU& rt, const float3& p0, const float3& p1, const float3& p2, CullMode cull, RayHitCPU& hit)
+{
+    const int kx = rt.kx, ky = rt.ky, kz = rt.kz;
+    float3 a = p0 - rt.origin;
+    float3 b = p1 - rt.origin;
+    float3 c = p2 - rt.origin;
+    float ax = a[kx] - rt.sx * a[kz];
+    float ay = a[ky] - rt.sy * a[kz];
+    float bx = b[kx] - rt.sx * b[kz];
+    float by = b[ky] - rt.sy * b[kz];
+    float cx = c[kx] - rt.sx * c[kz];
+    float cy = c[ky] - rt.sy * c[kz];
+
+    // scaled barycentrics: edge functions of the edges opposite to p0, p1 and p2
+    float w0 = cx * by - cy * bx;
+    float w1 = ax * cy - ay * cx;
+    float w2 = bx * ay - by * ax;
+    if ((w0 < 0.0f || w1 < 0.0f || w2 < 0.0f) && (w0 > 0.0f || w1 > 0.0f || w2 > 0.0f))
+        return false;
+    float det = w0 + w1 + w2;
+    if (det == 0.0f)
+        return false;
+    bool front = det > 0.0f;
+    if ((cull == CullMode::Back && !front) || (cull == CullMode::Front && front))
+        return false;
+
+    float idet = 1.0f / det;
+    float t = (w0 * (rt.sz * a[kz]) + w1 * (rt.sz * b[kz]) + w2 * (rt.sz * c[kz])) * idet;
+    if (t < ray.tmin || t > ray.tmax)
+        return false;
+
+    hit.t = t;
+    hit.u = w1 * idet;
+    hit.v = w2 * idet;
+    hit.front_face = front;
+    return true;
+}
+
+inline bool IntersectTriangle(const RayCPU& ray, const float3& p0, const float3& p1, const float3& p2, CullMode cull, RayHitCPU& hit)
+{
+    return IntersectTriangle(ray, RayTriangleTestCPU(ray), p0, p1, p2, cull, hit);
+}
+
+// 4 triangles in SoA layout. vertices are stored per axis so that the permutation of RayTriangleTestCPU is just a choice
+// of rows, and a block is intersected with one SSE pass that gives the same results as IntersectTriangle() for each triangle.
+// unused lanes have zero vertices (never hit) and prim_id ~0.
+struct TriangleBlockCPU
+{
+    static const int kWidth = 4;
+
+    float p0[3][kWidth];
+    float p1[3][kWidth];
+    float p2[3][kWidth];
+    uint32_t prim_id[kWidth];
+
+    void clear();
+    void set(int lane, const float3 *p, uint32_t prim);
+};
+
+// returns bit mask of triangles hit in [ray.tmin, ray.tmax]. t, u, v and front faces (bit mask) of them are stored to dst.
+inline int IntersectTriangleBlock(const RayCPU& ray, const RayTriangleTestCPU& rt, const TriangleBlockCPU& b, CullMode cull, float *t, float *u, float *v, int& front)
+{
+    // same operations in the same order as IntersectTriangle(). comparisons are written to reject NaN in the same way.
+    const simd4f zero(0.0f), one(1.0f);
+    const int kx = rt.kx, ky = rt.ky, kz = rt.kz;
+    const simd4f ox = rt.ox4, oy = rt.oy4, oz = rt.oz4;
+    const simd4f sx = rt.sx4, sy = rt.sy4, sz = rt.sz4;
+
+    simd4f az = simd4f::load(b.p0[kz]) - oz;
+    simd4f bz = simd4f::load(b.p1[kz]) - oz;
+    simd4f cz = simd4f::load(b.p2[kz]) - oz;
+    simd4f ax = (simd4f::load(b.p0[kx]) - ox) - sx * az;
+    simd4f ay = (simd4f::load(b.p0[ky]) - oy) - sy * az;
+    simd4f bx = (simd4f::load(b.p1[kx]) - ox) - sx * bz;
+    simd4f by = (simd4f::load(b.p1[ky]) - oy) - sy * bz;
+    simd4f cx = (simd4f::load(b.p2[kx]) - ox) - sx * cz;
+    simd4f cy = (simd4f::load(b.p2[ky]) - oy) - sy * cz;
+
+    simd4f w0 = cx * by - cy * bx;
+    simd4f w1 = ax * cy - ay * cx;
+    simd4f w2 = bx * ay - by * ax;
+    simd4f neg = (w0 < zero) | (w1 < zero) | (w2 < zero);
+    simd4f pos = (w0 > zero) | (w1 > zero) | (w2 > zero);
+    simd4f det = w0 + w1 + w2;
+    simd4f fmask = det > zero;
+    simd4f valid = andnot(neg & pos, det != zero);
+    if (cull == CullMode::Back)
+        valid = valid & fmask;
+    else if (cull == CullMode::Front)
+        valid = andnot(fmask, valid);
+    if (movemask(valid) == 0)
+        return 0;
+
+    simd4f idet = one / det;
+    simd4f vt = (w0 * (sz * az) + w1 * (sz * bz) + w2 * (sz * cz)) * idet;
+    valid = andnot((vt < simd4f(ray.tmin)) | (vt > simd4f(ray.tmax)), valid);
+
+    int mask = movemask(valid);
+    if (mask) {
+        vt.store(t);
+        (w1 * idet).store(u);
+        (w2 * idet).store(v);
+        front = movemask(fmask);
+    }
+    return mask;
+}
+
+// strided vertex / index buffers of a mesh
+struct TriangleSourceCPU
+{
+    const char *vertices = nullptr;
+    int vertex_stride = 0;
+    int vertex_count = 0;
+    const char *indices = nullptr;
+    int index_stride = 0; // 2 or 4
+    int index_count = 0;
+
+    int getTriangleCount() const { return index_count / 3; }
+
+    uint32_t getIndex(int i) const
+    {
+        if (index_stride == 2)
+            return ((const uint16_t*)indices)[i];
+        else
+            return ((const uint32_t*)indices)[i];
+    }
+
+    const float3& getVertex(uint32_t i) const
+    {
+        return *(const float3*)(vertices + vertex_stride * i);
+    }
+
+    // returns false if the triangle has broken indices
+    bool getTriangle(uint32_t ti, float3 *dst) const
+    {
+        for (int i = 0; i < 3; ++i) {
+            uint32_t vi = getIndex(ti * 3 + i);
+            if (vi >= (uint32_t)vertex_count)
+                return false;
+            dst[i] = getVertex(vi);
+        }
+        return true;
+    }
+};
+
+
+struct BVHNodeCPU
+{
+    AABB bounds;
+    uint32_t offset = 0; // inner node: index of the first child (children are always adjacent). leaf: first triangle block (BLAS) or instance (TLAS)
+    uint32_t count = 0;  // number of triangles. 0 if inner node
+};
+
+// equivalent of D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE / PREFER_FAST_BUILD
+enum class BVHBuildQuality : uint32_t
+{
+    FastTrace,
+    FastBuild,
+    Linear, // linear BVH (sorted Morton codes). much faster to build than FastBuild but lower quality. for meshes deformed every frame
+};
+
+struct BVHBuildStatsCPU
+{
+    nanosec build_time = 0;
+    float sah_cost = 0.0f; // relative to the root. lower is better
+    uint32_t triangle_count = 0;
+    uint32_t node_count = 0;
+    uint32_t leaf_count = 0;
+    uint32_t depth = 0;
+    bool refit = false; // updated by refit() instead of build()
+};
+
+// bottom level acceleration structure. built from strided vertex / index buffers with binned SAH.
+// holds a copy of triangles in TriangleBlockCPU. each leaf has its own blocks, so the last block of a leaf can be partially used.
+class BLASCPU
+{
+public:
+    static const int kMaxLeafSize = 8;
+    static const int kMaxDepth = 64;
+    // refit() fails if SAH cost becomes larger than (cost at build time * this)
+    static constexpr float kRebuildThreshold = 1.5f;
+
+    // index_stride must be 2 or 4 (16 / 32 bit indices).
+    // vertex_stride can be larger than float3. e.g. sizeof(float4) for deformed vertices (same layout as rthsDeform.hlsl writes).
+    void build(const void *vertices, int vertex_stride, int vertex_count,
+        const void *indices, int index_stride, int index_count,
+        BVHBuildQuality quality = BVHBuildQuality::FastTrace);
+    // update bounds with new vertex positions, keeping the tree topology. indices must be the same as the last build().
+    // returns false if the tree has degraded too much or the inputs don't match the tree. build() is needed in that case.
+    bool refit(const void *vertices, int vertex_stride, int vertex_count,
+        const void *indices, int index_stride, int index_count);
+    void clear();
+    bool empty() const;
+    const AABB& getBounds() const;
+    size_t getTriangleCount() const;
+    const BVHBuildStatsCPU& getBuildStats() const;
+    size_t getMemoryUsage() const; // in bytes
+
+    // raw data for custom traversals (e.g. ray packets). leaf.offset is the index of the first block.
+    const BVHNodeCPU* getNodes() const { return m_nodes.data(); }
+    const TriangleBlockCPU* getBlocks() const { return m_blocks.data(); }
+    uint32_t getNodeCount() const { return (uint32_t)m_nodes.size(); }
+    static uint32_t getBlockCount(const BVHNodeCPU& leaf) { return (leaf.count + TriangleBlockCPU::kWidth - 1) / TriangleBlockCPU::kWidth; }
+
+    // closest hit. ray.tmax is updated on hit.
+    // Filter: [](RayHitCPU& hit) -> bool. returns false to ignore the hit (equivalent of IgnoreHit()).
+    template<class Filter>
+    bool intersect(RayCPU& ray, RayHitCPU& hit, CullMode cull, const Filter& filter) const;
+
+    // any hit. returns true at the first hit accepted by the filter (equivalent of AcceptHitAndEndSearch()).
+    // Filter: [](RayHitCPU& hit) -> bool. same as intersect().
+    // leaf: if not null, receives the node index of the leaf of the accepted hit.
+    template<class Filter>
+    bool occluded(const RayCPU& ray, CullMode cull, const Filter& filter, uint32_t *leaf = nullptr) const;
+    // any hit against triangles of a single leaf given by occluded(). coherent rays are likely blocked by the same triangles.
+    template<class Filter>
+    bool occludedLeaf(uint32_t leaf, const RayCPU& ray, CullMode cull, const Filter& filter) const;
+
+    // same as above, but triangles are read from the source buffers (src must be the buffers of the last build() or refit()).
+    // slower. for benchmarks of the block layout.
+    template<class Filter>
+    bool intersect(RayCPU& ray, RayHitCPU& hit, CullMode cull, const Filter& filter, const TriangleSourceCPU& src) const;
+    template<class Filter>
+    bool occluded(const RayCPU& ray, CullMode cull, const Filter& filter, const TriangleSourceCPU& src) const;
+
+private:
+    float computeSAHCost(uint32_t ni, uint32_t depth);
+    void updateSAHCost();
+
+    template<class Filter>
+    bool intersectLeaf(const BVHNodeCPU& leaf, RayCPU& ray, const RayTriangleTestCPU& rt, RayHitCPU& hit, CullMode cull, const Filter& filter) const;
+    template<class Filter>
+    bool intersectLeaf(const BVHNodeCPU& leaf, RayCPU& ray, const RayTriangleTestCPU& rt, RayHitCPU& hit, CullMode cull, const Filter& filter, const TriangleSourceCPU& src) const;
+    template<class Filter>
+    bool occludedLeaf(const BVHNodeCPU& leaf, const RayCPU& ray, const RayTriangleTestCPU& rt, CullMode cull, const Filter& filter) const;
+    template<class Filter>
+    bool occludedLeaf(const BVHNodeCPU& leaf, const RayCPU& ray, const RayTriangleTestCPU& rt, CullMode cull, const Filter& filter, const TriangleSourceCPU& src) const;
+
+    std::vector<BVHNodeCPU> m_nodes;
+    std::vector<TriangleBlockCPU> m_blocks; // in leaf order
+    size_t m_triangle_count = 0;
+    AABB m_bounds;
+    BVHBuildStatsCPU m_stats;
+    uint32_t m_source_triangle_count = 0; // index_count / 3 of the last build(). refit() requires the same
+    float m_built_sah_cost = 0.0f;
+};
+using BLASCPUPtr = std::shared_ptr<BLASCPU>;
+
+
+// build time and trace time of each way to update BLAS of a deformed mesh. made by EvaluateBLASUpdateCPU().
+// the best one depends on the number of rays traced per frame: total cost is build_time + ray count * trace time per ray.
+struct BLASUpdateReportCPU
+{
+    enum Method
+    {
+        Refit,
+        Linear,
+        SAH, // FastTrace
+        MethodCount,
+    };
+    struct Entry
+    {
+        nanosec build_time = 0;
+        nanosec trace_time = 0;
+        float sah_cost = 0.0f; // triangle count weighted average
+        uint32_t hit_count = 0; // should be the same for all methods
+    };
+
+    uint32_t mesh_count = 0;
+    uint32_t triangle_count = 0;
+    uint32_t ray_count = 0;
+    Entry entries[MethodCount];
+
+    void merge(const BLASUpdateReportCPU& v);
+    std::string toString() const;
+};
+
+// blas: BLAS built from the previous vertices. rebuilds and refits copies of it with the new vertices,
+// and traces random rays against each of them. blas is not modified.
+BLASUpdateReportCPU EvaluateBLASUpdateCPU(const BLASCPU& blas,
+    const void *vertices, int vertex_stride, int vertex_count,
+    const void *indices, int index_stride, int index_count);
+
+
+// top level acceleration structure. BVH over world space bounds of instances.
+// refit() updates only the paths from the updated leaves to the root, so its cost scales with the number of updated instances.
+// camera / shadow bits (see GetInstanceMask()) and MeshInstanceData::layer_mask.
+// TLAS nodes hold the OR of the masks of all instances below them, so traversal can skip subtrees that can't match the ray.
+struct InstanceMaskCPU
+{
+    uint32_t instance_mask = 0;
+    uint32_t layer_mask = 0;
+
+    void expand(const InstanceMaskCPU& v)
+    {
+        instance_mask |= v.instance_mask;
+        layer_mask |= v.layer_mask;
+    }
+    bool test(const InstanceMaskCPU& v) const { return (instance_mask & v.instance_mask) != 0 && (layer_mask & v.layer_mask) != 0; }
+    bool operator==(const InstanceMaskCPU& v) const { return instance_mask == v.instance_mask && layer_mask == v.layer_mask; }
+    bool operator!=(const InstanceMaskCPU& v) const { return !(*this == v); }
+};
+
+class TLASCPU
+{
+public:
+    // refit() fails if SAH cost becomes larger than (cost at build time * this)
+    static constexpr float kRebuildThreshold = 1.5f;
+
+    void build(const AABB *bounds, const InstanceMaskCPU *masks, uint32_t instance_count);
+    // bounds, masks: of all instances. updated: indices of instances whose bounds or masks have changed.
+    // returns false if the tree has degraded too much. build() is needed in that case.
+    bool refit(const AABB *bounds, const InstanceMaskCPU *masks, const uint32_t *updated, uint32_t update_count);
+    void clear();
+    bool empty() const;
+    uint32_t getInstanceCount() const;
+    float getSAHCost() const; // current. relative to the root
+    size_t getMemoryUsage() const; // in bytes
+
+    // raw data for custom traversals (e.g. ray packets)
+    const BVHNodeCPU* getNodes() const { return m_nodes.data(); }
+    const uint32_t* getInstances() const { return m_instances.data(); }
+    const InstanceMaskCPU* getNodeMasks() const { return m_masks.data(); }
+
+    // Body: [](uint32_t instance_index) -> void. called for instances whose bounds are hit by the ray, near to far.
+    // the body can shrink ray.tmax to cull farther instances.
+    // subtrees that don't match ray_mask are skipped. instances are not tested individually; the body still has to check them.
+    template<class Body>
+    void traverse(RayCPU& ray, const InstanceMaskCPU& ray_mask, const Body& body) const;
+
+    // Body: [](uint32_t instance_index) -> bool. returns true to end the traversal. the order is the same as BLASCPU::occluded().
+    // returns true if the traversal is ended by the body.
+    template<class Body>
+    bool traverseAny(const RayCPU& ray, const InstanceMaskCPU& ray_mask, const Body& body) const;
+
+private:
+    float getNodeCost(uint32_t ni) const;
+
+    std::vector<BVHNodeCPU> m_nodes;
+    std::vector<InstanceMaskCPU> m_masks; // aggregated mask of each node
+    std::vector<uint32_t> m_parents;   // parent node index of each node. ~0 for the root
+    std::vector<uint32_t> m_leaves;    // leaf node index of each instance
+    std::vector<uint32_t> m_instances; // instance indices in leaf order
+    double m_cost_sum = 0.0;           // sum of getNodeCost() of all nodes. updated incrementally by refit()
+    float m_built_sah_cost = 0.0f;
+};
+
+
+// accepts all nodes. default of the Visit parameter of the traversals below
+struct VisitAllCPU
+{
+    bool operator()(uint32_t) const { return true; }
+};
+
+// closest hit traversal. Leaf: [](const BVHNodeCPU& leaf) -> void. the leaf can shrink ray.tmax to cull farther nodes.
+// Visit: [](uint32_t node_index) -> bool. nodes that return false are skipped with their subtree.
+template<class Leaf, class Visit = VisitAllCPU>
+inline void TraverseClosestCPU(const BVHNodeCPU *nodes, RayCPU& ray, const Leaf& leaf, const Visit& visit = Visit())
+{
+    RayBoxTestCPU bt(ray);
+    if (!visit(0) || bt.test(nodes[0].bounds, ray.tmin, ray.tmax) == FLT_MAX)
+        return;
+
+    struct StackEntry
+    {
+        uint32_t node;
+        float t;
+    };
+    StackEntry stack[BLASCPU::kMaxDepth];
+    int sp = 0;
+
+    uint32_t ni = 0;
+    for (;;) {
+        auto& node = nodes[ni];
+        if (node.count == 0) {
+            uint32_t c0 = node.offset, c1 = node.offset + 1;
+            float t0 = visit(c0) ? bt.test(nodes[c0].bounds, ray.tmin, ray.tmax) : FLT_MAX;
+            float t1 = visit(c1) ? bt.test(nodes[c1].bounds, ray.tmin, ray.tmax) : FLT_MAX;
+            if (t0 != FLT_MAX && t1 != FLT_MAX) {
+                if (t1 < t0) {
+                    std::swap(c0, c1);
+                    std::swap(t0, t1);
+                }
+                stack[sp++] = { c1, t1 };
+                ni = c0;
+                continue;
+            }
+            else if (t0 != FLT_MAX) {
+                ni = c0;
+                continue;
+            }
+            else if (t1 != FLT_MAX) {
+                ni = c1;
+                continue;
+            }
+        }
+        else {
+            leaf(node);
+        }
+
+        // pop. skip nodes that are farther than current closest hit
+        for (;;) {
+            if (sp == 0)
+                return;
+            auto& e = stack[--sp];
+            if (e.t <= ray.tmax) {
+                ni = e.node;
+                break;
+            }
+        }
+    }
+}
+
+// any hit traversal. Leaf: [](const BVHNodeCPU& leaf) -> bool. returns true to end.
+// Visit: same as TraverseClosestCPU().
+// the near child (by entry distance) is visited first as TraverseClosestCPU() does. the ray doesn't shrink, so distances
+// are not kept in the stack. choosing the near child by the sign of the ray direction on the split axis visited as many
+// nodes on shadow rays but was slower, likely because the child address then depends on the axis. so nodes don't keep it.
+template<class Leaf, class Visit = VisitAllCPU>
+inline bool TraverseOrderedCPU(const BVHNodeCPU *nodes, const RayCPU& ray, const Leaf& leaf, const Visit& visit = Visit())
+{
+    RayBoxTestCPU bt(ray);
+    if (!visit(0) || bt.test(nodes[0].bounds, ray.tmin, ray.tmax) == FLT_MAX)
+        return false;
+
+    uint32_t stack[BLASCPU::kMaxDepth];
+    int sp = 0;
+
+    uint32_t ni = 0;
+    for (;;) {
+        auto& node = nodes[ni];
+        if (node.count == 0) {
+            uint32_t c0 = node.offset, c1 = node.offset + 1;
+            float t0 = visit(c0) ? bt.test(nodes[c0].bounds, ray.tmin, ray.tmax) : FLT_MAX;
+            float t1 = visit(c1) ? bt.test(nodes[c1].bounds, ray.tmin, ray.tmax) : FLT_MAX;
+            if (t0 != FLT_MAX && t1 != FLT_MAX) {
+                if (t1 < t0)
+                    std::swap(c0, c1);
+                stack[sp++] = c1;
+                ni = c0;
+                continue;
+            }
+            else if (t0 != FLT_MAX) {
+                ni = c0;
+                continue;
+            }
+            else if (t1 != FLT_MAX) {
+                ni = c1;
+                continue;
+            }
+        }
+        else if (leaf(node)) {
+            return true;
+        }
+
+        if (sp == 0)
+            return false;
+        ni = stack[--sp];
+    }
+}
+
+// hits are passed to the filter in triangle order, and each of them is tested against the current ray.tmax.
+// so the results are the same as intersecting the triangles one by one.
+template<class Filter>
+inline bool BLASCPU::intersectLeaf(const BVHNodeCPU& leaf, RayCPU& ray, const RayTriangleTestCPU& rt, RayHitCPU& hit, CullMode cull, const Filter& filter) const
+{
+    bool ret = false;
+    uint32_t end = leaf.offset + getBlockCount(leaf);
+    for (uint32_t bi = leaf.offset; bi < end; ++bi) {
+        auto& block = m_blocks[bi];
+        alignas(16) float t[4], u[4], v[4];
+        int front;
+        int mask = IntersectTriangleBlock(ray, rt, block, cull, t, u, v, front);
+        for (int i = 0; mask != 0; ++i, mask >>= 1) {
+            if ((mask & 1) == 0 || t[i] > ray.tmax)
+                continue;
+            RayHitCPU tmp;
+            tmp.t = t[i];
+            tmp.u = u[i];
+            tmp.v = v[i];
+            tmp.front_face = (front & (1 << i)) != 0;
+            tmp.prim_id = block.prim_id[i];
+            if (filter(tmp)) {
+                hit = tmp;
+                ray.tmax = tmp.t;
+                ret = true;
+            }
+        }
+    }
+    return ret;
+}
+
+template<class Filter>
+inline bool BLASCPU::intersectLeaf(const BVHNodeCPU& leaf, RayCPU& ray, const RayTriangleTestCPU& rt, RayHitCPU& hit, CullMode cull, const Filter& filter, const TriangleSourceCPU& src) const
+{
+    bool ret = false;
+    for (uint32_t i = 0; i < leaf.count; ++i) {
+        uint32_t prim_id = m_blocks[leaf.offset + i / TriangleBlockCPU::kWidth].prim_id[i % TriangleBlockCPU::kWidth];
+        float3 p[3];
+        // indices may have been broken by a buffer update since the build
+        if (!src.getTriangle(prim_id, p))
+            continue;
+        RayHitCPU tmp;
+        if (IntersectTriangle(ray, rt, p[0], p[1], p[2], cull, tmp)) {
+            tmp.prim_id = prim_id;
+            if (filter(tmp)) {
+                hit = tmp;
+                ray.tmax = tmp.t;
+                ret = true;
+            }
+        }
+    }
+    return ret;
+}
+
+template<class Filter>
+inline bool BLASCPU::intersect(RayCPU& ray, RayHitCPU& hit, CullMode cull, const Filter& filter) const
+{
+    if (m_nodes.empty())
+        return false;
+
+    bool ret = false;
+    RayTriangleTestCPU rt(ray);
+    TraverseClosestCPU(m_nodes.data(), ray, [&](const BVHNodeCPU& leaf) {
+        ret |= intersectLeaf(leaf, ray, rt, hit, cull, filter);
+    });
+    return ret;
+}
+
+template<class Filter>
+inline bool BLASCPU::intersect(RayCPU& ray, RayHitCPU& hit, CullMode cull, const Filter& filter, const TriangleSourceCPU& src) const
+{
+    if (m_nodes.empty())
+        return false;
+
+    bool ret = false;
+    RayTriangleTestCPU rt(ray);
+    TraverseClosestCPU(m_nodes.data(), ray, [&](const BVHNodeCPU& leaf) {
+        ret |= intersectLeaf(leaf, ray, rt, hit, cull, filter, src);
+    });
+    return ret;
+}
+
+template<class Filter>
+inline bool BLASCPU::occludedLeaf(const BVHNodeCPU& leaf, const RayCPU& ray, const RayTriangleTestCPU& rt, CullMode cull, const Filter& filter) const
+{
+    uint32_t end = leaf.offset + getBlockCount(leaf);
+    for (uint32_t bi = leaf.offset; bi < end; ++bi) {
+        auto& block = m_blocks[bi];
+        alignas(16) float t[4], u[4], v[4];
+        int front;
+        int mask = IntersectTriangleBlock(ray, rt, block, cull, t, u, v, front);
+        for (int i = 0; mask != 0; ++i, mask >>= 1) {
+            if ((mask & 1) == 0)
+                continue;
+            RayHitCPU tmp;
+            tmp.t = t[i];
+            tmp.u = u[i];
+            tmp.v = v[i];
+            tmp.front_face = (front & (1 << i)) != 0;
+            tmp.prim_id = block.prim_id[i];
+            if (filter(tmp))
+                return true;
+        }
+    }
+    return false;
+}
+
+template<class Filter>
+inline bool BLASCPU::occludedLeaf(uint32_t leaf, const RayCPU& ray, CullMode cull, const Filter& filter) const
+{
+    return occludedLeaf(m_nodes[leaf], ray, RayTriangleTestCPU(ray), cull, filter);
+}
+
+template<class Filter>
+inline bool BLASCPU::occludedLeaf(const BVHNodeCPU& leaf, const RayCPU& ray, const RayTriangleTestCPU& rt, CullMode cull, const Filter& filter, const TriangleSourceCPU& src) const
+{
+    for (uint32_t i = 0; i < leaf.count; ++i) {
+        uint32_t prim_id = m_blocks[leaf.offset + i / TriangleBlockCPU::kWidth].prim_id[i % TriangleBlockCPU::kWidth];
+        float3 p[3];
+        // indices may have been broken by a buffer update since the build
+        if (!src.getTriangle(prim_id, p))
+            continue;
+        RayHitCPU tmp;
+        if (IntersectTriangle(ray, rt, p[0], p[1], p[2], cull, tmp)) {
+            tmp.prim_id = prim_id;
+            if (filter(tmp))
+                return true;
+        }
+    }
+    return false;
+}
+
+template<class Filter>
+inline bool BLASCPU::occluded(const RayCPU& ray, CullMode cull, const Filter& filter, uint32_t *leaf) const
+{
+    if (m_nodes.empty())
+        return false;
+
+    RayTriangleTestCPU rt(ray);
+    return TraverseOrderedCPU(m_nodes.data(), ray, [&](const BVHNodeCPU& node) {
+        if (!occludedLeaf(node, ray, rt, cull, filter))
+            return false;
+        if (leaf)
+            *leaf = (uint32_t)(&node - m_nodes.data());
+        return true;
+    });
+}
+
+template<class Filter>
+inline bool BLASCPU::occluded(const RayCPU& ray, CullMode cull, const Filter& filter, const TriangleSourceCPU& src) const
+{
+    if (m_nodes.empty())
+        return false;
+
+    RayTriangleTestCPU rt(ray);
+    return TraverseOrderedCPU(m_nodes.data(), ray, [&](const BVHNodeCPU& leaf) {
+        return occludedLeaf(leaf, ray, rt, cull, filter, src);
+    });
+}
+
+template<class Body>
+inline bool TLASCPU::traverseAny(const RayCPU& ray, const InstanceMaskCPU& ray_mask, const Body& body) const
+{
+    if (m_nodes.empty())
+        return false;
+
+    auto *masks = m_masks.data();
+    return TraverseOrderedCPU(m_nodes.data(), ray, [&](const BVHNodeCPU& leaf) {
+        for (uint32_t i = leaf.offset; i < leaf.offset + leaf.count; ++i) {
+            if (body(m_instances[i]))
+                return true;
+        }
+        return false;
+    }, [&](uint32_t ni) { return masks[ni].test(ray_mask); });
+}
+
+template<class Body>
+inline void TLASCPU::traverse(RayCPU& ray, const InstanceMaskCPU& ray_mask, const Body& body) const
+{
+    if (m_nodes.empty())
+        return;
+
+    auto *masks = m_masks.data();
+    TraverseClosestCPU(m_nodes.data(), ray, [&](const BVHNodeCPU& leaf) {
+        for (uint32_t i = leaf.offset; i < leaf.offset + leaf.count; ++i)
+            body(m_instances[i]);
+    }, [&](uint32_t ni) { return masks[ni].test(ray_mask); });
+}
+
+} // namespace rths
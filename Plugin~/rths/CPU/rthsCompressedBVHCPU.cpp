@@ -0,0 +1,434 @@
+#include "pch.h"
+#include "Foundation/rthsMisc.h"
+#include "Foundation/rthsParallel.h"
+#include "rthsCompressedBVHCPU.h"
+
+namespace rths {
+
+static const uint32_t kMaxLeafCount = 15; // CompressedBVHNodeCPU::counts has 4 bits per child
+static const int kMaxQuantized = 255;
+static const uint32_t kMergeThreshold = BLASCPU::kMaxLeafSize; // subtrees with this or less triangles become a leaf
+
+static inline int clampi(int v, int vmin, int vmax)
+{
+    return std::min(std::max(v, vmin), vmax);
+}
+
+// builds compressed nodes from a BLASCPU. the binary tree is collapsed top-down by repeatedly opening the largest child.
+class CompressedBLASCPU::Compressor
+{
+public:
+    // src_nodes: nodes of BLASCPU whose leaves point to triangles in leaf order (not blocks).
+    // prim_ids and tri_vertices: prim id and 3 vertex indices of each triangle in leaf order.
+    Compressor(CompressedBLASCPU& dst, const std::vector<BVHNodeCPU>& src_nodes, const std::vector<uint32_t>& prim_ids,
+        const std::vector<uint32_t>& tri_vertices, uint32_t vertex_count, const char *vertices, int vertex_stride)
+        : m_dst(dst)
+        , m_src_nodes(src_nodes.data())
+        , m_src_prim_ids(prim_ids.data())
+        , m_tri_vertices(tri_vertices)
+        , m_vertices(vertices)
+        , m_vertex_stride(vertex_stride)
+        , m_remap(vertex_count, ~0u)
+    {
+        m_ranges.resize(src_nodes.size());
+        computeRange(0);
+    }
+
+    void compress()
+    {
+        auto& root = m_src_nodes[0];
+        Child c;
+        c.bounds = root.bounds;
+        if (root.count == 0) {
+            c.type = ChildType::Inner;
+            c.index = 0;
+        }
+        else {
+            c.type = root.count > kMaxLeafCount ? ChildType::BigLeaf : ChildType::Leaf;
+            c.index = root.offset;
+            c.count = root.count;
+        }
+        m_dst.m_nodes.resize(1);
+        buildNode(0, c, true);
+    }
+
+private:
+    enum class ChildType
+    {
+        Inner,   // inner node of the source tree
+        Leaf,    // leaf with kMaxLeafCount or less triangles
+        BigLeaf, // leaf with more triangles than kMaxLeafCount. it is split in halves like an inner node
+    };
+    struct Child
+    {
+        AABB bounds;
+        ChildType type = ChildType::Inner;
+        uint32_t index = 0; // Inner: source node index. Leaf & BigLeaf: first triangle in leaf order
+        uint32_t count = 0; // Leaf & BigLeaf: triangle count
+    };
+    using Children = std::array<Child, CompressedBVHNodeCPU::kWidth>;
+
+    Child makeLeaf(uint32_t first, uint32_t count)
+    {
+        Child r;
+        r.type = count > kMaxLeafCount ? ChildType::BigLeaf : ChildType::Leaf;
+        r.index = first;
+        r.count = count;
+        for (uint32_t i = first * 3; i < (first + count) * 3; ++i)
+            r.bounds.expand(getVertex(m_tri_vertices[i]));
+        return r;
+    }
+
+    // first triangle and triangle count of the subtree. triangles of a subtree are always contiguous in leaf order.
+    std::pair<uint32_t, uint32_t> computeRange(uint32_t ni)
+    {
+        auto& node = m_src_nodes[ni];
+        if (node.count == 0) {
+            auto r0 = computeRange(node.offset);
+            auto r1 = computeRange(node.offset + 1);
+            m_ranges[ni] = { std::min(r0.first, r1.first), r0.second + r1.second };
+        }
+        else {
+            m_ranges[ni] = { node.offset, node.count };
+        }
+        return m_ranges[ni];
+    }
+
+    Child makeChild(uint32_t ni)
+    {
+        auto& node = m_src_nodes[ni];
+        Child r;
+        r.bounds = node.bounds;
+        if (node.count == 0 && m_ranges[ni].second <= kMergeThreshold) {
+            // small subtrees are merged into a leaf. otherwise most nodes have only a few leaf children.
+            r.type = ChildType::Leaf;
+            r.index = m_ranges[ni].first;
+            r.count = m_ranges[ni].second;
+        }
+        else if (node.count == 0) {
+            r.type = ChildType::Inner;
+            r.index = ni;
+        }
+        else {
+            r.type = node.count > kMaxLeafCount ? ChildType::BigLeaf : ChildType::Leaf;
+            r.index = node.offset;
+            r.count = node.count;
+        }
+        return r;
+    }
+
+    void open(const Child& c, Child& c0, Child& c1)
+    {
+        if (c.type == ChildType::Inner) {
+            uint32_t first = m_src_nodes[c.index].offset;
+            c0 = makeChild(first);
+            c1 = makeChild(first + 1);
+        }
+        else {
+            uint32_t half = c.count / 2;
+            c0 = makeLeaf(c.index, half);
+            c1 = makeLeaf(c.index + half, c.count - half);
+        }
+    }
+
+    // the smallest power of two scale that covers [origin, origin + extent] with kMaxQuantized steps
+    static uint8_t computeExponent(float origin, float extent)
+    {
+        int e = 1;
+        if (extent > 0.0f) {
+            std::frexp(extent / (float)kMaxQuantized, &e);
+            e = clampi(e + 127, 1, 254);
+        }
+        auto scale = [](int e) {
+            uint32_t bits = (uint32_t)e << 23;
+            float r;
+            std::memcpy(&r, &bits, sizeof(r));
+            return r;
+        };
+        // make sure the quantized range covers the whole extent after rounding
+        while (e < 254 && origin + (float)kMaxQuantized * scale(e) < origin + extent)
+            ++e;
+        return (uint8_t)e;
+    }
+
+    void buildNode(uint32_t wi, const Child& c, bool is_root = false)
+    {
+        // collapse
+        Children children;
+        int n = 0;
+        if (c.type == ChildType::Leaf && is_root) {
+            children[n++] = c;
+        }
+        else {
+            open(c, children[0], children[1]);
+            n = 2;
+            while (n < CompressedBVHNodeCPU::kWidth) {
+                int best = -1;
+                float best_area = -1.0f;
+                for (int i = 0; i < n; ++i) {
+                    if (children[i].type != ChildType::Leaf && children[i].bounds.area() > best_area) {
+                        best = i;
+                        best_area = children[i].bounds.area();
+                    }
+                }
+                if (best == -1)
+                    break;
+                Child tmp = children[best];
+                open(tmp, children[best], children[n++]);
+            }
+        }
+
+        auto& nodes = m_dst.m_nodes;
+        auto& triangles = m_dst.m_triangles;
+        auto& vertices = m_dst.m_vertices;
+        auto& prim_table = m_dst.m_prim_table;
+
+        CompressedBVHNodeCPU node{};
+        node.origin = c.bounds.bmin;
+        float3 extent = c.bounds.size();
+        float scale[3];
+        for (int a = 0; a < 3; ++a) {
+            node.exponent[a] = computeExponent(node.origin[a], extent[a]);
+            scale[a] = node.getScale(a);
+        }
+
+        // quantize child bounds. rounding of decoding is taken into account to keep them conservative.
+        for (int i = 0; i < n; ++i) {
+            auto& b = children[i].bounds;
+            for (int a = 0; a < 3; ++a) {
+                float o = node.origin[a];
+                int qmin = clampi((int)std::floor((b.bmin[a] - o) / scale[a]), 0, kMaxQuantized);
+                int qmax = clampi((int)std::ceil((b.bmax[a] - o) / scale[a]), 0, kMaxQuantized);
+                while (qmin > 0 && o + (float)qmin * scale[a] > b.bmin[a])
+                    --qmin;
+                while (qmax < kMaxQuantized && o + (float)qmax * scale[a] < b.bmax[a])
+                    ++qmax;
+                node.qmin[a][i] = (uint8_t)qmin;
+                node.qmax[a][i] = (uint8_t)qmax;
+            }
+            node.child_mask |= 1 << i;
+            if (children[i].type == ChildType::Leaf)
+                node.counts |= children[i].count << (i * 4);
+        }
+
+        // triangles of leaf children
+        node.triangle_base = (uint32_t)triangles.size();
+        uint32_t vmin = ~0u, vmax = 0, pmin = ~0u, pmax = 0, tri_count = 0;
+        for (int i = 0; i < n; ++i) {
+            auto& ch = children[i];
+            if (ch.type != ChildType::Leaf)
+                continue;
+            for (uint32_t ti = ch.index; ti < ch.index + ch.count; ++ti) {
+                for (int k = 0; k < 3; ++k) {
+                    uint32_t& vi = m_remap[m_tri_vertices[ti * 3 + k]];
+                    if (vi == ~0u) {
+                        vi = (uint32_t)vertices.size();
+                        vertices.push_back(getVertex(m_tri_vertices[ti * 3 + k]));
+                    }
+                    vmin = std::min(vmin, vi);
+                    vmax = std::max(vmax, vi);
+                }
+                pmin = std::min(pmin, m_src_prim_ids[ti]);
+                pmax = std::max(pmax, m_src_prim_ids[ti]);
+                ++tri_count;
+            }
+        }
+        if (tri_count > 0) {
+            // vertices that are too far from others are duplicated to keep indices in 16 bit
+            bool duplicate = vmax - vmin > 0xffff;
+            std::vector<std::pair<uint32_t, uint32_t>> local; // remapped index -> local index
+            node.vertex_base = duplicate ? (uint32_t)vertices.size() : vmin;
+
+            bool use_table = pmax - pmin > 0xffff;
+            node.prim_base = use_table ? (uint32_t)prim_table.size() | CompressedBVHNodeCPU::kPrimTableBit : pmin;
+
+            uint16_t li = 0;
+            for (int i = 0; i < n; ++i) {
+                auto& ch = children[i];
+                if (ch.type != ChildType::Leaf)
+                    continue;
+                for (uint32_t ti = ch.index; ti < ch.index + ch.count; ++ti, ++li) {
+                    CompressedTriangleCPU tri;
+                    for (int k = 0; k < 3; ++k) {
+                        uint32_t vi = m_remap[m_tri_vertices[ti * 3 + k]];
+                        if (duplicate) {
+                            auto it = std::find_if(local.begin(), local.end(), [vi](auto& p) { return p.first == vi; });
+                            if (it == local.end()) {
+                                local.push_back({ vi, (uint32_t)local.size() });
+                                vertices.push_back(vertices[vi]);
+                                it = local.end() - 1;
+                            }
+                            tri.indices[k] = (uint16_t)it->second;
+                        }
+                        else {
+                            tri.indices[k] = (uint16_t)(vi - vmin);
+                        }
+                    }
+                    uint32_t prim = m_src_prim_ids[ti];
+                    if (use_table) {
+                        tri.prim = li;
+                        prim_table.push_back(prim);
+                    }
+                    else {
+                        tri.prim = (uint16_t)(prim - pmin);
+                    }
+                    triangles.push_back(tri);
+                }
+            }
+        }
+
+        // inner children are allocated contiguously, then built recursively
+        node.child_base = (uint32_t)nodes.size();
+        for (int i = 0; i < n; ++i) {
+            if (children[i].type != ChildType::Leaf)
+                nodes.emplace_back();
+        }
+        nodes[wi] = node;
+
+        uint32_t ci = node.child_base;
+        for (int i = 0; i < n; ++i) {
+            if (children[i].type != ChildType::Leaf)
+                buildNode(ci++, children[i]);
+        }
+    }
+
+    const float3& getVertex(uint32_t i) const
+    {
+        return *(const float3*)(m_vertices + m_vertex_stride * i);
+    }
+
+    CompressedBLASCPU& m_dst;
+    const BVHNodeCPU *m_src_nodes;
+    const uint32_t *m_src_prim_ids;
+    const std::vector<uint32_t>& m_tri_vertices;
+    const char *m_vertices;
+    int m_vertex_stride;
+    std::vector<uint32_t> m_remap; // source vertex index -> index in m_dst.m_vertices
+    std::vector<std::pair<uint32_t, uint32_t>> m_ranges; // triangle range of each source node
+};
+
+
+void CompressedBLASCPU::build(const void *vertices, int vertex_stride, int vertex_count,
+    const void *indices, int index_stride, int index_count, BVHBuildQuality quality)
+{
+    clear();
+
+    BLASCPU src;
+    src.build(vertices, vertex_stride, vertex_count, indices, index_stride, index_count, quality);
+    if (src.empty())
+        return;
+
+    auto begin_time = Now();
+
+    // BLASCPU stores triangles in blocks that are padded per leaf. make a copy of the nodes whose leaves point to
+    // triangles in leaf order, and gather vertex indices of the triangles to share vertices between them.
+    TriangleSourceCPU isrc{ nullptr, 0, vertex_count, (const char*)indices, index_stride, index_count };
+    uint32_t node_count = src.getBuildStats().node_count;
+    std::vector<BVHNodeCPU> src_nodes(src.getNodes(), src.getNodes() + node_count);
+    std::vector<uint32_t> leaves;
+    for (uint32_t ni = 0; ni < node_count; ++ni) {
+        if (src_nodes[ni].count != 0)
+            leaves.push_back(ni);
+    }
+    std::sort(leaves.begin(), leaves.end(), [&](uint32_t a, uint32_t b) { return src_nodes[a].offset < src_nodes[b].offset; });
+    std::vector<uint32_t> leaf_blocks(leaves.size());
+    uint32_t triangle_count = 0;
+    for (size_t li = 0; li < leaves.size(); ++li) {
+        auto& leaf = src_nodes[leaves[li]];
+        leaf_blocks[li] = leaf.offset;
+        leaf.offset = triangle_count;
+        triangle_count += leaf.count;
+    }
+
+    auto *blocks = src.getBlocks();
+    std::vector<uint32_t> prim_ids(triangle_count);
+    std::vector<uint32_t> tri_vertices(triangle_count * 3);
+    parallel_for_blocked(0, (int)leaves.size(), 1024 * 4, [&](int begin, int end) {
+        for (int li = begin; li < end; ++li) {
+            auto& leaf = src_nodes[leaves[li]];
+            for (uint32_t i = 0; i < leaf.count; ++i) {
+                uint32_t ti = blocks[leaf_blocks[li] + i / TriangleBlockCPU::kWidth].prim_id[i % TriangleBlockCPU::kWidth];
+                uint32_t di = leaf.offset + i;
+                prim_ids[di] = ti;
+                tri_vertices[di * 3 + 0] = isrc.getIndex(ti * 3 + 0);
+                tri_vertices[di * 3 + 1] = isrc.getIndex(ti * 3 + 1);
+                tri_vertices[di * 3 + 2] = isrc.getIndex(ti * 3 + 2);
+            }
+        }
+    });
+
+    m_nodes.reserve(src.getBuildStats().node_count / 4 + 1);
+    m_triangles.reserve(triangle_count);
+    m_vertices.reserve(std::min<uint32_t>(vertex_count, triangle_count * 3));
+    Compressor compressor(*this, src_nodes, prim_ids, tri_vertices, (uint32_t)vertex_count, (const char*)vertices, vertex_stride);
+    compressor.compress();
+
+    m_nodes.shrink_to_fit();
+    m_vertices.shrink_to_fit();
+    m_prim_table.shrink_to_fit();
+
+    m_bounds = src.getBounds();
+    m_stats = src.getBuildStats();
+    m_stats.build_time += Now() - begin_time;
+    m_stats.node_count = (uint32_t)m_nodes.size();
+    m_uncompressed_size = src.getMemoryUsage();
+}
+
+void CompressedBLASCPU::clear()
+{
+    m_nodes.clear();
+    m_triangles.clear();
+    m_vertices.clear();
+    m_prim_table.clear();
+    m_bounds = {};
+    m_stats = {};
+    m_uncompressed_size = 0;
+}
+
+bool CompressedBLASCPU::empty() const
+{
+    return m_nodes.empty();
+}
+
+const AABB& CompressedBLASCPU::getBounds() const
+{
+    return m_bounds;
+}
+
+size_t CompressedBLASCPU::getTriangleCount() const
+{
+    return m_triangles.size();
+}
+
+const BVHBuildStatsCPU& CompressedBLASCPU::getBuildStats() const
+{
+    return m_stats;
+}
+
+size_t CompressedBLASCPU::getMemoryUsage() const
+{
+    return sizeof(Node) * m_nodes.size() +
+        sizeof(CompressedTriangleCPU) * m_triangles.size() +
+        sizeof(float3) * m_vertices.size() +
+        sizeof(uint32_t) * m_prim_table.size();
+}
+
+void CompressedBLASCPU::decodeChildBounds(const Node& node, AABB *dst)
+{
+    // defined here to keep the arithmetic of the compressor (no fused multiply-add) regardless of the caller's instruction set
+    for (int a = 0; a < 3; ++a) {
+        float o = node.origin[a];
+        float scale = node.getScale(a);
+        for (int i = 0; i < Node::kWidth; ++i) {
+            dst[i].bmin[a] = o + (float)node.qmin[a][i] * scale;
+            dst[i].bmax[a] = o + (float)node.qmax[a][i] * scale;
+        }
+    }
+}
+
+size_t CompressedBLASCPU::getUncompressedMemoryUsage() const
+{
+    return m_uncompressed_size;
+}
+
+} // namespace rths
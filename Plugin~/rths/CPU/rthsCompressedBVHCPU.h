@@ -0,0 +1,273 @@
+#pragma once
+#include "Foundation/rthsSIMD.h"
+#include "rthsBVHCPU.h"
+
+namespace rths {
+
+// 8-wide node with child bounds quantized to 8 bit relative to the node bounds.
+// child bounds are decoded as origin + q * scale, and are always conservative (decoded bounds contain the original bounds).
+struct CompressedBVHNodeCPU
+{
+    static const int kWidth = 8;
+
+    float3 origin;           // lower corner of the node bounds
+    uint8_t exponent[3];     // scale of each axis is 2^(exponent - 127). stored as exponent bits of float
+    uint8_t child_mask;      // bit i: child i exists
+    uint32_t child_base;     // index of the first inner child. inner children are stored contiguously in slot order
+    uint32_t triangle_base;  // index of the first triangle of leaf children. triangles are stored contiguously in slot order
+    uint32_t vertex_base;    // triangle vertex indices are relative to this
+    uint32_t prim_base;      // prim ids are relative to this. if kPrimTableBit is set, they are indices to the prim table instead
+    uint32_t counts;         // 4 bits per child. triangle count of leaf children, 0 for inner children
+    uint8_t qmin[3][kWidth]; // [axis][child]
+    uint8_t qmax[3][kWidth];
+
+    static const uint32_t kPrimTableBit = 0x80000000;
+
+    uint32_t getCount(int i) const { return (counts >> (i * 4)) & 0xf; }
+    float getScale(int axis) const
+    {
+        uint32_t bits = (uint32_t)exponent[axis] << 23;
+        float r;
+        std::memcpy(&r, &bits, sizeof(r));
+        return r;
+    }
+};
+
+// 8 byte triangle. vertex indices and prim id are relative to the node's vertex_base / prim_base
+struct CompressedTriangleCPU
+{
+    uint16_t indices[3];
+    uint16_t prim;
+};
+
+// compressed bottom level acceleration structure. built with the same builder as BLASCPU, then the binary tree is
+// collapsed into 8-wide quantized nodes and triangles are stored as 16-bit indices to vertices shared between triangles.
+// intersect() and occluded() give the same results as BLASCPU's except ties between triangles at the same distance.
+class CompressedBLASCPU
+{
+public:
+    using Node = CompressedBVHNodeCPU;
+
+    void build(const void *vertices, int vertex_stride, int vertex_count,
+        const void *indices, int index_stride, int index_count,
+        BVHBuildQuality quality = BVHBuildQuality::FastTrace);
+    void clear();
+    bool empty() const;
+    const AABB& getBounds() const;
+    size_t getTriangleCount() const;
+    const BVHBuildStatsCPU& getBuildStats() const; // stats of the binary tree. build_time includes compression
+
+    size_t getMemoryUsage() const;
+    size_t getUncompressedMemoryUsage() const; // BLASCPU::getMemoryUsage() of the same mesh
+
+    // same as BLASCPU's
+    template<class Filter>
+    bool intersect(RayCPU& ray, RayHitCPU& hit, CullMode cull, const Filter& filter) const;
+    template<class Filter>
+    bool occluded(const RayCPU& ray, CullMode cull, const Filter& filter) const;
+
+    // raw data for custom traversals (e.g. ray packets). vertex indices of triangles are relative to node.vertex_base.
+    const Node* getNodes() const { return m_nodes.data(); }
+    const CompressedTriangleCPU* getTriangles() const { return m_triangles.data(); }
+    const float3* getVertices() const { return m_vertices.data(); }
+    uint32_t getPrimID(const Node& node, const CompressedTriangleCPU& tri) const;
+    // decoded bounds of the children. the same values as testChildren() uses. all kWidth slots are written regardless of child_mask.
+    static void decodeChildBounds(const Node& node, AABB *dst);
+
+private:
+    class Compressor;
+
+    // returns bit mask of hit children. tenter: entry distances
+    int testChildren(const Node& node, const simd4f ro[3], const simd4f rinv[3], float tmin, float tmax, float *tenter) const;
+
+    std::vector<Node> m_nodes;
+    std::vector<CompressedTriangleCPU> m_triangles;
+    std::vector<float3> m_vertices;
+    std::vector<uint32_t> m_prim_table; // prim ids of nodes whose range doesn't fit in 16 bit
+    AABB m_bounds;
+    BVHBuildStatsCPU m_stats;
+    size_t m_uncompressed_size = 0;
+};
+
+
+inline int CompressedBLASCPU::testChildren(const Node& node, const simd4f ro[3], const simd4f rinv[3], float tmin, float tmax, float *tenter) const
+{
+    // same arithmetic as RayBoxTestCPU on decoded bounds
+    const __m128i zero = _mm_setzero_si128();
+    auto decode = [&](const uint8_t *q, float origin, float scale) {
+        int bits;
+        std::memcpy(&bits, q, sizeof(bits));
+        __m128i v = _mm_cvtsi32_si128(bits);
+        v = _mm_unpacklo_epi16(_mm_unpacklo_epi8(v, zero), zero);
+        return simd4f(origin) + simd4f(_mm_cvtepi32_ps(v)) * simd4f(scale);
+    };
+    float scale[3]{ node.getScale(0), node.getScale(1), node.getScale(2) };
+
+    int mask = 0;
+    for (int h = 0; h < 2; ++h) {
+        int o = h * 4;
+        simd4f enter(tmin), exit(tmax);
+        for (int a = 0; a < 3; ++a) {
+            simd4f t0 = (decode(&node.qmin[a][o], node.origin[a], scale[a]) - ro[a]) * rinv[a];
+            simd4f t1 = (decode(&node.qmax[a][o], node.origin[a], scale[a]) - ro[a]) * rinv[a];
+            enter = max(enter, min(t0, t1));
+            exit = min(exit, max(t0, t1));
+        }
+        enter.store(tenter + o);
+        mask |= movemask(enter <= exit) << o;
+    }
+    return mask & node.child_mask;
+}
+
+inline uint32_t CompressedBLASCPU::getPrimID(const Node& node, const CompressedTriangleCPU& tri) const
+{
+    if (node.prim_base & Node::kPrimTableBit)
+        return m_prim_table[(node.prim_base & ~Node::kPrimTableBit) + tri.prim];
+    else
+        return node.prim_base + tri.prim;
+}
+
+template<class Filter>
+inline bool CompressedBLASCPU::intersect(RayCPU& ray, RayHitCPU& hit, CullMode cull, const Filter& filter) const
+{
+    if (m_nodes.empty())
+        return false;
+
+    const simd4f ro[3]{ simd4f(ray.origin.x), simd4f(ray.origin.y), simd4f(ray.origin.z) };
+    const simd4f rinv[3]{ simd4f(1.0f / ray.direction.x), simd4f(1.0f / ray.direction.y), simd4f(1.0f / ray.direction.z) };
+    const RayTriangleTestCPU rt(ray);
+
+    struct StackEntry
+    {
+        uint32_t node;
+        float t;
+    };
+    StackEntry stack[BLASCPU::kMaxDepth * Node::kWidth];
+    int sp = 0;
+    stack[sp++] = { 0, ray.tmin };
+
+    bool ret = false;
+    while (sp > 0) {
+        auto& e = stack[--sp];
+        if (e.t > ray.tmax)
+            continue;
+        auto& node = m_nodes[e.node];
+
+        float tenter[Node::kWidth];
+        int mask = testChildren(node, ro, rinv, ray.tmin, ray.tmax, tenter);
+        if (mask == 0)
+            continue;
+
+        // sort hit children near to far
+        int order[Node::kWidth];
+        int n = 0;
+        for (int i = 0; i < Node::kWidth; ++i) {
+            if ((mask & (1 << i)) == 0)
+                continue;
+            int j = n++;
+            for (; j > 0 && tenter[order[j - 1]] > tenter[i]; --j)
+                order[j] = order[j - 1];
+            order[j] = i;
+        }
+
+        // leaf children are intersected immediately, near to far. inner children are pushed far to near.
+        uint32_t tri_offset[Node::kWidth];
+        uint32_t child_index[Node::kWidth];
+        {
+            uint32_t ti = node.triangle_base, ci = node.child_base;
+            for (int i = 0; i < Node::kWidth; ++i) {
+                if ((node.child_mask & (1 << i)) == 0)
+                    continue;
+                tri_offset[i] = ti;
+                child_index[i] = ci;
+                if (node.getCount(i) != 0)
+                    ti += node.getCount(i);
+                else
+                    ++ci;
+            }
+        }
+        for (int k = 0; k < n; ++k) {
+            int i = order[k];
+            uint32_t count = node.getCount(i);
+            if (count == 0 || tenter[i] > ray.tmax)
+                continue;
+            for (uint32_t ti = tri_offset[i]; ti < tri_offset[i] + count; ++ti) {
+                auto& tri = m_triangles[ti];
+                const float3& p0 = m_vertices[node.vertex_base + tri.indices[0]];
+                const float3& p1 = m_vertices[node.vertex_base + tri.indices[1]];
+                const float3& p2 = m_vertices[node.vertex_base + tri.indices[2]];
+                RayHitCPU tmp;
+                if (IntersectTriangle(ray, rt, p0, p1, p2, cull, tmp)) {
+                    tmp.prim_id = getPrimID(node, tri);
+                    if (filter(tmp)) {
+                        hit = tmp;
+                        ray.tmax = tmp.t;
+                        ret = true;
+                    }
+                }
+            }
+        }
+        for (int k = n - 1; k >= 0; --k) {
+            int i = order[k];
+            if (node.getCount(i) == 0 && tenter[i] <= ray.tmax)
+                stack[sp++] = { child_index[i], tenter[i] };
+        }
+    }
+    return ret;
+}
+
+template<class Filter>
+inline bool CompressedBLASCPU::occluded(const RayCPU& ray, CullMode cull, const Filter& filter) const
+{
+    if (m_nodes.empty())
+        return false;
+
+    const simd4f ro[3]{ simd4f(ray.origin.x), simd4f(ray.origin.y), simd4f(ray.origin.z) };
+    const simd4f rinv[3]{ simd4f(1.0f / ray.direction.x), simd4f(1.0f / ray.direction.y), simd4f(1.0f / ray.direction.z) };
+    const RayTriangleTestCPU rt(ray);
+
+    uint32_t stack[BLASCPU::kMaxDepth * Node::kWidth];
+    int sp = 0;
+    stack[sp++] = 0;
+
+    while (sp > 0) {
+        auto& node = m_nodes[stack[--sp]];
+
+        float tenter[Node::kWidth];
+        int mask = testChildren(node, ro, rinv, ray.tmin, ray.tmax, tenter);
+        if (mask == 0)
+            continue;
+
+        // no ordering. leaf children first as they may end the search
+        uint32_t ti = node.triangle_base, ci = node.child_base;
+        for (int i = 0; i < Node::kWidth; ++i) {
+            if ((node.child_mask & (1 << i)) == 0)
+                continue;
+            uint32_t count = node.getCount(i);
+            if (count == 0) {
+                if (mask & (1 << i))
+                    stack[sp++] = ci;
+                ++ci;
+                continue;
+            }
+            if (mask & (1 << i)) {
+                for (uint32_t t = ti; t < ti + count; ++t) {
+                    auto& tri = m_triangles[t];
+                    const float3& p0 = m_vertices[node.vertex_base + tri.indices[0]];
+                    const float3& p1 = m_vertices[node.vertex_base + tri.indices[1]];
+                    const float3& p2 = m_vertices[node.vertex_base + tri.indices[2]];
+                    RayHitCPU tmp;
+                    if (IntersectTriangle(ray, rt, p0, p1, p2, cull, tmp)) {
+                        tmp.prim_id = getPrimID(node, tri);
+                        if (filter(tmp))
+                            return true;
+                    }
+                }
+            }
+            ti += count;
+        }
+    }
+    return false;
+}
+
+} // namespace rths
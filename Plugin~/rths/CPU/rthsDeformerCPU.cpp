@@ -0,0 +1,235 @@
+#include "pch.h"
+#include "Foundation/rthsLog.h"
+#include "Foundation/rthsMatrix.h"
+#include "Foundation/rthsParallel.h"
+#include "Foundation/rthsSIMD.h"
+#include "rthsDeformerCPU.h"
+
+namespace rths {
+
+namespace {
+
+// a frame of a blendshape with non-zero weight and its coefficient.
+// ApplyBlendshape() adds lerp(p1, p2, s) = p1 * (1 - s) + p2 * s, so a blendshape is one or two terms.
+struct BlendshapeTermCPU
+{
+    const BlendshapeFrameData *frame;
+    float c;
+};
+
+// per-instance data shared by all chunks of the instance
+struct DeformStateCPU
+{
+    const MeshData *mesh = nullptr;
+    float4 *dst = nullptr;
+    std::vector<BlendshapeTermCPU> blendshapes;
+    std::vector<float4x4> bone_matrices; // bindpose * bone * inverse of the instance's transform
+    std::vector<uint32_t> weight_offsets; // per vertex. empty if the mesh is not skinned or its weights are broken
+};
+
+} // namespace
+
+bool NeedsDeformCPU(const MeshInstanceData& inst)
+{
+    auto *mesh = (const MeshData*)inst.mesh;
+    if (!mesh)
+        return false;
+    return (!inst.blendshape_weights.empty() && !mesh->blendshapes.empty()) ||
+        (!inst.bones.empty() && mesh->skin.valid());
+}
+
+// same as ApplyBlendshape() of rthsDeform.hlsl. the selection of frames and s depend only on the weight,
+// so they are done once per instance and the vertex loop is a plain multiply-add.
+static void SetupBlendshapes(DeformStateCPU& state, const MeshInstanceData& inst, bool clamp_weights)
+{
+    auto& mesh = *state.mesh;
+    size_t blendshape_count = std::min(inst.blendshape_weights.size(), mesh.blendshapes.size());
+    for (size_t bsi = 0; bsi < blendshape_count; ++bsi) {
+        auto& frames = mesh.blendshapes[bsi].frames;
+        if (frames.empty())
+            continue;
+
+        // 0-100 -> 0.0-1.0 as DeformerDXR does
+        float weight = inst.blendshape_weights[bsi];
+        if (clamp_weights)
+            weight = clamp(weight, 0.0f, frames.back().weight);
+        weight /= 100.0f;
+        if (weight == 0.0f)
+            continue;
+
+        int frame_count = (int)frames.size();
+        auto frame_weight = [&](int fi) { return frames[fi].weight / 100.0f; };
+        float last_weight = frame_weight(frame_count - 1);
+
+        if (weight < 0.0f) {
+            state.blendshapes.push_back({ &frames[0], weight / frame_weight(0) });
+        }
+        else if (weight > last_weight) {
+            // extrapolates the last frame alone, as the shader does
+            float s;
+            if (frame_count >= 2) {
+                float prev_weight = frame_weight(frame_count - 2);
+                s = (weight - prev_weight) / (last_weight - prev_weight);
+            }
+            else {
+                s = weight / last_weight;
+            }
+            state.blendshapes.push_back({ &frames[frame_count - 1], s });
+        }
+        else {
+            const BlendshapeFrameData *p1 = nullptr, *p2 = nullptr;
+            float w1 = 0.0f, w2 = 0.0f;
+            for (int fi = 0; fi < frame_count; ++fi) {
+                if (weight <= frame_weight(fi)) {
+                    p2 = &frames[fi];
+                    w2 = frame_weight(fi);
+                    break;
+                }
+                else {
+                    p1 = &frames[fi];
+                    w1 = frame_weight(fi);
+                }
+            }
+            float s = (weight - w1) / (w2 - w1);
+            if (p1)
+                state.blendshapes.push_back({ p1, 1.0f - s });
+            state.blendshapes.push_back({ p2, s });
+        }
+    }
+}
+
+static void SetupSkinning(DeformStateCPU& state, const MeshInstanceData& inst, bool avx)
+{
+    auto& mesh = *state.mesh;
+    auto& skin = mesh.skin;
+    if (inst.bones.empty() || !skin.valid())
+        return;
+    if (skin.bone_counts.size() < (size_t)mesh.vertex_count) {
+        DebugPrint("DeformCPU(): %s has less bone counts than vertices\n", mesh.name.c_str());
+        return;
+    }
+
+    state.weight_offsets.resize(mesh.vertex_count);
+    uint32_t offset = 0;
+    for (int vi = 0; vi < mesh.vertex_count; ++vi) {
+        state.weight_offsets[vi] = offset;
+        offset += skin.bone_counts[vi];
+    }
+    if (offset > skin.weights.size()) {
+        DebugPrint("DeformCPU(): %s has less bone weights than bone counts require\n", mesh.name.c_str());
+        state.weight_offsets.clear();
+        return;
+    }
+
+    // same as the bone matrices of DeformerDXR
+    size_t bone_count = std::min(skin.bindposes.size(), inst.bones.size());
+    state.bone_matrices.resize(bone_count);
+    auto iroot = invert(inst.transform);
+    MulMatrices(state.bone_matrices.data(), skin.bindposes.data(), inst.bones.data(), iroot, bone_count, avx);
+}
+
+// vertices [begin, end) of an instance. vectorized over the xyz of runs of sparse deltas for blendshapes, and over the
+// xyzw of each vertex for skinning (the weights of each vertex differ)
+static void DeformChunk(const DeformStateCPU& state, int begin, int end)
+{
+    auto& mesh = *state.mesh;
+    int count = end - begin;
+    float3 tmp[kDeformChunkSize];
+
+    // base vertices. the vertex buffer can be strided
+    int stride = mesh.vertex_stride != 0 ? mesh.vertex_stride : (int)sizeof(float3);
+    auto *src = (const char*)mesh.cpu_vertex_buffer + mesh.vertex_offset + (size_t)stride * begin;
+    for (int i = 0; i < count; ++i)
+        tmp[i] = *(const float3*)(src + (size_t)stride * i);
+
+    // blendshapes. only runs of non-zero deltas in the chunk are visited.
+    // deltas of a run and tmp are tightly packed float3, so they are processed as float arrays
+    for (auto& term : state.blendshapes) {
+        auto& runs = term.frame->runs;
+        // the first run that ends after begin. runs don't overlap, so their ends are sorted too
+        auto it = std::upper_bound(runs.begin(), runs.end(), (uint32_t)begin,
+            [](uint32_t vi, const BlendshapeDeltaRun& run) { return vi < run.vertex_offset + run.vertex_count; });
+        simd4f c(term.c);
+        for (; it != runs.end() && it->vertex_offset < (uint32_t)end; ++it) {
+            int first = std::max((int)it->vertex_offset, begin);
+            int last = std::min((int)(it->vertex_offset + it->vertex_count), end);
+            const float *d = &term.frame->delta[it->delta_offset + (first - it->vertex_offset)].x;
+            float *v = &tmp[first - begin].x;
+            int num_floats = (last - first) * 3;
+            int i = 0;
+            for (; i + 4 <= num_floats; i += 4)
+                (simd4f::load(v + i) + simd4f::load(d + i) * c).store(v + i);
+            for (; i < num_floats; ++i)
+                v[i] += d[i] * term.c;
+        }
+    }
+
+    float4 *dst = state.dst + begin;
+    if (state.weight_offsets.empty()) {
+        for (int i = 0; i < count; ++i)
+            dst[i] = to_float4(tmp[i], 1.0f);
+        return;
+    }
+
+    // skinning. same as ApplySkinning(): the sum of mul(m, float4(v, 1)).xyz * w
+    auto& skin = mesh.skin;
+    auto *matrices = state.bone_matrices.data();
+    uint32_t matrix_count = (uint32_t)state.bone_matrices.size();
+    const __m128 w_one = _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f);
+    const __m128 xyz_mask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+    for (int i = 0; i < count; ++i) {
+        int vi = begin + i;
+        const BoneWeight1 *weights = skin.weights.data() + state.weight_offsets[vi];
+        int n = skin.bone_counts[vi];
+        __m128 x = _mm_set1_ps(tmp[i].x);
+        __m128 y = _mm_set1_ps(tmp[i].y);
+        __m128 z = _mm_set1_ps(tmp[i].z);
+        __m128 r = _mm_setzero_ps();
+        for (int bi = 0; bi < n; ++bi) {
+            uint32_t mi = (uint32_t)weights[bi].index;
+            if (mi >= matrix_count)
+                continue;
+            const float *m = &matrices[mi][0][0];
+            __m128 t = _mm_mul_ps(x, _mm_loadu_ps(m + 0));
+            t = _mm_add_ps(t, _mm_mul_ps(y, _mm_loadu_ps(m + 4)));
+            t = _mm_add_ps(t, _mm_mul_ps(z, _mm_loadu_ps(m + 8)));
+            t = _mm_add_ps(t, _mm_loadu_ps(m + 12));
+            r = _mm_add_ps(r, _mm_mul_ps(t, _mm_set1_ps(weights[bi].weight)));
+        }
+        _mm_storeu_ps(&dst[i].x, _mm_or_ps(_mm_and_ps(r, xyz_mask), w_one));
+    }
+}
+
+size_t DeformCPU(const DeformJobCPU *jobs, size_t num_jobs, bool clamp_blendshape_weights)
+{
+    bool avx = !GetGlobals().hasDebugFlag(DebugFlag::NoMatrixAVX);
+
+    // per-instance setup, parallelized across instances
+    std::vector<DeformStateCPU> states(num_jobs);
+    parallel_for(0, (int)num_jobs, 1, [&](int ji) {
+        auto& job = jobs[ji];
+        auto& state = states[ji];
+        state.mesh = job.inst->mesh;
+        state.dst = job.dst;
+        SetupBlendshapes(state, *job.inst, clamp_blendshape_weights);
+        SetupSkinning(state, *job.inst, avx);
+    });
+
+    // chunks of all instances are one flat range, so small instances don't leave threads idle
+    std::vector<std::pair<int, int>> chunks; // job index, first vertex
+    size_t vertex_count = 0;
+    for (size_t ji = 0; ji < num_jobs; ++ji) {
+        int n = states[ji].mesh->vertex_count;
+        for (int vi = 0; vi < n; vi += kDeformChunkSize)
+            chunks.push_back({ (int)ji, vi });
+        vertex_count += n;
+    }
+    parallel_for(0, (int)chunks.size(), 1, [&](int ci) {
+        auto& state = states[chunks[ci].first];
+        int begin = chunks[ci].second;
+        DeformChunk(state, begin, std::min(begin + kDeformChunkSize, state.mesh->vertex_count));
+    });
+    return vertex_count;
+}
+
+} // namespace rths
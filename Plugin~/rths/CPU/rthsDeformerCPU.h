@@ -0,0 +1,26 @@
+#pragma once
+#include "rthsTypes.h"
+
+namespace rths {
+
+// CPU version of DeformerDXR (rthsDeform.hlsl): blendshapes, then skinning.
+// results are float4 (w = 1) as the deformed vertices of DeformerDXR, so they can be the vertex buffer of BLAS directly.
+// skinned vertices are in the space of the instance's transform (bone matrices are multiplied by its inverse) as DeformerDXR does.
+
+struct DeformJobCPU
+{
+    const MeshInstanceData *inst;
+    float4 *dst; // inst->mesh->vertex_count elements
+};
+
+// vertices are processed in chunks of this size. each chunk is a task
+static const int kDeformChunkSize = 2048;
+
+// whether inst has anything to deform: blendshape weights of a mesh with blendshapes, or bones of a skinned mesh
+bool NeedsDeformCPU(const MeshInstanceData& inst);
+
+// deforms vertices of all jobs. parallelized across instances and vertex chunks. returns the number of vertices deformed.
+// clamp_blendshape_weights: RenderFlag::ClampBlendShapeWights
+size_t DeformCPU(const DeformJobCPU *jobs, size_t num_jobs, bool clamp_blendshape_weights);
+
+} // namespace rths
@@ -0,0 +1,570 @@
+#include "pch.h"
+#include "Foundation/rthsLog.h"
+#include "Foundation/rthsMisc.h"
+#include "Foundation/rthsParallel.h"
+#include "rthsGfxContextCPU.h"
+#include "rthsDeformerCPU.h"
+#include "rthsTracerCPU.h"
+
+namespace rths {
+
+static std::atomic_int g_gfx_cpu_initialize_count{ 0 };
+static std::unique_ptr<GfxContextCPU> g_gfx_cpu_context;
+
+bool GfxContextCPU::initializeInstance()
+{
+    if (g_gfx_cpu_initialize_count++ == 0)
+        g_gfx_cpu_context = std::make_unique<GfxContextCPU>();
+    return g_gfx_cpu_context != nullptr;
+}
+
+void GfxContextCPU::finalizeInstance()
+{
+    if (--g_gfx_cpu_initialize_count == 0)
+        g_gfx_cpu_context.reset();
+}
+
+GfxContextCPU* GfxContextCPU::getInstance()
+{
+    return g_gfx_cpu_context.get();
+}
+
+GfxContextCPU::GfxContextCPU()
+{
+}
+
+GfxContextCPU::~GfxContextCPU()
+{
+}
+
+void GfxContextCPU::frameBegin()
+{
+    // clear state flags
+    for (auto& kvp : m_mesh_records)
+        kvp.second->is_updated = false;
+    for (auto& kvp : m_deformed_mesh_records)
+        kvp.second->is_updated = false;
+    for (auto& kvp : m_meshinstance_records)
+        kvp.second->is_updated = false;
+}
+
+void GfxContextCPU::prepare(RenderDataCPU& rd)
+{
+    rthsTimestampInitializeCPU(rd.timestamp);
+    rthsTimestampResetCPU(rd.timestamp);
+    rthsTimestampSetEnableCPU(rd.timestamp, GetGlobals().hasDebugFlag(DebugFlag::Timestamp));
+    rd.stats.clear();
+    ++rd.render_count;
+
+    std::swap(rd.instances, rd.instances_prev);
+    rd.instances.clear();
+}
+
+void GfxContextCPU::setSceneData(RenderDataCPU& rd, SceneData& data)
+{
+    rd.scene_data = data;
+    rd.render_flags = data.render_flags;
+}
+
+void GfxContextCPU::setRenderTarget(RenderDataCPU& rd, RenderTargetData *rt)
+{
+    if (!rt) {
+        rd.render_target = nullptr;
+        return;
+    }
+
+    auto& data = m_rendertarget_records[rt];
+    if (!data) {
+        data = std::make_shared<RenderTargetDataCPU>();
+        rt->device_data = data.get();
+        data->base = rt;
+    }
+    if (!data->valid() || data->isRelocated()) {
+        if (rt->width <= 0 || rt->height <= 0 || SizeOfElement(rt->format) == 0) {
+            // GPU textures can not be a render target because there is no device to write them.
+            // rthsRenderTargetSetup() is required.
+            DebugPrint("GfxContextCPU::setRenderTarget(): render target has no valid size or format\n");
+            rd.render_target = nullptr;
+            return;
+        }
+        data->width = rt->width;
+        data->height = rt->height;
+        data->format = rt->format;
+        data->buffer.resize(data->width * data->height);
+    }
+    rd.render_target = data;
+}
+
+static bool IsSameMeshes(const std::vector<MeshInstanceData*>& a, const std::vector<MeshInstanceDataPtr>& b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); ++i)
+        if (a[i] != (const MeshInstanceData*)b[i])
+            return false;
+    return true;
+}
+
+void GfxContextCPU::shareScene(RenderDataCPU& rd, std::vector<MeshInstanceDataPtr>& instances)
+{
+    // renderers that have the same instances share one TLAS
+    SharedSceneCPUPtr scene;
+    for (auto& s : m_shared_scenes) {
+        if (IsSameMeshes(s->meshes, instances)) {
+            scene = s;
+            break;
+        }
+    }
+    if (!scene) {
+        scene = std::make_shared<SharedSceneCPU>();
+        for (auto& inst : instances)
+            scene->meshes.push_back(inst);
+        m_shared_scenes.push_back(scene);
+    }
+    scene->renderers.push_back(&rd);
+}
+
+void GfxContextCPU::prepareSharedScene()
+{
+    if (m_shared_scenes.empty())
+        return;
+
+    // BLAS of all renderers are built or refitted at once. each mesh is processed once regardless of renderer count.
+    std::vector<MeshInstanceData*> all;
+    bool clamp_blendshape_weights = false;
+    for (auto& scene : m_shared_scenes) {
+        all.insert(all.end(), scene->meshes.begin(), scene->meshes.end());
+        for (auto *rd : scene->renderers)
+            clamp_blendshape_weights |= rd->hasFlag(RenderFlag::ClampBlendShapeWights);
+    }
+    RenderStatsCPU blas_stats;
+    updateBLAS(all, blas_stats, clamp_blendshape_weights);
+
+    for (auto& scene : m_shared_scenes) {
+        // take over the TLAS of the scene of two frames ago that has the same meshes. renderers have moved on
+        // to the last frame's scene, so it can be refitted in place without copying the tree.
+        // fall back to a copy of the last frame's scene, which renderers that are not finished yet may still be tracing.
+        std::vector<MeshInstanceDataCPUPtr> instances_prev;
+        auto take_over = [&](std::vector<SharedSceneCPUPtr>& candidates, bool move) {
+            for (auto& prev : candidates) {
+                if (!prev || prev->meshes != scene->meshes || (move && prev.use_count() > 1))
+                    continue;
+                if (move) {
+                    instances_prev = std::move(prev->instances);
+                    scene->tlas = std::move(prev->tlas);
+                    scene->instance_bounds = std::move(prev->instance_bounds);
+                    scene->instance_masks = std::move(prev->instance_masks);
+                    scene->instance_update_counts = std::move(prev->instance_update_counts);
+                    prev = nullptr;
+                }
+                else {
+                    instances_prev = prev->instances;
+                    scene->tlas = prev->tlas;
+                    scene->instance_bounds = prev->instance_bounds;
+                    scene->instance_masks = prev->instance_masks;
+                    scene->instance_update_counts = prev->instance_update_counts;
+                }
+                return true;
+            }
+            return false;
+        };
+        if (!take_over(m_shared_scenes_spare, true))
+            take_over(m_shared_scenes_prev, false);
+
+        scene->stats = blas_stats;
+        updateInstances(scene->meshes, scene->instances);
+        updateTLAS(scene->tlas, scene->instance_bounds, scene->instance_masks, scene->instance_update_counts, scene->instances, instances_prev, scene->stats);
+        scene->stats.shared_renderers = (uint32_t)scene->renderers.size();
+    }
+}
+
+void GfxContextCPU::setMeshes(RenderDataCPU& rd, std::vector<MeshInstanceDataPtr>& instances)
+{
+    // use the shared scene if prepareSharedScene() has processed the instances of this renderer.
+    // the instances may have been changed since shareScene() (e.g. not called via RenderAll()).
+    for (auto& scene : m_shared_scenes) {
+        auto& renderers = scene->renderers;
+        if (std::find(renderers.begin(), renderers.end(), &rd) == renderers.end() || !IsSameMeshes(scene->meshes, instances))
+            continue;
+
+        rd.instances = scene->instances;
+        // must be done before rd.shared_scene is replaced. the previous TLAS tells whether there is the last frame
+        updateDirtyBounds(rd);
+        rd.instance_bounds = scene->instance_bounds;
+        rd.instance_masks = scene->instance_masks;
+        rd.shared_scene = scene;
+        rd.stats = scene->stats;
+        return;
+    }
+    if (rd.shared_scene) {
+        // rd.tlas has not been updated while the scene was shared
+        rd.shared_scene = nullptr;
+        rd.tlas.clear();
+    }
+
+    std::vector<MeshInstanceData*> meshes;
+    for (auto& inst : instances)
+        meshes.push_back(inst);
+
+    rthsTimestampQueryCPU(rd.timestamp, "Building BLAS begin");
+    updateBLAS(meshes, rd.stats, rd.hasFlag(RenderFlag::ClampBlendShapeWights));
+    updateInstances(meshes, rd.instances);
+    rthsTimestampQueryCPU(rd.timestamp, "Building BLAS end");
+
+    // must be done before the TLAS update overwrites bounds of the previous frame
+    updateDirtyBounds(rd);
+
+    rthsTimestampQueryCPU(rd.timestamp, "Building TLAS begin");
+    updateTLAS(rd.tlas, rd.instance_bounds, rd.instance_masks, rd.instance_update_counts, rd.instances, rd.instances_prev, rd.stats);
+    rthsTimestampQueryCPU(rd.timestamp, "Building TLAS end");
+}
+
+void GfxContextCPU::setViewMeshes(RenderDataCPU& rd, const RenderDataCPU& primary)
+{
+    // instances are needed to resolve receivers. bounds and masks are not, as TLAS of the primary is traced.
+    rd.instances = primary.instances;
+    rd.shared_scene = nullptr;
+    rd.primary = &primary;
+
+    // if this view has been rendered with the previous render of the primary, changes since then are
+    // what the primary has collected. otherwise they can't be determined.
+    bool consecutive = rd.primary_render_count + 1 == primary.render_count;
+    rd.dirty_all = !consecutive || primary.dirty_all;
+    if (rd.dirty_all)
+        rd.dirty_bounds.clear();
+    else
+        rd.dirty_bounds = primary.dirty_bounds;
+    rd.primary_render_count = primary.render_count;
+}
+
+void GfxContextCPU::updateBLAS(const std::vector<MeshInstanceData*>& instances, RenderStatsCPU& stats, bool clamp_blendshape_weights)
+{
+    // collect meshes that need to build BLAS, and instances that need to be deformed before it
+    std::vector<MeshDataCPU*> build_list;
+    std::vector<DeformJobCPU> deform_list;
+    for (auto *inst : instances) {
+        auto& mesh = inst->mesh;
+        if (mesh->vertex_count == 0 || mesh->index_count == 0)
+            continue;
+        if (!mesh->cpu_vertex_buffer || !mesh->cpu_index_buffer) {
+            DebugPrint("GfxContextCPU::setMeshes(): %s has no CPU buffers\n", mesh->name.c_str());
+            continue;
+        }
+
+        if (NeedsDeformCPU(*inst)) {
+            // deformed at most once per frame, as dynamic meshes are. other renderers may be tracing the result already.
+            auto& deformed = m_deformed_mesh_records[inst];
+            if (!deformed) {
+                deformed = std::make_shared<MeshDataCPU>();
+                deformed->base = mesh;
+                deformed->is_deformed = true;
+            }
+            bool needs_deform = !deformed->is_updated &&
+                (!deformed->hasBLAS() || inst->isUpdated(UpdateFlag::Deform) || mesh->is_dynamic);
+            if (needs_deform) {
+                deformed->is_updated = true;
+                deformed->deformed_vertices.resize(mesh->vertex_count);
+                deform_list.push_back({ inst, deformed->deformed_vertices.data() });
+                build_list.push_back(deformed.get());
+            }
+            continue;
+        }
+        // instances that are no longer deformed go back to the BLAS of the mesh.
+        // the record is kept alive by MeshInstanceDataCPU::mesh while it is traced
+        m_deformed_mesh_records.erase(inst);
+
+        auto& mesh_cpu = m_mesh_records[mesh];
+        if (!mesh_cpu) {
+            mesh_cpu = std::make_shared<MeshDataCPU>();
+            mesh->device_data = mesh_cpu.get();
+            mesh_cpu->base = mesh;
+        }
+        // dynamic meshes are updated once per frame (vertices may have been modified)
+        bool needs_update = !mesh_cpu->hasBLAS() || (mesh->is_dynamic && !mesh_cpu->is_updated);
+        if (needs_update && std::find(build_list.begin(), build_list.end(), mesh_cpu.get()) == build_list.end())
+            build_list.push_back(mesh_cpu.get());
+    }
+
+    if (!deform_list.empty()) {
+        auto deform_begin = Now();
+        stats.deform_vertex_count += (uint32_t)DeformCPU(deform_list.data(), deform_list.size(), clamp_blendshape_weights);
+        stats.deform_instance_count += (uint32_t)deform_list.size();
+        stats.deform_time += Now() - deform_begin;
+    }
+
+    if (GetGlobals().hasDebugFlag(DebugFlag::BLASUpdateReport)) {
+        // evaluated one by one before the update as it measures time
+        for (auto *mesh_cpu : build_list) {
+            if (!mesh_cpu->isDynamic() || mesh_cpu->blas.empty())
+                continue;
+            stats.blas_update_report.merge(EvaluateBLASUpdateCPU(mesh_cpu->blas,
+                mesh_cpu->getVertices(), mesh_cpu->getVertexStride(), mesh_cpu->base->vertex_count,
+                mesh_cpu->getIndices(), mesh_cpu->getIndexStride(), mesh_cpu->base->index_count));
+        }
+    }
+
+    // build or refit BLAS. parallelized across meshes, and each build is parallelized internally too.
+    parallel_for(0, (int)build_list.size(), 1, [&](int i) {
+        auto *mesh_cpu = build_list[i];
+        if (mesh_cpu->hasBLAS())
+            mesh_cpu->updateBLAS();
+        else
+            mesh_cpu->buildBLAS();
+        mesh_cpu->is_updated = true;
+    });
+    for (auto *mesh_cpu : build_list)
+        stats.addBLASStats(mesh_cpu->getBuildStats());
+}
+
+void GfxContextCPU::updateInstances(const std::vector<MeshInstanceData*>& instances, std::vector<MeshInstanceDataCPUPtr>& dst)
+{
+    dst.clear();
+    for (auto *inst : instances) {
+        MeshDataCPUPtr mesh_cpu;
+        auto dit = m_deformed_mesh_records.find(inst);
+        if (dit != m_deformed_mesh_records.end()) {
+            mesh_cpu = dit->second;
+        }
+        else {
+            auto it = m_mesh_records.find(inst->mesh);
+            if (it != m_mesh_records.end())
+                mesh_cpu = it->second;
+        }
+        if (!mesh_cpu || !mesh_cpu->hasBLAS())
+            continue;
+
+        auto& inst_cpu = m_meshinstance_records[inst];
+        bool needs_update = false;
+        if (!inst_cpu) {
+            inst_cpu = std::make_shared<MeshInstanceDataCPU>();
+            inst->device_data = inst_cpu.get();
+            inst_cpu->base = inst;
+            inst_cpu->mesh = mesh_cpu;
+            needs_update = true;
+        }
+        if (inst_cpu->mesh != mesh_cpu) {
+            // the instance has started or stopped being deformed
+            inst_cpu->mesh = mesh_cpu;
+            needs_update = true;
+        }
+        // bounds need to be updated if transform is changed or BLAS is rebuilt.
+        // BLAS rebuild is handled once per frame. other renderers may be tracing this instance already (see flush()).
+        if (inst->isUpdated(UpdateFlag::Any) || (mesh_cpu->is_updated && !inst_cpu->is_updated))
+            needs_update = true;
+        if (needs_update) {
+            inst_cpu->is_updated = true;
+            ++inst_cpu->update_count;
+            inst_cpu->updateTransform();
+        }
+
+        inst->clearUpdateFlags();
+        dst.push_back(inst_cpu);
+    }
+}
+
+void GfxContextCPU::updateTLAS(TLASCPU& tlas, std::vector<AABB>& instance_bounds, std::vector<InstanceMaskCPU>& instance_masks, std::vector<uint64_t>& instance_update_counts,
+    const std::vector<MeshInstanceDataCPUPtr>& instances, const std::vector<MeshInstanceDataCPUPtr>& instances_prev, RenderStatsCPU& stats)
+{
+    // build or refit TLAS.
+    // full rebuild is needed only when the instance list is changed or the tree is degraded by refits.
+    auto tlas_begin = Now();
+    uint32_t instance_count = (uint32_t)instances.size();
+    bool needs_rebuild = tlas.empty() || instances != instances_prev || instance_update_counts.size() != instance_count;
+    if (!needs_rebuild) {
+        // compare update counts instead of relying on is_updated. this also catches updates that happened
+        // while this TLAS was not updated (update flags may have been consumed by other renderers).
+        // layer mask changes are marked as updates by endScene().
+        std::vector<uint32_t> updated;
+        for (uint32_t ii = 0; ii < instance_count; ++ii) {
+            auto& inst = *instances[ii];
+            if (instance_update_counts[ii] != inst.update_count) {
+                instance_update_counts[ii] = inst.update_count;
+                instance_bounds[ii] = inst.bounds;
+                instance_masks[ii] = { GetInstanceMask(*inst.base), inst.base->layer_mask };
+                updated.push_back(ii);
+            }
+        }
+        if (!updated.empty()) {
+            needs_rebuild = !tlas.refit(instance_bounds.data(), instance_masks.data(), updated.data(), (uint32_t)updated.size());
+            stats.tlas_update_count = (uint32_t)updated.size();
+        }
+    }
+    if (needs_rebuild) {
+        instance_bounds.resize(instance_count);
+        instance_masks.resize(instance_count);
+        instance_update_counts.resize(instance_count);
+        for (uint32_t ii = 0; ii < instance_count; ++ii) {
+            auto& base = *instances[ii]->base;
+            instance_bounds[ii] = instances[ii]->bounds;
+            instance_masks[ii] = { GetInstanceMask(base), base.layer_mask };
+            instance_update_counts[ii] = instances[ii]->update_count;
+        }
+        tlas.build(instance_bounds.data(), instance_masks.data(), instance_count);
+        stats.tlas_rebuilt = true;
+    }
+    stats.tlas_instance_count = instance_count;
+    stats.tlas_time = Now() - tlas_begin;
+    stats.tlas_sah_cost = tlas.getSAHCost();
+}
+
+void GfxContextCPU::setGBuffer(RenderDataCPU& rd, const float *depth, const uint32_t *instance_ids,
+    std::vector<MeshInstanceDataPtr>& meshes, const std::vector<uint32_t>& mesh_indices)
+{
+    rd.gbuffer_depth = depth;
+    rd.gbuffer_instance_ids = instance_ids;
+    rd.gbuffer_instances.clear();
+    if (!depth || !instance_ids)
+        return;
+
+    // meshes that have no BLAS are not in rd.instances. receivers of them are unknown.
+    std::map<const MeshInstanceData*, uint32_t> indices;
+    for (uint32_t ii = 0; ii < (uint32_t)rd.instances.size(); ++ii)
+        indices[rd.instances[ii]->base] = ii;
+    for (size_t mi = 0; mi < meshes.size(); ++mi) {
+        uint32_t id = mesh_indices[mi];
+        if (id >= rd.gbuffer_instances.size())
+            rd.gbuffer_instances.resize(id + 1, kUnknownInstance);
+        auto it = indices.find(meshes[mi]);
+        if (it != indices.end())
+            rd.gbuffer_instances[id] = it->second;
+    }
+}
+
+void GfxContextCPU::updateDirtyBounds(RenderDataCPU& rd)
+{
+    rd.dirty_bounds.clear();
+    if (!rd.hasFlag(RenderFlag::DirtyRegions)) {
+        // update counts of the next render can't be compared with stale ones
+        rd.dirty_update_counts.clear();
+        rd.dirty_all = true;
+        return;
+    }
+
+    // instance_bounds, instance_masks and dirty_update_counts are still those of instances_prev here.
+    // update counts are compared instead of is_updated, as this renderer may not have rendered the previous frame.
+    std::vector<uint64_t> update_counts(rd.instances.size());
+    for (size_t ii = 0; ii < rd.instances.size(); ++ii)
+        update_counts[ii] = rd.instances[ii]->update_count;
+    std::swap(update_counts, rd.dirty_update_counts);
+
+    size_t prev_count = rd.instances_prev.size();
+    rd.dirty_all = rd.getTLAS().empty() ||
+        rd.instance_bounds.size() != prev_count || update_counts.size() != prev_count;
+    if (rd.dirty_all)
+        return;
+
+    auto is_dirty = [&](const MeshInstanceDataCPU& inst, uint32_t prev_index) {
+        auto& base = *inst.base;
+        InstanceMaskCPU mask{ GetInstanceMask(base), base.layer_mask };
+        return inst.update_count != update_counts[prev_index] ||
+            rd.instance_bounds[prev_index] != inst.bounds || rd.instance_masks[prev_index] != mask;
+    };
+    auto add = [&rd](const AABB& v) {
+        if (v.valid())
+            rd.dirty_bounds.push_back(v);
+    };
+
+    if (rd.instances == rd.instances_prev) {
+        for (uint32_t ii = 0; ii < (uint32_t)rd.instances.size(); ++ii) {
+            auto& inst = *rd.instances[ii];
+            if (is_dirty(inst, ii)) {
+                add(rd.instance_bounds[ii]);
+                add(inst.bounds);
+            }
+        }
+    }
+    else {
+        // instances have been added or removed. match them by pointers.
+        std::map<const MeshInstanceDataCPU*, uint32_t> prev_indices;
+        for (uint32_t ii = 0; ii < (uint32_t)rd.instances_prev.size(); ++ii)
+            prev_indices[rd.instances_prev[ii].get()] = ii;
+        for (auto& inst : rd.instances) {
+            auto it = prev_indices.find(inst.get());
+            if (it == prev_indices.end()) {
+                add(inst->bounds);
+                continue;
+            }
+            if (is_dirty(*inst, it->second)) {
+                add(rd.instance_bounds[it->second]);
+                add(inst->bounds);
+            }
+            prev_indices.erase(it);
+        }
+        for (auto& kvp : prev_indices)
+            add(rd.instance_bounds[kvp.second]);
+    }
+}
+
+void GfxContextCPU::flush(RenderDataCPU& rd)
+{
+    if (!rd.render_target || !rd.render_target->valid()) {
+        SetErrorLog("GfxContextCPU::flush(): render target is null\n");
+        return;
+    }
+
+    // rays are traced asynchronously on the job system, as GfxContextDXR submits command lists.
+    // so multiple renderers in RenderAll() trace in parallel. finish() waits for it.
+    rthsTimestampQueryCPU(rd.timestamp, "DispatchRays begin");
+    if (!rd.dispatch_task)
+        rd.dispatch_task = std::make_unique<TaskGroup>();
+    rd.dispatch_task->run([&rd]() {
+        TracerCPU tracer(rd);
+        tracer.dispatch();
+        rthsTimestampQueryCPU(rd.timestamp, "DispatchRays end");
+    });
+}
+
+bool GfxContextCPU::finish(RenderDataCPU& rd)
+{
+    if (rd.dispatch_task)
+        rd.dispatch_task->wait();
+    rthsTimestampUpdateLogCPU(rd.timestamp);
+    return true;
+}
+
+void GfxContextCPU::frameEnd()
+{
+    // kept to refit TLAS in the next frames. the last frame's scenes are recycled in the next frame
+    m_shared_scenes_spare = std::move(m_shared_scenes_prev);
+    m_shared_scenes_prev = std::move(m_shared_scenes);
+    m_shared_scenes.clear();
+}
+
+bool GfxContextCPU::readbackRenderTarget(RenderDataCPU& rd, void *dst)
+{
+    if (!rd.render_target || !rd.render_target->valid())
+        return false;
+
+    auto& rt = *rd.render_target;
+    ConvertRenderTarget(dst, rt.buffer.data(), rt.buffer.size(), rt.format);
+    return true;
+}
+
+void GfxContextCPU::clearResourceCache()
+{
+    m_mesh_records.clear();
+    m_deformed_mesh_records.clear();
+    m_meshinstance_records.clear();
+    m_rendertarget_records.clear();
+    m_shared_scenes.clear();
+    m_shared_scenes_prev.clear();
+    m_shared_scenes_spare.clear();
+}
+
+void GfxContextCPU::onMeshDelete(MeshData *mesh)
+{
+    m_mesh_records.erase(mesh);
+}
+
+void GfxContextCPU::onMeshInstanceDelete(MeshInstanceData *inst)
+{
+    m_deformed_mesh_records.erase(inst);
+    m_meshinstance_records.erase(inst);
+}
+
+void GfxContextCPU::onRenderTargetDelete(RenderTargetData *rt)
+{
+    m_rendertarget_records.erase(rt);
+}
+
+} // namespace rths
@@ -0,0 +1,62 @@
+#pragma once
+#include "rthsRenderer.h"
+#include "rthsTypesCPU.h"
+
+namespace rths {
+
+// software implementation of GfxContextDXR. works without any GPU.
+class GfxContextCPU : public ISceneCallback
+{
+public:
+    static bool initializeInstance();
+    static void finalizeInstance();
+    static GfxContextCPU* getInstance();
+
+    void frameBegin() override;
+    // RenderAll(). shareScene() registers instances of renderers, and prepareSharedScene() builds them at once.
+    // setMeshes() of these renderers then uses the result instead of building acceleration structures by themselves.
+    void shareScene(RenderDataCPU& rd, std::vector<MeshInstanceDataPtr>& meshes);
+    void prepareSharedScene() override;
+    void prepare(RenderDataCPU& rd);
+    void setSceneData(RenderDataCPU& rd, SceneData& data);
+    void setRenderTarget(RenderDataCPU& rd, RenderTargetData *rt);
+    void setMeshes(RenderDataCPU& rd, std::vector<MeshInstanceDataPtr>& meshes);
+    // multi-view. rd traces the acceleration structures of primary. must be called after setMeshes() of primary
+    void setViewMeshes(RenderDataCPU& rd, const RenderDataCPU& primary);
+    // must be called after setMeshes(). mesh_indices: instance IDs of meshes
+    void setGBuffer(RenderDataCPU& rd, const float *depth, const uint32_t *instance_ids,
+        std::vector<MeshInstanceDataPtr>& meshes, const std::vector<uint32_t>& mesh_indices);
+    void flush(RenderDataCPU& rd);
+    bool finish(RenderDataCPU& rd);
+    void frameEnd() override;
+
+    bool readbackRenderTarget(RenderDataCPU& rd, void *dst);
+    void clearResourceCache();
+
+    void onMeshDelete(MeshData *mesh) override;
+    void onMeshInstanceDelete(MeshInstanceData *inst) override;
+    void onRenderTargetDelete(RenderTargetData *rt) override;
+
+private:
+    friend std::unique_ptr<GfxContextCPU> std::make_unique<GfxContextCPU>();
+    friend struct std::default_delete<GfxContextCPU>;
+
+    GfxContextCPU();
+    ~GfxContextCPU();
+    // clamp_blendshape_weights: RenderFlag::ClampBlendShapeWights of the renderers
+    void updateBLAS(const std::vector<MeshInstanceData*>& instances, RenderStatsCPU& stats, bool clamp_blendshape_weights);
+    void updateInstances(const std::vector<MeshInstanceData*>& instances, std::vector<MeshInstanceDataCPUPtr>& dst);
+    // only instances whose update_count differs from instance_update_counts are refitted
+    void updateTLAS(TLASCPU& tlas, std::vector<AABB>& instance_bounds, std::vector<InstanceMaskCPU>& instance_masks, std::vector<uint64_t>& instance_update_counts,
+        const std::vector<MeshInstanceDataCPUPtr>& instances, const std::vector<MeshInstanceDataCPUPtr>& instances_prev, RenderStatsCPU& stats);
+    // RenderFlag::DirtyRegions. collects bounds of instances that have changed since the last setMeshes() of rd
+    void updateDirtyBounds(RenderDataCPU& rd);
+
+    std::map<MeshData*, MeshDataCPUPtr> m_mesh_records;
+    std::map<MeshInstanceData*, MeshDataCPUPtr> m_deformed_mesh_records; // BLAS of deformed instances. see MeshDataCPU::is_deformed
+    std::map<MeshInstanceData*, MeshInstanceDataCPUPtr> m_meshinstance_records;
+    std::map<RenderTargetData*, RenderTargetDataCPUPtr> m_rendertarget_records;
+    std::vector<SharedSceneCPUPtr> m_shared_scenes, m_shared_scenes_prev, m_shared_scenes_spare; // current frame, last frame, two frames ago
+};
+
+} // namespace rths
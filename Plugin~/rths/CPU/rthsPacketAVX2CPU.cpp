@@ -0,0 +1,35 @@
+#include "pch.h"
+#include "rthsPacketImplCPU.h"
+
+// this file must be compiled with AVX2 enabled (/arch:AVX2 or -mavx2). IsPackets8Available() returns false otherwise.
+
+namespace rths {
+
+#ifdef __AVX2__
+
+void IntersectPackets8(const RenderDataCPU& rd, const PacketQueryCPU& q, RayCPU *rays, RayHitCPU *hits, int ray_count)
+{
+    packet::IntersectPackets<simd8f>(rd, q, rays, hits, ray_count);
+}
+
+bool IsPackets8Available()
+{
+    static const bool s_available = IsAVX2Supported();
+    return s_available;
+}
+
+#else // __AVX2__
+
+void IntersectPackets8(const RenderDataCPU& rd, const PacketQueryCPU& q, RayCPU *rays, RayHitCPU *hits, int ray_count)
+{
+    IntersectPackets4(rd, q, rays, hits, ray_count);
+}
+
+bool IsPackets8Available()
+{
+    return false;
+}
+
+#endif // __AVX2__
+
+} // namespace rths
@@ -0,0 +1,11 @@
+#include "pch.h"
+#include "rthsPacketImplCPU.h"
+
+namespace rths {
+
+void IntersectPackets4(const RenderDataCPU& rd, const PacketQueryCPU& q, RayCPU *rays, RayHitCPU *hits, int ray_count)
+{
+    packet::IntersectPackets<simd4f>(rd, q, rays, hits, ray_count);
+}
+
+} // namespace rths
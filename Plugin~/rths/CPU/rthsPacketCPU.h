@@ -0,0 +1,26 @@
+#pragma once
+#include "rthsTypesCPU.h"
+
+namespace rths {
+
+// filters of packet queries are evaluated per instance.
+// this is enough for camera rays as AnyHitCamera only checks the layer mask of the instance.
+struct PacketQueryCPU
+{
+    uint32_t instance_mask = ~0u; // kInstanceMaskCamera / kInstanceMaskShadow
+    uint32_t layer_mask = ~0u;
+    CullMode cull = CullMode::None;
+    bool any_hit = false; // end each ray at its first hit (occlusion). hits are not the closest ones in that case
+};
+
+// closest hit of rays against rd.getTLAS(), 4 or 8 rays at once. rays[i].tmax is updated on hit.
+// each packet is made of consecutive rays, so rays should be ordered to make packets coherent (e.g. 2x2 or 4x2 pixel blocks).
+// results are the same as TracerCPU's single ray traversal except ties between triangles at the same distance.
+using IntersectPacketsFunc = void(*)(const RenderDataCPU& rd, const PacketQueryCPU& q, RayCPU *rays, RayHitCPU *hits, int ray_count);
+void IntersectPackets4(const RenderDataCPU& rd, const PacketQueryCPU& q, RayCPU *rays, RayHitCPU *hits, int ray_count); // SSE
+void IntersectPackets8(const RenderDataCPU& rd, const PacketQueryCPU& q, RayCPU *rays, RayHitCPU *hits, int ray_count); // AVX2
+
+// IntersectPackets8() requires AVX2 on both the build (rthsPacketAVX2CPU.cpp) and the CPU.
+bool IsPackets8Available();
+
+} // namespace rths
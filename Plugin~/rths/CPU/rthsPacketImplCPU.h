@@ -0,0 +1,457 @@
+#pragma once
+#include "Foundation/rthsSIMD.h"
+#include "rthsPacketCPU.h"
+
+// implementation of ray packet traversal. V is simd4f or simd8f.
+// this is included only from rthsPacketCPU.cpp and rthsPacketAVX2CPU.cpp that are compiled with different instruction sets.
+// arithmetics are done in the same order as IntersectTriangle() and RayBoxTestCPU to get the same results as single rays.
+
+namespace rths {
+namespace packet {
+
+template<class V>
+struct RayPacket
+{
+    V ox, oy, oz;
+    V dx, dy, dz;
+    V ix, iy, iz; // 1 / direction
+    V tmin, tmax;
+    V active;     // mask
+
+    // RayTriangleTestCPU of each lane. set by SetupTriangleTest()
+    V kx0, kx1, ky0, ky1, kz0, kz1; // masks. the axis is 0 or 1 (2 if neither)
+    V okx, oky, okz;      // permuted origin
+    V sx, sy, sz;
+    int kx, ky, kz;       // permutation shared by all lanes. -1 if lanes differ
+};
+
+template<class V>
+struct HitPacket
+{
+    V t, u, v;
+    V prim_id;     // uint32_t in float lanes
+    V instance_id; // uint32_t in float lanes
+    V front_face;  // mask
+};
+
+// returns entry distance. FLT_MAX for rays that miss
+template<class V>
+inline V TestBox(const RayPacket<V>& r, const AABB& box)
+{
+    V t0x = (V(box.bmin.x) - r.ox) * r.ix;
+    V t0y = (V(box.bmin.y) - r.oy) * r.iy;
+    V t0z = (V(box.bmin.z) - r.oz) * r.iz;
+    V t1x = (V(box.bmax.x) - r.ox) * r.ix;
+    V t1y = (V(box.bmax.y) - r.oy) * r.iy;
+    V t1z = (V(box.bmax.z) - r.oz) * r.iz;
+    V enter = max(max(min(t0x, t1x), min(t0y, t1y)), max(min(t0z, t1z), r.tmin));
+    V exit = min(min(max(t0x, t1x), max(t0y, t1y)), min(max(t0z, t1z), r.tmax));
+    return select((enter <= exit) & r.active, enter, V(FLT_MAX));
+}
+
+// same choice of axes and shear as RayTriangleTestCPU, made per lane.
+// coherent rays mostly share the permutation. then vertices are permuted once for the packet instead of per lane.
+template<class V>
+inline void SetupTriangleTest(RayPacket<V>& r)
+{
+    const V sign = V::bits(0x80000000);
+    V adx = andnot(sign, r.dx), ady = andnot(sign, r.dy), adz = andnot(sign, r.dz);
+    V kz0 = (adx > ady) & (adx > adz);
+    V kz1 = andnot(adx > ady, ady > adz);
+    V kz2 = andnot(kz0 | kz1, V::bits(~0u));
+    r.kz0 = kz0;
+    r.kz1 = kz1;
+    V dkz = select(kz0, r.dx, select(kz1, r.dy, r.dz));
+    V neg = dkz < V(0.0f);
+
+    // without swap: kz 0 -> (kx, ky) = (1, 2), kz 1 -> (2, 0), kz 2 -> (0, 1)
+    r.kx0 = select(neg, kz1, kz2);
+    r.kx1 = select(neg, kz2, kz0);
+    r.ky0 = select(neg, kz2, kz1);
+    r.ky1 = select(neg, kz0, kz2);
+    V dkx = select(r.kx0, r.dx, select(r.kx1, r.dy, r.dz));
+    V dky = select(r.ky0, r.dx, select(r.ky1, r.dy, r.dz));
+    r.okx = select(r.kx0, r.ox, select(r.kx1, r.oy, r.oz));
+    r.oky = select(r.ky0, r.ox, select(r.ky1, r.oy, r.oz));
+    r.okz = select(kz0, r.ox, select(kz1, r.oy, r.oz));
+    r.sx = dkx / dkz;
+    r.sy = dky / dkz;
+    r.sz = V(1.0f) / dkz;
+
+    const int all = (1 << V::size) - 1;
+    int m0 = movemask(kz0), m1 = movemask(kz1), mn = movemask(neg);
+    if ((m0 == 0 || m0 == all) && (m1 == 0 || m1 == all) && (mn == 0 || mn == all)) {
+        r.kz = m0 ? 0 : m1 ? 1 : 2;
+        r.kx = r.kz == 2 ? 0 : r.kz + 1;
+        r.ky = r.kx == 2 ? 0 : r.kx + 1;
+        if (mn)
+            std::swap(r.kx, r.ky);
+    }
+    else {
+        r.kx = r.ky = r.kz = -1;
+    }
+}
+
+// vertex translated to the ray origin, permuted and sheared. z is not scaled by sz yet.
+template<class V>
+inline void ShearVertex(const RayPacket<V>& r, const float3& p, V& x, V& y, V& z)
+{
+    V pkx, pky, pkz;
+    if (r.kz >= 0) {
+        pkx = V(p[r.kx]);
+        pky = V(p[r.ky]);
+        pkz = V(p[r.kz]);
+    }
+    else {
+        const V px(p.x), py(p.y), pz(p.z);
+        pkx = select(r.kx0, px, select(r.kx1, py, pz));
+        pky = select(r.ky0, px, select(r.ky1, py, pz));
+        pkz = select(r.kz0, px, select(r.kz1, py, pz));
+    }
+    z = pkz - r.okz;
+    x = (pkx - r.okx) - r.sx * z;
+    y = (pky - r.oky) - r.sy * z;
+}
+
+// a triangle vs all rays of the packet. same as IntersectTriangle() with RayTriangleTestCPU.
+template<class V>
+inline void IntersectTriangle(RayPacket<V>& r, HitPacket<V>& h,
+    const float3& p0, const float3& p1, const float3& p2, V prim_id, CullMode cull, V instance_id)
+{
+    V ax, ay, az, bx, by, bz, cx, cy, cz;
+    ShearVertex(r, p0, ax, ay, az);
+    ShearVertex(r, p1, bx, by, bz);
+    ShearVertex(r, p2, cx, cy, cz);
+
+    const V zero(0.0f);
+    V w0 = cx * by - cy * bx;
+    V w1 = ax * cy - ay * cx;
+    V w2 = bx * ay - by * ax;
+    V neg = (w0 < zero) | (w1 < zero) | (w2 < zero);
+    V pos = (w0 > zero) | (w1 > zero) | (w2 > zero);
+    V det = w0 + w1 + w2;
+    V front = det > zero;
+    V valid = r.active & andnot(neg & pos, det != zero);
+    if (cull == CullMode::Back)
+        valid = valid & front;
+    else if (cull == CullMode::Front)
+        valid = andnot(front, valid);
+    if (movemask(valid) == 0)
+        return;
+
+    V idet = V(1.0f) / det;
+    V t = (w0 * (r.sz * az) + w1 * (r.sz * bz) + w2 * (r.sz * cz)) * idet;
+    valid = valid & (t >= r.tmin) & (t <= r.tmax);
+    if (movemask(valid) == 0)
+        return;
+
+    h.t = select(valid, t, h.t);
+    h.u = select(valid, w1 * idet, h.u);
+    h.v = select(valid, w2 * idet, h.v);
+    h.prim_id = select(valid, prim_id, h.prim_id);
+    h.instance_id = select(valid, instance_id, h.instance_id);
+    h.front_face = select(valid, front, h.front_face);
+    r.tmax = select(valid, t, r.tmax);
+}
+
+// lane 'i' of a triangle block vs all rays of the packet
+template<class V>
+inline void IntersectTriangle(RayPacket<V>& r, HitPacket<V>& h,
+    const TriangleBlockCPU& b, int i, CullMode cull, V instance_id)
+{
+    float3 p0{ b.p0[0][i], b.p0[1][i], b.p0[2][i] };
+    float3 p1{ b.p1[0][i], b.p1[1][i], b.p1[2][i] };
+    float3 p2{ b.p2[0][i], b.p2[1][i], b.p2[2][i] };
+    IntersectTriangle(r, h, p0, p1, p2, V::bits(b.prim_id[i]), cull, instance_id);
+}
+
+// max tmax of active rays. nodes farther than this can be skipped.
+template<class V>
+inline float MaxT(const RayPacket<V>& r)
+{
+    return hmax(select(r.active, r.tmax, V(-FLT_MAX)));
+}
+
+// common part of BLAS and TLAS traversal. Leaf: [](const BVHNodeCPU& leaf) -> void
+// Visit: [](uint32_t node_index) -> bool. same as TraverseClosestCPU()
+template<class V, class Leaf, class Visit = VisitAllCPU>
+inline void Traverse(const BVHNodeCPU *nodes, RayPacket<V>& r, const Leaf& leaf, const Visit& visit = Visit())
+{
+    if (!visit(0) || movemask(TestBox(r, nodes[0].bounds) < V(FLT_MAX)) == 0)
+        return;
+
+    struct StackEntry
+    {
+        uint32_t node;
+        float t; // nearest entry of the packet
+    };
+    StackEntry stack[BLASCPU::kMaxDepth];
+    int sp = 0;
+    float max_t = MaxT(r);
+
+    uint32_t ni = 0;
+    for (;;) {
+        auto& node = nodes[ni];
+        if (node.count == 0) {
+            uint32_t c0 = node.offset, c1 = node.offset + 1;
+            V t0 = visit(c0) ? TestBox(r, nodes[c0].bounds) : V(FLT_MAX);
+            V t1 = visit(c1) ? TestBox(r, nodes[c1].bounds) : V(FLT_MAX);
+            bool h0 = movemask(t0 < V(FLT_MAX)) != 0;
+            bool h1 = movemask(t1 < V(FLT_MAX)) != 0;
+            if (h0 && h1) {
+                float n0 = hmin(t0), n1 = hmin(t1);
+                if (n1 < n0) {
+                    std::swap(c0, c1);
+                    std::swap(n0, n1);
+                }
+                stack[sp++] = { c1, n1 };
+                ni = c0;
+                continue;
+            }
+            else if (h0) {
+                ni = c0;
+                continue;
+            }
+            else if (h1) {
+                ni = c1;
+                continue;
+            }
+        }
+        else {
+            leaf(node);
+            max_t = MaxT(r);
+        }
+
+        for (;;) {
+            if (sp == 0)
+                return;
+            auto& e = stack[--sp];
+            if (e.t <= max_t) {
+                ni = e.node;
+                break;
+            }
+        }
+    }
+}
+
+// any_hit: rays that have hit are deactivated after each leaf. traversal ends when all rays are deactivated.
+template<class V>
+inline void IntersectBLAS(const BLASCPU& blas, RayPacket<V>& r, HitPacket<V>& h, CullMode cull, V instance_id, bool any_hit)
+{
+    if (blas.empty())
+        return;
+    auto *blocks = blas.getBlocks();
+    Traverse(blas.getNodes(), r, [&](const BVHNodeCPU& leaf) {
+        for (uint32_t i = 0; i < leaf.count; ++i)
+            IntersectTriangle(r, h, blocks[leaf.offset + i / TriangleBlockCPU::kWidth], i % TriangleBlockCPU::kWidth, cull, instance_id);
+        if (any_hit)
+            r.active = andnot(h.t < V(FLT_MAX), r.active);
+    });
+}
+
+// 8-wide nodes of CompressedBLASCPU. children hit by any ray of the packet are ordered by the nearest entry of the packet.
+// leaf children are intersected immediately, near to far. inner children are pushed far to near.
+// this is the order CompressedBLASCPU::intersect() visits them in. any_hit: same as IntersectBLAS().
+template<class V>
+inline void IntersectCompressedBLAS(const CompressedBLASCPU& blas, RayPacket<V>& r, HitPacket<V>& h, CullMode cull, V instance_id, bool any_hit)
+{
+    using Node = CompressedBVHNodeCPU;
+    if (blas.empty())
+        return;
+    auto *nodes = blas.getNodes();
+    auto *triangles = blas.getTriangles();
+    auto *vertices = blas.getVertices();
+
+    struct StackEntry
+    {
+        uint32_t node;
+        float t; // nearest entry of the packet
+    };
+    StackEntry stack[BLASCPU::kMaxDepth * Node::kWidth];
+    int sp = 0;
+    stack[sp++] = { 0, -FLT_MAX };
+    float max_t = MaxT(r);
+
+    while (sp > 0) {
+        auto& e = stack[--sp];
+        if (e.t > max_t)
+            continue;
+        auto& node = nodes[e.node];
+
+        AABB bounds[Node::kWidth];
+        CompressedBLASCPU::decodeChildBounds(node, bounds);
+
+        // test children and sort hit ones near to far
+        float tenter[Node::kWidth];
+        uint32_t tri_offset[Node::kWidth];
+        uint32_t child_index[Node::kWidth];
+        int order[Node::kWidth];
+        int n = 0;
+        uint32_t ti = node.triangle_base, ci = node.child_base;
+        for (int i = 0; i < Node::kWidth; ++i) {
+            if ((node.child_mask & (1 << i)) == 0)
+                continue;
+            tri_offset[i] = ti;
+            child_index[i] = ci;
+            if (node.getCount(i) != 0)
+                ti += node.getCount(i);
+            else
+                ++ci;
+
+            V t = TestBox(r, bounds[i]);
+            if (movemask(t < V(FLT_MAX)) == 0)
+                continue;
+            tenter[i] = hmin(t);
+            int j = n++;
+            for (; j > 0 && tenter[order[j - 1]] > tenter[i]; --j)
+                order[j] = order[j - 1];
+            order[j] = i;
+        }
+
+        for (int k = 0; k < n; ++k) {
+            int i = order[k];
+            uint32_t count = node.getCount(i);
+            if (count == 0 || tenter[i] > max_t)
+                continue;
+            for (uint32_t t = tri_offset[i]; t < tri_offset[i] + count; ++t) {
+                auto& tri = triangles[t];
+                const float3& p0 = vertices[node.vertex_base + tri.indices[0]];
+                const float3& p1 = vertices[node.vertex_base + tri.indices[1]];
+                const float3& p2 = vertices[node.vertex_base + tri.indices[2]];
+                IntersectTriangle(r, h, p0, p1, p2, V::bits(blas.getPrimID(node, tri)), cull, instance_id);
+            }
+            if (any_hit) {
+                r.active = andnot(h.t < V(FLT_MAX), r.active);
+                if (movemask(r.active) == 0)
+                    return;
+            }
+            max_t = MaxT(r);
+        }
+        for (int k = n - 1; k >= 0; --k) {
+            int i = order[k];
+            if (node.getCount(i) == 0 && tenter[i] <= max_t)
+                stack[sp++] = { child_index[i], tenter[i] };
+        }
+    }
+}
+
+template<class V>
+inline void IntersectTLAS(const RenderDataCPU& rd, const PacketQueryCPU& q, RayPacket<V>& r, HitPacket<V>& h)
+{
+    auto& tlas = rd.getTLAS();
+    if (tlas.empty())
+        return;
+    auto *instance_indices = tlas.getInstances();
+    auto *node_masks = tlas.getNodeMasks();
+    InstanceMaskCPU ray_mask{ q.instance_mask, q.layer_mask };
+    Traverse(tlas.getNodes(), r, [&](const BVHNodeCPU& leaf) {
+        for (uint32_t li = leaf.offset; li < leaf.offset + leaf.count; ++li) {
+            if (q.any_hit && movemask(r.active) == 0)
+                break;
+            uint32_t ii = instance_indices[li];
+            auto& inst = *rd.instances[ii];
+            auto& base = *inst.base;
+            if ((GetInstanceMask(base) & q.instance_mask) == 0 || (base.layer_mask & q.layer_mask) == 0)
+                continue;
+
+            // transform rays to object space. same as mul_p() / mul_v().
+            auto& m = inst.itransform;
+            RayPacket<V> o;
+            o.ox = V(m[0][0]) * r.ox + V(m[1][0]) * r.oy + V(m[2][0]) * r.oz + V(m[3][0]);
+            o.oy = V(m[0][1]) * r.ox + V(m[1][1]) * r.oy + V(m[2][1]) * r.oz + V(m[3][1]);
+            o.oz = V(m[0][2]) * r.ox + V(m[1][2]) * r.oy + V(m[2][2]) * r.oz + V(m[3][2]);
+            o.dx = V(m[0][0]) * r.dx + V(m[1][0]) * r.dy + V(m[2][0]) * r.dz;
+            o.dy = V(m[0][1]) * r.dx + V(m[1][1]) * r.dy + V(m[2][1]) * r.dz;
+            o.dz = V(m[0][2]) * r.dx + V(m[1][2]) * r.dy + V(m[2][2]) * r.dz;
+            o.ix = V(1.0f) / o.dx;
+            o.iy = V(1.0f) / o.dy;
+            o.iz = V(1.0f) / o.dz;
+            o.tmin = r.tmin;
+            o.tmax = r.tmax;
+            o.active = r.active;
+            SetupTriangleTest(o);
+
+            auto cull = base.hasFlag(InstanceFlag::ShadowsOnly) ? CullMode::None : q.cull;
+            if (inst.mesh->isCompressed())
+                IntersectCompressedBLAS(inst.mesh->compressed_blas, o, h, cull, V::bits(ii), q.any_hit);
+            else
+                IntersectBLAS(inst.mesh->blas, o, h, cull, V::bits(ii), q.any_hit);
+            r.tmax = o.tmax;
+            if (q.any_hit)
+                r.active = andnot(h.t < V(FLT_MAX), r.active);
+        }
+    }, [&](uint32_t ni) { return node_masks[ni].test(ray_mask); });
+}
+
+template<class V>
+inline void IntersectPackets(const RenderDataCPU& rd, const PacketQueryCPU& q, RayCPU *rays, RayHitCPU *hits, int ray_count)
+{
+    const int W = V::size;
+    for (int base = 0; base < ray_count; base += W) {
+        int n = std::min(W, ray_count - base);
+        RayCPU *src = rays + base;
+
+        // AoS -> SoA. unused lanes are filled with the first ray and disabled.
+        float buf[11][W];
+        for (int i = 0; i < W; ++i) {
+            auto& ray = src[i < n ? i : 0];
+            buf[0][i] = ray.origin.x;
+            buf[1][i] = ray.origin.y;
+            buf[2][i] = ray.origin.z;
+            buf[3][i] = ray.direction.x;
+            buf[4][i] = ray.direction.y;
+            buf[5][i] = ray.direction.z;
+            buf[6][i] = 1.0f / ray.direction.x;
+            buf[7][i] = 1.0f / ray.direction.y;
+            buf[8][i] = 1.0f / ray.direction.z;
+            buf[9][i] = ray.tmin;
+            buf[10][i] = ray.tmax;
+        }
+        RayPacket<V> r;
+        r.ox = V::load(buf[0]);
+        r.oy = V::load(buf[1]);
+        r.oz = V::load(buf[2]);
+        r.dx = V::load(buf[3]);
+        r.dy = V::load(buf[4]);
+        r.dz = V::load(buf[5]);
+        r.ix = V::load(buf[6]);
+        r.iy = V::load(buf[7]);
+        r.iz = V::load(buf[8]);
+        r.tmin = V::load(buf[9]);
+        r.tmax = V::load(buf[10]);
+        r.active = V::lanes(n);
+
+        HitPacket<V> h;
+        h.t = V(FLT_MAX);
+        h.u = h.v = V(0.0f);
+        h.prim_id = h.instance_id = V::bits(~0u);
+        h.front_face = V::bits(~0u);
+
+        IntersectTLAS(rd, q, r, h);
+
+        // SoA -> AoS
+        h.t.store(buf[0]);
+        h.u.store(buf[1]);
+        h.v.store(buf[2]);
+        h.prim_id.store(buf[3]);
+        h.instance_id.store(buf[4]);
+        h.front_face.store(buf[5]);
+        for (int i = 0; i < n; ++i) {
+            auto& hit = hits[base + i];
+            std::memcpy(&hit.prim_id, &buf[3][i], sizeof(uint32_t));
+            if (!hit.valid())
+                continue;
+            hit.t = buf[0][i];
+            hit.u = buf[1][i];
+            hit.v = buf[2][i];
+            std::memcpy(&hit.instance_id, &buf[4][i], sizeof(uint32_t));
+            uint32_t front;
+            std::memcpy(&front, &buf[5][i], sizeof(uint32_t));
+            hit.front_face = front != 0;
+            src[i].tmax = hit.t;
+        }
+    }
+}
+
+} // namespace packet
+} // namespace rths
@@ -0,0 +1,296 @@
+#include "pch.h"
+#include "Foundation/rthsLog.h"
+#include "rthsRenderer.h"
+#include "rthsGfxContextCPU.h"
+
+namespace rths {
+
+class RendererCPU : public RendererBase
+{
+public:
+    RendererCPU();
+    ~RendererCPU() override;
+    void setName(const std::string& name) override;
+
+    bool initialized() const override;
+    bool valid() const override;
+
+    bool isRendering() const override;
+    void frameBegin() override; // called from render thread
+    void shareScene() override; // called from render thread
+    void render() override; // called from render thread
+    void finish() override; // called from render thread
+    void frameEnd() override; // called from render thread
+
+    bool readbackRenderTarget(void *dst) override;
+    bool readbackViewRenderTarget(int view, void *dst) override;
+    std::string getTimestampLog() override;
+    std::string getMemoryReport() override;
+    bool readbackTileLights(int& tile_size, int& tiles_x, int& tiles_y, uint32_t *dst) override;
+    void* getRenderTexturePtr() override;
+
+private:
+    RenderDataCPU m_render_data;
+    std::vector<std::unique_ptr<RenderDataCPU>> m_view_data; // multi-view. views other than view 0
+    size_t m_view_count = 0; // views of the last render() other than view 0. m_views is cleared by beginScene()
+    std::atomic_bool m_is_initialized{ false };
+};
+
+
+RendererCPU::RendererCPU()
+{
+    auto do_init = [this]() {
+        GfxContextCPU::initializeInstance();
+        m_is_initialized = true;
+    };
+
+    if (GetGlobals().hasFlag(GlobalFlag::DeferredInitialization))
+        AddDeferredCommand(do_init);
+    else
+        do_init();
+}
+
+RendererCPU::~RendererCPU()
+{
+    if (m_is_initialized) {
+        GfxContextCPU::finalizeInstance();
+    }
+}
+
+void RendererCPU::setName(const std::string& name)
+{
+    m_render_data.name = name;
+}
+
+bool RendererCPU::initialized() const
+{
+    return m_is_initialized;
+}
+
+bool RendererCPU::valid() const
+{
+    if (!this)
+        return false;
+    if (!GfxContextCPU::getInstance()) {
+        m_is_rendering = false;
+        return false;
+    }
+    return true;
+}
+
+bool RendererCPU::isRendering() const
+{
+    return m_is_rendering;
+}
+
+void RendererCPU::frameBegin()
+{
+    if (GetGlobals().hasDebugFlag(DebugFlag::ForceUpdateAS)) {
+        // clear BLAS and mark updated to rebuild them in the next render()
+        for (auto& inst : m_render_data.instances) {
+            inst->mesh->clearBLAS();
+            inst->base->markUpdated();
+        }
+    }
+}
+
+void RendererCPU::shareScene()
+{
+    if (!valid() || !m_ready_to_render)
+        return;
+
+    // renderers that are being updated are skipped as render() does
+    if (m_mutex.try_lock()) {
+        // render flags are needed by prepareSharedScene() (e.g. RenderFlag::ClampBlendShapeWights). render() sets them again
+        auto ctx = GfxContextCPU::getInstance();
+        ctx->setSceneData(m_render_data, m_scene_data);
+        ctx->shareScene(m_render_data, m_meshes);
+        m_mutex.unlock();
+    }
+}
+
+void RendererCPU::render()
+{
+    if (!valid() || !m_ready_to_render)
+        return;
+
+    if (m_mutex.try_lock()) {
+        m_is_rendering = true;
+        captureScene();
+        auto ctx = GfxContextCPU::getInstance();
+        ctx->prepare(m_render_data);
+        ctx->setSceneData(m_render_data, m_scene_data);
+        ctx->setRenderTarget(m_render_data, m_render_target);
+        ctx->setMeshes(m_render_data, m_meshes);
+        ctx->setGBuffer(m_render_data, m_gbuffer_depth, m_gbuffer_instance_ids, m_meshes, m_mesh_indices);
+        if (!m_views.empty())
+            m_render_data.stats.view_count = (uint32_t)m_views.size() + 1;
+        ctx->flush(m_render_data);
+
+        // multi-view. other views share the scene with view 0 and trace its acceleration structures.
+        // each view is dispatched as a task, so tiles of all views are traced together on the job system.
+        m_view_count = m_views.size();
+        while (m_view_data.size() < m_view_count)
+            m_view_data.push_back(std::make_unique<RenderDataCPU>());
+        for (size_t vi = 0; vi < m_view_count; ++vi) {
+            auto& view = m_views[vi];
+            auto& vd = *m_view_data[vi];
+            if (vd.name.empty())
+                vd.name = m_render_data.name + " View " + std::to_string(vi + 1);
+
+            SceneData scene_data = m_scene_data;
+            scene_data.camera = view.camera;
+            if (view.render_target)
+                scene_data.output_format = (uint32_t)view.render_target->output_format;
+            ctx->prepare(vd);
+            ctx->setSceneData(vd, scene_data);
+            ctx->setRenderTarget(vd, view.render_target);
+            ctx->setViewMeshes(vd, m_render_data);
+            ctx->flush(vd);
+        }
+        // flush() returns before rays are traced. the scene is kept locked until finish().
+    }
+}
+
+void RendererCPU::finish()
+{
+    if (!m_is_rendering)
+        return;
+
+    auto ctx = GfxContextCPU::getInstance();
+    for (size_t vi = 0; vi < m_view_count; ++vi) {
+        auto& vd = *m_view_data[vi];
+        if (!ctx->finish(vd))
+            vd.clear();
+    }
+    if (!ctx->finish(m_render_data))
+        m_render_data.clear();
+    m_is_rendering = false;
+    m_mutex.unlock();
+}
+
+void RendererCPU::frameEnd()
+{
+}
+
+bool RendererCPU::readbackRenderTarget(void *dst)
+{
+    if (!valid())
+        return false;
+
+    auto ctx = GfxContextCPU::getInstance();
+    return ctx->readbackRenderTarget(m_render_data, dst);
+}
+
+bool RendererCPU::readbackViewRenderTarget(int view, void *dst)
+{
+    if (view == 0)
+        return readbackRenderTarget(dst);
+    if (!valid() || view < 0 || view > (int)m_view_count)
+        return false;
+
+    auto ctx = GfxContextCPU::getInstance();
+    return ctx->readbackRenderTarget(*m_view_data[view - 1], dst);
+}
+
+std::string RendererCPU::getTimestampLog()
+{
+    std::string ret;
+#ifdef rthsEnableTimestamp
+    if (m_render_data.timestamp) {
+        if (m_mutex.try_lock()) {
+            ret = m_render_data.timestamp->getLog();
+            if (m_render_data.timestamp->isEnabled())
+                ret += m_render_data.stats.toString();
+            m_mutex.unlock();
+        }
+    }
+#endif // rthsEnableTimestamp
+    return ret;
+}
+
+std::string RendererCPU::getMemoryReport()
+{
+    std::string ret;
+    if (!m_mutex.try_lock())
+        return ret;
+
+    auto& rd = m_render_data;
+    std::vector<const MeshDataCPU*> meshes;
+    for (auto& inst : rd.instances) {
+        if (std::find(meshes.begin(), meshes.end(), inst->mesh.get()) == meshes.end())
+            meshes.push_back(inst->mesh.get());
+    }
+
+    size_t triangles = 0, size = 0, uncompressed_size = 0, deformed_size = 0;
+    int compressed = 0, deformed = 0;
+    std::vector<const MeshData*> blendshape_meshes; // deformed instances of a mesh share its deltas
+    for (auto *mesh : meshes) {
+        if (mesh->isCompressed())
+            ++compressed;
+        if (mesh->is_deformed) {
+            ++deformed;
+            deformed_size += mesh->deformed_vertices.size() * sizeof(float4);
+        }
+        const MeshData *base = mesh->base;
+        if (!base->blendshapes.empty() && std::find(blendshape_meshes.begin(), blendshape_meshes.end(), base) == blendshape_meshes.end())
+            blendshape_meshes.push_back(base);
+        triangles += mesh->getBuildStats().triangle_count;
+        size += mesh->getMemoryUsage();
+        uncompressed_size += mesh->getUncompressedMemoryUsage();
+    }
+
+    auto to_mb = [](size_t v) { return (double)v / (1024.0 * 1024.0); };
+    char buf[256];
+    snprintf(buf, sizeof(buf), "BLAS: %d meshes (%d compressed), %zu triangles, %.2lfMB, uncompressed layout %.2lfMB (%.2lfx)\n",
+        (int)meshes.size(), compressed, triangles, to_mb(size), to_mb(uncompressed_size),
+        size > 0 ? (double)uncompressed_size / (double)size : 1.0);
+    ret += buf;
+    if (deformed > 0) {
+        snprintf(buf, sizeof(buf), "Deformed vertices: %d instances, %.2lfMB\n", deformed, to_mb(deformed_size));
+        ret += buf;
+    }
+    for (auto *mesh : blendshape_meshes) {
+        // deltas are sparse. how much is saved compared to storing the deltas of all vertices
+        size_t sparse = mesh->getBlendshapeMemoryUsage(), dense = mesh->getDenseBlendshapeMemoryUsage();
+        snprintf(buf, sizeof(buf), "Blendshape deltas of %s: %.2lfMB, dense %.2lfMB (%.2lfMB saved)\n",
+            mesh->name.c_str(), to_mb(sparse), to_mb(dense), dense > sparse ? to_mb(dense - sparse) : 0.0);
+        ret += buf;
+    }
+    auto& tlas = rd.getTLAS();
+    snprintf(buf, sizeof(buf), "TLAS: %u instances, %.2lfMB%s\n",
+        tlas.getInstanceCount(), to_mb(tlas.getMemoryUsage()), rd.shared_scene ? " (shared)" : "");
+    ret += buf;
+
+    m_mutex.unlock();
+    return ret;
+}
+
+bool RendererCPU::readbackTileLights(int& tile_size, int& tiles_x, int& tiles_y, uint32_t *dst)
+{
+    if (!m_mutex.try_lock())
+        return false;
+
+    auto& rd = m_render_data;
+    tile_size = rd.tile_size;
+    tiles_x = rd.tiles_x;
+    tiles_y = rd.tiles_y;
+    if (dst)
+        std::copy(rd.tile_lights.begin(), rd.tile_lights.end(), dst);
+
+    m_mutex.unlock();
+    return !rd.tile_lights.empty();
+}
+
+void* RendererCPU::getRenderTexturePtr()
+{
+    // result is not on GPU. use readbackRenderTarget() instead.
+    return nullptr;
+}
+
+IRenderer* CreateRendererCPU()
+{
+    return new RendererCPU();
+}
+
+} // namespace rths
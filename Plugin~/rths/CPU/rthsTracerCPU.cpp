@@ -0,0 +1,1041 @@
+#include "pch.h"
+#include "Foundation/rthsParallel.h"
+#include "rthsTracerCPU.h"
+
+namespace rths {
+
+// a & b must be normalized
+static inline float angle_between(const float3& a, const float3& b)
+{
+    return std::acos(clamp(dot(a, b), 0.0f, 1.0f));
+}
+
+// distance between p and the nearest point of the box. 0 if p is inside.
+static inline float distance_to_box(const float3& p, const AABB& b)
+{
+    float3 d = max(max(b.bmin - p, p - b.bmax), float3{ 0.0f, 0.0f, 0.0f });
+    return length(d);
+}
+
+// light culling must be conservative. exact tests are done per pixel with slightly different arithmetic.
+static const float kLightCullingMargin = 1e-3f;
+
+// reprojected depth must match the previous frame within this ratio. otherwise the pixel is disoccluded.
+static const float kTemporalDepthThreshold = 0.01f;
+// reused values must have been traced within this distance (in pixels) from the pixel center.
+static const float kTemporalMaxDrift = 1.0f;
+
+// dirty regions are clipped at this view depth at least, even if the near plane is closer.
+static const float kDirtyRegionNearClip = 1e-4f;
+
+static inline void GetCorners(const AABB& b, float3 *dst)
+{
+    for (int i = 0; i < 8; ++i) {
+        dst[i] = {
+            (i & 1) ? b.bmax.x : b.bmin.x,
+            (i & 2) ? b.bmax.y : b.bmin.y,
+            (i & 4) ? b.bmax.z : b.bmin.z };
+    }
+}
+
+// view matrix is column major in the shader. so camera axes are columns of the matrix here.
+static void GetCameraAxes(const CameraData& cam, float3& right, float3& up, float3& forward, float& focal)
+{
+    right = { cam.view[0][0], cam.view[1][0], cam.view[2][0] };
+    up = { cam.view[0][1], cam.view[1][1], cam.view[2][1] };
+    forward = -float3{ cam.view[0][2], cam.view[1][2], cam.view[2][2] };
+    focal = std::abs(cam.proj[1][1]);
+}
+
+
+TracerCPU::TracerCPU(RenderDataCPU& rd)
+    : m_rd(rd)
+    , m_scene(rd.scene_data)
+{
+    auto& rt = *rd.render_target;
+    m_width = rt.width;
+    m_height = rt.height;
+    m_aspect = (float)m_width / (float)m_height;
+
+    m_cam_pos = m_scene.camera.position;
+    GetCameraAxes(m_scene.camera, m_cam_right, m_cam_up, m_cam_forward, m_focal);
+
+    m_temporal = rd.hasFlag(RenderFlag::TemporalReprojection);
+    if (m_temporal) {
+        m_history_valid = isHistoryCompatible();
+        auto& prev = rd.history_scene.camera;
+        m_prev_cam_pos = prev.position;
+        GetCameraAxes(prev, m_prev_cam_right, m_prev_cam_up, m_prev_cam_forward, m_prev_focal);
+        m_depth.resize(m_width * m_height);
+        m_receivers.resize(m_width * m_height);
+        m_sources.resize(m_width * m_height);
+        m_age.resize(m_width * m_height);
+    }
+
+    m_dirty_regions = rd.hasFlag(RenderFlag::DirtyRegions) && isDirtyRegionCompatible();
+    if (m_dirty_regions && m_temporal) {
+        // traced tiles are traced exactly. skipped tiles keep the history as it is, as the camera is still.
+        m_history_valid = false;
+        if (rd.history_age.size() == m_age.size()) {
+            m_depth = rd.history_depth;
+            m_receivers = rd.history_instance;
+            m_sources = rd.history_source;
+            m_age = rd.history_age;
+        }
+    }
+
+    // camera rays are coherent. trace them with packets if possible.
+    auto& globals = GetGlobals();
+    m_occlusion_query = !globals.hasDebugFlag(DebugFlag::NoOcclusionQuery);
+    m_triangle_blocks = !globals.hasDebugFlag(DebugFlag::NoTriangleBlocks);
+    m_light_culling = !globals.hasDebugFlag(DebugFlag::NoLightCulling);
+    m_all_lights = m_scene.light_count >= 32 ? ~0u : (1u << m_scene.light_count) - 1;
+    // ray packets always use triangle blocks. NoTriangleBlocks disables them too.
+    if (m_triangle_blocks && !globals.hasDebugFlag(DebugFlag::NoRayPackets)) {
+        if (!globals.hasDebugFlag(DebugFlag::NoAVX2) && IsPackets8Available()) {
+            m_intersect_packets = &IntersectPackets8;
+            m_packet_width = 8;
+        }
+        else {
+            m_intersect_packets = &IntersectPackets4;
+            m_packet_width = 4;
+        }
+    }
+    // bins are traced with packets. IgnoreSelfShadow needs per-ray filters, so without packets or with it rays would go
+    // through the same scalar query as the per pixel path and sorting them would be pure overhead.
+    m_shadow_ray_binning = !globals.hasDebugFlag(DebugFlag::NoShadowRayBinning) &&
+        m_intersect_packets && !m_rd.hasFlag(RenderFlag::IgnoreSelfShadow);
+}
+
+void TracerCPU::dispatch()
+{
+    m_tiles_x = ceildiv(m_width, kTileSize);
+    m_tiles_y = ceildiv(m_height, kTileSize);
+    m_rd.tile_size = kTileSize;
+    m_rd.tiles_x = m_tiles_x;
+    m_rd.tiles_y = m_tiles_y;
+    int tile_count = m_tiles_x * m_tiles_y;
+    // skipped tiles keep the light bits of the last dispatch
+    if (!m_dirty_regions || (int)m_rd.tile_lights.size() != tile_count)
+        m_rd.tile_lights.assign(tile_count, 0);
+
+    auto trace_tile = [&](int ti) {
+        if (m_rd.gbuffer_depth)
+            traceTileGBuffer(ti % m_tiles_x, ti / m_tiles_x);
+        else if (m_intersect_packets)
+            traceTilePackets(ti % m_tiles_x, ti / m_tiles_x);
+        else
+            traceTile(ti % m_tiles_x, ti / m_tiles_x);
+    };
+    if (m_dirty_regions) {
+        markDirtyTiles();
+        std::vector<int> tiles;
+        for (int ti = 0; ti < tile_count; ++ti) {
+            if (m_dirty_tiles[ti])
+                tiles.push_back(ti);
+        }
+        parallel_for(0, (int)tiles.size(), 1, [&](int i) { trace_tile(tiles[i]); });
+        m_rd.stats.dirty_tiles = (uint32_t)tiles.size();
+    }
+    else {
+        parallel_for(0, tile_count, 1, trace_tile);
+        m_rd.stats.dirty_tiles = tile_count;
+    }
+
+    if (m_light_culling)
+        m_rd.stats.addLightCullingStats(m_rd.tile_lights, m_scene.light_count);
+    if (m_shadow_ray_binning) {
+        m_rd.stats.shadow_ray_count = m_shadow_ray_count;
+        m_rd.stats.shadow_ray_bins = m_shadow_ray_bins;
+    }
+
+    if (m_rd.gbuffer_depth) {
+        m_rd.stats.gbuffer_pixels = m_gbuffer_pixels;
+        m_rd.stats.gbuffer_total = m_width * m_height;
+    }
+
+    auto& rd = m_rd;
+    auto& rt = *rd.render_target;
+    ++rt.write_count;
+    if (rd.hasFlag(RenderFlag::DirtyRegions)) {
+        rd.stats.dirty_tiles_total = tile_count;
+        rd.dirty_scene = m_scene;
+        rd.dirty_write_count = rt.write_count;
+    }
+
+    if (m_temporal) {
+        rd.stats.temporal_pixels = m_temporal_pixels;
+        rd.stats.temporal_retraced = m_temporal_retraced;
+
+        rd.history_scene = m_scene;
+        rd.history_width = m_width;
+        rd.history_height = m_height;
+        rd.history_result = rd.render_target->buffer;
+        rd.history_depth = std::move(m_depth);
+        rd.history_instance = std::move(m_receivers);
+        rd.history_source = std::move(m_sources);
+        rd.history_age = std::move(m_age);
+        ++rd.history_frame;
+    }
+    else if (!rd.history_result.empty()) {
+        // release the history. it is outdated when the mode is enabled again.
+        rd.history_result = {};
+        rd.history_depth = {};
+        rd.history_instance = {};
+        rd.history_source = {};
+        rd.history_age = {};
+    }
+}
+
+void TracerCPU::traceTile(int tx, int ty)
+{
+    int x_begin = tx * kTileSize;
+    int y_begin = ty * kTileSize;
+    int x_end = std::min(x_begin + kTileSize, m_width);
+    int y_end = std::min(y_begin + kTileSize, m_height);
+    auto cull = m_rd.hasFlag(RenderFlag::CullBackFaces) ? CullMode::Back : CullMode::None;
+
+    int pixels[kTileSize * kTileSize][2];
+    RayCPU rays[kTileSize * kTileSize];
+    RayHitCPU hits[kTileSize * kTileSize];
+    int n = 0;
+    for (int y = y_begin; y < y_end; ++y) {
+        for (int x = x_begin; x < x_end; ++x) {
+            pixels[n][0] = x;
+            pixels[n][1] = y;
+            rays[n] = getCameraRay(x, y);
+            // AnyHitCamera only checks the layer mask, which is done by traceScene()
+            traceScene(rays[n], hits[n], kInstanceMaskCamera, m_scene.camera.layer_mask, cull, [](RayHitCPU&, const MeshInstanceDataCPU&) {
+                return true;
+            });
+            ++n;
+        }
+    }
+    if (m_temporal)
+        n = reprojectTile(pixels, rays, hits, n);
+    shadeTile(tx, ty, pixels, rays, hits, n);
+}
+
+void TracerCPU::traceTilePackets(int tx, int ty)
+{
+    int x_begin = tx * kTileSize;
+    int y_begin = ty * kTileSize;
+    int x_end = std::min(x_begin + kTileSize, m_width);
+    int y_end = std::min(y_begin + kTileSize, m_height);
+
+    // order pixels in 2x2 (4-wide) or 4x2 (8-wide) blocks to make each packet coherent
+    const int block_w = m_packet_width == 8 ? 4 : 2;
+    const int block_h = 2;
+    int pixels[kTileSize * kTileSize][2];
+    RayCPU rays[kTileSize * kTileSize];
+    RayHitCPU hits[kTileSize * kTileSize];
+    int n = 0;
+    for (int by = y_begin; by < y_end; by += block_h) {
+        for (int bx = x_begin; bx < x_end; bx += block_w) {
+            for (int y = by; y < std::min(by + block_h, y_end); ++y) {
+                for (int x = bx; x < std::min(bx + block_w, x_end); ++x) {
+                    pixels[n][0] = x;
+                    pixels[n][1] = y;
+                    rays[n] = getCameraRay(x, y);
+                    ++n;
+                }
+            }
+        }
+    }
+
+    PacketQueryCPU query;
+    query.instance_mask = kInstanceMaskCamera;
+    query.layer_mask = m_scene.camera.layer_mask; // AnyHitCamera
+    query.cull = m_rd.hasFlag(RenderFlag::CullBackFaces) ? CullMode::Back : CullMode::None;
+    m_intersect_packets(m_rd, query, rays, hits, n);
+    if (m_temporal)
+        n = reprojectTile(pixels, rays, hits, n);
+    shadeTile(tx, ty, pixels, rays, hits, n);
+}
+
+void TracerCPU::traceTileGBuffer(int tx, int ty)
+{
+    int x_begin = tx * kTileSize;
+    int y_begin = ty * kTileSize;
+    int x_end = std::min(x_begin + kTileSize, m_width);
+    int y_end = std::min(y_begin + kTileSize, m_height);
+    float far_plane = m_scene.camera.far_plane;
+    auto *ids = m_rd.gbuffer_instance_ids;
+    auto& instances = m_rd.gbuffer_instances;
+
+    int pixels[kTileSize * kTileSize][2];
+    RayCPU rays[kTileSize * kTileSize];
+    RayHitCPU hits[kTileSize * kTileSize];
+    int n = 0;
+    uint32_t hit_count = 0;
+    for (int y = y_begin; y < y_end; ++y) {
+        for (int x = x_begin; x < x_end; ++x) {
+            int pi = m_width * y + x;
+            pixels[n][0] = x;
+            pixels[n][1] = y;
+            rays[n] = getCameraRay(x, y);
+
+            auto& hit = hits[n];
+            hit = RayHitCPU();
+            float depth = m_rd.gbuffer_depth[pi];
+            if (depth > 0.0f && depth < far_plane) {
+                // depth is along the forward axis. convert it to the distance along the ray.
+                hit.t = depth / dot(rays[n].direction, m_cam_forward);
+                hit.prim_id = 0;
+                hit.instance_id = kUnknownInstance;
+                if (ids && ids[pi] < instances.size())
+                    hit.instance_id = instances[ids[pi]];
+                ++hit_count;
+            }
+            ++n;
+        }
+    }
+    m_gbuffer_pixels += hit_count;
+
+    if (m_temporal)
+        n = reprojectTile(pixels, rays, hits, n);
+    shadeTile(tx, ty, pixels, rays, hits, n);
+}
+
+int TracerCPU::reprojectTile(int (*pixels)[2], RayCPU *rays, RayHitCPU *hits, int n)
+{
+    auto *dst = m_rd.render_target->buffer.data();
+    uint32_t frame = m_rd.history_frame;
+    uint32_t hit_count = 0, retraced = 0;
+    int remain = 0;
+    for (int i = 0; i < n; ++i) {
+        int x = pixels[i][0];
+        int y = pixels[i][1];
+        int pi = m_width * y + x;
+        auto& hit = hits[i];
+
+        const MeshInstanceDataCPU *receiver = nullptr;
+        float depth = 0.0f;
+        bool reuse = false;
+        uint8_t age = 0;
+        float3 pos{};
+        if (hit.valid()) {
+            ++hit_count;
+            if (hit.instance_id != kUnknownInstance)
+                receiver = m_rd.instances[hit.instance_id].get();
+            pos = rays[i].origin + rays[i].direction * hit.t;
+            depth = dot(pos - m_cam_pos, m_cam_forward);
+
+            // moved or deformed receivers and a rotating fraction of stable pixels are traced again
+            int hx, hy;
+            float hdepth;
+            bool refresh = ((uint32_t)(x + y * 3) + frame) % kTemporalRefreshInterval == 0;
+            // receivers of G-buffer pixels without instance IDs can't tell if they have moved
+            if (m_history_valid && receiver && !receiver->is_updated && !refresh && projectToHistory(pos, hx, hy, hdepth)) {
+                // the receiver must have been visible at the same depth. otherwise the pixel is disoccluded.
+                int hi = m_width * hy + hx;
+                // values are passed from pixel to pixel as the camera moves. they are reused only while the position
+                // they were traced at stays near the pixel, and the age limits how long they survive.
+                age = m_rd.history_age[hi] + 1;
+                reuse = m_rd.history_instance[hi] == receiver &&
+                    std::abs(m_rd.history_depth[hi] - hdepth) <= hdepth * kTemporalDepthThreshold &&
+                    age < kTemporalRefreshInterval &&
+                    isNearPixel(m_rd.history_source[hi], x, y);
+                if (reuse) {
+                    dst[pi] = m_rd.history_result[hi];
+                    pos = m_rd.history_source[hi];
+                }
+            }
+            if (!reuse)
+                ++retraced;
+        }
+        m_depth[pi] = depth;
+        m_receivers[pi] = receiver;
+        m_sources[pi] = pos;
+        m_age[pi] = reuse ? age : 0;
+
+        if (!reuse) {
+            if (remain != i) {
+                pixels[remain][0] = x;
+                pixels[remain][1] = y;
+                rays[remain] = rays[i];
+                hits[remain] = hits[i];
+            }
+            ++remain;
+        }
+    }
+    m_temporal_pixels += hit_count;
+    m_temporal_retraced += retraced;
+    return remain;
+}
+
+// changes of lights or settings affect all pixels
+static bool IsSameLighting(const SceneData& prev, const SceneData& cur)
+{
+    return prev.render_flags == cur.render_flags &&
+        prev.output_format == cur.output_format &&
+        prev.light_count == cur.light_count &&
+        prev.shadow_ray_offset == cur.shadow_ray_offset &&
+        prev.self_shadow_threshold == cur.self_shadow_threshold &&
+        prev.camera.layer_mask == cur.camera.layer_mask &&
+        std::memcmp(prev.lights, cur.lights, sizeof(LightData) * cur.light_count) == 0;
+}
+
+bool TracerCPU::isHistoryCompatible() const
+{
+    auto& rd = m_rd;
+    if (rd.history_result.empty() || rd.history_width != m_width || rd.history_height != m_height)
+        return false;
+    return IsSameLighting(rd.history_scene, m_scene);
+}
+
+bool TracerCPU::isDirtyRegionCompatible() const
+{
+    // G-buffer input can change anywhere
+    auto& rd = m_rd;
+    if (rd.dirty_all || rd.gbuffer_depth || rd.render_target->write_count != rd.dirty_write_count)
+        return false;
+
+    auto& prev = rd.dirty_scene.camera;
+    auto& cam = m_scene.camera;
+    return prev.view == cam.view && prev.proj == cam.proj && prev.position == cam.position &&
+        prev.near_plane == cam.near_plane && prev.far_plane == cam.far_plane &&
+        IsSameLighting(rd.dirty_scene, m_scene);
+}
+
+void TracerCPU::markDirtyTiles()
+{
+    m_dirty_tiles.assign(m_tiles_x * m_tiles_y, 0);
+
+    // values reprojected by RenderFlag::TemporalReprojection are not exact. they are traced again once.
+    auto& age = m_rd.history_age;
+    if (age.size() == (size_t)(m_width * m_height)) {
+        for (int y = 0; y < m_height; ++y) {
+            for (int x = 0; x < m_width; ++x) {
+                if (age[m_width * y + x] != 0)
+                    m_dirty_tiles[m_tiles_x * (y / kTileSize) + (x / kTileSize)] = 1;
+            }
+        }
+    }
+
+    // shadows can fall only on instances in the TLAS. shadow rays start slightly off the surface.
+    AABB scene_bounds;
+    auto& tlas = m_rd.getTLAS();
+    if (!tlas.empty()) {
+        scene_bounds = tlas.getNodes()[0].bounds;
+        float margin = m_scene.shadow_ray_offset * 2.0f + 1e-3f;
+        scene_bounds.bmin = scene_bounds.bmin - float3{ margin, margin, margin };
+        scene_bounds.bmax = scene_bounds.bmax + float3{ margin, margin, margin };
+    }
+    float3 scene_corners[8];
+    GetCorners(scene_bounds, scene_corners);
+
+    float3 points[kMaxHullPoints];
+    for (auto& bounds : m_rd.dirty_bounds) {
+        // receivers in the box and anything it covers
+        GetCorners(bounds, points);
+        markDirtyHull(points, 8, nullptr);
+        if (!scene_bounds.valid())
+            continue;
+
+        // shadow volume of the box for each light. the box swept along shadow rays, clipped by the scene.
+        for (uint32_t li = 0; li < m_scene.light_count; ++li) {
+            auto& light = m_scene.lights[li];
+            if (light.light_type == LightType::Directional) {
+                // receivers at p are shadowed by the box if p - direction * s is in it (0 <= s <= far plane)
+                float box_min = FLT_MAX, scene_max = -FLT_MAX;
+                for (int i = 0; i < 8; ++i) {
+                    box_min = std::min(box_min, dot(points[i], light.direction));
+                    scene_max = std::max(scene_max, dot(scene_corners[i], light.direction));
+                }
+                float s = std::min(scene_max - box_min, m_scene.camera.far_plane);
+                if (s <= 0.0f)
+                    continue;
+                for (int i = 0; i < 8; ++i)
+                    points[8 + i] = points[i] + light.direction * s;
+                markDirtyHull(points, 16, &scene_bounds);
+            }
+            else if (light.light_type == LightType::Point || light.light_type == LightType::Spot) {
+                // the box scaled from the light position up to the farthest receiver within the range.
+                // any scale between them is a linear interpolation of the two, so the hull contains the whole volume.
+                float near_dist = distance_to_box(light.position, bounds);
+                if (near_dist <= 0.0f) {
+                    // the light is in the box. shadows can be anywhere.
+                    std::fill(m_dirty_tiles.begin(), m_dirty_tiles.end(), 1);
+                    return;
+                }
+                float far_dist = 0.0f;
+                for (int i = 0; i < 8; ++i)
+                    far_dist = std::max(far_dist, length(scene_corners[i] - light.position));
+                far_dist = std::min(far_dist, light.range);
+                if (far_dist <= near_dist)
+                    continue;
+                float scale = far_dist / near_dist;
+                for (int i = 0; i < 8; ++i)
+                    points[8 + i] = light.position + (points[i] - light.position) * scale;
+                markDirtyHull(points, 16, &scene_bounds);
+            }
+            else if (light.light_type == LightType::ReversePoint) {
+                // shadow rays go away from the light. receivers between the light and the box are shadowed.
+                points[8] = light.position;
+                markDirtyHull(points, 9, &scene_bounds);
+            }
+        }
+    }
+}
+
+// 2D convex hull (counter clockwise) of points. points are sorted in place.
+static int ConvexHull2D(float2 *points, int n, float2 *dst)
+{
+    std::sort(points, points + n, [](const float2& a, const float2& b) { return a.x < b.x || (a.x == b.x && a.y < b.y); });
+    auto cross2 = [](const float2& o, const float2& a, const float2& b) {
+        return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+    };
+    // monotone chain
+    int k = 0;
+    for (int i = 0; i < n; ++i) {
+        while (k >= 2 && cross2(dst[k - 2], dst[k - 1], points[i]) <= 0.0f)
+            --k;
+        dst[k++] = points[i];
+    }
+    for (int i = n - 2, lower = k + 1; i >= 0; --i) {
+        while (k >= lower && cross2(dst[k - 2], dst[k - 1], points[i]) <= 0.0f)
+            --k;
+        dst[k++] = points[i];
+    }
+    return n > 1 ? k - 1 : n;
+}
+
+// separating axis test of a convex polygon and a rectangle
+static bool OverlapsRect(const float2 *polygon, int n, const float2& rmin, const float2& rmax)
+{
+    float2 pmin{ FLT_MAX, FLT_MAX }, pmax{ -FLT_MAX, -FLT_MAX };
+    for (int i = 0; i < n; ++i) {
+        pmin = { std::min(pmin.x, polygon[i].x), std::min(pmin.y, polygon[i].y) };
+        pmax = { std::max(pmax.x, polygon[i].x), std::max(pmax.y, polygon[i].y) };
+    }
+    if (pmax.x < rmin.x || pmin.x > rmax.x || pmax.y < rmin.y || pmin.y > rmax.y)
+        return false;
+
+    float2 corners[4] = { rmin, { rmax.x, rmin.y }, rmax, { rmin.x, rmax.y } };
+    for (int i = 0; i < n; ++i) {
+        auto& a = polygon[i];
+        auto& b = polygon[(i + 1) % n];
+        // outward normal of the edge. the rectangle is outside if all its corners are on the outer side.
+        float2 normal{ b.y - a.y, a.x - b.x };
+        bool outside = true;
+        for (auto& c : corners) {
+            if ((c.x - a.x) * normal.x + (c.y - a.y) * normal.y <= 0.0f) {
+                outside = false;
+                break;
+            }
+        }
+        if (outside)
+            return false;
+    }
+    return true;
+}
+
+int TracerCPU::projectHull(const float3 *points, int n, float2 *dst) const
+{
+    // vertices of the hull clipped by the near plane are points in front of the camera and intersections of
+    // the near plane and segments between points on both sides of it.
+    // camera rays start at the near plane. the view depth of the start is the smallest at the corners of the screen.
+    float corner = std::sqrt(m_aspect * m_aspect + 1.0f + m_focal * m_focal);
+    float near_clip = std::max(m_scene.camera.near_plane * m_focal / corner, kDirtyRegionNearClip);
+
+    float depth[kMaxHullPoints];
+    float2 projected[kMaxHullVertices];
+    int count = 0;
+    auto add = [&](const float3& p, float d) {
+        float3 v = p - m_cam_pos;
+        float sx = dot(v, m_cam_right) / d * m_focal / m_aspect;
+        float sy = dot(v, m_cam_up) / d * m_focal;
+        projected[count++] = { (sx + 1.0f) * 0.5f * (float)m_width, (sy + 1.0f) * 0.5f * (float)m_height };
+    };
+    for (int i = 0; i < n; ++i) {
+        depth[i] = dot(points[i] - m_cam_pos, m_cam_forward);
+        if (depth[i] >= near_clip)
+            add(points[i], depth[i]);
+    }
+    for (int i = 0; i < n; ++i) {
+        for (int j = i + 1; j < n; ++j) {
+            if ((depth[i] >= near_clip) != (depth[j] >= near_clip)) {
+                float t = (near_clip - depth[i]) / (depth[j] - depth[i]);
+                add(points[i] + (points[j] - points[i]) * t, near_clip);
+            }
+        }
+    }
+    return ConvexHull2D(projected, count, dst);
+}
+
+void TracerCPU::markDirtyHull(const float3 *points, int n, const AABB *clip)
+{
+    float2 polygon[kMaxHullVertices];
+    int polygon_size = projectHull(points, n, polygon);
+    if (polygon_size == 0)
+        return; // entirely behind the camera
+
+    // bounds of the hull clipped by the box. the volume is in both of them.
+    float2 clip_polygon[kMaxHullVertices];
+    int clip_polygon_size = 0;
+    if (clip) {
+        AABB bounds;
+        for (int i = 0; i < n; ++i)
+            bounds.expand(points[i]);
+        bounds.bmin = max(bounds.bmin, clip->bmin);
+        bounds.bmax = min(bounds.bmax, clip->bmax);
+        if (!bounds.valid())
+            return;
+        float3 corners[8];
+        GetCorners(bounds, corners);
+        clip_polygon_size = projectHull(corners, 8, clip_polygon);
+        if (clip_polygon_size == 0)
+            return;
+    }
+
+    float2 rmin{ FLT_MAX, FLT_MAX }, rmax{ -FLT_MAX, -FLT_MAX };
+    for (int i = 0; i < polygon_size; ++i) {
+        rmin = { std::min(rmin.x, polygon[i].x), std::min(rmin.y, polygon[i].y) };
+        rmax = { std::max(rmax.x, polygon[i].x), std::max(rmax.y, polygon[i].y) };
+    }
+    // points close to the camera can be projected very far
+    rmin = { std::max(rmin.x, -2.0f), std::max(rmin.y, -2.0f) };
+    rmax = { std::min(rmax.x, (float)m_width + 2.0f), std::min(rmax.y, (float)m_height + 2.0f) };
+    int tx0 = std::max((int)std::floor(rmin.x) - 1, 0) / kTileSize;
+    int ty0 = std::max((int)std::floor(rmin.y) - 1, 0) / kTileSize;
+    int tx1 = std::min((int)std::ceil(rmax.x) + 1, m_width - 1) / kTileSize;
+    int ty1 = std::min((int)std::ceil(rmax.y) + 1, m_height - 1) / kTileSize;
+    for (int ty = ty0; ty <= ty1; ++ty) {
+        for (int tx = tx0; tx <= tx1; ++tx) {
+            auto& dirty = m_dirty_tiles[m_tiles_x * ty + tx];
+            if (dirty)
+                continue;
+            // pixel centers of the tile with a margin of a pixel for rounding errors
+            float2 tmin{ (float)(tx * kTileSize) - 0.5f, (float)(ty * kTileSize) - 0.5f };
+            float2 tmax{ (float)((tx + 1) * kTileSize) + 0.5f, (float)((ty + 1) * kTileSize) + 0.5f };
+            if (OverlapsRect(polygon, polygon_size, tmin, tmax) &&
+                (!clip || OverlapsRect(clip_polygon, clip_polygon_size, tmin, tmax)))
+                dirty = 1;
+        }
+    }
+}
+
+// inverse of getCameraRay(). fx, fy are in pixels. returns false if p is out of the screen.
+static bool ProjectToScreen(const float3& p, const float3& cam_pos, const float3& right, const float3& up, const float3& forward,
+    float focal, float aspect, int width, int height, float& fx, float& fy, float& depth)
+{
+    float3 v = p - cam_pos;
+    depth = dot(v, forward);
+    if (depth <= 0.0f)
+        return false;
+
+    float sx = dot(v, right) / depth * focal / aspect;
+    float sy = dot(v, up) / depth * focal;
+    fx = (sx + 1.0f) * 0.5f * (float)width;
+    fy = (sy + 1.0f) * 0.5f * (float)height;
+    return fx >= 0.0f && fx < (float)width && fy >= 0.0f && fy < (float)height;
+}
+
+bool TracerCPU::projectToHistory(const float3& p, int& x, int& y, float& depth) const
+{
+    float fx, fy;
+    if (!ProjectToScreen(p, m_prev_cam_pos, m_prev_cam_right, m_prev_cam_up, m_prev_cam_forward,
+            m_prev_focal, m_aspect, m_width, m_height, fx, fy, depth))
+        return false;
+    x = (int)fx;
+    y = (int)fy;
+    return true;
+}
+
+bool TracerCPU::isNearPixel(const float3& p, int x, int y) const
+{
+    float fx, fy, depth;
+    if (!ProjectToScreen(p, m_cam_pos, m_cam_right, m_cam_up, m_cam_forward,
+            m_focal, m_aspect, m_width, m_height, fx, fy, depth))
+        return false;
+    return std::abs(fx - ((float)x + 0.5f)) <= kTemporalMaxDrift && std::abs(fy - ((float)y + 0.5f)) <= kTemporalMaxDrift;
+}
+
+void TracerCPU::shadeTile(int tx, int ty, const int (*pixels)[2], const RayCPU *rays, const RayHitCPU *hits, int n)
+{
+    uint32_t light_bits = m_all_lights;
+    if (m_light_culling) {
+        // bounds of the hit positions is the tile's depth range in world space
+        AABB bounds;
+        uint32_t layer_mask = 0;
+        for (int i = 0; i < n; ++i) {
+            if (hits[i].valid()) {
+                bounds.expand(getShadowRayOrigin(rays[i], hits[i]));
+                auto *receiver = getReceiver(hits[i].instance_id);
+                layer_mask |= receiver ? receiver->layer_mask : ~0u;
+            }
+        }
+        light_bits = bounds.valid() ? cullLights(bounds, layer_mask) : 0;
+    }
+    m_rd.tile_lights[m_tiles_x * ty + tx] = light_bits;
+
+    bool bitmask = m_scene.output_format == (uint32_t)OutputFormat::BitMask;
+    auto *dst = m_rd.render_target->buffer.data();
+    if (m_shadow_ray_binning) {
+        uint32_t visible[kTileSize * kTileSize];
+        traceShadowRayBins(light_bits, rays, hits, n, visible);
+
+        float ls = 1.0f / (float)m_scene.light_count;
+        for (int i = 0; i < n; ++i) {
+            // accumulate in the same order as closestHitCamera()
+            CameraPayload payload;
+            payload.light_bits = visible[i];
+            for (uint32_t li = 0; li < m_scene.light_count; ++li) {
+                if ((visible[i] & (1u << li)) != 0)
+                    payload.shadow += ls;
+            }
+            dst[m_width * pixels[i][1] + pixels[i][0]] = bitmask ? asfloat(payload.light_bits) : payload.shadow;
+        }
+    }
+    else {
+        OccluderCache caches[kMaxLights];
+        for (int i = 0; i < n; ++i) {
+            CameraPayload payload;
+            if (hits[i].valid())
+                closestHitCamera(rays[i], hits[i], light_bits, payload, caches);
+            dst[m_width * pixels[i][1] + pixels[i][0]] = bitmask ? asfloat(payload.light_bits) : payload.shadow;
+        }
+    }
+}
+
+void TracerCPU::traceShadowRayBins(uint32_t light_bits, const RayCPU *rays, const RayHitCPU *hits, int n, uint32_t *visible)
+{
+    CullMode cull = getShadowCullMode();
+
+    static thread_local ShadowRayScratch s_scratch;
+    auto *queue = s_scratch.queue.data();
+    auto *sorted = s_scratch.sorted.data();
+
+    // generate shadow rays of all pixels and lights
+    uint32_t queue_size = 0;
+    uint32_t bin_counts[kMaxLights * 8]{};
+    for (int i = 0; i < n; ++i) {
+        visible[i] = 0;
+        if (!hits[i].valid())
+            continue;
+
+        auto *receiver = getReceiver(hits[i].instance_id);
+        uint32_t instance_layer_mask = receiver ? receiver->layer_mask : ~0u;
+        bool receive_shadows = !receiver || receiver->hasFlag(InstanceFlag::ReceiveShadows);
+        float3 pos = getShadowRayOrigin(rays[i], hits[i]);
+        for (uint32_t li = 0; li < m_scene.light_count; ++li) {
+            auto& light = m_scene.lights[li];
+            if ((light_bits & (1u << li)) == 0 || (instance_layer_mask & light.layer_mask) == 0)
+                continue;
+
+            ShadowRay sr;
+            if (!getShadowRay(light, pos, sr.ray))
+                continue;
+            if (!receive_shadows || (light.layer_mask & m_scene.camera.layer_mask) == 0) {
+                // nothing can occlude
+                visible[i] |= 1u << li;
+                continue;
+            }
+            auto& d = sr.ray.direction;
+            sr.pixel = (uint16_t)i;
+            sr.light = (uint8_t)li;
+            sr.bin = (uint8_t)(li * 8 + (d.x < 0.0f ? 1 : 0) + (d.y < 0.0f ? 2 : 0) + (d.z < 0.0f ? 4 : 0));
+            ++bin_counts[sr.bin];
+            queue[queue_size++] = sr;
+        }
+    }
+    if (queue_size == 0)
+        return;
+
+    // counting sort by bin. rays keep pixel order in each bin.
+    uint32_t bin_offsets[kMaxLights * 8 + 1];
+    bin_offsets[0] = 0;
+    uint32_t bins = 0;
+    for (int bi = 0; bi < kMaxLights * 8; ++bi) {
+        bin_offsets[bi + 1] = bin_offsets[bi] + bin_counts[bi];
+        if (bin_counts[bi] > 0)
+            ++bins;
+    }
+    {
+        uint32_t pos[kMaxLights * 8];
+        std::copy(bin_offsets, bin_offsets + kMaxLights * 8, pos);
+        for (uint32_t i = 0; i < queue_size; ++i)
+            sorted[pos[queue[i].bin]++] = queue[i];
+    }
+    m_shadow_ray_count += queue_size;
+    m_shadow_ray_bins += bins;
+
+    // without IgnoreSelfShadow, AnyHitLight accepts all hits. each bin has the same light mask and can be traced with packets.
+    auto *bin_rays = s_scratch.bin_rays.data();
+    auto *bin_hits = s_scratch.bin_hits.data();
+    for (int bi = 0; bi < kMaxLights * 8; ++bi) {
+        uint32_t begin = bin_offsets[bi], end = bin_offsets[bi + 1];
+        if (begin == end)
+            continue;
+        uint32_t li = bi / 8;
+        uint32_t light_mask = m_scene.lights[li].layer_mask & m_scene.camera.layer_mask;
+
+        uint32_t count = end - begin;
+        for (uint32_t i = 0; i < count; ++i) {
+            bin_rays[i] = sorted[begin + i].ray;
+            bin_hits[i] = RayHitCPU();
+        }
+
+        PacketQueryCPU query;
+        query.instance_mask = kInstanceMaskShadow;
+        query.layer_mask = light_mask;
+        query.cull = cull;
+        query.any_hit = m_occlusion_query;
+        m_intersect_packets(m_rd, query, bin_rays, bin_hits, (int)count);
+        for (uint32_t i = 0; i < count; ++i) {
+            if (!bin_hits[i].valid())
+                visible[sorted[begin + i].pixel] |= 1u << li;
+        }
+    }
+}
+
+uint32_t TracerCPU::cullLights(const AABB& bounds, uint32_t layer_mask) const
+{
+    // bounding sphere of the box for cone tests
+    float3 center = bounds.center();
+    float radius = length(bounds.size()) * 0.5f;
+
+    uint32_t ret = 0;
+    for (uint32_t li = 0; li < m_scene.light_count; ++li) {
+        auto& light = m_scene.lights[li];
+        if ((light.layer_mask & layer_mask) == 0)
+            continue;
+
+        bool reach = true;
+        if (light.light_type == LightType::Point || light.light_type == LightType::ReversePoint) {
+            reach = distance_to_box(light.position, bounds) <= light.range * (1.0f + kLightCullingMargin) + kLightCullingMargin;
+        }
+        else if (light.light_type == LightType::Spot) {
+            reach = distance_to_box(light.position, bounds) <= light.range * (1.0f + kLightCullingMargin) + kLightCullingMargin;
+            float3 v = center - light.position;
+            float d = length(v);
+            if (reach && d > radius) {
+                // nearest angle of the sphere from the spot axis. per-pixel test clamps angles to 90 degrees.
+                float axis_angle = std::acos(clamp(dot(v / d, light.direction), -1.0f, 1.0f));
+                float min_angle = std::min(axis_angle - std::asin(radius / d), 1.57079632f);
+                reach = min_angle * 2.0f <= light.spot_angle + kLightCullingMargin;
+            }
+        }
+        if (reach)
+            ret |= 1u << li;
+    }
+    return ret;
+}
+
+template<class Filter>
+inline bool TracerCPU::traceScene(RayCPU& ray, RayHitCPU& hit, uint32_t instance_mask, uint32_t layer_mask, CullMode cull, const Filter& filter)
+{
+    bool ret = false;
+    auto& instances = m_rd.instances;
+    m_rd.getTLAS().traverse(ray, { instance_mask, layer_mask }, [&](uint32_t ii) {
+        auto& inst = *instances[ii];
+        auto& base = *inst.base;
+        if ((GetInstanceMask(base) & instance_mask) == 0 || (base.layer_mask & layer_mask) == 0)
+            return;
+
+        // transform the ray to object space. direction is not normalized so t is the same in both spaces.
+        RayCPU oray;
+        oray.origin = mul_p(inst.itransform, ray.origin);
+        oray.direction = mul_v(inst.itransform, ray.direction);
+        oray.tmin = ray.tmin;
+        oray.tmax = ray.tmax;
+
+        auto icull = base.hasFlag(InstanceFlag::ShadowsOnly) ? CullMode::None : cull;
+        bool r = inst.mesh->intersect(oray, hit, icull, [&](RayHitCPU& h) {
+            h.instance_id = ii;
+            return filter(h, inst);
+        }, m_triangle_blocks);
+        if (r) {
+            ray.tmax = oray.tmax;
+            ret = true;
+        }
+    });
+    return ret;
+}
+
+template<class Filter>
+inline bool TracerCPU::traceOcclusion(const RayCPU& ray, uint32_t instance_mask, uint32_t layer_mask, uint32_t skip_instance, uint32_t defer_instance,
+    CullMode cull, const Filter& filter, OccluderCache *cache)
+{
+    auto& instances = m_rd.instances;
+    // leaf: the cached leaf to test instead of the whole BLAS, or ~0
+    auto occluded = [&](uint32_t ii, uint32_t leaf) {
+        auto& inst = *instances[ii];
+        auto& base = *inst.base;
+        if ((GetInstanceMask(base) & instance_mask) == 0 || (base.layer_mask & layer_mask) == 0)
+            return false;
+
+        RayCPU oray;
+        oray.origin = mul_p(inst.itransform, ray.origin);
+        oray.direction = mul_v(inst.itransform, ray.direction);
+        oray.tmin = ray.tmin;
+        oray.tmax = ray.tmax;
+
+        auto icull = base.hasFlag(InstanceFlag::ShadowsOnly) ? CullMode::None : cull;
+        auto ifilter = [&](RayHitCPU& h) {
+            h.instance_id = ii;
+            return filter(h, inst);
+        };
+        if (leaf != ~0u)
+            return inst.mesh->occludedLeaf(leaf, oray, icull, ifilter);
+
+        uint32_t hit_leaf;
+        if (!inst.mesh->occluded(oray, icull, ifilter, m_triangle_blocks, &hit_leaf))
+            return false;
+        if (cache) {
+            cache->instance_id = ii;
+            cache->leaf = hit_leaf;
+        }
+        return true;
+    };
+
+    if (cache && cache->leaf != ~0u && cache->instance_id != skip_instance && occluded(cache->instance_id, cache->leaf))
+        return true;
+
+    bool deferred = false;
+    if (m_rd.getTLAS().traverseAny(ray, { instance_mask, layer_mask }, [&](uint32_t ii) {
+            if (ii == skip_instance)
+                return false;
+            if (ii == defer_instance) {
+                deferred = true;
+                return false;
+            }
+            return occluded(ii, ~0u);
+        }))
+        return true;
+    return deferred && occluded(defer_instance, ~0u);
+}
+
+RayCPU TracerCPU::getCameraRay(int x, int y)
+{
+    float sx = (((float)x + 0.5f) / (float)m_width) * 2.0f - 1.0f;
+    float sy = (((float)y + 0.5f) / (float)m_height) * 2.0f - 1.0f;
+    sx *= m_aspect;
+
+    RayCPU ray;
+    ray.origin = m_cam_pos;
+    ray.direction = normalize(m_cam_right * sx + m_cam_up * sy + m_cam_forward * m_focal);
+    ray.tmin = m_scene.camera.near_plane;
+    ray.tmax = m_scene.camera.far_plane;
+    return ray;
+}
+
+const MeshInstanceData* TracerCPU::getReceiver(uint32_t instance_id) const
+{
+    return instance_id != kUnknownInstance ? m_rd.instances[instance_id]->base : nullptr;
+}
+
+float3 TracerCPU::getShadowRayOrigin(const RayCPU& ray, const RayHitCPU& hit) const
+{
+    return ray.origin + ray.direction * (hit.t - m_scene.shadow_ray_offset);
+}
+
+bool TracerCPU::getShadowRay(const LightData& light, const float3& pos, RayCPU& ray) const
+{
+    ray.origin = pos;
+    ray.tmin = 0.0f;
+    if (light.light_type == LightType::Directional) {
+        ray.direction = -light.direction;
+        ray.tmax = m_scene.camera.far_plane;
+        return true;
+    }
+    else if (light.light_type == LightType::Spot) {
+        float3 dir = normalize(light.position - pos);
+        float distance = length(light.position - pos);
+        if (distance <= light.range && angle_between(-dir, light.direction) * 2.0f <= light.spot_angle) {
+            ray.direction = dir;
+            ray.tmax = distance;
+            return true;
+        }
+    }
+    else if (light.light_type == LightType::Point) {
+        float3 dir = normalize(light.position - pos);
+        float distance = length(light.position - pos);
+        if (distance <= light.range) {
+            ray.direction = dir;
+            ray.tmax = distance;
+            return true;
+        }
+    }
+    else if (light.light_type == LightType::ReversePoint) {
+        float3 dir = normalize(light.position - pos);
+        float distance = length(light.position - pos);
+        if (distance <= light.range) {
+            ray.direction = -dir;
+            ray.tmax = light.range - distance;
+            return true;
+        }
+    }
+    return false;
+}
+
+CullMode TracerCPU::getShadowCullMode() const
+{
+    CullMode cull = CullMode::None;
+    if (m_rd.hasFlag(RenderFlag::CullBackFaces))
+        cull = m_rd.hasFlag(RenderFlag::FlipCasterFaces) ? CullMode::Front : CullMode::Back;
+    return cull;
+}
+
+// light_bits: lights to evaluate. others are skipped as if they are out of range.
+void TracerCPU::closestHitCamera(const RayCPU& ray, const RayHitCPU& hit, uint32_t light_bits, CameraPayload& payload, OccluderCache *caches)
+{
+    payload.t = hit.t;
+    payload.instance_id = hit.instance_id;
+
+    auto *receiver = getReceiver(hit.instance_id);
+    uint32_t instance_layer_mask = receiver ? receiver->layer_mask : ~0u;
+    bool receive_shadows = !receiver || receiver->hasFlag(InstanceFlag::ReceiveShadows);
+    float ls = 1.0f / (float)m_scene.light_count;
+    CullMode cull = getShadowCullMode();
+    float3 pos = getShadowRayOrigin(ray, hit);
+
+    for (uint32_t li = 0; li < m_scene.light_count; ++li) {
+        auto& light = m_scene.lights[li];
+        if ((light_bits & (1u << li)) == 0 || (instance_layer_mask & light.layer_mask) == 0)
+            continue;
+
+        RayCPU sray;
+        if (!getShadowRay(light, pos, sray))
+            continue;
+
+        uint32_t mask = !receive_shadows ? 0 : (light.layer_mask & m_scene.camera.layer_mask);
+        if (!shootShadowRay(sray, cull, mask, payload.instance_id, caches ? &caches[li] : nullptr)) {
+            payload.light_bits |= 0x1 << li;
+            payload.shadow += ls;
+        }
+    }
+}
+
+bool TracerCPU::shootShadowRay(RayCPU& ray, CullMode cull, uint32_t light_mask, uint32_t instance_id, OccluderCache *cache)
+{
+    if (light_mask == 0)
+        return false;
+
+    bool ignore_self_shadow = m_rd.hasFlag(RenderFlag::IgnoreSelfShadow);
+    bool keep_self_drop_shadow = m_rd.hasFlag(RenderFlag::KeepSelfDropShadow);
+    float self_shadow_threshold = m_scene.self_shadow_threshold;
+
+    // AnyHitLight. the layer mask is checked per instance by traceOcclusion() / traceScene()
+    auto any_hit_light = [&](RayHitCPU& h, const MeshInstanceDataCPU&) {
+        if (ignore_self_shadow) {
+            if (h.t < self_shadow_threshold ||
+                (h.instance_id == instance_id && (!keep_self_drop_shadow || !h.front_face)))
+                return false;
+        }
+        return true;
+    };
+    if (m_occlusion_query) {
+        // without KeepSelfDropShadow all hits on the receiver itself are ignored. no need to traverse it.
+        // with it, only front faces of the receiver can occlude. others are tested first as they are more likely to.
+        uint32_t skip_instance = ignore_self_shadow && !keep_self_drop_shadow ? instance_id : ~0u;
+        uint32_t defer_instance = ignore_self_shadow && keep_self_drop_shadow ? instance_id : ~0u;
+        return traceOcclusion(ray, kInstanceMaskShadow, light_mask, skip_instance, defer_instance, cull, any_hit_light, cache);
+    }
+
+    RayHitCPU hit;
+    return traceScene(ray, hit, kInstanceMaskShadow, light_mask, cull, any_hit_light);
+}
+
+} // namespace rths
@@ -0,0 +1,158 @@
+#pragma once
+#include "rthsTypesCPU.h"
+#include "rthsPacketCPU.h"
+
+namespace rths {
+
+// CPU counterpart of rthsShadowDXR.hlsl.
+// traces camera rays and shadow rays for each pixel of rd.render_target. the screen is split into tiles and processed in parallel.
+// camera rays of a tile are traced first, then lights that can't reach any hit position of the tile are culled
+// before shadow rays are generated. the light bits of each tile are stored in rd.tile_lights.
+// shadow rays of a tile are queued, binned by light and direction octant, and each bin is traced as a batch.
+// with RenderFlag::TemporalReprojection, pixels whose receiver was visible in the previous frame reuse its shadow result
+// and only the rest go to shadow rays. camera rays are still traced for every pixel: the hit position is what is
+// reprojected and what detects disocclusion, so only shadow rays are saved.
+// with RenderFlag::DirtyRegions and a still camera, only tiles that updated instances or their shadows can cover
+// are traced, and the others keep the previous result in the render target.
+// with G-buffer input (rd.gbuffer_depth), camera rays are not traced. hit positions are reconstructed from the depth.
+class TracerCPU
+{
+public:
+    static const int kTileSize = 16;
+    static const int kTemporalRefreshInterval = 8; // reprojected pixels are traced again at least once in this many frames
+    static const int kMaxHullPoints = 16; // markDirtyHull()
+    // points in front of the camera and intersections of the near plane and segments (8 x 8 at most), +1 for ConvexHull2D()
+    static const int kMaxHullVertices = kMaxHullPoints + kMaxHullPoints * kMaxHullPoints / 4 + 1;
+
+    TracerCPU(RenderDataCPU& rd);
+    void dispatch();
+
+private:
+    struct CameraPayload
+    {
+        float shadow = 0.0f;
+        uint32_t light_bits = 0;
+        float t = FLT_MAX;
+        uint32_t instance_id = ~0u;
+    };
+
+    // queued shadow ray
+    struct ShadowRay
+    {
+        RayCPU ray;
+        uint16_t pixel;       // index in the tile
+        uint8_t light;
+        uint8_t bin;          // light * 8 + direction octant
+    };
+
+    // buffers of traceShadowRayBins(). one per thread, allocated at the max size on the first use and reused by all
+    // tiles the thread shades. a tile has kTileSize^2 pixels and kMaxLights shadow rays per pixel at most.
+    struct ShadowRayScratch
+    {
+        static const int kMaxRays = kTileSize * kTileSize * kMaxLights;
+
+        std::vector<ShadowRay> queue;
+        std::vector<ShadowRay> sorted; // queue sorted by bin
+        std::vector<RayCPU> bin_rays;
+        std::vector<RayHitCPU> bin_hits;
+
+        ShadowRayScratch() : queue(kMaxRays), sorted(kMaxRays), bin_rays(kMaxRays), bin_hits(kMaxRays) {}
+    };
+
+    // the BLAS leaf that occluded the last shadow ray to a light in a tile. shadow rays of neighboring pixels to the same
+    // light are coherent, so the next one is likely blocked by the same triangles. it is tested before traversing the scene.
+    struct OccluderCache
+    {
+        uint32_t instance_id = ~0u;
+        uint32_t leaf = ~0u;
+    };
+
+    void traceTile(int tx, int ty);
+    void traceTilePackets(int tx, int ty);
+    // G-buffer input. hits are made from depth and instance IDs instead of camera rays
+    void traceTileGBuffer(int tx, int ty);
+    // RenderFlag::TemporalReprojection. writes results of pixels that can be reprojected from the previous frame.
+    // hits are results of camera rays of this frame. they give the positions to reproject.
+    // the remaining pixels are moved to the front of the arrays and the number of them is returned.
+    int reprojectTile(int (*pixels)[2], RayCPU *rays, RayHitCPU *hits, int n);
+    bool isHistoryCompatible() const;
+    // pixel and view depth of p in the previous frame. returns false if p is out of the screen.
+    bool projectToHistory(const float3& p, int& x, int& y, float& depth) const;
+    // true if p is projected near the pixel in the current frame
+    bool isNearPixel(const float3& p, int x, int y) const;
+    // RenderFlag::DirtyRegions. true if the render target still has the last result and only instances have changed.
+    bool isDirtyRegionCompatible() const;
+    // fills m_dirty_tiles with tiles covered by rd.dirty_bounds and shadow volumes of them
+    void markDirtyTiles();
+    // screen space convex polygon of the convex hull of points, clipped by the near plane. returns the number of vertices.
+    int projectHull(const float3 *points, int n, float2 *dst) const;
+    // marks tiles covered by the convex hull of points. the hull is clipped by the box if clip is not null.
+    void markDirtyHull(const float3 *points, int n, const AABB *clip);
+    // shadow rays of a tile. pixels, rays and hits are results of camera rays
+    void shadeTile(int tx, int ty, const int (*pixels)[2], const RayCPU *rays, const RayHitCPU *hits, int n);
+    // shadow ray queue of shadeTile(). visible receives bits of lights that are not occluded from each pixel.
+    void traceShadowRayBins(uint32_t light_bits, const RayCPU *rays, const RayHitCPU *hits, int n, uint32_t *visible);
+    // bits of lights that may reach any of the hit positions. the exact test is still done per pixel.
+    uint32_t cullLights(const AABB& bounds, uint32_t layer_mask) const;
+    RayCPU getCameraRay(int x, int y);
+    // null for kUnknownInstance
+    const MeshInstanceData* getReceiver(uint32_t instance_id) const;
+    float3 getShadowRayOrigin(const RayCPU& ray, const RayHitCPU& hit) const;
+    // ray from pos to the light. returns false if pos is out of the light's range.
+    bool getShadowRay(const LightData& light, const float3& pos, RayCPU& ray) const;
+    CullMode getShadowCullMode() const;
+    // caches: one for each light. can be null
+    void closestHitCamera(const RayCPU& ray, const RayHitCPU& hit, uint32_t light_bits, CameraPayload& payload, OccluderCache *caches = nullptr);
+    // cache: can be null. used only by the occlusion query.
+    bool shootShadowRay(RayCPU& ray, CullMode cull, uint32_t light_mask, uint32_t instance_id, OccluderCache *cache = nullptr);
+
+    // Filter: [](const RayHitCPU& hit, const MeshInstanceDataCPU& inst) -> bool
+    // instances that don't match instance_mask or layer_mask are skipped without traversing their BLAS.
+    // TLAS subtrees that contain no such instances are skipped as a whole.
+    template<class Filter>
+    bool traceScene(RayCPU& ray, RayHitCPU& hit, uint32_t instance_mask, uint32_t layer_mask, CullMode cull, const Filter& filter);
+    // any hit. instances that don't match instance_mask or layer_mask, and skip_instance, are skipped without traversing their BLAS.
+    // defer_instance is traversed last, after all other instances have missed. for instances whose hits the filter mostly rejects.
+    template<class Filter>
+    bool traceOcclusion(const RayCPU& ray, uint32_t instance_mask, uint32_t layer_mask, uint32_t skip_instance, uint32_t defer_instance,
+        CullMode cull, const Filter& filter, OccluderCache *cache);
+
+    RenderDataCPU& m_rd;
+    SceneData& m_scene;
+    int m_width = 0;
+    int m_height = 0;
+    float m_aspect = 1.0f;
+    float3 m_cam_pos{}, m_cam_right{}, m_cam_up{}, m_cam_forward{};
+    float m_focal = 1.0f;
+
+    // null if ray packets are disabled
+    IntersectPacketsFunc m_intersect_packets = nullptr;
+    int m_packet_width = 1;
+    bool m_occlusion_query = true;
+    bool m_triangle_blocks = true;
+    bool m_light_culling = true;
+    bool m_shadow_ray_binning = true;
+    std::atomic_uint32_t m_shadow_ray_count{ 0 };
+    std::atomic_uint32_t m_shadow_ray_bins{ 0 };
+    uint32_t m_all_lights = 0; // bits of all lights in the scene
+
+    bool m_temporal = false;
+    bool m_history_valid = false;
+    float3 m_prev_cam_pos{}, m_prev_cam_right{}, m_prev_cam_up{}, m_prev_cam_forward{};
+    float m_prev_focal = 1.0f;
+    std::vector<float> m_depth; // depth and receiver of each pixel. become the history of the next frame
+    std::vector<const MeshInstanceDataCPU*> m_receivers;
+    std::vector<float3> m_sources; // world position where the value of each pixel was traced
+    std::vector<uint8_t> m_age;    // frames since the value of each pixel was traced
+    std::atomic_uint32_t m_temporal_pixels{ 0 };
+    std::atomic_uint32_t m_temporal_retraced{ 0 };
+
+    std::atomic_uint32_t m_gbuffer_pixels{ 0 };
+
+    bool m_dirty_regions = false;
+    std::vector<uint8_t> m_dirty_tiles; // 1 if the tile needs to be traced
+    int m_tiles_x = 0;
+    int m_tiles_y = 0;
+};
+
+} // namespace rths
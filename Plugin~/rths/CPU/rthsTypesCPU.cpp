@@ -0,0 +1,408 @@
+#include "pch.h"
+#include "Foundation/rthsMisc.h"
+#include "Foundation/rthsConvert.h"
+#include "rthsTypesCPU.h"
+
+namespace rths {
+
+bool MeshDataCPU::valid() const
+{
+    return this && base && base->cpu_vertex_buffer && base->cpu_index_buffer;
+}
+
+bool MeshDataCPU::isRelocated() const
+{
+    // CPU buffers are referenced directly. nothing to relocate.
+    return false;
+}
+
+bool MeshDataCPU::isDynamic() const
+{
+    return base->is_dynamic || is_deformed;
+}
+
+int MeshDataCPU::getVertexStride() const
+{
+    if (is_deformed)
+        return (int)sizeof(float4);
+    // vertex buffer size is unknown for CPU buffers. assume tightly packed float3.
+    return base->vertex_stride != 0 ? base->vertex_stride : (int)sizeof(float3);
+}
+
+int MeshDataCPU::getIndexStride() const
+{
+    return base->index_stride != 0 ? base->index_stride : (int)sizeof(uint32_t);
+}
+
+const void* MeshDataCPU::getVertices() const
+{
+    if (is_deformed)
+        return deformed_vertices.data();
+    return (const char*)base->cpu_vertex_buffer + base->vertex_offset;
+}
+
+const void* MeshDataCPU::getIndices() const
+{
+    return (const char*)base->cpu_index_buffer + base->index_offset;
+}
+
+TriangleSourceCPU MeshDataCPU::getTriangleSource() const
+{
+    return { (const char*)getVertices(), getVertexStride(), base->vertex_count, (const char*)getIndices(), getIndexStride(), base->index_count };
+}
+
+void MeshDataCPU::buildBLAS()
+{
+    clearBLAS();
+    // dynamic and deformed meshes are updated every frame. LBVH is the cheapest to rebuild and refit keeps its quality reasonably.
+    auto quality = isDynamic() ? BVHBuildQuality::Linear : BVHBuildQuality::FastTrace;
+    if (GetGlobals().hasFlag(GlobalFlag::CompressBVH)) {
+        compressed_blas.build(
+            getVertices(), getVertexStride(), base->vertex_count,
+            getIndices(), getIndexStride(), base->index_count,
+            quality);
+    }
+    else {
+        blas.build(
+            getVertices(), getVertexStride(), base->vertex_count,
+            getIndices(), getIndexStride(), base->index_count,
+            quality);
+    }
+}
+
+void MeshDataCPU::updateBLAS()
+{
+    // compressed BLAS can't be refitted
+    if (!blas.empty() && blas.refit(
+        getVertices(), getVertexStride(), base->vertex_count,
+        getIndices(), getIndexStride(), base->index_count))
+        return;
+    buildBLAS();
+}
+
+void MeshDataCPU::clearBLAS()
+{
+    blas.clear();
+    compressed_blas.clear();
+}
+
+bool MeshDataCPU::hasBLAS() const
+{
+    return !blas.empty() || !compressed_blas.empty();
+}
+
+bool MeshDataCPU::isCompressed() const
+{
+    return !compressed_blas.empty();
+}
+
+const AABB& MeshDataCPU::getBounds() const
+{
+    return isCompressed() ? compressed_blas.getBounds() : blas.getBounds();
+}
+
+const BVHBuildStatsCPU& MeshDataCPU::getBuildStats() const
+{
+    return isCompressed() ? compressed_blas.getBuildStats() : blas.getBuildStats();
+}
+
+size_t MeshDataCPU::getMemoryUsage() const
+{
+    return isCompressed() ? compressed_blas.getMemoryUsage() : blas.getMemoryUsage();
+}
+
+size_t MeshDataCPU::getUncompressedMemoryUsage() const
+{
+    return isCompressed() ? compressed_blas.getUncompressedMemoryUsage() : blas.getMemoryUsage();
+}
+
+
+bool MeshInstanceDataCPU::valid() const
+{
+    return this && base && mesh && mesh->valid();
+}
+
+void MeshInstanceDataCPU::updateTransform()
+{
+    transform = base->transform;
+    itransform = invert(transform);
+    bounds = TransformAABB(mesh->getBounds(), transform);
+}
+
+
+bool RenderTargetDataCPU::valid() const
+{
+    return this && width > 0 && height > 0 && format != RenderTargetFormat::Unknown;
+}
+
+bool RenderTargetDataCPU::isRelocated() const
+{
+    return base && (base->width != width || base->height != height || base->format != format);
+}
+
+
+bool TimestampCPU::isEnabled() const
+{
+    return m_enabled;
+}
+
+void TimestampCPU::setEnabled(bool v)
+{
+    m_enabled = v;
+}
+
+void TimestampCPU::reset()
+{
+    m_samples.clear();
+}
+
+void TimestampCPU::query(const char *message)
+{
+    if (!m_enabled)
+        return;
+    m_samples.push_back(std::make_tuple(Now(), message));
+}
+
+void TimestampCPU::updateLog()
+{
+    if (!m_enabled)
+        return;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    // same format as TimestampDXR: "name: elapsed ms" for each begin / end pair
+    m_log.clear();
+    char buf[256];
+    size_t n = m_samples.size();
+    for (size_t si = 0; si < n; ++si) {
+        auto name1 = std::get<1>(m_samples[si]);
+        auto pos1 = std::strstr(name1, " begin");
+        if (!pos1)
+            continue;
+        size_t len = pos1 - name1;
+        for (size_t sj = si + 1; sj < n; ++sj) {
+            auto name2 = std::get<1>(m_samples[sj]);
+            auto pos2 = std::strstr(name2, " end");
+            if (pos2 && size_t(pos2 - name2) == len && std::strncmp(name1, name2, len) == 0) {
+                auto elapsed = std::get<0>(m_samples[sj]) - std::get<0>(m_samples[si]);
+                sprintf(buf, "%.*s: %.2fms\n", (int)len, name1, NS2MS(elapsed));
+                m_log += buf;
+                break;
+            }
+        }
+    }
+}
+
+std::string TimestampCPU::getLog()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_log;
+}
+
+
+void RenderStatsCPU::clear()
+{
+    *this = RenderStatsCPU();
+}
+
+void RenderStatsCPU::addBLASStats(const BVHBuildStatsCPU& v)
+{
+    if (v.triangle_count == 0)
+        return;
+    if (v.refit) {
+        blas_refit_time += v.build_time;
+        ++blas_refit_count;
+        return;
+    }
+    uint32_t total = blas_triangle_count + v.triangle_count;
+    blas_sah_cost = (blas_sah_cost * blas_triangle_count + v.sah_cost * v.triangle_count) / total;
+    blas_triangle_count = total;
+    blas_build_time += v.build_time;
+    ++blas_build_count;
+}
+
+void RenderStatsCPU::addLightCullingStats(const std::vector<uint32_t>& tile_lights, uint32_t lights)
+{
+    light_count = lights;
+    for (uint32_t bits : tile_lights) {
+        if (bits == 0)
+            continue;
+        uint32_t n = 0;
+        for (; bits != 0; bits &= bits - 1)
+            ++n;
+        ++light_culling_tiles;
+        light_culling_sum += n;
+        light_culling_max = std::max(light_culling_max, n);
+    }
+}
+
+std::string RenderStatsCPU::toString() const
+{
+    char buf[256];
+    std::string ret;
+    if (deform_instance_count > 0) {
+        double sec = (double)deform_time / 1e9;
+        snprintf(buf, sizeof(buf), "Deform: %u instances, %u vertices, %.2fms (%.2fM vertices/s)\n",
+            deform_instance_count, deform_vertex_count, NS2MS(deform_time), sec > 0.0 ? (double)deform_vertex_count / sec / 1e6 : 0.0);
+        ret += buf;
+    }
+    if (blas_build_count > 0) {
+        snprintf(buf, sizeof(buf), "BLAS build: %u meshes, %u triangles, %.2fms, SAH cost %.2f\n",
+            blas_build_count, blas_triangle_count, NS2MS(blas_build_time), blas_sah_cost);
+        ret += buf;
+    }
+    if (blas_refit_count > 0) {
+        snprintf(buf, sizeof(buf), "BLAS refit: %u meshes, %.2fms\n",
+            blas_refit_count, NS2MS(blas_refit_time));
+        ret += buf;
+    }
+    if (blas_update_report.mesh_count > 0)
+        ret += blas_update_report.toString();
+    if (tlas_rebuilt) {
+        snprintf(buf, sizeof(buf), "TLAS build: %u instances, %.2fms, SAH cost %.2f\n",
+            tlas_instance_count, NS2MS(tlas_time), tlas_sah_cost);
+        ret += buf;
+    }
+    else if (tlas_update_count > 0) {
+        snprintf(buf, sizeof(buf), "TLAS refit: %u / %u instances, %.2fms, SAH cost %.2f\n",
+            tlas_update_count, tlas_instance_count, NS2MS(tlas_time), tlas_sah_cost);
+        ret += buf;
+    }
+    if (shared_renderers > 0) {
+        snprintf(buf, sizeof(buf), "Shared scene: %u instances, %u renderers\n", tlas_instance_count, shared_renderers);
+        ret += buf;
+    }
+    if (view_count > 0) {
+        snprintf(buf, sizeof(buf), "Multi-view: %u views\n", view_count);
+        ret += buf;
+    }
+    if (light_culling_tiles > 0) {
+        snprintf(buf, sizeof(buf), "Light culling: %u tiles, %.2f / %u lights per tile, max %u\n",
+            light_culling_tiles, (float)light_culling_sum / (float)light_culling_tiles, light_count, light_culling_max);
+        ret += buf;
+    }
+    if (shadow_ray_count > 0) {
+        snprintf(buf, sizeof(buf), "Shadow rays: %u rays in %u bins\n", shadow_ray_count, shadow_ray_bins);
+        ret += buf;
+    }
+    if (temporal_pixels > 0) {
+        snprintf(buf, sizeof(buf), "Temporal reprojection: shadow rays of %u / %u pixels retraced (%.2f%%)\n",
+            temporal_retraced, temporal_pixels, (float)temporal_retraced / (float)temporal_pixels * 100.0f);
+        ret += buf;
+    }
+    if (dirty_tiles_total > 0) {
+        snprintf(buf, sizeof(buf), "Dirty regions: %u / %u tiles traced (%.2f%%)\n",
+            dirty_tiles, dirty_tiles_total, (float)dirty_tiles / (float)dirty_tiles_total * 100.0f);
+        ret += buf;
+    }
+    if (gbuffer_total > 0) {
+        snprintf(buf, sizeof(buf), "G-buffer: %u / %u pixels have depth\n", gbuffer_pixels, gbuffer_total);
+        ret += buf;
+    }
+    return ret;
+}
+
+
+bool RenderDataCPU::hasFlag(RenderFlag f) const
+{
+    return (render_flags & (uint32_t)f) != 0;
+}
+
+void RenderDataCPU::clear()
+{
+    *this = RenderDataCPU();
+}
+
+
+int SizeOfElement(RenderTargetFormat format)
+{
+    switch (format) {
+    case RenderTargetFormat::Ru8: return 1;
+    case RenderTargetFormat::RGu8: return 2;
+    case RenderTargetFormat::RGBAu8: return 4;
+    case RenderTargetFormat::Rf16: return 2;
+    case RenderTargetFormat::RGf16: return 4;
+    case RenderTargetFormat::RGBAf16: return 8;
+    case RenderTargetFormat::Rf32: return 4;
+    case RenderTargetFormat::RGf32: return 8;
+    case RenderTargetFormat::RGBAf32: return 16;
+    default: return 0;
+    }
+}
+
+int ChannelCount(RenderTargetFormat format)
+{
+    switch (format) {
+    case RenderTargetFormat::Ru8:
+    case RenderTargetFormat::Rf16:
+    case RenderTargetFormat::Rf32:
+        return 1;
+    case RenderTargetFormat::RGu8:
+    case RenderTargetFormat::RGf16:
+    case RenderTargetFormat::RGf32:
+        return 2;
+    case RenderTargetFormat::RGBAu8:
+    case RenderTargetFormat::RGBAf16:
+    case RenderTargetFormat::RGBAf32:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+// Convert: [](T *dst, const float *src, size_t n) -> void. batch conversion of the first channel
+template<class T, class Convert>
+static inline void ConvertRenderTargetImpl(T *dst, const float *src, size_t num_pixels, int num_channels, const Convert& convert)
+{
+    if (num_channels == 1) {
+        convert(dst, src, num_pixels);
+        return;
+    }
+
+    // convert blocks of pixels and interleave them with zero filled channels
+    const size_t block_size = 256;
+    T tmp[block_size];
+    for (size_t bi = 0; bi < num_pixels; bi += block_size) {
+        size_t n = std::min(block_size, num_pixels - bi);
+        convert(tmp, src + bi, n);
+        for (size_t pi = 0; pi < n; ++pi) {
+            *dst++ = tmp[pi];
+            for (int ci = 1; ci < num_channels; ++ci)
+                *dst++ = T(0);
+        }
+    }
+}
+
+void ConvertRenderTarget(void *dst, const float *src, size_t num_pixels, RenderTargetFormat format)
+{
+    int num_channels = ChannelCount(format);
+    bool f16c = !GetGlobals().hasDebugFlag(DebugFlag::NoF16C);
+    switch (format) {
+    case RenderTargetFormat::Ru8:
+    case RenderTargetFormat::RGu8:
+    case RenderTargetFormat::RGBAu8:
+        ConvertRenderTargetImpl((uint8_t*)dst, src, num_pixels, num_channels, [](uint8_t *d, const float *s, size_t n) {
+            ConvertFloatToUnorm8(d, s, n);
+        });
+        break;
+    case RenderTargetFormat::Rf16:
+    case RenderTargetFormat::RGf16:
+    case RenderTargetFormat::RGBAf16:
+        // half bits of 0.0f is 0
+        ConvertRenderTargetImpl((uint16_t*)dst, src, num_pixels, num_channels, [f16c](uint16_t *d, const float *s, size_t n) {
+            ConvertFloatToHalf(d, s, n, f16c);
+        });
+        break;
+    case RenderTargetFormat::Rf32:
+    case RenderTargetFormat::RGf32:
+    case RenderTargetFormat::RGBAf32:
+        ConvertRenderTargetImpl((float*)dst, src, num_pixels, num_channels, [](float *d, const float *s, size_t n) {
+            std::copy(s, s + n, d);
+        });
+        break;
+    default:
+        break;
+    }
+}
+
+} // namespace rths
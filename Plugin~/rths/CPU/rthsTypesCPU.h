@@ -0,0 +1,301 @@
+#pragma once
+#include "rthsTypes.h"
+#include "rthsBVHCPU.h"
+#include "rthsCompressedBVHCPU.h"
+#include "Foundation/rthsParallel.h"
+
+namespace rths {
+
+// same as instance masks of TLAS in GfxContextDXR
+static const uint32_t kInstanceMaskCamera = 0x01;
+static const uint32_t kInstanceMaskShadow = 0x02;
+// instance_id of G-buffer hits whose receiver is not known. treated as an instance that is on all layers and receives shadows
+static const uint32_t kUnknownInstance = ~0u - 1;
+
+inline uint32_t GetInstanceMask(const MeshInstanceData& inst)
+{
+    uint32_t mask = 0;
+    if (!inst.hasFlag(InstanceFlag::ShadowsOnly))
+        mask |= kInstanceMaskCamera;
+    if (inst.hasFlag(InstanceFlag::CastShadows))
+        mask |= kInstanceMaskShadow;
+    return mask;
+}
+
+class MeshDataCPU : public DeviceMeshData
+{
+public:
+    MeshData *base = nullptr;
+    BLASCPU blas; // bottom level acceleration structure
+    CompressedBLASCPU compressed_blas; // used instead of blas if GlobalFlag::CompressBVH is set
+    bool is_updated = false; // BLAS has been rebuilt in this frame
+    // a deformed instance has its own MeshDataCPU whose BLAS is built on the results of DeformCPU().
+    // base is the mesh of the instance. vertices of base are replaced with deformed_vertices.
+    bool is_deformed = false;
+    std::vector<float4> deformed_vertices;
+
+    bool valid() const override;
+    bool isRelocated() const override;
+    bool isDynamic() const; // vertices can change every frame
+    int getVertexStride() const;
+    int getIndexStride() const;
+    const void* getVertices() const; // vertex_offset is applied. deformed_vertices if is_deformed
+    const void* getIndices() const;  // index_offset is applied
+    TriangleSourceCPU getTriangleSource() const;
+    void buildBLAS(); // Linear if the mesh is dynamic, FastTrace otherwise
+    void updateBLAS(); // for dynamic meshes. refit while the tree is good enough, rebuild otherwise
+    void clearBLAS();
+
+    // these forward to blas or compressed_blas
+    bool hasBLAS() const;
+    bool isCompressed() const;
+    const AABB& getBounds() const;
+    const BVHBuildStatsCPU& getBuildStats() const;
+    size_t getMemoryUsage() const;
+    size_t getUncompressedMemoryUsage() const;
+    // use_blocks: false to read triangles from the source buffers instead of triangle blocks (DebugFlag::NoTriangleBlocks)
+    template<class Filter>
+    bool intersect(RayCPU& ray, RayHitCPU& hit, CullMode cull, const Filter& filter, bool use_blocks = true) const;
+    // leaf: receives the leaf of the accepted hit for occludedLeaf(). ~0 if it is not available (compressed or !use_blocks)
+    template<class Filter>
+    bool occluded(const RayCPU& ray, CullMode cull, const Filter& filter, bool use_blocks = true, uint32_t *leaf = nullptr) const;
+    template<class Filter>
+    bool occludedLeaf(uint32_t leaf, const RayCPU& ray, CullMode cull, const Filter& filter) const;
+};
+using MeshDataCPUPtr = std::shared_ptr<MeshDataCPU>;
+
+template<class Filter>
+inline bool MeshDataCPU::intersect(RayCPU& ray, RayHitCPU& hit, CullMode cull, const Filter& filter, bool use_blocks) const
+{
+    if (!compressed_blas.empty())
+        return compressed_blas.intersect(ray, hit, cull, filter);
+    else if (use_blocks)
+        return blas.intersect(ray, hit, cull, filter);
+    else
+        return blas.intersect(ray, hit, cull, filter, getTriangleSource());
+}
+
+template<class Filter>
+inline bool MeshDataCPU::occluded(const RayCPU& ray, CullMode cull, const Filter& filter, bool use_blocks, uint32_t *leaf) const
+{
+    if (leaf)
+        *leaf = ~0u;
+    if (!compressed_blas.empty())
+        return compressed_blas.occluded(ray, cull, filter);
+    else if (use_blocks)
+        return blas.occluded(ray, cull, filter, leaf);
+    else
+        return blas.occluded(ray, cull, filter, getTriangleSource());
+}
+
+template<class Filter>
+inline bool MeshDataCPU::occludedLeaf(uint32_t leaf, const RayCPU& ray, CullMode cull, const Filter& filter) const
+{
+    if (!compressed_blas.empty() || leaf >= blas.getNodeCount())
+        return false;
+    return blas.occludedLeaf(leaf, ray, cull, filter);
+}
+
+class MeshInstanceDataCPU : public DeviceMeshInstanceData
+{
+public:
+    MeshInstanceData *base = nullptr;
+
+    MeshDataCPUPtr mesh;
+    float4x4 transform = float4x4::identity();
+    float4x4 itransform = float4x4::identity(); // world to object
+    AABB bounds; // world space
+    bool is_updated = false;
+    uint64_t update_count = 0; // incremented when transform, flags or BLAS are updated
+
+    bool valid() const override;
+    void updateTransform();
+};
+using MeshInstanceDataCPUPtr = std::shared_ptr<MeshInstanceDataCPU>;
+
+class RenderTargetDataCPU : public DeviceRenderTargetData
+{
+public:
+    RenderTargetData *base = nullptr;
+    int width = 0;
+    int height = 0;
+    RenderTargetFormat format = RenderTargetFormat::Unknown;
+    std::vector<float> buffer; // equivalent of RWTexture2D<float>. bit masks are stored as asfloat()
+    uint64_t write_count = 0;  // incremented by each dispatch. tells whether the buffer still has a renderer's last result
+
+    bool valid() const override;
+    bool isRelocated() const override;
+};
+using RenderTargetDataCPUPtr = std::shared_ptr<RenderTargetDataCPU>;
+
+
+class TimestampCPU
+{
+public:
+    bool isEnabled() const;
+    void setEnabled(bool v);
+    void reset();
+    void query(const char *message);
+    void updateLog();
+    std::string getLog(); // returns copy. it is intended
+
+private:
+    using Sample = std::tuple<uint64_t, const char*>;
+    bool m_enabled = true;
+    std::vector<Sample> m_samples;
+    std::string m_log;
+    std::mutex m_mutex;
+};
+using TimestampCPUPtr = std::shared_ptr<TimestampCPU>;
+
+
+struct RenderStatsCPU
+{
+    uint32_t deform_instance_count = 0; // instances deformed by DeformCPU()
+    uint32_t deform_vertex_count = 0;
+    nanosec deform_time = 0;
+    uint32_t blas_build_count = 0;
+    uint32_t blas_triangle_count = 0;
+    nanosec blas_build_time = 0; // sum of all builds. can be larger than the wall clock time as builds run in parallel
+    float blas_sah_cost = 0.0f;  // triangle count weighted average
+    uint32_t blas_refit_count = 0;
+    nanosec blas_refit_time = 0;
+    BLASUpdateReportCPU blas_update_report; // DebugFlag::BLASUpdateReport
+
+    bool tlas_rebuilt = false;
+    uint32_t tlas_instance_count = 0;
+    uint32_t tlas_update_count = 0; // number of instances refitted
+    nanosec tlas_time = 0;
+    float tlas_sah_cost = 0.0f;
+
+    uint32_t light_count = 0;
+    uint32_t light_culling_tiles = 0;  // tiles that have any hit
+    uint32_t light_culling_sum = 0;    // sum of light counts of these tiles
+    uint32_t light_culling_max = 0;
+
+    uint32_t shadow_ray_count = 0; // queued shadow rays
+    uint32_t shadow_ray_bins = 0;  // sum of non-empty bins of all tiles
+
+    uint32_t temporal_pixels = 0;   // RenderFlag::TemporalReprojection. pixels that hit anything
+    uint32_t temporal_retraced = 0; // pixels of them whose shadow rays are traced again. camera rays are traced for all pixels
+
+    uint32_t dirty_tiles = 0;       // RenderFlag::DirtyRegions. tiles traced in this frame
+    uint32_t dirty_tiles_total = 0; // all tiles of the render target
+
+    uint32_t gbuffer_pixels = 0;    // G-buffer input. pixels that have depth
+    uint32_t gbuffer_total = 0;     // all pixels of the render target
+
+    uint32_t shared_renderers = 0;  // RenderAll(). renderers that share the TLAS. 0 if the TLAS is not shared
+    uint32_t view_count = 0;        // multi-view. views rendered including view 0. 0 if there are no added views
+
+    void clear();
+    void addBLASStats(const BVHBuildStatsCPU& v);
+    void addLightCullingStats(const std::vector<uint32_t>& tile_lights, uint32_t lights);
+    std::string toString() const;
+};
+
+
+class RenderDataCPU;
+
+// acceleration structures shared by renderers in RenderAll() that have the same instances.
+// built by GfxContextCPU::prepareSharedScene() and not modified after that. the next frame makes a new one,
+// which takes over the acceleration structures of the one of two frames ago if no renderer holds it anymore.
+class SharedSceneCPU
+{
+public:
+    std::vector<MeshInstanceData*> meshes; // input. only compared with renderers' meshes
+    std::vector<const RenderDataCPU*> renderers; // renderers that share this in the current frame
+    std::vector<MeshInstanceDataCPUPtr> instances;
+    TLASCPU tlas;
+    std::vector<AABB> instance_bounds;
+    std::vector<InstanceMaskCPU> instance_masks;
+    std::vector<uint64_t> instance_update_counts;
+    RenderStatsCPU stats; // BLAS and TLAS part
+};
+using SharedSceneCPUPtr = std::shared_ptr<SharedSceneCPU>;
+
+
+class RenderDataCPU
+{
+public:
+    std::string name;
+
+    std::vector<MeshInstanceDataCPUPtr> instances, instances_prev;
+    SceneData scene_data{};
+    RenderTargetDataCPUPtr render_target;
+    uint32_t render_flags = 0;
+    TLASCPU tlas; // top level acceleration structure. not used if shared_scene is set
+    SharedSceneCPUPtr shared_scene; // set by setMeshes() if the instances are prepared by RenderAll()
+    const RenderDataCPU *primary = nullptr; // multi-view. views other than view 0 trace the acceleration structures of view 0
+    uint64_t render_count = 0;              // incremented by GfxContextCPU::prepare()
+    uint64_t primary_render_count = 0;      // multi-view. render_count of primary when this view was set up last
+    std::vector<AABB> instance_bounds; // world space bounds of instances. input of TLAS
+    std::vector<InstanceMaskCPU> instance_masks; // instance / layer masks of instances. input of TLAS
+    std::vector<uint64_t> instance_update_counts; // MeshInstanceDataCPU::update_count when the TLAS took the instances
+    RenderStatsCPU stats;
+
+    // light bits of each screen tile of the last dispatch. 0 for tiles without hits.
+    int tile_size = 0;
+    int tiles_x = 0;
+    int tiles_y = 0;
+    std::vector<uint32_t> tile_lights;
+
+    // RenderFlag::TemporalReprojection. results of the previous frame.
+    // instances of the previous frame are kept alive by instances_prev, so history_instance can be compared with pointers.
+    SceneData history_scene{};
+    int history_width = 0;
+    int history_height = 0;
+    uint32_t history_frame = 0; // selects stable pixels to refresh
+    std::vector<float> history_result; // copy of render_target->buffer
+    std::vector<float> history_depth;  // view space depth of the receiver
+    std::vector<const MeshInstanceDataCPU*> history_instance; // receiver. null if the camera ray missed
+    std::vector<float3> history_source; // world position where the value was traced
+    std::vector<uint8_t> history_age;   // frames since the value was traced
+
+    // RenderFlag::DirtyRegions. world space bounds of instances that have been moved, deformed, added or removed
+    // since the last dispatch (both old and new bounds). dirty_all is set if they can't be determined.
+    std::vector<AABB> dirty_bounds;
+    bool dirty_all = true;
+    std::vector<uint64_t> dirty_update_counts; // MeshInstanceDataCPU::update_count of instances
+    uint64_t dirty_write_count = 0; // RenderTargetDataCPU::write_count after the last dispatch
+    SceneData dirty_scene{};        // scene of the last dispatch
+
+    // G-buffer input (rthsRendererSetGBuffer()). camera rays are not traced if gbuffer_depth is set.
+    // gbuffer_instances maps instance IDs of the G-buffer to indices of instances (kUnknownInstance if it is skipped).
+    const float *gbuffer_depth = nullptr;
+    const uint32_t *gbuffer_instance_ids = nullptr;
+    std::vector<uint32_t> gbuffer_instances;
+
+#ifdef rthsEnableTimestamp
+    TimestampCPUPtr timestamp;
+#endif // rthsEnableTimestamp
+
+    // tracing started by GfxContextCPU::flush(). declared last so that it is destroyed (waited) first.
+    std::unique_ptr<TaskGroup> dispatch_task;
+
+    bool hasFlag(RenderFlag f) const;
+    const TLASCPU& getTLAS() const { return primary ? primary->getTLAS() : shared_scene ? shared_scene->tlas : tlas; }
+    void clear();
+};
+
+#ifdef rthsEnableTimestamp
+    #define rthsTimestampInitializeCPU(q)   if (!q) { q = std::make_shared<TimestampCPU>(); }
+    #define rthsTimestampSetEnableCPU(q, e) q->setEnabled(e)
+    #define rthsTimestampResetCPU(q)        q->reset()
+    #define rthsTimestampQueryCPU(q, m)     q->query(m)
+    #define rthsTimestampUpdateLogCPU(q)    q->updateLog()
+#else // rthsEnableTimestamp
+    #define rthsTimestampInitializeCPU(...)
+    #define rthsTimestampSetEnableCPU(...)
+    #define rthsTimestampResetCPU(...)
+    #define rthsTimestampQueryCPU(...)
+    #define rthsTimestampUpdateLogCPU(...)
+#endif // rthsEnableTimestamp
+
+int SizeOfElement(RenderTargetFormat format);
+int ChannelCount(RenderTargetFormat format);
+
+// convert float image to render target format. the value goes to the first channel and others are filled with zero.
+void ConvertRenderTarget(void *dst, const float *src, size_t num_pixels, RenderTargetFormat format);
+
+} // namespace rths
@@ -8,9 +8,17 @@ enum DEFORM_FLAG
 
 struct BlendshapeFrame
 {
-    uint delta_offset;
+    uint run_offset;
+    uint run_count;
     float weight;
 };
+// deltas are sparse. vertices out of runs have zero deltas
+struct BlendshapeRun
+{
+    uint vertex_offset;
+    uint vertex_count;
+    uint delta_offset;
+};
 struct BlendshapeInfo
 {
     uint frame_count;
@@ -49,6 +57,8 @@ StructuredBuffer<BoneCount>   g_bone_counts : register(t5);
 StructuredBuffer<BoneWeight>  g_bone_weights : register(t6);
 StructuredBuffer<float4x4>    g_bone_matrices : register(t7);
 
+StructuredBuffer<BlendshapeRun>     g_bs_runs : register(t8);
+
 ConstantBuffer<MeshInfo>      g_mesh_info : register(b0);
 
 
@@ -95,8 +105,25 @@ float GetBlendshapeFrameWeight(uint bsi, uint fi)
 
 float3 GetBlendshapeDelta(uint bsi, uint fi, uint vi)
 {
-    uint offset = g_bs_frames[g_bs_info[bsi].frame_offset + fi].delta_offset;
-    return g_bs_delta[offset + vi].xyz;
+    BlendshapeFrame frame = g_bs_frames[g_bs_info[bsi].frame_offset + fi];
+
+    // binary search the last run that begins at or before vi
+    uint lo = 0, hi = frame.run_count;
+    while (lo < hi) {
+        uint mid = (lo + hi) / 2;
+        if (g_bs_runs[frame.run_offset + mid].vertex_offset <= vi)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return 0.0f;
+
+    BlendshapeRun run = g_bs_runs[frame.run_offset + lo - 1];
+    uint i = vi - run.vertex_offset;
+    if (i >= run.vertex_count)
+        return 0.0f;
+    return g_bs_delta[run.delta_offset + i].xyz;
 }
 
 
@@ -59,7 +59,8 @@ struct SceneData
     uint light_count;
     float shadow_ray_offset;
     float self_shadow_threshold;
-    float3 pad;
+    uint instance_layer_mask;
+    float2 pad;
 
     CameraData camera;
     LightData lights[kMaxLights];
@@ -92,6 +93,9 @@ float CameraFocalLength()   { return abs(g_scene_data.camera.proj[1][1]); }
 float CameraNearPlane()     { return g_scene_data.camera.near_plane; }
 float CameraFarPlane() { return g_scene_data.camera.far_plane; }
 uint CameraLayerMask() { return g_scene_data.camera.layer_mask; }
+// hardware TLAS nodes can't hold layer masks. only the mask of the whole scene is available.
+// anyhit is needed only if some instances in the scene can be rejected by the ray's layer mask.
+bool NeedsLayerTest(uint ray_layer_mask) { return (g_scene_data.instance_layer_mask & ~ray_layer_mask) != 0; }
 
 uint  RenderFlags()         { return g_scene_data.render_flags; }
 uint  OutputFormat()        { return g_scene_data.output_format; }
@@ -190,7 +194,7 @@ CameraPayload ShootCameraRay(float2 offset = 0.0f)
     uint ray_flags = 0;
     if (render_flags & RF_CULL_BACK_FACES)
         ray_flags |= RAY_FLAG_CULL_BACK_FACING_TRIANGLES;
-    if (CameraLayerMask() != ~0)
+    if (NeedsLayerTest(CameraLayerMask()))
         ray_flags |= RAY_FLAG_FORCE_NON_OPAQUE; // use anyhit
 
     uint layer_mask = CameraLayerMask();
@@ -352,7 +356,7 @@ void ClosestHitCamera(inout CameraPayload payload : SV_RayPayload, in BuiltInTri
 
         uint mask = (instance_flags & IF_RECEIVE_SHADOWS) == 0 ? 0 : (light.layer_mask & CameraLayerMask());
         uint ray_flags = ray_flags_common;
-        if (mask != ~0)
+        if (NeedsLayerTest(mask))
             ray_flags |= RAY_FLAG_FORCE_NON_OPAQUE; // use anyhit
 
         bool hit = true;
@@ -2,6 +2,7 @@
 #ifdef _WIN32
 #include "Foundation/rthsLog.h"
 #include "Foundation/rthsMisc.h"
+#include "Foundation/rthsMatrix.h"
 #include "rthsGfxContextDXR.h"
 #include "rthsDeformerDXR.h"
 
@@ -18,9 +19,16 @@ enum class DeformFlag : uint32_t
 
 struct BlendshapeFrame
 {
-    int delta_offset;
+    int run_offset;
+    int run_count;
     float weight;
 };
+struct BlendshapeRun
+{
+    int vertex_offset;
+    int vertex_count;
+    int delta_offset;
+};
 struct BlendshapeInfo
 {
     int frame_count;
@@ -53,7 +61,7 @@ DeformerDXR::DeformerDXR(ID3D12Device5Ptr device)
     {
         const D3D12_DESCRIPTOR_RANGE ranges[] = {
             { D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 1, 0, 0, D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND },
-            { D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 8, 0, 0, D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND },
+            { D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 9, 0, 0, D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND },
             { D3D12_DESCRIPTOR_RANGE_TYPE_CBV, 1, 0, 0, D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND },
         };
         D3D12_ROOT_PARAMETER param{};
@@ -119,6 +127,14 @@ bool DeformerDXR::prepare(RenderDataDXR& rd)
 }
 
 bool DeformerDXR::deform(RenderDataDXR& rd, MeshInstanceDataDXR& inst_dxr)
+{
+    if (!update(rd, inst_dxr))
+        return false;
+    dispatch(rd, inst_dxr);
+    return true;
+}
+
+bool DeformerDXR::update(RenderDataDXR& rd, MeshInstanceDataDXR& inst_dxr)
 {
     if (!valid() || !inst_dxr.mesh)
         return false;
@@ -161,6 +177,7 @@ bool DeformerDXR::deform(RenderDataDXR& rd, MeshInstanceDataDXR& inst_dxr)
     auto hbone_counts = handle_allocator.allocate();
     auto hbone_weights = handle_allocator.allocate();
     auto hbone_matrices = handle_allocator.allocate();
+    auto hbs_runs = handle_allocator.allocate();
     auto hmesh_info = handle_allocator.allocate();
 
     if (!inst_dxr.deformed_vertices) {
@@ -176,21 +193,46 @@ bool DeformerDXR::deform(RenderDataDXR& rd, MeshInstanceDataDXR& inst_dxr)
 
     // blendshape
     if (blendshape_count > 0) {
-        int frame_count = 0;
-        for (auto& bs : mesh.blendshapes)
+        // deltas are sparse. only runs of non-zero deltas are uploaded
+        int frame_count = 0, run_count = 0, delta_count = 0;
+        for (auto& bs : mesh.blendshapes) {
             frame_count += (int)bs.frames.size();
+            for (auto& frame : bs.frames) {
+                run_count += (int)frame.runs.size();
+                delta_count += (int)frame.delta.size();
+            }
+        }
+        // empty buffers can't be created
+        run_count = std::max(run_count, 1);
+        delta_count = std::max(delta_count, 1);
 
+        // per-mesh resources. other instances of the mesh may be updated in parallel
+        std::unique_lock<std::mutex> mesh_lock(mesh_dxr.deform_mutex);
         if (!mesh_dxr.bs_delta) {
             // delta
-            mesh_dxr.bs_delta = createBuffer(sizeof(float4) * vertex_count * frame_count, kUploadHeapProps);
+            mesh_dxr.bs_delta = createBuffer(sizeof(float4) * delta_count, kUploadHeapProps);
             rthsSetName(mesh_dxr.bs_delta, mesh.name + " Blendshape Delta");
             writeBuffer(mesh_dxr.bs_delta, [&](void *dst_) {
                 auto dst = (float4*)dst_;
                 for (auto& bs : mesh.blendshapes) {
                     for (auto& frame : bs.frames) {
-                        auto& delta = frame.delta;
-                        for (int vi = 0; vi < vertex_count; ++vi)
-                            *dst++ = to_float4(delta[vi], 0.0f);
+                        for (auto& delta : frame.delta)
+                            *dst++ = to_float4(delta, 0.0f);
+                    }
+                }
+            });
+
+            // runs
+            mesh_dxr.bs_runs = createBuffer(sizeof(BlendshapeRun) * run_count, kUploadHeapProps);
+            rthsSetName(mesh_dxr.bs_runs, mesh.name + " Blendshape Runs");
+            writeBuffer(mesh_dxr.bs_runs, [&](void *dst_) {
+                auto dst = (BlendshapeRun*)dst_;
+                int delta_offset = 0;
+                for (auto& bs : mesh.blendshapes) {
+                    for (auto& frame : bs.frames) {
+                        for (auto& run : frame.runs)
+                            *dst++ = { (int)run.vertex_offset, (int)run.vertex_count, delta_offset + (int)run.delta_offset };
+                        delta_offset += (int)frame.delta.size();
                     }
                 }
             });
@@ -204,11 +246,12 @@ bool DeformerDXR::deform(RenderDataDXR& rd, MeshInstanceDataDXR& inst_dxr)
                 for (auto& bs : mesh.blendshapes) {
                     for (auto& frame : bs.frames) {
                         BlendshapeFrame tmp{};
-                        tmp.delta_offset = offset;
+                        tmp.run_offset = offset;
+                        tmp.run_count = (int)frame.runs.size();
                         tmp.weight = frame.weight / 100.0f; // 0-100 -> 0.0-1.0
                         *dst++ = tmp;
 
-                        offset += vertex_count;
+                        offset += tmp.run_count;
                     }
                 }
             });
@@ -229,6 +272,7 @@ bool DeformerDXR::deform(RenderDataDXR& rd, MeshInstanceDataDXR& inst_dxr)
                 }
             });
         }
+        mesh_lock.unlock();
 
         // weights
         {
@@ -249,7 +293,8 @@ bool DeformerDXR::deform(RenderDataDXR& rd, MeshInstanceDataDXR& inst_dxr)
         }
 
         if (update_descriptors) {
-            createSRV(hbs_delta.hcpu, mesh_dxr.bs_delta, vertex_count * frame_count, sizeof(float4));
+            createSRV(hbs_delta.hcpu, mesh_dxr.bs_delta, delta_count, sizeof(float4));
+            createSRV(hbs_runs.hcpu, mesh_dxr.bs_runs, run_count, sizeof(BlendshapeRun));
             createSRV(hbs_frames.hcpu, mesh_dxr.bs_frames, frame_count, sizeof(BlendshapeFrame));
             createSRV(hbs_info.hcpu, mesh_dxr.bs_info, blendshape_count, sizeof(BlendshapeInfo));
             createSRV(hbs_weights.hcpu, inst_dxr.bs_weights, blendshape_count, sizeof(float));
@@ -259,6 +304,7 @@ bool DeformerDXR::deform(RenderDataDXR& rd, MeshInstanceDataDXR& inst_dxr)
     // skinning 
     if (bone_count > 0) {
         // bone counts & weights
+        std::unique_lock<std::mutex> mesh_lock(mesh_dxr.deform_mutex);
         if (!mesh_dxr.bone_counts) {
             mesh_dxr.bone_counts = createBuffer(sizeof(BoneCount) * vertex_count, kUploadHeapProps);
             rthsSetName(mesh_dxr.bone_counts, mesh.name + " Bone Counts");
@@ -284,6 +330,7 @@ bool DeformerDXR::deform(RenderDataDXR& rd, MeshInstanceDataDXR& inst_dxr)
                 }
             });
         }
+        mesh_lock.unlock();
 
         // bone matrices
         {
@@ -301,8 +348,8 @@ bool DeformerDXR::deform(RenderDataDXR& rd, MeshInstanceDataDXR& inst_dxr)
                 // on skinned meshes, inst.transform is root bone's transform or identity if root bone is not assigned.
                 // both cases work, but identity matrix means world space skinning that is not optimal.
                 auto iroot = invert(inst.transform);
-                for (int bi = 0; bi < bone_count; ++bi)
-                    *dst++ = mesh.skin.bindposes[bi] * inst.bones[bi] * iroot;
+                MulMatrices(dst, mesh.skin.bindposes.data(), inst.bones.data(), iroot, bone_count,
+                    !GetGlobals().hasDebugFlag(DebugFlag::NoMatrixAVX));
             });
         }
 
@@ -316,6 +363,7 @@ bool DeformerDXR::deform(RenderDataDXR& rd, MeshInstanceDataDXR& inst_dxr)
 
     // mesh info
     int mesh_info_size = align_to(256, sizeof(MeshInfo));
+    std::unique_lock<std::mutex> mesh_lock(mesh_dxr.deform_mutex);
     if (!mesh_dxr.mesh_info) {
         mesh_dxr.mesh_info = createBuffer(mesh_info_size, kUploadHeapProps);
         rthsSetName(mesh_dxr.mesh_info, mesh.name + " Mesh Info");
@@ -331,10 +379,16 @@ bool DeformerDXR::deform(RenderDataDXR& rd, MeshInstanceDataDXR& inst_dxr)
             *(MeshInfo*)dst_ = info;
         });
     }
+    mesh_lock.unlock();
     if (update_descriptors) {
         createCBV(hmesh_info.hcpu, mesh_dxr.mesh_info, mesh_info_size);
     }
+    return true;
+}
 
+void DeformerDXR::dispatch(RenderDataDXR& rd, MeshInstanceDataDXR& inst_dxr)
+{
+    auto& mesh = *inst_dxr.mesh->base;
     {
         auto& cl = rd.cl_deform;
         cl->SetComputeRootSignature(m_rootsig);
@@ -344,8 +398,6 @@ bool DeformerDXR::deform(RenderDataDXR& rd, MeshInstanceDataDXR& inst_dxr)
         cl->SetComputeRootDescriptorTable(0, inst_dxr.desc_heap->GetGPUDescriptorHandleForHeapStart());
         cl->Dispatch(mesh.vertex_count, 1, 1);
     }
-
-    return true;
 }
 
 uint64_t DeformerDXR::flush(RenderDataDXR& rd)
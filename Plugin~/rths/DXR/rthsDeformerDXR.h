@@ -9,7 +9,12 @@ public:
     ~DeformerDXR();
     bool valid() const;
     bool prepare(RenderDataDXR& rd);
+    // deform() = update() + dispatch().
+    // update() writes deform parameters to buffers and can be called from multiple threads for different instances.
+    // returns false if the instance doesn't need to be deformed. dispatch() records the command and is not thread safe.
     bool deform(RenderDataDXR& rd, MeshInstanceDataDXR& inst);
+    bool update(RenderDataDXR& rd, MeshInstanceDataDXR& inst);
+    void dispatch(RenderDataDXR& rd, MeshInstanceDataDXR& inst);
     uint64_t flush(RenderDataDXR& rd);
     bool reset();
 
@@ -2,6 +2,8 @@
 #ifdef _WIN32
 #include "Foundation/rthsLog.h"
 #include "Foundation/rthsMisc.h"
+#include "Foundation/rthsParallel.h"
+#include "Foundation/rthsConvert.h"
 #include "rthsGfxContextDXR.h"
 #include "rthsResourceTranslatorDXR.h"
 #include "rthsHookDXR.h"
@@ -540,11 +542,6 @@ void GfxContextDXR::prepare(RenderDataDXR& rd)
 
     // reset fence values
     rd.fv_translate = rd.fv_deform = rd.fv_blas = rd.fv_tlas = rd.fv_rays = 0;
-
-    if (m_fv_last_rays != 0) {
-        // wait for complete previous renderer's DispatchRays() because there may be dependencies. (e.g. building BLAS)
-        m_cmd_queue_direct->Wait(m_fence, m_fv_last_rays);
-    }
 }
 
 void GfxContextDXR::setSceneData(RenderDataDXR& rd, SceneData& data)
@@ -655,34 +652,75 @@ void GfxContextDXR::setRenderTarget(RenderDataDXR& rd, RenderTargetData *rt)
 #ifdef rthsEnableRenderTargetValidation
     if (rd.render_target) {
         // fill texture with 0.0-1.0 gradation for debug
-        auto do_fill = [this, &rd](auto& tex, auto&& data) {
-            int n = tex.width * tex.height;
-            float r = 1.0f / (float)(n - 1);
-            data.resize(n);
-            for (int i = 0; i < n; ++i)
-                data[i] = r * (float)i;
-            uploadTexture(tex.resource, data.data(), tex.width, tex.height, tex.format);
-        };
-
         auto& tex = *rd.render_target->texture;
+        int n = tex.width * tex.height;
+        float r = 1.0f / (float)(n - 1);
+        std::vector<float> gradation(n);
+        for (int i = 0; i < n; ++i)
+            gradation[i] = r * (float)i;
+
         switch (GetFloatFormat(tex.format)) {
-        case DXGI_FORMAT_R8_UNORM: do_fill(tex, std::vector<unorm8>()); break;
-        case DXGI_FORMAT_R16_FLOAT: do_fill(tex, std::vector<half>()); break;
-        case DXGI_FORMAT_R32_FLOAT: do_fill(tex, std::vector<float>()); break;
+        case DXGI_FORMAT_R8_UNORM:
+        {
+            std::vector<uint8_t> data(n);
+            ConvertFloatToUnorm8(data.data(), gradation.data(), n);
+            uploadTexture(tex.resource, data.data(), tex.width, tex.height, tex.format);
+            break;
+        }
+        case DXGI_FORMAT_R16_FLOAT:
+        {
+            std::vector<uint16_t> data(n);
+            ConvertFloatToHalf(data.data(), gradation.data(), n);
+            uploadTexture(tex.resource, data.data(), tex.width, tex.height, tex.format);
+            break;
+        }
+        case DXGI_FORMAT_R32_FLOAT:
+            uploadTexture(tex.resource, gradation.data(), tex.width, tex.height, tex.format);
+            break;
         }
     }
 #endif // rthsEnableRenderTargetValidation
 }
 
-void GfxContextDXR::setMeshes(RenderDataDXR& rd, std::vector<MeshInstanceDataPtr>& instances)
+void GfxContextDXR::shareScene(RenderDataDXR& rd, std::vector<MeshInstanceDataPtr>& instances, uint32_t render_flags)
 {
-    if (!valid() || !checkError())
-        return;
-    if (rd.fv_blas != 0 || rd.fv_tlas != 0) {
-        SetErrorLog("GfxContext::setGeometries(): called before prepare()\n");
-        return;
+    // deformation depends on these flags. renderers that disagree can't share the scene pass.
+    const uint32_t deform_flags = (uint32_t)RenderFlag::GPUSkinning | (uint32_t)RenderFlag::ClampBlendShapeWights;
+    if (m_shared_renderer_count++ == 0)
+        m_shared_render_flags = render_flags;
+    else if ((m_shared_render_flags & deform_flags) != (render_flags & deform_flags))
+        m_shared_scene_conflict = true;
+
+    for (auto& inst : instances) {
+        auto& registered = m_shared_mesh_records[inst];
+        if (!registered) {
+            registered = true;
+            m_shared_meshes.push_back(inst);
+        }
     }
+}
 
+void GfxContextDXR::prepareSharedScene()
+{
+    if (valid() && checkError() && !m_shared_meshes.empty() && !m_shared_scene_conflict) {
+        // translate, deform and build BLAS of all renderers' instances at once.
+        // setMeshes() of each renderer then finds nothing to update and builds only its TLAS.
+        auto& rd = m_shared_render_data;
+        if (rd.name.empty())
+            rd.name = "Shared Scene";
+        prepare(rd);
+        rd.render_flags = m_shared_render_flags;
+        updateBLAS(rd, m_shared_meshes);
+    }
+    m_shared_meshes.clear();
+    m_shared_mesh_records.clear();
+    m_shared_renderer_count = 0;
+    m_shared_render_flags = 0;
+    m_shared_scene_conflict = false;
+}
+
+bool GfxContextDXR::updateBLAS(RenderDataDXR& rd, std::vector<MeshInstanceDataPtr>& instances)
+{
     int buffer_update_count = 0;
     auto translate_gpu_buffer = [this, &buffer_update_count](GPUResourcePtr buffer) {
         auto& data = m_buffer_records[buffer];
@@ -802,11 +840,19 @@ void GfxContextDXR::setMeshes(RenderDataDXR& rd, std::vector<MeshInstanceDataPtr
     // deform
     bool gpu_skinning = rd.hasFlag(RenderFlag::GPUSkinning) && m_deformer;
     if (gpu_skinning) {
+        // writing skinning matrices and blendshape weights is done in parallel. only recording commands is serial.
         int deform_count = 0;
+        int num_instances = (int)rd.instances.size();
+        std::vector<char> needs_deform(num_instances);
         m_deformer->prepare(rd);
-        for (auto& inst_dxr : rd.instances) {
-            if (m_deformer->deform(rd, *inst_dxr))
+        parallel_for(0, num_instances, 4, [&](int ii) {
+            needs_deform[ii] = m_deformer->update(rd, *rd.instances[ii]);
+        });
+        for (int ii = 0; ii < num_instances; ++ii) {
+            if (needs_deform[ii]) {
+                m_deformer->dispatch(rd, *rd.instances[ii]);
                 ++deform_count;
+            }
         }
         m_deformer->flush(rd);
     }
@@ -816,7 +862,6 @@ void GfxContextDXR::setMeshes(RenderDataDXR& rd, std::vector<MeshInstanceDataPtr
 
 
     // build BLAS
-    size_t instance_count = rd.instances.size();
     auto cl_blas = m_clm_direct->get();
     rthsTimestampQuery(rd.timestamp, cl_blas, "Building BLAS begin");
     int blas_update_count = 0;
@@ -954,7 +999,27 @@ void GfxContextDXR::setMeshes(RenderDataDXR& rd, std::vector<MeshInstanceDataPtr
 
     rthsTimestampQuery(rd.timestamp, cl_blas, "Building BLAS end");
     cl_blas->Close();
+    if (blas_update_count > 0 && m_fv_last_rays != 0) {
+        // previous renderers' DispatchRays() may be using BLAS that are updated here. wait for them.
+        // the shared scene pass of RenderAll() updates BLAS before any renderer, so renderers don't wait for each other in that case.
+        m_cmd_queue_direct->Wait(m_fence, m_fv_last_rays);
+    }
     rd.fv_blas = submitDirectCommandList(cl_blas, rd.fv_deform);
+    return needs_build_tlas;
+}
+
+void GfxContextDXR::setMeshes(RenderDataDXR& rd, std::vector<MeshInstanceDataPtr>& instances)
+{
+    if (!valid() || !checkError())
+        return;
+    if (rd.fv_blas != 0 || rd.fv_tlas != 0) {
+        SetErrorLog("GfxContext::setGeometries(): called before prepare()\n");
+        return;
+    }
+
+    bool needs_build_tlas = updateBLAS(rd, instances);
+    bool gpu_skinning = rd.hasFlag(RenderFlag::GPUSkinning) && m_deformer;
+    size_t instance_count = rd.instances.size();
 
     if (!needs_build_tlas) {
         // if there are no BLAS updates, check geometry list is the same as last render.
@@ -984,11 +1049,11 @@ void GfxContextDXR::setMeshes(RenderDataDXR& rd, std::vector<MeshInstanceDataPtr
 
         // create instance desc
         {
-            UINT num_descs = 0;
+            UINT num_descs = (UINT)instance_count;
 
             D3D12_RAYTRACING_INSTANCE_DESC *instance_descs;
             td.instance_desc->Map(0, nullptr, (void**)&instance_descs);
-            for (size_t i = 0; i < instance_count; i++) {
+            parallel_for(0, (int)instance_count, 256, [&](int i) {
                 auto& inst_dxr = *rd.instances[i];
                 auto& inst = *inst_dxr.base;
 
@@ -1009,8 +1074,8 @@ void GfxContextDXR::setMeshes(RenderDataDXR& rd, std::vector<MeshInstanceDataPtr
                 if (inst_dxr.base->hasFlag(InstanceFlag::ShadowsOnly))
                     tmp.Flags |= D3D12_RAYTRACING_INSTANCE_FLAG_TRIANGLE_CULL_DISABLE;
                 tmp.AccelerationStructure = blas->GetGPUVirtualAddress();
-                instance_descs[num_descs++] = tmp;
-            }
+                instance_descs[i] = tmp;
+            });
             td.instance_desc->Unmap(0, nullptr);
 
             inputs.NumDescs = num_descs;
@@ -1240,18 +1305,29 @@ bool GfxContextDXR::finish(RenderDataDXR& rd)
 
 #ifdef rthsEnableRenderTargetValidation
         if (rd.render_target) {
-            auto do_readback = [this, &rd](auto& tex, auto&& data) {
-                data.resize(tex.width * tex.height, std::numeric_limits<float>::quiet_NaN());
-                readbackTexture(data.data(), tex.resource, tex.width, tex.height, tex.format);
-                // break here to inspect data
-            };
-
             auto& tex = *rd.render_target->texture;
+            int n = tex.width * tex.height;
+            std::vector<float> data(n, std::numeric_limits<float>::quiet_NaN());
             switch (GetFloatFormat(tex.format)) {
-            case DXGI_FORMAT_R8_UNORM: do_readback(tex, std::vector<unorm8>()); break;
-            case DXGI_FORMAT_R16_FLOAT: do_readback(tex, std::vector<half>()); break;
-            case DXGI_FORMAT_R32_FLOAT: do_readback(tex, std::vector<float>()); break;
+            case DXGI_FORMAT_R8_UNORM:
+            {
+                std::vector<uint8_t> raw(n);
+                readbackTexture(raw.data(), tex.resource, tex.width, tex.height, tex.format);
+                ConvertUnorm8ToFloat(data.data(), raw.data(), n);
+                break;
+            }
+            case DXGI_FORMAT_R16_FLOAT:
+            {
+                std::vector<uint16_t> raw(n);
+                readbackTexture(raw.data(), tex.resource, tex.width, tex.height, tex.format);
+                ConvertHalfToFloat(data.data(), raw.data(), n);
+                break;
+            }
+            case DXGI_FORMAT_R32_FLOAT:
+                readbackTexture(data.data(), tex.resource, tex.width, tex.height, tex.format);
+                break;
             }
+            // break here to inspect data
         }
 #endif // rthsEnableRenderTargetValidation
     }
@@ -1306,6 +1382,7 @@ void GfxContextDXR::clearResourceCache()
     m_mesh_records.clear();
     m_meshinstance_records.clear();
     m_rendertarget_records.clear();
+    m_shared_render_data.clear();
 }
 
 void GfxContextDXR::onMeshDelete(MeshData *mesh)
@@ -20,6 +20,10 @@ public:
     bool setPowerStableState(bool v);
 
     void frameBegin() override;
+    // RenderAll(). shareScene() registers instances of renderers, and prepareSharedScene() translates, deforms and
+    // builds BLAS of them at once. setMeshes() of these renderers then builds only TLAS.
+    void shareScene(RenderDataDXR& rd, std::vector<MeshInstanceDataPtr>& meshes, uint32_t render_flags);
+    void prepareSharedScene() override;
     void prepare(RenderDataDXR& rd);
     void setSceneData(RenderDataDXR& rd, SceneData& data);
     void setRenderTarget(RenderDataDXR& rd, RenderTargetData *rt);
@@ -71,6 +75,8 @@ private:
 
     GfxContextDXR();
     ~GfxContextDXR();
+    // translates buffers, deforms and builds BLAS. returns true if TLAS needs to be rebuilt
+    bool updateBLAS(RenderDataDXR& rd, std::vector<MeshInstanceDataPtr>& meshes);
 
     IResourceTranslatorPtr m_resource_translator;
     DeformerDXRPtr m_deformer;
@@ -96,6 +102,14 @@ private:
     std::map<MeshData*, MeshDataDXRPtr> m_mesh_records;
     std::map<MeshInstanceData*, MeshInstanceDataDXRPtr> m_meshinstance_records;
     std::map<RenderTargetData*, RenderTargetDataDXRPtr> m_rendertarget_records;
+
+    // shared scene pass of RenderAll()
+    RenderDataDXR m_shared_render_data;
+    std::vector<MeshInstanceDataPtr> m_shared_meshes;
+    std::map<MeshInstanceData*, bool> m_shared_mesh_records;
+    int m_shared_renderer_count = 0;
+    uint32_t m_shared_render_flags = 0;
+    bool m_shared_scene_conflict = false;
 };
 
 } // namespace rths
@@ -1,4 +1,5 @@
 #include "pch.h"
+#ifdef _WIN32
 #include "rthsHookDXR.h"
 
 namespace rths {
@@ -128,3 +129,4 @@ bool InstallHook(ID3D12Resource *dst)
 }
 
 } // namespace rths
+#endif // _WIN32
@@ -18,12 +18,16 @@ public:
 
     bool isRendering() const override;
     void frameBegin() override; // called from render thread
+    void shareScene() override; // called from render thread
     void render() override; // called from render thread
     void finish() override; // called from render thread
     void frameEnd() override; // called from render thread
 
     bool readbackRenderTarget(void *dst) override;
+    bool readbackViewRenderTarget(int view, void *dst) override;
     std::string getTimestampLog() override;
+    std::string getMemoryReport() override;
+    bool readbackTileLights(int& tile_size, int& tiles_x, int& tiles_y, uint32_t *dst) override;
     void* getRenderTexturePtr() override;
 
 private:
@@ -92,6 +96,18 @@ void RendererDXR::frameBegin()
     }
 }
 
+void RendererDXR::shareScene()
+{
+    if (!valid() || !m_ready_to_render)
+        return;
+
+    // renderers that are being updated are skipped as render() does
+    if (m_mutex.try_lock()) {
+        GfxContextDXR::getInstance()->shareScene(m_render_data, m_meshes, m_scene_data.render_flags);
+        m_mutex.unlock();
+    }
+}
+
 void RendererDXR::render()
 {
     if (!valid() || !m_ready_to_render)
@@ -99,6 +115,7 @@ void RendererDXR::render()
 
     if (m_mutex.try_lock()) {
         m_is_rendering = true;
+        captureScene();
         auto ctx = GfxContextDXR::getInstance();
         ctx->prepare(m_render_data);
         ctx->setSceneData(m_render_data, m_scene_data);
@@ -133,6 +150,14 @@ bool RendererDXR::readbackRenderTarget(void *dst)
     return ctx->readbackRenderTarget(m_render_data, dst);
 }
 
+bool RendererDXR::readbackViewRenderTarget(int view, void *dst)
+{
+    // multi-view is not supported. only view 0 is rendered
+    if (view != 0)
+        return false;
+    return readbackRenderTarget(dst);
+}
+
 std::string RendererDXR::getTimestampLog()
 {
     std::string ret;
@@ -147,6 +172,18 @@ std::string RendererDXR::getTimestampLog()
     return ret;
 }
 
+std::string RendererDXR::getMemoryReport()
+{
+    // acceleration structures are on GPU and their sizes are up to the driver. not reported.
+    return std::string();
+}
+
+bool RendererDXR::readbackTileLights(int& tile_size, int& tiles_x, int& tiles_y, uint32_t *dst)
+{
+    // lights are not culled per tile on GPU
+    return false;
+}
+
 void* RendererDXR::getRenderTexturePtr()
 {
     if (m_render_data.render_target)
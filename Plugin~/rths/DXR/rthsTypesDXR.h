@@ -138,10 +138,12 @@ public:
     ID3D12ResourcePtr bs_delta;
     ID3D12ResourcePtr bs_frames;
     ID3D12ResourcePtr bs_info;
+    ID3D12ResourcePtr bs_runs;
 
     // skinning data
     ID3D12ResourcePtr bone_counts;
     ID3D12ResourcePtr bone_weights;
+    std::mutex deform_mutex; // guards creation of the above in DeformerDXR::update()
 
     ID3D12ResourcePtr blas; // bottom level acceleration structure
     ID3D12ResourcePtr blas_scratch;
@@ -0,0 +1,162 @@
+#include "pch.h"
+#include "rthsHalf.h"
+#include "rthsConvert.h"
+#include "rthsSIMD.h"
+
+namespace rths {
+
+// SSE2 versions of float_to_half() and half_to_float(). the same operations are done for 4 elements with masks.
+static inline __m128i FloatToHalfSSE2(__m128 v)
+{
+    const __m128i f32_inf = _mm_set1_epi32(255 << 23);
+    const __m128i f16_max = _mm_set1_epi32((127 + 16) << 23);
+    const __m128i denorm_magic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+    const __m128i normal_min = _mm_set1_epi32(113 << 23);
+
+    __m128i n = _mm_castps_si128(v);
+    __m128i sign_bit = _mm_and_si128(n, _mm_set1_epi32(0x80000000));
+    n = _mm_xor_si128(n, sign_bit);
+
+    // signed compares are fine as the sign bit is cleared
+    __m128i is_large = _mm_cmpgt_epi32(n, _mm_sub_epi32(f16_max, _mm_set1_epi32(1)));
+    __m128i is_nan = _mm_cmpgt_epi32(n, f32_inf);
+    __m128i is_small = _mm_cmplt_epi32(n, normal_min);
+
+    __m128i large = _mm_or_si128(_mm_set1_epi32(0x7c00), _mm_and_si128(is_nan, _mm_set1_epi32(0x0200)));
+    __m128i small = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(_mm_castsi128_ps(n), _mm_castsi128_ps(denorm_magic))), denorm_magic);
+    __m128i mantissa_odd = _mm_and_si128(_mm_srli_epi32(n, 13), _mm_set1_epi32(1));
+    __m128i normal = _mm_add_epi32(n, _mm_set1_epi32((int)(((uint32_t)(15 - 127) << 23) + 0xfff)));
+    normal = _mm_srli_epi32(_mm_add_epi32(normal, mantissa_odd), 13);
+
+    __m128i r = _mm_or_si128(_mm_and_si128(is_small, small), _mm_andnot_si128(is_small, normal));
+    r = _mm_or_si128(_mm_and_si128(is_large, large), _mm_andnot_si128(is_large, r));
+    return _mm_or_si128(r, _mm_srli_epi32(sign_bit, 16));
+}
+
+static inline __m128 HalfToFloatSSE2(__m128i v)
+{
+    const __m128i shifted_exponent = _mm_set1_epi32(0x7c00 << 13);
+    const __m128i magic = _mm_set1_epi32(113 << 23);
+
+    __m128i r = _mm_slli_epi32(_mm_and_si128(v, _mm_set1_epi32(0x7fff)), 13);
+    __m128i exponent = _mm_and_si128(r, shifted_exponent);
+    r = _mm_add_epi32(r, _mm_set1_epi32((127 - 15) << 23));
+
+    __m128i is_inf_nan = _mm_cmpeq_epi32(exponent, shifted_exponent);
+    __m128i is_denormal = _mm_cmpeq_epi32(exponent, _mm_setzero_si128());
+    __m128i inf_nan = _mm_add_epi32(r, _mm_set1_epi32((128 - 16) << 23));
+    __m128i denormal = _mm_castps_si128(_mm_sub_ps(_mm_castsi128_ps(_mm_add_epi32(r, _mm_set1_epi32(1 << 23))), _mm_castsi128_ps(magic)));
+
+    r = _mm_or_si128(_mm_and_si128(is_inf_nan, inf_nan), _mm_andnot_si128(is_inf_nan, r));
+    r = _mm_or_si128(_mm_and_si128(is_denormal, denormal), _mm_andnot_si128(is_denormal, r));
+    r = _mm_or_si128(r, _mm_slli_epi32(_mm_and_si128(v, _mm_set1_epi32(0x8000)), 16));
+    return _mm_castsi128_ps(r);
+}
+
+// 32 bit lanes that hold 16 bit values -> 16 bit lanes. sign extension keeps packs from saturating values >= 0x8000
+static inline __m128i Pack16(__m128i a, __m128i b)
+{
+    a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+    b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+    return _mm_packs_epi32(a, b);
+}
+
+void ConvertFloatToHalf(uint16_t *dst, const float *src, size_t n, bool f16c)
+{
+    if (f16c && IsF16CAvailable()) {
+        ConvertFloatToHalfF16C(dst, src, n);
+        return;
+    }
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i a = FloatToHalfSSE2(_mm_loadu_ps(src + i));
+        __m128i b = FloatToHalfSSE2(_mm_loadu_ps(src + i + 4));
+        _mm_storeu_si128((__m128i*)(dst + i), Pack16(a, b));
+    }
+    for (; i < n; ++i)
+        dst[i] = float_to_half(src[i]);
+}
+
+void ConvertHalfToFloat(float *dst, const uint16_t *src, size_t n, bool f16c)
+{
+    if (f16c && IsF16CAvailable()) {
+        ConvertHalfToFloatF16C(dst, src, n);
+        return;
+    }
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_ps(dst + i, HalfToFloatSSE2(_mm_unpacklo_epi16(v, _mm_setzero_si128())));
+        _mm_storeu_ps(dst + i + 4, HalfToFloatSSE2(_mm_unpackhi_epi16(v, _mm_setzero_si128())));
+    }
+    for (; i < n; ++i)
+        dst[i] = half_to_float(src[i]);
+}
+
+void ConvertFloatToUnorm8(uint8_t *dst, const float *src, size_t n)
+{
+    // max(v, 0) returns 0 for NaN as the second operand is returned if either is NaN
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 scale = _mm_set1_ps(255.0f);
+    const __m128 bias = _mm_set1_ps(0.5f);
+    auto convert = [&](const float *s) {
+        __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(s), zero), one);
+        return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, scale), bias));
+    };
+
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_packs_epi32(convert(src + i), convert(src + i + 4));
+        __m128i b = _mm_packs_epi32(convert(src + i + 8), convert(src + i + 12));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(a, b));
+    }
+    for (; i < n; ++i)
+        dst[i] = float_to_unorm8(src[i]);
+}
+
+void ConvertUnorm8ToFloat(float *dst, const uint8_t *src, size_t n)
+{
+    const __m128 scale = _mm_set1_ps(unorm8::R);
+    const __m128i zero = _mm_setzero_si128();
+
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), scale));
+        _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), scale));
+        _mm_storeu_ps(dst + i + 8, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), scale));
+        _mm_storeu_ps(dst + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), scale));
+    }
+    for (; i < n; ++i)
+        dst[i] = (float)src[i] * unorm8::R;
+}
+
+void ConvertBitMaskToPlanes(uint8_t *dst, const uint32_t *src, size_t n, int num_planes)
+{
+    // 16 elements at a time. the bit is moved to the sign bit and expanded to all bits by an arithmetic shift.
+    // then 0 / -1 is packed to 8 bit lanes with saturation.
+    for (int pi = 0; pi < num_planes; ++pi) {
+        uint8_t *plane = dst + n * pi;
+        __m128i shift = _mm_cvtsi32_si128(31 - pi);
+        auto expand = [shift](const uint32_t *s) {
+            __m128i v = _mm_loadu_si128((const __m128i*)s);
+            return _mm_srai_epi32(_mm_sll_epi32(v, shift), 31);
+        };
+
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            __m128i a = _mm_packs_epi32(expand(src + i), expand(src + i + 4));
+            __m128i b = _mm_packs_epi32(expand(src + i + 8), expand(src + i + 12));
+            _mm_storeu_si128((__m128i*)(plane + i), _mm_packs_epi16(a, b));
+        }
+        for (; i < n; ++i)
+            plane[i] = (src[i] & (1u << pi)) != 0 ? 0xff : 0;
+    }
+}
+
+} // namespace rths
@@ -0,0 +1,26 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+// batch versions of float <-> half / unorm8 conversions in rthsHalf.h. results are the same as them.
+// SSE2 is always available on x64. float <-> half use F16C instead if the CPU supports it.
+
+namespace rths {
+
+bool IsF16CAvailable(); // IsF16CSupported(), and rthsConvertF16C.cpp is compiled with F16C enabled
+
+// f16c: use F16C if supported. false to force the SSE2 path
+void ConvertFloatToHalf(uint16_t *dst, const float *src, size_t n, bool f16c = true);
+void ConvertHalfToFloat(float *dst, const uint16_t *src, size_t n, bool f16c = true);
+void ConvertFloatToUnorm8(uint8_t *dst, const float *src, size_t n);
+void ConvertUnorm8ToFloat(float *dst, const uint8_t *src, size_t n);
+
+// OutputFormat::BitMask -> one unorm8 plane per light (0 or 255). plane i has bit i of all elements.
+// dst: num_planes * n elements
+void ConvertBitMaskToPlanes(uint8_t *dst, const uint32_t *src, size_t n, int num_planes);
+
+// F16C paths. valid only if IsF16CAvailable() is true
+void ConvertFloatToHalfF16C(uint16_t *dst, const float *src, size_t n);
+void ConvertHalfToFloatF16C(float *dst, const uint16_t *src, size_t n);
+
+} // namespace rths
@@ -0,0 +1,61 @@
+#include "pch.h"
+#include "rthsHalf.h"
+#include "rthsConvert.h"
+#include "rthsSIMD.h"
+
+// this file must be compiled with AVX enabled (/arch:AVX, or -mavx -mf16c). IsF16CAvailable() returns false otherwise.
+
+namespace rths {
+
+#if defined(__F16C__) || (defined(_MSC_VER) && defined(__AVX__))
+
+bool IsF16CAvailable()
+{
+    static const bool s_available = IsF16CSupported();
+    return s_available;
+}
+
+void ConvertFloatToHalfF16C(uint16_t *dst, const float *src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_loadu_ps(src + i);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+    }
+    for (; i < n; ++i)
+        dst[i] = float_to_half(src[i]);
+}
+
+void ConvertHalfToFloatF16C(float *dst, const uint16_t *src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(v));
+    }
+    for (; i < n; ++i)
+        dst[i] = half_to_float(src[i]);
+}
+
+#else
+
+bool IsF16CAvailable()
+{
+    return false;
+}
+
+void ConvertFloatToHalfF16C(uint16_t *dst, const float *src, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = float_to_half(src[i]);
+}
+
+void ConvertHalfToFloatF16C(float *dst, const uint16_t *src, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = half_to_float(src[i]);
+}
+
+#endif
+
+} // namespace rths
@@ -1,28 +1,83 @@
 #pragma once
 #include <cstdint>
+#include <cstring>
 #include <algorithm>
 
 namespace rths {
 
-inline float clamp01(float v);
+// reinterpret bits as HLSL does
+inline float asfloat(uint32_t v)
+{
+    float r;
+    std::memcpy(&r, &v, sizeof(r));
+    return r;
+}
+inline uint32_t asuint(float v)
+{
+    uint32_t r;
+    std::memcpy(&r, &v, sizeof(r));
+    return r;
+}
+
+// float -> half bits. rounds to nearest even. denormals, Inf and NaN are kept. values out of range become Inf.
+inline uint16_t float_to_half(float v)
+{
+    const uint32_t f32_inf = 255 << 23;
+    const uint32_t f16_max = (127 + 16) << 23; // 65536.0f. values >= this overflow even after rounding is applied
+    const uint32_t denorm_magic = ((127 - 15) + (23 - 10) + 1) << 23;
+
+    uint32_t n = asuint(v);
+    uint32_t sign_bit = n & 0x80000000;
+    n ^= sign_bit;
+
+    uint32_t r;
+    if (n >= f16_max) {
+        r = n > f32_inf ? 0x7e00 : 0x7c00; // NaN : Inf
+    }
+    else if (n < (113 << 23)) {
+        // denormal or zero. the FPU rounds the mantissa by adding the magic number
+        r = asuint(asfloat(n) + asfloat(denorm_magic)) - denorm_magic;
+    }
+    else {
+        uint32_t mantissa_odd = (n >> 13) & 1;
+        n += ((uint32_t)(15 - 127) << 23) + 0xfff;
+        n += mantissa_odd;
+        r = n >> 13;
+    }
+    return (uint16_t)(r | (sign_bit >> 16));
+}
+
+// half bits -> float. exact
+inline float half_to_float(uint16_t v)
+{
+    const uint32_t magic = 113 << 23;
+    const uint32_t shifted_exponent = 0x7c00 << 13;
+
+    uint32_t r = (uint32_t)(v & 0x7fff) << 13;
+    uint32_t exponent = r & shifted_exponent;
+    r += (uint32_t)(127 - 15) << 23;
+    if (exponent == shifted_exponent)
+        r += (uint32_t)(128 - 16) << 23; // Inf / NaN
+    else if (exponent == 0)
+        r = asuint(asfloat(r + (1 << 23)) - asfloat(magic)); // denormal. renormalized by the FPU
+    r |= (uint32_t)(v & 0x8000) << 16;
+    return asfloat(r);
+}
+
+// 0.0f - 1.0f -> 0 - 255. rounds to nearest. NaN becomes 0
+inline uint8_t float_to_unorm8(float v)
+{
+    v = v > 0.0f ? (v < 1.0f ? v : 1.0f) : 0.0f;
+    return (uint8_t)(v * 255.0f + 0.5f);
+}
 
-// note: this half doesn't care about Inf nor NaN. simply round down minor bits of exponent and mantissa.
 struct half
 {
     uint16_t value;
 
     half() {}
     half(const half& v) : value(v.value) {}
-
-    half(float v)
-    {
-        uint32_t n = (uint32_t&)v;
-        uint16_t sign_bit = (n >> 16) & 0x8000;
-        uint16_t exponent = (std::max<int>((n >> 23) - 127 + 15, 0) & 0x1f) << 10;
-        uint16_t mantissa = (n >> (23 - 10)) & 0x3ff;
-
-        value = sign_bit | exponent | mantissa;
-    }
+    half(float v) : value(float_to_half(v)) {}
 
     half& operator=(float v)
     {
@@ -30,15 +85,7 @@ struct half
         return *this;
     }
 
-    operator float() const
-    {
-        uint32_t sign_bit = (value & 0x8000) << 16;
-        uint32_t exponent = ((((value >> 10) & 0x1f) - 15 + 127) & 0xff) << 23;
-        uint32_t mantissa = (value & 0x3ff) << (23 - 10);
-
-        uint32_t r = sign_bit | exponent | mantissa;
-        return (float&)r;
-    }
+    operator float() const { return half_to_float(value); }
 
     static half zero() { return half(0.0f); }
     static half one() { return half(1.0f); }
@@ -54,7 +101,7 @@ struct unorm8
 
     unorm8() {}
     unorm8(const unorm8& v) : value(v.value) {}
-    unorm8(float v) : value(uint8_t(clamp01(v) * C)) {}
+    unorm8(float v) : value(float_to_unorm8(v)) {}
 
     unorm8& operator=(float v)
     {
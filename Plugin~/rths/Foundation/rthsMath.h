@@ -1,5 +1,10 @@
 #pragma once
 #include "rthsHalf.h"
+#include <limits>
+#if defined(_M_X64) || defined(__SSE2__)
+    #include <emmintrin.h>
+    #define rthsMathSSE
+#endif
 
 #define align_to(_alignment, _val) (((_val + _alignment - 1) / _alignment) * _alignment)
 
@@ -202,6 +207,10 @@ inline float3 operator+(const float3& l, const float3& r) { return{ l.x + r.x, l
 inline float3 operator-(const float3& l, const float3& r) { return{ l.x - r.x, l.y - r.y, l.z - r.z }; }
 inline float3 operator*(const float3& l, float r) { return{ l.x * r, l.y * r, l.z * r }; }
 inline float3 operator/(const float3& l, float r) { return{ l.x / r, l.y / r, l.z / r }; }
+inline float3 operator*(const float3& l, const float3& r) { return{ l.x * r.x, l.y * r.y, l.z * r.z }; }
+inline float3 operator/(const float3& l, const float3& r) { return{ l.x / r.x, l.y / r.y, l.z / r.z }; }
+inline float3& operator+=(float3& l, const float3& r) { l = l + r; return l; }
+inline float3& operator*=(float3& l, float r) { l = l * r; return l; }
 
 inline int ceildiv(int v, int d) { return (v + (d - 1)) / d; }
 inline float clamp(float v, float vmin, float vmax) { return std::min<float>(std::max<float>(v, vmin), vmax); }
@@ -211,6 +220,8 @@ inline float dot(const float3& l, const float3& r) { return l.x*r.x + l.y*r.y +
 inline float length_sq(const float3& v) { return dot(v, v); }
 inline float length(const float3& v) { return sqrt(length_sq(v)); }
 inline float3 normalize(const float3& v) { return v / length(v); }
+inline float3 min(const float3& l, const float3& r) { return{ std::min(l.x, r.x), std::min(l.y, r.y), std::min(l.z, r.z) }; }
+inline float3 max(const float3& l, const float3& r) { return{ std::max(l.x, r.x), std::max(l.y, r.y), std::max(l.z, r.z) }; }
 inline float3 cross(const float3& l, const float3& r)
 {
     return{
@@ -229,14 +240,45 @@ inline float4 to_float4(const float3& xyz, float w)
 inline float3x4 to_float3x4(const float4x4& v)
 {
     // copy with transpose
+#ifdef rthsMathSSE
+    __m128 r0 = _mm_loadu_ps(&v[0][0]);
+    __m128 r1 = _mm_loadu_ps(&v[1][0]);
+    __m128 r2 = _mm_loadu_ps(&v[2][0]);
+    __m128 r3 = _mm_loadu_ps(&v[3][0]);
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    float3x4 ret;
+    _mm_storeu_ps(&ret[0][0], r0);
+    _mm_storeu_ps(&ret[1][0], r1);
+    _mm_storeu_ps(&ret[2][0], r2);
+    return ret;
+#else
     return float3x4{ {
         {v[0][0], v[1][0], v[2][0], v[3][0]},
         {v[0][1], v[1][1], v[2][1], v[3][1]},
         {v[0][2], v[1][2], v[2][2], v[3][2]},
     } };
+#endif
 }
 #endif // rthsTestImpl
 
+// row vector convention (same as to_float3x4()): translation is in m[3]
+inline float3 mul_p(const float4x4& m, const float3& v)
+{
+    return{
+        m[0][0] * v.x + m[1][0] * v.y + m[2][0] * v.z + m[3][0],
+        m[0][1] * v.x + m[1][1] * v.y + m[2][1] * v.z + m[3][1],
+        m[0][2] * v.x + m[1][2] * v.y + m[2][2] * v.z + m[3][2],
+    };
+}
+inline float3 mul_v(const float4x4& m, const float3& v)
+{
+    return{
+        m[0][0] * v.x + m[1][0] * v.y + m[2][0] * v.z,
+        m[0][1] * v.x + m[1][1] * v.y + m[2][1] * v.z,
+        m[0][2] * v.x + m[1][2] * v.y + m[2][2] * v.z,
+    };
+}
+
 inline float3 extract_position(const float4x4& m)
 {
     return (const float3&)m[3];
@@ -246,7 +288,8 @@ inline float3 extract_direction(const float4x4& m)
     return normalize((const float3&)m[2]);
 }
 
-inline float4x4 operator*(const float4x4 &a, const float4x4 &b)
+// scalar references of operator*() and invert(). the SSE versions give bitwise identical results
+inline float4x4 mul_scalar(const float4x4 &a, const float4x4 &b)
 {
     float4x4 c;
     const float *ap = &a[0][0];
@@ -296,7 +339,7 @@ inline float4x4 operator*(const float4x4 &a, const float4x4 &b)
     return c;
 }
 
-inline float4x4 invert(const float4x4& x)
+inline float4x4 invert_scalar(const float4x4& x)
 {
     float4x4 s{
         x[1][1] * x[2][2] - x[2][1] * x[1][2],
@@ -348,6 +391,121 @@ inline float4x4 invert(const float4x4& x)
     return s;
 }
 
+#ifdef rthsMathSSE
+// helpers of the SSE paths. they are used by rthsMatrix.cpp too
+namespace sse {
+
+// a * b for a row of a. same operation order as mul_scalar()
+inline __m128 mul_row(const float *a, __m128 b0, __m128 b1, __m128 b2, __m128 b3)
+{
+    __m128 r = _mm_mul_ps(_mm_set1_ps(a[0]), b0);
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[1]), b1));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[2]), b2));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[3]), b3));
+    return r;
+}
+
+inline void mul(float *dst, const float *a, const float *b)
+{
+    __m128 b0 = _mm_loadu_ps(b + 0);
+    __m128 b1 = _mm_loadu_ps(b + 4);
+    __m128 b2 = _mm_loadu_ps(b + 8);
+    __m128 b3 = _mm_loadu_ps(b + 12);
+    // all rows are computed before storing. dst can be a or b
+    __m128 c0 = mul_row(a + 0, b0, b1, b2, b3);
+    __m128 c1 = mul_row(a + 4, b0, b1, b2, b3);
+    __m128 c2 = mul_row(a + 8, b0, b1, b2, b3);
+    __m128 c3 = mul_row(a + 12, b0, b1, b2, b3);
+    _mm_storeu_ps(dst + 0, c0);
+    _mm_storeu_ps(dst + 4, c1);
+    _mm_storeu_ps(dst + 8, c2);
+    _mm_storeu_ps(dst + 12, c3);
+}
+
+// a.yzx * b.zxy - a.zxy * b.yzx
+inline __m128 cross(__m128 a, __m128 b)
+{
+    __m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 a_zxy = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 1, 0, 2));
+    __m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 b_zxy = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 1, 0, 2));
+    return _mm_sub_ps(_mm_mul_ps(a_yzx, b_zxy), _mm_mul_ps(a_zxy, b_yzx));
+}
+
+// same as invert_scalar(): the cofactors of the upper 3x3 are the cross products of its rows
+inline void invert(float *dst, const float *x)
+{
+    const __m128 xyz_mask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+    __m128 r0 = _mm_loadu_ps(x + 0);
+    __m128 r1 = _mm_loadu_ps(x + 4);
+    __m128 r2 = _mm_loadu_ps(x + 8);
+
+    // columns of the adjugate. transposed into rows s0-s2
+    __m128 s0 = cross(r1, r2);
+    __m128 s1 = cross(r2, r0);
+    __m128 s2 = cross(r0, r1);
+    __m128 s3 = _mm_setzero_ps();
+    _MM_TRANSPOSE4_PS(s0, s1, s2, s3);
+
+    // determinant. x00 * s00 + x01 * s10 + x02 * s20
+    float r = x[0] * _mm_cvtss_f32(s0) + x[1] * _mm_cvtss_f32(s1) + x[2] * _mm_cvtss_f32(s2);
+
+    if (!(std::abs(r) >= 1)) {
+        // the result is identity if any element of the adjugate doesn't fit in the float range after division
+        __m128 mr = _mm_set1_ps(std::abs(r) / std::numeric_limits<float>::min());
+        __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+        __m128 ok = _mm_and_ps(_mm_cmpgt_ps(mr, _mm_and_ps(s0, abs_mask)), _mm_cmpgt_ps(mr, _mm_and_ps(s1, abs_mask)));
+        ok = _mm_and_ps(ok, _mm_cmpgt_ps(mr, _mm_and_ps(s2, abs_mask)));
+        if ((_mm_movemask_ps(ok) & 0x7) != 0x7) {
+            static const float identity[16] = { 1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1 };
+            memcpy(dst, identity, sizeof(identity));
+            return;
+        }
+    }
+    // w stays +0 (0 / negative r would be -0)
+    __m128 rv = _mm_set1_ps(r);
+    s0 = _mm_and_ps(_mm_div_ps(s0, rv), xyz_mask);
+    s1 = _mm_and_ps(_mm_div_ps(s1, rv), xyz_mask);
+    s2 = _mm_and_ps(_mm_div_ps(s2, rv), xyz_mask);
+
+    // translation. -x30 * s0 - x31 * s1 - x32 * s2
+    __m128 t = _mm_mul_ps(_mm_set1_ps(-x[12]), s0);
+    t = _mm_sub_ps(t, _mm_mul_ps(_mm_set1_ps(x[13]), s1));
+    t = _mm_sub_ps(t, _mm_mul_ps(_mm_set1_ps(x[14]), s2));
+    t = _mm_or_ps(_mm_and_ps(t, xyz_mask), _mm_setr_ps(0, 0, 0, 1));
+
+    _mm_storeu_ps(dst + 0, s0);
+    _mm_storeu_ps(dst + 4, s1);
+    _mm_storeu_ps(dst + 8, s2);
+    _mm_storeu_ps(dst + 12, t);
+}
+
+} // namespace sse
+#endif // rthsMathSSE
+
+inline float4x4 operator*(const float4x4 &a, const float4x4 &b)
+{
+#ifdef rthsMathSSE
+    float4x4 c;
+    sse::mul(&c[0][0], &a[0][0], &b[0][0]);
+    return c;
+#else
+    return mul_scalar(a, b);
+#endif
+}
+
+// affine only: the upper 3x3 is inverted and the translation is transformed by it. returns identity if it's singular
+inline float4x4 invert(const float4x4& x)
+{
+#ifdef rthsMathSSE
+    float4x4 s;
+    sse::invert(&s[0][0], &x[0][0]);
+    return s;
+#else
+    return invert_scalar(x);
+#endif
+}
+
 inline float4x4 perspective(float fovy, float aspect, float znear, float zfar)
 {
     float radians = (fovy / 2.0f) * DegToRad;
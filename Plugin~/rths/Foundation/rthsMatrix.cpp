@@ -0,0 +1,106 @@
+#include "pch.h"
+#include "rthsMatrix.h"
+#include "rthsSIMD.h"
+
+namespace rths {
+
+// 4 points at once in SoA, with the same shuffles as each 128 bit lane of TransformAVX() in rthsMatrixAVX.cpp.
+// x * m0 + y * m1 + z * m2 (+ m3). same operation order as mul_p() / mul_v()
+template<bool Point>
+static inline void TransformSSE(float3 *dst, const float3 *src, const float4x4& m, size_t n)
+{
+    __m128 m00 = _mm_set1_ps(m[0][0]), m01 = _mm_set1_ps(m[0][1]), m02 = _mm_set1_ps(m[0][2]);
+    __m128 m10 = _mm_set1_ps(m[1][0]), m11 = _mm_set1_ps(m[1][1]), m12 = _mm_set1_ps(m[1][2]);
+    __m128 m20 = _mm_set1_ps(m[2][0]), m21 = _mm_set1_ps(m[2][1]), m22 = _mm_set1_ps(m[2][2]);
+    __m128 m30 = _mm_set1_ps(m[3][0]), m31 = _mm_set1_ps(m[3][1]), m32 = _mm_set1_ps(m[3][2]);
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const float *s = &src[i].x;
+        // [x0 y0 z0 x1] [y1 z1 x2 y2] [z2 x3 y3 z3]
+        __m128 m0 = _mm_loadu_ps(s + 0);
+        __m128 m1 = _mm_loadu_ps(s + 4);
+        __m128 m2 = _mm_loadu_ps(s + 8);
+        __m128 xy = _mm_shuffle_ps(m1, m2, _MM_SHUFFLE(2, 1, 3, 2));
+        __m128 yz = _mm_shuffle_ps(m0, m1, _MM_SHUFFLE(1, 0, 2, 1));
+        __m128 x = _mm_shuffle_ps(m0, xy, _MM_SHUFFLE(2, 0, 3, 0));
+        __m128 y = _mm_shuffle_ps(yz, xy, _MM_SHUFFLE(3, 1, 2, 0));
+        __m128 z = _mm_shuffle_ps(yz, m2, _MM_SHUFFLE(3, 0, 3, 1));
+
+        __m128 rx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m00, x), _mm_mul_ps(m10, y)), _mm_mul_ps(m20, z));
+        __m128 ry = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m01, x), _mm_mul_ps(m11, y)), _mm_mul_ps(m21, z));
+        __m128 rz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m02, x), _mm_mul_ps(m12, y)), _mm_mul_ps(m22, z));
+        if (Point) {
+            rx = _mm_add_ps(rx, m30);
+            ry = _mm_add_ps(ry, m31);
+            rz = _mm_add_ps(rz, m32);
+        }
+
+        __m128 rxy = _mm_shuffle_ps(rx, ry, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 ryz = _mm_shuffle_ps(ry, rz, _MM_SHUFFLE(3, 1, 3, 1));
+        __m128 rzx = _mm_shuffle_ps(rz, rx, _MM_SHUFFLE(3, 1, 2, 0));
+        float *d = &dst[i].x;
+        _mm_storeu_ps(d + 0, _mm_shuffle_ps(rxy, rzx, _MM_SHUFFLE(2, 0, 2, 0)));
+        _mm_storeu_ps(d + 4, _mm_shuffle_ps(ryz, rxy, _MM_SHUFFLE(3, 1, 2, 0)));
+        _mm_storeu_ps(d + 8, _mm_shuffle_ps(rzx, ryz, _MM_SHUFFLE(3, 1, 3, 1)));
+    }
+    for (; i < n; ++i)
+        dst[i] = Point ? mul_p(m, src[i]) : mul_v(m, src[i]);
+}
+
+void MulMatrices(float4x4 *dst, const float4x4 *a, const float4x4 *b, size_t n, bool avx)
+{
+    if (avx && IsMatrixAVXAvailable()) {
+        MulMatricesAVX(dst, a, b, n);
+        return;
+    }
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = a[i] * b[i];
+}
+
+void MulMatrices(float4x4 *dst, const float4x4 *a, const float4x4& b, size_t n, bool avx)
+{
+    if (avx && IsMatrixAVXAvailable()) {
+        MulMatricesAVX(dst, a, b, n);
+        return;
+    }
+    float4x4 tb = b; // b can be an element of dst
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = a[i] * tb;
+}
+
+void MulMatrices(float4x4 *dst, const float4x4 *a, const float4x4 *b, const float4x4& c, size_t n, bool avx)
+{
+    if (avx && IsMatrixAVXAvailable()) {
+        MulMatricesAVX(dst, a, b, c, n);
+        return;
+    }
+    float4x4 tc = c;
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = a[i] * b[i] * tc;
+}
+
+void InvertAffine(float4x4 *dst, const float4x4 *src, size_t n)
+{
+    // the division and the range check don't gain from wider registers. SSE for all CPUs
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = invert(src[i]);
+}
+
+void TransformPoints(float3 *dst, const float3 *src, const float4x4& m, size_t n, bool avx)
+{
+    if (avx && IsMatrixAVXAvailable())
+        TransformPointsAVX(dst, src, m, n);
+    else
+        TransformSSE<true>(dst, src, m, n);
+}
+
+void TransformVectors(float3 *dst, const float3 *src, const float4x4& m, size_t n, bool avx)
+{
+    if (avx && IsMatrixAVXAvailable())
+        TransformVectorsAVX(dst, src, m, n);
+    else
+        TransformSSE<false>(dst, src, m, n);
+}
+
+} // namespace rths
@@ -0,0 +1,32 @@
+#pragma once
+#include "rthsMath.h"
+
+// batch versions of float4x4 operations in rthsMath.h. results are bitwise identical to them.
+// SSE2 is always available on x64. multiplications and transforms use AVX instead if the CPU supports it (no FMA to keep the results identical).
+// dst can be the same as a source in all functions.
+
+namespace rths {
+
+bool IsMatrixAVXAvailable(); // IsAVXSupported(), and rthsMatrixAVX.cpp is compiled with AVX enabled
+
+// avx: use AVX if supported. false to force the SSE2 path
+// dst[i] = a[i] * b[i]
+void MulMatrices(float4x4 *dst, const float4x4 *a, const float4x4 *b, size_t n, bool avx = true);
+// dst[i] = a[i] * b
+void MulMatrices(float4x4 *dst, const float4x4 *a, const float4x4& b, size_t n, bool avx = true);
+// dst[i] = a[i] * b[i] * c. e.g. bindpose * bone * inverse of the root (skinning matrices)
+void MulMatrices(float4x4 *dst, const float4x4 *a, const float4x4 *b, const float4x4& c, size_t n, bool avx = true);
+// dst[i] = invert(src[i]). affine matrices only, same as invert()
+void InvertAffine(float4x4 *dst, const float4x4 *src, size_t n);
+// dst[i] = mul_p(m, src[i]) / mul_v(m, src[i])
+void TransformPoints(float3 *dst, const float3 *src, const float4x4& m, size_t n, bool avx = true);
+void TransformVectors(float3 *dst, const float3 *src, const float4x4& m, size_t n, bool avx = true);
+
+// AVX paths. valid only if IsMatrixAVXAvailable() is true
+void MulMatricesAVX(float4x4 *dst, const float4x4 *a, const float4x4 *b, size_t n);
+void MulMatricesAVX(float4x4 *dst, const float4x4 *a, const float4x4& b, size_t n);
+void MulMatricesAVX(float4x4 *dst, const float4x4 *a, const float4x4 *b, const float4x4& c, size_t n);
+void TransformPointsAVX(float3 *dst, const float3 *src, const float4x4& m, size_t n);
+void TransformVectorsAVX(float3 *dst, const float3 *src, const float4x4& m, size_t n);
+
+} // namespace rths
@@ -0,0 +1,195 @@
+#include "pch.h"
+#include "rthsMatrix.h"
+#include "rthsSIMD.h"
+
+// this file must be compiled with AVX enabled (/arch:AVX or -mavx), but without FMA. IsMatrixAVXAvailable() returns false otherwise.
+
+namespace rths {
+
+#if defined(__AVX__)
+
+bool IsMatrixAVXAvailable()
+{
+    static const bool s_available = IsAVXSupported();
+    return s_available;
+}
+
+// two rows of a * b at once. the lanes of each half are the same operations as sse::mul_row()
+static inline __m256 MulRows2(__m256 a, __m256 b0, __m256 b1, __m256 b2, __m256 b3)
+{
+    __m256 r = _mm256_mul_ps(_mm256_permute_ps(a, 0x00), b0);
+    r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_permute_ps(a, 0x55), b1));
+    r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_permute_ps(a, 0xaa), b2));
+    r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_permute_ps(a, 0xff), b3));
+    return r;
+}
+
+struct MatrixRowsAVX
+{
+    __m256 r0, r1, r2, r3; // each row broadcast to both halves
+
+    void load(const float4x4& m)
+    {
+        r0 = _mm256_broadcast_ps((const __m128*)&m[0]);
+        r1 = _mm256_broadcast_ps((const __m128*)&m[1]);
+        r2 = _mm256_broadcast_ps((const __m128*)&m[2]);
+        r3 = _mm256_broadcast_ps((const __m128*)&m[3]);
+    }
+};
+
+void MulMatricesAVX(float4x4 *dst, const float4x4 *a, const float4x4 *b, size_t n)
+{
+    MatrixRowsAVX mb;
+    for (size_t i = 0; i < n; ++i) {
+        __m256 a01 = _mm256_loadu_ps(&a[i][0][0]);
+        __m256 a23 = _mm256_loadu_ps(&a[i][2][0]);
+        mb.load(b[i]);
+        __m256 c01 = MulRows2(a01, mb.r0, mb.r1, mb.r2, mb.r3);
+        __m256 c23 = MulRows2(a23, mb.r0, mb.r1, mb.r2, mb.r3);
+        _mm256_storeu_ps(&dst[i][0][0], c01);
+        _mm256_storeu_ps(&dst[i][2][0], c23);
+    }
+}
+
+void MulMatricesAVX(float4x4 *dst, const float4x4 *a, const float4x4& b, size_t n)
+{
+    MatrixRowsAVX mb;
+    mb.load(b);
+    for (size_t i = 0; i < n; ++i) {
+        __m256 a01 = _mm256_loadu_ps(&a[i][0][0]);
+        __m256 a23 = _mm256_loadu_ps(&a[i][2][0]);
+        _mm256_storeu_ps(&dst[i][0][0], MulRows2(a01, mb.r0, mb.r1, mb.r2, mb.r3));
+        _mm256_storeu_ps(&dst[i][2][0], MulRows2(a23, mb.r0, mb.r1, mb.r2, mb.r3));
+    }
+}
+
+void MulMatricesAVX(float4x4 *dst, const float4x4 *a, const float4x4 *b, const float4x4& c, size_t n)
+{
+    MatrixRowsAVX mb, mc;
+    mc.load(c);
+    for (size_t i = 0; i < n; ++i) {
+        __m256 a01 = _mm256_loadu_ps(&a[i][0][0]);
+        __m256 a23 = _mm256_loadu_ps(&a[i][2][0]);
+        mb.load(b[i]);
+        // (a * b) * c, kept in registers
+        __m256 t01 = MulRows2(a01, mb.r0, mb.r1, mb.r2, mb.r3);
+        __m256 t23 = MulRows2(a23, mb.r0, mb.r1, mb.r2, mb.r3);
+        _mm256_storeu_ps(&dst[i][0][0], MulRows2(t01, mc.r0, mc.r1, mc.r2, mc.r3));
+        _mm256_storeu_ps(&dst[i][2][0], MulRows2(t23, mc.r0, mc.r1, mc.r2, mc.r3));
+    }
+}
+
+// 8 points at once in SoA. the loads and stores deinterleave / interleave xyz with shuffles
+template<bool Point>
+static inline void TransformAVX(float3 *dst, const float3 *src, const float4x4& m, size_t n)
+{
+    __m256 m00 = _mm256_set1_ps(m[0][0]), m01 = _mm256_set1_ps(m[0][1]), m02 = _mm256_set1_ps(m[0][2]);
+    __m256 m10 = _mm256_set1_ps(m[1][0]), m11 = _mm256_set1_ps(m[1][1]), m12 = _mm256_set1_ps(m[1][2]);
+    __m256 m20 = _mm256_set1_ps(m[2][0]), m21 = _mm256_set1_ps(m[2][1]), m22 = _mm256_set1_ps(m[2][2]);
+    __m256 m30 = _mm256_set1_ps(m[3][0]), m31 = _mm256_set1_ps(m[3][1]), m32 = _mm256_set1_ps(m[3][2]);
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const float *s = &src[i].x;
+        // [x0 y0 z0 x1] [y1 z1 x2 y2] [z2 x3 y3 z3], points 4-7 in the upper halves
+        __m256 m03 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(s + 0)), _mm_loadu_ps(s + 12), 1);
+        __m256 m14 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(s + 4)), _mm_loadu_ps(s + 16), 1);
+        __m256 m25 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(s + 8)), _mm_loadu_ps(s + 20), 1);
+        __m256 xy = _mm256_shuffle_ps(m14, m25, _MM_SHUFFLE(2, 1, 3, 2));
+        __m256 yz = _mm256_shuffle_ps(m03, m14, _MM_SHUFFLE(1, 0, 2, 1));
+        __m256 x = _mm256_shuffle_ps(m03, xy, _MM_SHUFFLE(2, 0, 3, 0));
+        __m256 y = _mm256_shuffle_ps(yz, xy, _MM_SHUFFLE(3, 1, 2, 0));
+        __m256 z = _mm256_shuffle_ps(yz, m25, _MM_SHUFFLE(3, 0, 3, 1));
+
+        __m256 rx = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m00, x), _mm256_mul_ps(m10, y)), _mm256_mul_ps(m20, z));
+        __m256 ry = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m01, x), _mm256_mul_ps(m11, y)), _mm256_mul_ps(m21, z));
+        __m256 rz = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m02, x), _mm256_mul_ps(m12, y)), _mm256_mul_ps(m22, z));
+        if (Point) {
+            rx = _mm256_add_ps(rx, m30);
+            ry = _mm256_add_ps(ry, m31);
+            rz = _mm256_add_ps(rz, m32);
+        }
+
+        __m256 rxy = _mm256_shuffle_ps(rx, ry, _MM_SHUFFLE(2, 0, 2, 0));
+        __m256 ryz = _mm256_shuffle_ps(ry, rz, _MM_SHUFFLE(3, 1, 3, 1));
+        __m256 rzx = _mm256_shuffle_ps(rz, rx, _MM_SHUFFLE(3, 1, 2, 0));
+        __m256 r03 = _mm256_shuffle_ps(rxy, rzx, _MM_SHUFFLE(2, 0, 2, 0));
+        __m256 r14 = _mm256_shuffle_ps(ryz, rxy, _MM_SHUFFLE(3, 1, 2, 0));
+        __m256 r25 = _mm256_shuffle_ps(rzx, ryz, _MM_SHUFFLE(3, 1, 3, 1));
+        float *d = &dst[i].x;
+        _mm_storeu_ps(d + 0, _mm256_castps256_ps128(r03));
+        _mm_storeu_ps(d + 4, _mm256_castps256_ps128(r14));
+        _mm_storeu_ps(d + 8, _mm256_castps256_ps128(r25));
+        _mm_storeu_ps(d + 12, _mm256_extractf128_ps(r03, 1));
+        _mm_storeu_ps(d + 16, _mm256_extractf128_ps(r14, 1));
+        _mm_storeu_ps(d + 20, _mm256_extractf128_ps(r25, 1));
+    }
+    // the rest. same operations as mul_p() / mul_v(), written here to keep AVX code out of the inline functions of rthsMath.h
+    for (; i < n; ++i) {
+        float3 v = src[i];
+        float3 r{
+            m[0][0] * v.x + m[1][0] * v.y + m[2][0] * v.z,
+            m[0][1] * v.x + m[1][1] * v.y + m[2][1] * v.z,
+            m[0][2] * v.x + m[1][2] * v.y + m[2][2] * v.z,
+        };
+        if (Point) {
+            r.x += m[3][0];
+            r.y += m[3][1];
+            r.z += m[3][2];
+        }
+        dst[i] = r;
+    }
+}
+
+void TransformPointsAVX(float3 *dst, const float3 *src, const float4x4& m, size_t n)
+{
+    TransformAVX<true>(dst, src, m, n);
+}
+
+void TransformVectorsAVX(float3 *dst, const float3 *src, const float4x4& m, size_t n)
+{
+    TransformAVX<false>(dst, src, m, n);
+}
+
+#else
+
+bool IsMatrixAVXAvailable()
+{
+    return false;
+}
+
+void MulMatricesAVX(float4x4 *dst, const float4x4 *a, const float4x4 *b, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = a[i] * b[i];
+}
+
+void MulMatricesAVX(float4x4 *dst, const float4x4 *a, const float4x4& b, size_t n)
+{
+    float4x4 tb = b;
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = a[i] * tb;
+}
+
+void MulMatricesAVX(float4x4 *dst, const float4x4 *a, const float4x4 *b, const float4x4& c, size_t n)
+{
+    float4x4 tc = c;
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = a[i] * b[i] * tc;
+}
+
+void TransformPointsAVX(float3 *dst, const float3 *src, const float4x4& m, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = mul_p(m, src[i]);
+}
+
+void TransformVectorsAVX(float3 *dst, const float3 *src, const float4x4& m, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = mul_v(m, src[i]);
+}
+
+#endif
+
+} // namespace rths
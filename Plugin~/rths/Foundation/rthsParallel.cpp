@@ -0,0 +1,255 @@
+#include "pch.h"
+#include "rthsParallel.h"
+
+namespace rths {
+
+// index of the queue of the current thread. 0 for threads that are not workers.
+static thread_local int g_queue_index = 0;
+// nesting level of tasks in the current thread. busy time is measured only at the outermost level.
+static thread_local int g_task_depth = 0;
+
+JobSystem& JobSystem::getInstance()
+{
+    static JobSystem s_instance;
+    return s_instance;
+}
+
+JobSystem::JobSystem()
+{
+    setThreadCount(0);
+}
+
+JobSystem::~JobSystem()
+{
+    stopWorkers();
+}
+
+void JobSystem::setThreadCount(int n)
+{
+    if (g_queue_index != 0)
+        return; // called from a worker. stopping workers would deadlock.
+
+    std::unique_lock<std::mutex> l(m_config_mutex);
+    if (n <= 0)
+        n = std::max<int>(std::thread::hardware_concurrency(), 1);
+    // the calling thread of TaskGroup::wait() works too. so n - 1 workers are enough.
+    int num_workers = std::min(std::max(n - 1, 0), kMaxThreads - 1);
+    if (num_workers == m_worker_count)
+        return;
+    stopWorkers();
+    startWorkers(num_workers);
+}
+
+int JobSystem::getThreadCount() const
+{
+    return m_worker_count + 1;
+}
+
+int JobSystem::getWorkerCount() const
+{
+    return m_worker_count;
+}
+
+std::vector<WorkerStats> JobSystem::getStats() const
+{
+    std::vector<WorkerStats> ret(m_worker_count + 1);
+    for (size_t qi = 0; qi < ret.size(); ++qi) {
+        auto& q = m_queues[qi];
+        auto& dst = ret[qi];
+        dst.task_count = q.task_count;
+        dst.steal_count = q.steal_count;
+        dst.busy_time = q.busy_time;
+    }
+    return ret;
+}
+
+void JobSystem::resetStats()
+{
+    for (auto& q : m_queues) {
+        q.task_count = 0;
+        q.steal_count = 0;
+        q.busy_time = 0;
+    }
+}
+
+void JobSystem::enqueue(TaskGroup *group, std::function<void()>&& body)
+{
+    ++group->m_pending;
+    {
+        auto& q = m_queues[g_queue_index];
+        std::unique_lock<std::mutex> l(q.mutex);
+        ++m_queued;
+        q.tasks.push_back({ group, std::move(body) });
+        ++q.size;
+    }
+    // workers increment m_sleeping before checking m_queued. so either they see the new task or we see them.
+    if (m_sleeping > 0) {
+        std::unique_lock<std::mutex> l(m_sleep_mutex);
+        m_sleep_cond.notify_one();
+    }
+}
+
+bool JobSystem::executeOne()
+{
+    int qi = g_queue_index;
+    Task task;
+    if (pop(qi, task)) {
+        execute(qi, task, false);
+        return true;
+    }
+    if (steal(qi, task)) {
+        execute(qi, task, true);
+        return true;
+    }
+    return false;
+}
+
+void JobSystem::startWorkers(int n)
+{
+    m_stop = false;
+    for (int i = 0; i < n; ++i) {
+        int qi = i + 1;
+        m_workers.emplace_back([this, qi]() { workerMain(qi); });
+    }
+    m_worker_count = n;
+}
+
+void JobSystem::stopWorkers()
+{
+    {
+        std::unique_lock<std::mutex> l(m_sleep_mutex);
+        m_stop = true;
+    }
+    m_sleep_cond.notify_all();
+    for (auto& t : m_workers)
+        t.join();
+    m_workers.clear();
+    m_worker_count = 0;
+}
+
+void JobSystem::workerMain(int qi)
+{
+    g_queue_index = qi;
+    for (;;) {
+        if (executeOne())
+            continue;
+
+        std::unique_lock<std::mutex> l(m_sleep_mutex);
+        ++m_sleeping;
+        m_sleep_cond.wait(l, [this]() { return m_queued > 0 || m_stop; });
+        --m_sleeping;
+        // remaining tasks are done before exit
+        if (m_stop && m_queued == 0)
+            break;
+    }
+}
+
+bool JobSystem::pop(int qi, Task& dst)
+{
+    auto& q = m_queues[qi];
+    if (q.size == 0)
+        return false;
+
+    std::unique_lock<std::mutex> l(q.mutex);
+    if (q.tasks.empty())
+        return false;
+    dst = std::move(q.tasks.back());
+    q.tasks.pop_back();
+    --q.size;
+    --m_queued;
+    return true;
+}
+
+bool JobSystem::steal(int qi, Task& dst)
+{
+    if (m_queued == 0)
+        return false;
+
+    // queues of workers that have been stopped are always empty. so up to the current worker count is enough.
+    int num_queues = m_worker_count + 1;
+    for (int i = 1; i < num_queues; ++i) {
+        auto& q = m_queues[(qi + i) % num_queues];
+        if (q.size == 0)
+            continue;
+
+        std::unique_lock<std::mutex> l(q.mutex);
+        if (q.tasks.empty())
+            continue;
+        dst = std::move(q.tasks.front());
+        q.tasks.pop_front();
+        --q.size;
+        --m_queued;
+        return true;
+    }
+    return false;
+}
+
+void JobSystem::execute(int qi, Task& task, bool stolen)
+{
+    auto& q = m_queues[qi];
+    nanosec begin = g_task_depth == 0 ? Now() : 0;
+    ++g_task_depth;
+    task.body();
+    --g_task_depth;
+    if (g_task_depth == 0)
+        q.busy_time += Now() - begin;
+    ++q.task_count;
+    if (stolen)
+        ++q.steal_count;
+
+    // release captures before the group is notified. the owner of the group may return right after that.
+    task.body = nullptr;
+    task.group->onTaskDone();
+}
+
+
+TaskGroup::TaskGroup()
+{
+}
+
+TaskGroup::~TaskGroup()
+{
+    wait();
+}
+
+void TaskGroup::run(std::function<void()>&& body)
+{
+    JobSystem::getInstance().enqueue(this, std::move(body));
+}
+
+void TaskGroup::wait()
+{
+    auto& js = JobSystem::getInstance();
+    int spin = 0;
+    while (m_pending > 0) {
+        if (js.executeOne()) {
+            spin = 0;
+            continue;
+        }
+        // remaining tasks are running on other threads
+        if (++spin < 64) {
+            std::this_thread::yield();
+        }
+        else {
+            // wake up periodically to help with tasks that are queued in the meantime
+            std::unique_lock<std::mutex> l(m_mutex);
+            m_cond.wait_for(l, std::chrono::microseconds(100), [this]() { return m_pending == 0; });
+        }
+    }
+    // onTaskDone() may still hold the mutex. wait for it before this group can be destroyed.
+    std::unique_lock<std::mutex> l(m_mutex);
+}
+
+bool TaskGroup::done() const
+{
+    return m_pending == 0;
+}
+
+void TaskGroup::onTaskDone()
+{
+    std::unique_lock<std::mutex> l(m_mutex);
+    if (--m_pending == 0)
+        m_cond.notify_all();
+}
+
+} // namespace rths
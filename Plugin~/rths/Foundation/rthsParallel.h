@@ -0,0 +1,155 @@
+#pragma once
+#include "rthsMath.h"
+#include "rthsMisc.h"
+
+namespace rths {
+
+struct WorkerStats
+{
+    uint32_t task_count;  // tasks executed
+    uint32_t steal_count; // tasks taken from queues of other threads
+    nanosec busy_time;    // time spent in tasks
+};
+
+class TaskGroup;
+
+// work-stealing scheduler.
+// each worker thread has its own task queue. a worker pushes and pops its own tasks at the back (LIFO),
+// and steals from the front of other queues (FIFO) when its queue is empty. threads that are not workers
+// (e.g. the render thread) share one extra queue. they execute tasks too while waiting in TaskGroup::wait().
+class JobSystem
+{
+public:
+    static const int kMaxThreads = 64;
+
+    static JobSystem& getInstance();
+
+    JobSystem();
+    ~JobSystem();
+
+    // number of threads that execute tasks, including the calling thread of TaskGroup::wait().
+    // 0: std::thread::hardware_concurrency(). 1: no worker threads. tasks are executed in TaskGroup::wait().
+    // this waits for all queued tasks. must not be called from tasks.
+    void setThreadCount(int n);
+    int getThreadCount() const;
+    int getWorkerCount() const;
+
+    // [0]: threads that are not workers. [1...]: workers
+    std::vector<WorkerStats> getStats() const;
+    void resetStats();
+
+    void enqueue(TaskGroup *group, std::function<void()>&& body);
+    // executes one queued task if any. returns false if there is no task.
+    bool executeOne();
+
+private:
+    struct Task
+    {
+        TaskGroup *group;
+        std::function<void()> body;
+    };
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        std::atomic_int size{ 0 }; // to skip empty queues without locking
+
+        std::atomic_uint32_t task_count{ 0 };
+        std::atomic_uint32_t steal_count{ 0 };
+        std::atomic_uint64_t busy_time{ 0 };
+    };
+
+    void startWorkers(int n);
+    void stopWorkers();
+    void workerMain(int qi);
+    bool pop(int qi, Task& dst);
+    bool steal(int qi, Task& dst);
+    void execute(int qi, Task& task, bool stolen);
+
+    Queue m_queues[kMaxThreads];
+    std::vector<std::thread> m_workers;
+    std::atomic_int m_worker_count{ 0 };
+    std::atomic_int m_queued{ 0 };   // number of tasks in all queues
+    std::atomic_int m_sleeping{ 0 }; // number of idle workers
+    std::atomic_bool m_stop{ false };
+    std::mutex m_sleep_mutex;
+    std::condition_variable m_sleep_cond;
+    std::mutex m_config_mutex;
+};
+
+// set of tasks that can be waited for together. tasks can run() more tasks into the same group.
+// the destructor waits for remaining tasks.
+class TaskGroup
+{
+public:
+    TaskGroup();
+    ~TaskGroup();
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    void run(std::function<void()>&& body);
+    // the calling thread executes queued tasks (of any group) until all tasks of this group are done.
+    void wait();
+    bool done() const;
+
+private:
+    friend class JobSystem;
+    void onTaskDone();
+
+    std::atomic_int m_pending{ 0 };
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+};
+
+
+template<class Body>
+inline void parallel_for_chunks(TaskGroup& group, int chunk_begin, int chunk_end, const Body& body)
+{
+    // split the range in half and leave the second half to thieves until one chunk remains.
+    // idle workers steal the largest pieces first as they take tasks from the front of the queue.
+    while (chunk_end - chunk_begin > 1) {
+        int mid = (chunk_begin + chunk_end) / 2;
+        int end = chunk_end;
+        group.run([&group, mid, end, &body]() { parallel_for_chunks(group, mid, end, body); });
+        chunk_end = mid;
+    }
+    body(chunk_begin);
+}
+
+// split [begin, end) into chunks of 'grain' elements and process them on the job system.
+// chunk boundaries are always multiples of grain from begin. the calling thread also processes chunks,
+// and returns when all of them are done. can be nested.
+// Body: [](int begin, int end) -> void
+template<class Body>
+inline void parallel_for_blocked(int begin, int end, int grain, const Body& body)
+{
+    if (begin >= end)
+        return;
+    grain = std::max(grain, 1);
+    int num_chunks = ceildiv(end - begin, grain);
+    auto chunk = [&](int ci) {
+        int b = begin + grain * ci;
+        body(b, std::min(b + grain, end));
+    };
+    if (num_chunks == 1 || JobSystem::getInstance().getWorkerCount() == 0) {
+        for (int ci = 0; ci < num_chunks; ++ci)
+            chunk(ci);
+        return;
+    }
+
+    TaskGroup group;
+    parallel_for_chunks(group, 0, num_chunks, chunk);
+    group.wait();
+}
+
+// Body: [](int i) -> void
+template<class Body>
+inline void parallel_for(int begin, int end, int grain, const Body& body)
+{
+    parallel_for_blocked(begin, end, grain, [&body](int b, int e) {
+        for (int i = b; i < e; ++i)
+            body(i);
+    });
+}
+
+} // namespace rths
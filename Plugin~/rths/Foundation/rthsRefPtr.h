@@ -57,10 +57,11 @@ protected:
 
     int internalRelease()
     {
-        if (--m_ref_count == 0) {
+        int ret = --m_ref_count;
+        if (ret == 0) {
             delete m_self;
         }
-        return m_ref_count;
+        return ret;
     }
 
 private:
@@ -0,0 +1,103 @@
+#pragma once
+#include <immintrin.h>
+
+// thin wrappers of SSE / AVX registers. they make it possible to write one template for multiple SIMD widths.
+// comparisons return masks (all bits set for true lanes) in float registers as SSE / AVX do.
+// simd8f is available only when the translation unit is compiled with AVX2 enabled (/arch:AVX2 or -mavx2).
+
+namespace rths {
+
+bool IsAVXSupported(); // CPU and OS support. checked on runtime
+bool IsAVX2Supported(); // same as above
+bool IsF16CSupported(); // same as above. F16C instructions need AVX
+
+struct simd4f
+{
+    static const int size = 4;
+    __m128 v;
+
+    simd4f() {}
+    simd4f(__m128 a) : v(a) {}
+    explicit simd4f(float a) : v(_mm_set1_ps(a)) {}
+
+    static simd4f load(const float *src) { return _mm_loadu_ps(src); }
+    static simd4f bits(uint32_t a) { return _mm_castsi128_ps(_mm_set1_epi32((int)a)); } // equivalent of asfloat()
+    static simd4f lanes(int n) { return _mm_castsi128_ps(_mm_cmplt_epi32(_mm_setr_epi32(0, 1, 2, 3), _mm_set1_epi32(n))); } // mask of the first n lanes
+    void store(float *dst) const { _mm_storeu_ps(dst, v); }
+};
+
+inline simd4f operator+(simd4f a, simd4f b) { return _mm_add_ps(a.v, b.v); }
+inline simd4f operator-(simd4f a, simd4f b) { return _mm_sub_ps(a.v, b.v); }
+inline simd4f operator*(simd4f a, simd4f b) { return _mm_mul_ps(a.v, b.v); }
+inline simd4f operator/(simd4f a, simd4f b) { return _mm_div_ps(a.v, b.v); }
+inline simd4f operator&(simd4f a, simd4f b) { return _mm_and_ps(a.v, b.v); }
+inline simd4f operator|(simd4f a, simd4f b) { return _mm_or_ps(a.v, b.v); }
+inline simd4f operator<(simd4f a, simd4f b) { return _mm_cmplt_ps(a.v, b.v); }
+inline simd4f operator<=(simd4f a, simd4f b) { return _mm_cmple_ps(a.v, b.v); }
+inline simd4f operator>(simd4f a, simd4f b) { return _mm_cmpgt_ps(a.v, b.v); }
+inline simd4f operator>=(simd4f a, simd4f b) { return _mm_cmpge_ps(a.v, b.v); }
+inline simd4f operator!=(simd4f a, simd4f b) { return _mm_cmpneq_ps(a.v, b.v); }
+inline simd4f andnot(simd4f mask, simd4f a) { return _mm_andnot_ps(mask.v, a.v); } // ~mask & a
+inline simd4f min(simd4f a, simd4f b) { return _mm_min_ps(a.v, b.v); }
+inline simd4f max(simd4f a, simd4f b) { return _mm_max_ps(a.v, b.v); }
+inline simd4f select(simd4f mask, simd4f a, simd4f b) { return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); } // mask ? a : b
+inline int movemask(simd4f mask) { return _mm_movemask_ps(mask.v); }
+inline float hmin(simd4f a)
+{
+    __m128 t = _mm_min_ps(a.v, _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(2, 3, 0, 1)));
+    t = _mm_min_ps(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(1, 0, 3, 2)));
+    return _mm_cvtss_f32(t);
+}
+inline float hmax(simd4f a)
+{
+    __m128 t = _mm_max_ps(a.v, _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(2, 3, 0, 1)));
+    t = _mm_max_ps(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(1, 0, 3, 2)));
+    return _mm_cvtss_f32(t);
+}
+
+
+#ifdef __AVX2__
+struct simd8f
+{
+    static const int size = 8;
+    __m256 v;
+
+    simd8f() {}
+    simd8f(__m256 a) : v(a) {}
+    explicit simd8f(float a) : v(_mm256_set1_ps(a)) {}
+
+    static simd8f load(const float *src) { return _mm256_loadu_ps(src); }
+    static simd8f bits(uint32_t a) { return _mm256_castsi256_ps(_mm256_set1_epi32((int)a)); } // equivalent of asfloat()
+    static simd8f lanes(int n) { return _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(n), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7))); } // mask of the first n lanes
+    void store(float *dst) const { _mm256_storeu_ps(dst, v); }
+};
+
+inline simd8f operator+(simd8f a, simd8f b) { return _mm256_add_ps(a.v, b.v); }
+inline simd8f operator-(simd8f a, simd8f b) { return _mm256_sub_ps(a.v, b.v); }
+inline simd8f operator*(simd8f a, simd8f b) { return _mm256_mul_ps(a.v, b.v); }
+inline simd8f operator/(simd8f a, simd8f b) { return _mm256_div_ps(a.v, b.v); }
+inline simd8f operator&(simd8f a, simd8f b) { return _mm256_and_ps(a.v, b.v); }
+inline simd8f operator|(simd8f a, simd8f b) { return _mm256_or_ps(a.v, b.v); }
+inline simd8f operator<(simd8f a, simd8f b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+inline simd8f operator<=(simd8f a, simd8f b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+inline simd8f operator>(simd8f a, simd8f b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+inline simd8f operator>=(simd8f a, simd8f b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+inline simd8f operator!=(simd8f a, simd8f b) { return _mm256_cmp_ps(a.v, b.v, _CMP_NEQ_UQ); }
+inline simd8f andnot(simd8f mask, simd8f a) { return _mm256_andnot_ps(mask.v, a.v); } // ~mask & a
+inline simd8f min(simd8f a, simd8f b) { return _mm256_min_ps(a.v, b.v); }
+inline simd8f max(simd8f a, simd8f b) { return _mm256_max_ps(a.v, b.v); }
+inline simd8f select(simd8f mask, simd8f a, simd8f b) { return _mm256_blendv_ps(b.v, a.v, mask.v); } // mask ? a : b
+inline int movemask(simd8f mask) { return _mm256_movemask_ps(mask.v); }
+inline float hmin(simd8f a)
+{
+    __m128 t = _mm_min_ps(_mm256_castps256_ps128(a.v), _mm256_extractf128_ps(a.v, 1));
+    return hmin(simd4f(t));
+}
+inline float hmax(simd8f a)
+{
+    __m128 t = _mm_max_ps(_mm256_castps256_ps128(a.v), _mm256_extractf128_ps(a.v, 1));
+    return hmax(simd4f(t));
+}
+#endif // __AVX2__
+
+} // namespace rths
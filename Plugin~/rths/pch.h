@@ -17,13 +17,20 @@
 // Unity PluginAPI
 #include "IUnityInterface.h"
 #include "IUnityGraphics.h"
+#ifdef _WIN32
 #include "IUnityGraphicsD3D11.h"
 #include "IUnityGraphicsD3D12.h"
+#endif // _WIN32
 
+#include <cstdarg>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
 #include <array>
 #include <string>
 #include <vector>
 #include <list>
+#include <deque>
 #include <map>
 #include <algorithm>
 #include <functional>
@@ -32,6 +39,9 @@
 #include <sstream>
 #include <fstream>
 #include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include <future>
 #include <random>
 #include <regex>
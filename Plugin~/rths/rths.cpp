@@ -1,7 +1,12 @@
 #include "pch.h"
 #include "Foundation/rthsMath.h"
 #include "Foundation/rthsLog.h"
+#include "Foundation/rthsParallel.h"
+#include "Foundation/rthsConvert.h"
+#include "Foundation/rthsMatrix.h"
 #include "rthsRenderer.h"
+#include "rthsCapture.h"
+#include "CPU/rthsDeformerCPU.h"
 #include "rths.h"
 
 using namespace rths;
@@ -36,6 +41,96 @@ rthsAPI void rthsGlobalsSetFlags(uint32_t v)
 {
     rths::GetGlobals().flags = v;
 }
+rthsAPI int rthsGlobalsGetThreadCount()
+{
+    return rths::GetGlobals().getThreadCount();
+}
+rthsAPI void rthsGlobalsSetThreadCount(int v)
+{
+    rths::GetGlobals().setThreadCount(v);
+}
+rthsAPI int rthsGlobalsGetWorkerStats(WorkerStats *dst, int max_count)
+{
+    auto stats = JobSystem::getInstance().getStats();
+    int n = (int)stats.size();
+    if (dst) {
+        n = std::min(n, max_count);
+        std::copy(stats.begin(), stats.begin() + n, dst);
+    }
+    return n;
+}
+rthsAPI void rthsGlobalsResetWorkerStats()
+{
+    JobSystem::getInstance().resetStats();
+}
+
+rthsAPI void rthsConvertFloatToHalf(uint16_t *dst, const float *src, int num)
+{
+    if (!dst || !src || num <= 0)
+        return;
+    ConvertFloatToHalf(dst, src, num, !rths::GetGlobals().hasDebugFlag(DebugFlag::NoF16C));
+}
+rthsAPI void rthsConvertHalfToFloat(float *dst, const uint16_t *src, int num)
+{
+    if (!dst || !src || num <= 0)
+        return;
+    ConvertHalfToFloat(dst, src, num, !rths::GetGlobals().hasDebugFlag(DebugFlag::NoF16C));
+}
+rthsAPI void rthsConvertFloatToUnorm8(uint8_t *dst, const float *src, int num)
+{
+    if (!dst || !src || num <= 0)
+        return;
+    ConvertFloatToUnorm8(dst, src, num);
+}
+rthsAPI void rthsConvertUnorm8ToFloat(float *dst, const uint8_t *src, int num)
+{
+    if (!dst || !src || num <= 0)
+        return;
+    ConvertUnorm8ToFloat(dst, src, num);
+}
+rthsAPI void rthsConvertBitMaskToPlanes(uint8_t *dst, const uint32_t *src, int num, int num_planes)
+{
+    if (!dst || !src || num <= 0)
+        return;
+    ConvertBitMaskToPlanes(dst, src, num, std::min(num_planes, 32));
+}
+
+rthsAPI void rthsMatrixMul(float4x4 *dst, const float4x4 *a, const float4x4 *b, int num)
+{
+    if (!dst || !a || !b || num <= 0)
+        return;
+    MulMatrices(dst, a, b, num, !rths::GetGlobals().hasDebugFlag(DebugFlag::NoMatrixAVX));
+}
+rthsAPI void rthsMatrixMulConst(float4x4 *dst, const float4x4 *a, const float4x4 *m, int num)
+{
+    if (!dst || !a || !m || num <= 0)
+        return;
+    MulMatrices(dst, a, *m, num, !rths::GetGlobals().hasDebugFlag(DebugFlag::NoMatrixAVX));
+}
+rthsAPI void rthsMatrixMulPalette(float4x4 *dst, const float4x4 *bindposes, const float4x4 *bones, const float4x4 *root, int num)
+{
+    if (!dst || !bindposes || !bones || !root || num <= 0)
+        return;
+    MulMatrices(dst, bindposes, bones, *root, num, !rths::GetGlobals().hasDebugFlag(DebugFlag::NoMatrixAVX));
+}
+rthsAPI void rthsMatrixInvertAffine(float4x4 *dst, const float4x4 *src, int num)
+{
+    if (!dst || !src || num <= 0)
+        return;
+    InvertAffine(dst, src, num);
+}
+rthsAPI void rthsMatrixTransformPoints(float3 *dst, const float3 *src, const float4x4 *m, int num)
+{
+    if (!dst || !src || !m || num <= 0)
+        return;
+    TransformPoints(dst, src, *m, num, !rths::GetGlobals().hasDebugFlag(DebugFlag::NoMatrixAVX));
+}
+rthsAPI void rthsMatrixTransformVectors(float3 *dst, const float3 *src, const float4x4 *m, int num)
+{
+    if (!dst || !src || !m || num <= 0)
+        return;
+    TransformVectors(dst, src, *m, num, !rths::GetGlobals().hasDebugFlag(DebugFlag::NoMatrixAVX));
+}
 
 
 rthsAPI MeshData* rthsMeshCreate()
@@ -148,7 +243,7 @@ rthsAPI void rthsMeshAddBlendshapeFrame(MeshData *self, int bs_index, const floa
         self->blendshapes.resize(bs_index + 1);
 
     BlendshapeFrameData frame;
-    frame.delta.assign(delta, delta + self->vertex_count);
+    frame.setDelta(delta, self->vertex_count);
     frame.weight = weight;
     self->blendshapes[bs_index].frames.push_back(std::move(frame));
 }
@@ -160,6 +255,16 @@ rthsAPI void rthsMeshMarkDyncmic(MeshData *self, bool v)
     self->is_dynamic = v;
 }
 
+rthsAPI void rthsMeshGetBlendshapeMemoryUsage(MeshData *self, uint64_t *sparse_size, uint64_t *dense_size)
+{
+    if (!self)
+        return;
+    if (sparse_size)
+        *sparse_size = self->getBlendshapeMemoryUsage();
+    if (dense_size)
+        *dense_size = self->getDenseBlendshapeMemoryUsage();
+}
+
 
 rthsAPI MeshInstanceData* rthsMeshInstanceCreate(rths::MeshData *mesh)
 {
@@ -209,6 +314,16 @@ rthsAPI void rthsMeshInstanceSetBlendshapeWeights(MeshInstanceData *self, const
         return;
     self->setBlendshapeWeights(bsw, num_bsw);
 }
+rthsAPI int rthsMeshInstanceDeformCPU(MeshInstanceData *self, float4 *dst, int max_vertices, bool clamp_blendshape_weights)
+{
+    if (!self || !dst || !NeedsDeformCPU(*self))
+        return 0;
+    auto& mesh = *self->mesh;
+    if (!mesh.cpu_vertex_buffer || mesh.vertex_count > max_vertices)
+        return 0;
+    DeformJobCPU job{ self, dst };
+    return (int)DeformCPU(&job, 1, clamp_blendshape_weights);
+}
 
 
 rthsAPI RenderTargetData* rthsRenderTargetCreate()
@@ -257,7 +372,12 @@ rthsAPI void rthsRenderTargetSetOutputFormat(RenderTargetData *self, OutputForma
 
 rthsAPI IRenderer* rthsRendererCreate()
 {
-    return CreateRendererDXR();
+    auto ret = CreateRendererDXR();
+    if (!ret) {
+        // DXR is not available (no capable GPU or non-Windows platform). fallback to software implementation.
+        ret = CreateRendererCPU();
+    }
+    return ret;
 }
 
 rthsAPI void rthsRendererRelease(IRenderer *self)
@@ -309,6 +429,13 @@ rthsAPI void rthsRendererSetRenderTarget(IRenderer *self, RenderTargetData *rend
     self->setRenderTarget(render_target);
 }
 
+rthsAPI void rthsRendererSetGBuffer(IRenderer *self, const float *depth, const uint32_t *instance_ids)
+{
+    if (!self)
+        return;
+    self->setGBuffer(depth, instance_ids);
+}
+
 rthsAPI void rthsRendererBeginScene(IRenderer *self)
 {
     if (!self)
@@ -384,6 +511,27 @@ rthsAPI void rthsRendererAddMesh(IRenderer *self, rths::MeshInstanceData *mesh)
     self->addMesh(mesh);
 }
 
+rthsAPI void rthsRendererAddView(IRenderer *self, RenderTargetData *render_target, float3 pos, float4x4 view, float4x4 proj, uint32_t lmask)
+{
+    if (!self)
+        return;
+    self->addView(render_target, pos, view, proj, lmask);
+}
+
+rthsAPI void rthsRendererSetViews(IRenderer *self, const CameraData *cameras, RenderTargetData **render_targets, int count)
+{
+    if (!self || !cameras || !render_targets)
+        return;
+    self->setViews(cameras, render_targets, count);
+}
+
+rthsAPI void rthsRendererSetCubeCamera(IRenderer *self, RenderTargetData **faces, float3 pos, float near_plane, float far_plane, uint32_t lmask)
+{
+    if (!self || !faces)
+        return;
+    self->setCubeCamera(faces, pos, near_plane, far_plane, lmask);
+}
+
 rthsAPI void rthsRendererStartRender(IRenderer *self)
 {
     if (!self)
@@ -405,6 +553,13 @@ rthsAPI bool rthsRendererReadbackRenderTarget(IRenderer *self, void *dst)
     return self->readbackRenderTarget(dst);
 }
 
+rthsAPI bool rthsRendererReadbackViewRenderTarget(IRenderer *self, int view, void *dst)
+{
+    if (!self)
+        return false;
+    return self->readbackViewRenderTarget(view, dst);
+}
+
 rthsAPI const char* rthsRendererGetTimestampLog(IRenderer *self)
 {
     if (!self)
@@ -414,6 +569,22 @@ rthsAPI const char* rthsRendererGetTimestampLog(IRenderer *self)
     return s_log.c_str();
 }
 
+rthsAPI const char* rthsRendererGetMemoryReport(IRenderer *self)
+{
+    if (!self)
+        return nullptr;
+    static std::string s_report;
+    s_report = self->getMemoryReport();
+    return s_report.c_str();
+}
+
+rthsAPI bool rthsRendererReadbackTileLights(IRenderer *self, int *tile_size, int *tiles_x, int *tiles_y, uint32_t *dst)
+{
+    if (!self || !tile_size || !tiles_x || !tiles_y)
+        return false;
+    return self->readbackTileLights(*tile_size, *tiles_x, *tiles_y, dst);
+}
+
 rthsAPI GPUResourcePtr rthsRendererGetRenderTexturePtr(IRenderer *self)
 {
     if (!self)
@@ -435,6 +606,21 @@ rthsAPI void rthsRenderAll()
     rths::RenderAll();
 }
 
+rthsAPI bool rthsCaptureBegin(const char *path)
+{
+    if (!path)
+        return false;
+    return rths::SceneCapture::getInstance().begin(path);
+}
+rthsAPI void rthsCaptureEnd()
+{
+    rths::SceneCapture::getInstance().end();
+}
+rthsAPI bool rthsCaptureIsCapturing()
+{
+    return rths::SceneCapture::getInstance().isCapturing();
+}
+
 
 #ifdef _WIN32
 namespace rths {
@@ -51,11 +51,21 @@ enum class DebugFlag : uint32_t
     Timestamp       = 0x01,
     ForceUpdateAS   = 0x02,
     PowerStableState= 0x04,
+    NoRayPackets    = 0x08, // CPU renderer: trace camera rays one by one
+    NoAVX2          = 0x10, // CPU renderer: use 4-wide ray packets even if AVX2 is available
+    NoOcclusionQuery= 0x20, // CPU renderer: trace shadow rays with closest hit traversal
+    BLASUpdateReport= 0x40, // CPU renderer: compare refit, LBVH and SAH rebuild of dynamic meshes. the result goes to the timestamp log
+    NoTriangleBlocks= 0x80, // CPU renderer: read triangles from the strided source buffers at trace time (for benchmarks). disables ray packets
+    NoLightCulling  = 0x100, // CPU renderer: evaluate all lights for each pixel instead of per-tile light lists
+    NoShadowRayBinning= 0x200, // CPU renderer: shoot shadow rays pixel by pixel instead of binning them by light and direction
+    NoF16C          = 0x400, // format conversions of readbacks: use the SSE2 path even if F16C is available
+    NoMatrixAVX     = 0x800, // batch matrix operations: use the SSE2 path even if AVX is available
 };
 
 enum class GlobalFlag : uint32_t
 {
     DeferredInitialization = 0x01,
+    CompressBVH            = 0x02, // CPU renderer: store BLAS in the compressed layout (quantized 8-wide nodes, 16-bit indices)
 };
 
 enum class OutputFormat : uint32_t
@@ -74,6 +84,8 @@ enum class RenderFlag : uint32_t
     Transparent             = 0x00000020,
     AdaptiveSampling        = 0x00000100,
     Antialiasing            = 0x00000200,
+    TemporalReprojection    = 0x00000400, // CPU renderer: reuse the previous frame's result for stable pixels
+    DirtyRegions            = 0x00000800, // CPU renderer: trace only screen regions that updated instances can affect
     GPUSkinning             = 0x00010000,
     ClampBlendShapeWights   = 0x00020000,
     ParallelCommandList     = 0x00040000,
@@ -116,8 +128,30 @@ struct BoneWeight4
     float weight[4];
     int index[4];
 };
+
+struct WorkerStats
+{
+    uint32_t task_count;  // tasks executed
+    uint32_t steal_count; // tasks taken from queues of other threads
+    uint64_t busy_time;   // in nanoseconds
+};
+
+// camera of rthsRendererSetViews(). same layout as the internal one
+struct CameraData
+{
+    float4x4 view;
+    float4x4 proj;
+    float4 position; // w is not used
+    float near_plane;
+    float far_plane;
+    uint32_t layer_mask;
+    uint32_t pad1;
+};
 #endif // rthsImpl
 
+// checks the public CameraData above in user code and the internal one (rthsTypes.h) in rths.cpp
+static_assert(sizeof(CameraData) == 160, "CameraData of rths.h and rthsTypes.h must have the same layout");
+
 using GPUResourcePtr = const void*;
 using CPUResourcePtr = const void*;
 class MeshData;
@@ -137,6 +171,31 @@ rthsAPI uint32_t rthsGlobalsGetDebugFlags();
 rthsAPI void rthsGlobalsSetDebugFlags(uint32_t v);
 rthsAPI uint32_t rthsGlobalsGetFlags();
 rthsAPI void rthsGlobalsSetFlags(uint32_t v);
+rthsAPI int rthsGlobalsGetThreadCount();
+rthsAPI void rthsGlobalsSetThreadCount(int v); // 0: hardware concurrency
+// [0]: threads outside the job system that wait for tasks (e.g. render thread), [1...]: worker threads.
+// returns the number of entries. dst can be null to get the count.
+rthsAPI int rthsGlobalsGetWorkerStats(rths::WorkerStats *dst, int max_count);
+rthsAPI void rthsGlobalsResetWorkerStats();
+
+// batch format conversions (vectorized). half: rounds to nearest even. unorm8: 0.0-1.0 <-> 0-255, rounds to nearest.
+// DebugFlag::NoF16C disables the F16C path of half conversions.
+rthsAPI void rthsConvertFloatToHalf(uint16_t *dst, const float *src, int num);
+rthsAPI void rthsConvertHalfToFloat(float *dst, const uint16_t *src, int num);
+rthsAPI void rthsConvertFloatToUnorm8(uint8_t *dst, const float *src, int num);
+rthsAPI void rthsConvertUnorm8ToFloat(float *dst, const uint8_t *src, int num);
+// OutputFormat::BitMask results -> unorm8 plane of each light (0 or 255). dst: num_planes * num elements
+rthsAPI void rthsConvertBitMaskToPlanes(uint8_t *dst, const uint32_t *src, int num, int num_planes);
+
+// batch float4x4 operations (vectorized). results are bitwise identical to one by one operations. dst can be the same as a source.
+// row vector convention: translation is in m[3]. DebugFlag::NoMatrixAVX disables the AVX path.
+rthsAPI void rthsMatrixMul(rths::float4x4 *dst, const rths::float4x4 *a, const rths::float4x4 *b, int num); // dst[i] = a[i] * b[i]
+rthsAPI void rthsMatrixMulConst(rths::float4x4 *dst, const rths::float4x4 *a, const rths::float4x4 *m, int num); // dst[i] = a[i] * m
+// dst[i] = bindposes[i] * bones[i] * root. skinning matrices in the space of root
+rthsAPI void rthsMatrixMulPalette(rths::float4x4 *dst, const rths::float4x4 *bindposes, const rths::float4x4 *bones, const rths::float4x4 *root, int num);
+rthsAPI void rthsMatrixInvertAffine(rths::float4x4 *dst, const rths::float4x4 *src, int num); // returns identity for singular matrices
+rthsAPI void rthsMatrixTransformPoints(rths::float3 *dst, const rths::float3 *src, const rths::float4x4 *m, int num);
+rthsAPI void rthsMatrixTransformVectors(rths::float3 *dst, const rths::float3 *src, const rths::float4x4 *m, int num);
 
 // mesh interface
 rthsAPI rths::MeshData* rthsMeshCreate();
@@ -153,6 +212,8 @@ rthsAPI void rthsMeshSetSkinWeights4(rths::MeshData *self, const rths::BoneWeigh
 rthsAPI void rthsMeshSetBlendshapeCount(rths::MeshData *self, int num_bs);
 rthsAPI void rthsMeshAddBlendshapeFrame(rths::MeshData *self, int bs_index, const rths::float3 *delta, float weight);
 rthsAPI void rthsMeshMarkDyncmic(rths::MeshData *self, bool v);
+// blendshape deltas are stored sparse (zero deltas are skipped). dense_size is the size if all deltas were stored.
+rthsAPI void rthsMeshGetBlendshapeMemoryUsage(rths::MeshData *self, uint64_t *sparse_size, uint64_t *dense_size);
 
 // mesh instance interface
 rthsAPI rths::MeshInstanceData* rthsMeshInstanceCreate(rths::MeshData *mesh);
@@ -163,6 +224,10 @@ rthsAPI void rthsMeshInstanceSetLayer(rths::MeshInstanceData *self, uint32_t lay
 rthsAPI void rthsMeshInstanceSetTransform(rths::MeshInstanceData *self, rths::float4x4 transform);
 rthsAPI void rthsMeshInstanceSetBones(rths::MeshInstanceData *self, const rths::float4x4 *bones, int num_bones);
 rthsAPI void rthsMeshInstanceSetBlendshapeWeights(rths::MeshInstanceData *self, const float *bsw, int num_bsw);
+// deforms vertices of the instance with its blendshape weights and bones on the CPU, as the CPU renderer does.
+// dst: vertex_count float4 (w = 1). skinned vertices are in the space of the instance's transform.
+// returns the number of vertices written. 0 if there is nothing to deform or max_vertices is less than vertex_count.
+rthsAPI int rthsMeshInstanceDeformCPU(rths::MeshInstanceData *self, rths::float4 *dst, int max_vertices, bool clamp_blendshape_weights);
 
 // render target interface
 rthsAPI rths::RenderTargetData* rthsRenderTargetCreate();
@@ -182,6 +247,11 @@ rthsAPI int  rthsRendererGetID(rths::IRenderer *self);
 rthsAPI bool rthsRendererIsRendering(rths::IRenderer *self);
 rthsAPI void rthsRendererSetName(rths::IRenderer *self, const char *name);
 rthsAPI void rthsRendererSetRenderTarget(rths::IRenderer *self, rths::RenderTargetData *render_target);
+// G-buffer input. CPU renderer only. call between BeginScene and EndScene. camera rays are skipped and hit positions are
+// reconstructed from depth (view space depth along the camera's forward axis. <= 0 or >= far plane: no hit).
+// instance_ids: index of the rthsRendererAddMesh() call of the receiver in the scene, or ~0 if unknown. can be null.
+// both have render target size elements and must be kept until rthsRendererFinishRender(). depth = null disables it.
+rthsAPI void rthsRendererSetGBuffer(rths::IRenderer *self, const float *depth, const uint32_t *instance_ids);
 rthsAPI void rthsRendererBeginScene(rths::IRenderer *self);
 rthsAPI void rthsRendererEndScene(rths::IRenderer *self);
 rthsAPI void rthsRendererSetRenderFlags(rths::IRenderer *self, uint32_t flag); // flag: combination of RenderFlag
@@ -193,17 +263,39 @@ rthsAPI void rthsRendererAddSpotLight(rths::IRenderer *self, rths::float3 pos, r
 rthsAPI void rthsRendererAddPointLight(rths::IRenderer *self, rths::float3 pos, float range, uint32_t lmask = -1);
 rthsAPI void rthsRendererAddReversePointLight(rths::IRenderer *self, rths::float3 pos, float range, uint32_t lmask = -1);
 rthsAPI void rthsRendererAddMesh(rths::IRenderer *self, rths::MeshInstanceData *mesh);
+// multi-view. CPU renderer only. call between BeginScene and EndScene. adds a camera rendered to its own render target with
+// the same scene (lights, meshes and flags) in one render. the camera of rthsRendererSetCamera() is view 0 and added views are 1, 2, ...
+// all views trace the same acceleration structures and their tiles are traced together on the job system.
+rthsAPI void rthsRendererAddView(rths::IRenderer *self, rths::RenderTargetData *render_target, rths::float3 pos, rths::float4x4 view, rths::float4x4 proj, uint32_t lmask = -1);
+// multi-view with an array. CPU renderer only. call between BeginScene and EndScene instead of SetRenderTarget, SetCamera and AddView.
+// cameras[0] and render_targets[0] are view 0 and others are views 1 to count - 1. near_plane and far_plane of cameras must be set.
+rthsAPI void rthsRendererSetViews(rths::IRenderer *self, const rths::CameraData *cameras, rths::RenderTargetData **render_targets, int count);
+// omnidirectional shadow output. CPU renderer only. call between BeginScene and EndScene instead of SetRenderTarget and SetCamera.
+// faces: 6 square render targets of +X, -X, +Y, -Y, +Z, -Z in the layout of D3D / Unity cube maps. they are views 0 to 5.
+// replaces the camera and views set before.
+rthsAPI void rthsRendererSetCubeCamera(rths::IRenderer *self, rths::RenderTargetData **faces, rths::float3 pos, float near_plane, float far_plane, uint32_t lmask = -1);
 rthsAPI void rthsRendererStartRender(rths::IRenderer *self);
 rthsAPI void rthsRendererFinishRender(rths::IRenderer *self);
 rthsAPI bool rthsRendererReadbackRenderTarget(rths::IRenderer *self, void *dst);
+rthsAPI bool rthsRendererReadbackViewRenderTarget(rths::IRenderer *self, int view, void *dst); // view 0 is the same as above
 rthsAPI const char* rthsRendererGetTimestampLog(rths::IRenderer *self);
+rthsAPI const char* rthsRendererGetMemoryReport(rths::IRenderer *self); // memory usage of acceleration structures. CPU renderer only
+// per-tile light bits of the last frame (tiles_x * tiles_y elements). CPU renderer only. dst can be null to get the size
+rthsAPI bool rthsRendererReadbackTileLights(rths::IRenderer *self, int *tile_size, int *tiles_x, int *tiles_y, uint32_t *dst);
 rthsAPI rths::GPUResourcePtr rthsRendererGetRenderTexturePtr(rths::IRenderer *self); // return raw texture ptr (ID3D12Resouce* etc)
 
 rthsAPI void rthsMarkFrameBegin();
 rthsAPI void rthsMarkFrameEnd();
 // no need to call rthsMarkFrameBegin/End when use rthsRenderAll()
+// renderers share one scene preparation pass. each instance is deformed and its BLAS is built once regardless of renderer count.
 rthsAPI void rthsRenderAll();
 
+// scene capture. renderers write meshes, instances and scenes that they render into path until rthsCaptureEnd().
+// the file format is in rthsCaptureFormat.h. rths-cli replays it. meshes with GPU buffers only are captured without geometry.
+rthsAPI bool rthsCaptureBegin(const char *path);
+rthsAPI void rthsCaptureEnd();
+rthsAPI bool rthsCaptureIsCapturing();
+
 #ifdef _WIN32
 struct ID3D11Device;
 struct ID3D12Device;
@@ -0,0 +1,292 @@
+#include "pch.h"
+#include "rthsCapture.h"
+#include "rthsRenderer.h"
+#include "Foundation/rthsLog.h"
+
+namespace rths {
+
+namespace {
+
+// payload of a chunk. the fixed size part (Header) comes first and arrays follow it
+template<class Header>
+class CapturePayload
+{
+public:
+    Header header{};
+
+    CapturePayload()
+    {
+        m_buf.resize(align_to(kCaptureAlignment, sizeof(Header)));
+    }
+
+    CaptureArray add(const void *data, size_t element_size, size_t count)
+    {
+        CaptureArray ret{ m_buf.size(), (uint32_t)count, 0 };
+        auto *src = (const char*)data;
+        if (src)
+            m_buf.insert(m_buf.end(), src, src + element_size * count);
+        m_buf.resize(align_to(kCaptureAlignment, m_buf.size()));
+        return ret;
+    }
+
+    template<class T>
+    CaptureArray add(const std::vector<T>& v)
+    {
+        return add(v.data(), sizeof(T), v.size());
+    }
+
+    CaptureArray add(const std::string& v)
+    {
+        return add(v.data(), 1, v.size());
+    }
+
+    const std::vector<char>& finish()
+    {
+        std::memcpy(m_buf.data(), &header, sizeof(Header));
+        return m_buf;
+    }
+
+private:
+    std::vector<char> m_buf;
+};
+
+} // namespace
+
+static CaptureCamera ToCaptureCamera(const CameraData& cam)
+{
+    CaptureCamera ret{};
+    std::memcpy(ret.position, &cam.position, sizeof(ret.position));
+    std::memcpy(ret.view, &cam.view, sizeof(ret.view));
+    std::memcpy(ret.proj, &cam.proj, sizeof(ret.proj));
+    ret.layer_mask = cam.layer_mask;
+    return ret;
+}
+
+
+bool SceneCapture::MeshState::operator==(const MeshState& v) const
+{
+    return vertex_buffer == v.vertex_buffer && index_buffer == v.index_buffer &&
+        vertex_stride == v.vertex_stride && vertex_count == v.vertex_count && vertex_offset == v.vertex_offset &&
+        index_stride == v.index_stride && index_count == v.index_count && index_offset == v.index_offset &&
+        bindpose_count == v.bindpose_count && weight_count == v.weight_count && blendshape_count == v.blendshape_count;
+}
+
+SceneCapture& SceneCapture::getInstance()
+{
+    static SceneCapture s_instance;
+    return s_instance;
+}
+
+bool SceneCapture::begin(const char *path)
+{
+    end();
+
+    std::unique_lock<std::mutex> l(m_mutex);
+    m_file = std::fopen(path, "wb");
+    if (!m_file) {
+        SetErrorLog("SceneCapture::begin(): can't open %s\n", path);
+        return false;
+    }
+
+    CaptureFileHeader header{};
+    std::memcpy(header.magic, kCaptureMagic, sizeof(header.magic));
+    header.version = kCaptureVersion;
+    header.header_size = sizeof(header);
+    std::fwrite(&header, sizeof(header), 1, m_file);
+
+    m_frame = 0;
+    m_frame_has_scene = false;
+    m_begin_time = Now();
+    m_capturing = true;
+    return true;
+}
+
+void SceneCapture::end()
+{
+    std::unique_lock<std::mutex> l(m_mutex);
+    if (!m_file)
+        return;
+
+    // scenes rendered without rthsMarkFrameEnd() after them
+    endFrameImpl();
+    std::fclose(m_file);
+    m_file = nullptr;
+    m_capturing = false;
+
+    // releases references. meshes and instances that have been released by the application are deleted here
+    m_instances.clear();
+    m_meshes.clear();
+}
+
+bool SceneCapture::isCapturing() const
+{
+    return m_capturing;
+}
+
+void SceneCapture::addScene(int renderer_id, const SceneData& scene, const std::vector<ViewData>& views,
+    const std::vector<MeshInstanceDataPtr>& instances)
+{
+    std::unique_lock<std::mutex> l(m_mutex);
+    if (!m_file)
+        return;
+
+    CapturePayload<CaptureScene> payload;
+    auto& dst = payload.header;
+    dst.renderer_id = (uint32_t)renderer_id;
+    dst.render_flags = scene.render_flags;
+    dst.shadow_ray_offset = scene.shadow_ray_offset;
+    dst.self_shadow_threshold = scene.self_shadow_threshold;
+
+    std::vector<CaptureView> capture_views;
+    for (auto& view : views) {
+        CaptureView cv{};
+        cv.camera = ToCaptureCamera(view.camera);
+        if (const RenderTargetData *rt = view.render_target) {
+            cv.width = rt->width;
+            cv.height = rt->height;
+            cv.format = (uint32_t)rt->format;
+            cv.output_format = (uint32_t)rt->output_format;
+        }
+        capture_views.push_back(cv);
+    }
+    dst.views = payload.add(capture_views);
+
+    std::vector<CaptureLight> lights;
+    for (uint32_t li = 0; li < scene.light_count; ++li) {
+        auto& src = scene.lights[li];
+        CaptureLight cl{};
+        cl.type = (uint32_t)src.light_type;
+        cl.layer_mask = src.layer_mask;
+        std::memcpy(cl.position, &src.position, sizeof(cl.position));
+        std::memcpy(cl.direction, &src.direction, sizeof(cl.direction));
+        cl.range = src.range;
+        cl.spot_angle = src.spot_angle * RadToDeg;
+        lights.push_back(cl);
+    }
+    dst.lights = payload.add(lights);
+
+    // meshes and instances are written before the scene that refers to them
+    std::vector<uint32_t> instance_ids;
+    for (auto inst : instances)
+        instance_ids.push_back(writeInstance(inst));
+    dst.instances = payload.add(instance_ids);
+
+    writeChunk(CaptureChunkType::Scene, payload.finish());
+    m_frame_has_scene = true;
+}
+
+void SceneCapture::endFrame()
+{
+    std::unique_lock<std::mutex> l(m_mutex);
+    if (!m_file)
+        return;
+    endFrameImpl();
+}
+
+void SceneCapture::endFrameImpl()
+{
+    if (!m_frame_has_scene)
+        return;
+
+    CapturePayload<CaptureFrameEnd> payload;
+    payload.header.frame = m_frame;
+    payload.header.time = Now() - m_begin_time;
+    writeChunk(CaptureChunkType::FrameEnd, payload.finish());
+    std::fflush(m_file);
+    ++m_frame;
+    m_frame_has_scene = false;
+}
+
+uint32_t SceneCapture::writeMesh(MeshData *mesh)
+{
+    auto& rec = m_meshes[mesh];
+    if (!rec.mesh) {
+        rec.id = (uint32_t)m_meshes.size() - 1;
+        rec.mesh = mesh;
+    }
+
+    MeshState state{ mesh->cpu_vertex_buffer, mesh->cpu_index_buffer,
+        mesh->vertex_stride, mesh->vertex_count, mesh->vertex_offset,
+        mesh->index_stride, mesh->index_count, mesh->index_offset,
+        mesh->skin.bindposes.size(), mesh->skin.weights.size(), mesh->blendshapes.size() };
+    // contents of CPU buffers of dynamic meshes can be changed without notice
+    bool changed = rec.frame_written == ~0u || !(rec.state == state) || (mesh->is_dynamic && rec.frame_written != m_frame);
+    if (!changed)
+        return rec.id;
+    rec.state = state;
+    rec.frame_written = m_frame;
+
+    CapturePayload<CaptureMesh> payload;
+    auto& dst = payload.header;
+    dst.id = rec.id;
+    dst.is_dynamic = mesh->is_dynamic ? 1 : 0;
+    // same defaults as the CPU renderer
+    dst.vertex_stride = mesh->vertex_stride != 0 ? mesh->vertex_stride : (int)sizeof(float3);
+    dst.index_stride = mesh->index_stride != 0 ? mesh->index_stride : (int)sizeof(uint32_t);
+    dst.name = payload.add(mesh->name);
+    if (mesh->cpu_vertex_buffer && mesh->cpu_index_buffer) {
+        dst.vertex_count = mesh->vertex_count;
+        dst.index_count = mesh->index_count;
+        dst.vertices = payload.add((const char*)mesh->cpu_vertex_buffer + mesh->vertex_offset, dst.vertex_stride, dst.vertex_count);
+        dst.indices = payload.add((const char*)mesh->cpu_index_buffer + mesh->index_offset, dst.index_stride, dst.index_count);
+    }
+    else {
+        // GPU buffers can't be read here. the mesh is captured without geometry
+        DebugPrint("SceneCapture::writeMesh(): %s has no CPU buffers\n", mesh->name.c_str());
+    }
+    dst.bindposes = payload.add(mesh->skin.bindposes);
+    dst.bone_counts = payload.add(mesh->skin.bone_counts);
+    dst.weights = payload.add(mesh->skin.weights);
+
+    // deltas are sparse in memory, but dense in captures as rthsMeshAddBlendshapeFrame() takes them
+    std::vector<CaptureBlendshapeFrame> frames;
+    std::vector<float3> delta(mesh->vertex_count);
+    for (size_t bi = 0; bi < mesh->blendshapes.size(); ++bi) {
+        for (auto& frame : mesh->blendshapes[bi].frames) {
+            frame.getDelta(delta.data(), mesh->vertex_count);
+            frames.push_back({ (uint32_t)bi, frame.weight, payload.add(delta) });
+        }
+    }
+    dst.blendshape_frames = payload.add(frames);
+    dst.blendshape_count = (uint32_t)mesh->blendshapes.size();
+
+    writeChunk(CaptureChunkType::Mesh, payload.finish());
+    return rec.id;
+}
+
+uint32_t SceneCapture::writeInstance(MeshInstanceData *inst)
+{
+    auto& rec = m_instances[inst];
+    if (!rec.instance) {
+        rec.id = (uint32_t)m_instances.size() - 1;
+        rec.instance = inst;
+    }
+    // the mesh is checked even if the instance has been written in this frame. it can be changed by other renderers
+    uint32_t mesh_id = inst->mesh ? writeMesh(inst->mesh) : ~0u;
+    if (rec.frame_written == m_frame)
+        return rec.id;
+    rec.frame_written = m_frame;
+
+    CapturePayload<CaptureInstance> payload;
+    auto& dst = payload.header;
+    dst.id = rec.id;
+    dst.mesh_id = mesh_id;
+    dst.flags = inst->instance_flags;
+    dst.layer = inst->layer;
+    std::memcpy(dst.transform, &inst->transform, sizeof(dst.transform));
+    dst.name = payload.add(inst->name);
+    dst.bones = payload.add(inst->bones);
+    dst.blendshape_weights = payload.add(inst->blendshape_weights);
+
+    writeChunk(CaptureChunkType::Instance, payload.finish());
+    return rec.id;
+}
+
+void SceneCapture::writeChunk(CaptureChunkType type, const std::vector<char>& payload)
+{
+    CaptureChunkHeader header{ type, 0, payload.size() };
+    std::fwrite(&header, sizeof(header), 1, m_file);
+    std::fwrite(payload.data(), 1, payload.size(), m_file);
+}
+
+} // namespace rths
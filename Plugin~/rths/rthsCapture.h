@@ -0,0 +1,67 @@
+#pragma once
+#include "rthsTypes.h"
+#include "rthsCaptureFormat.h"
+#include "Foundation/rthsMisc.h"
+
+namespace rths {
+
+struct ViewData;
+
+// writes scenes that renderers render into a capture file (see rthsCaptureFormat.h).
+// meshes and instances are identified by pointers. they are kept alive until end() so that the pointers are not reused.
+class SceneCapture
+{
+public:
+    static SceneCapture& getInstance();
+
+    bool begin(const char *path);
+    void end();
+    bool isCapturing() const;
+
+    // called by renderers when they start rendering. views[0] is the camera and render target of the renderer
+    void addScene(int renderer_id, const SceneData& scene, const std::vector<ViewData>& views,
+        const std::vector<MeshInstanceDataPtr>& instances);
+    // called by MarkFrameEnd()
+    void endFrame();
+
+private:
+    // states of a mesh that are compared to tell whether it has to be written again
+    struct MeshState
+    {
+        CPUResourcePtr vertex_buffer;
+        CPUResourcePtr index_buffer;
+        int vertex_stride, vertex_count, vertex_offset;
+        int index_stride, index_count, index_offset;
+        size_t bindpose_count, weight_count, blendshape_count;
+        bool operator==(const MeshState& v) const;
+    };
+    struct MeshRecord
+    {
+        uint32_t id = 0;
+        MeshDataPtr mesh;
+        MeshState state{};
+        uint32_t frame_written = ~0u;
+    };
+    struct InstanceRecord
+    {
+        uint32_t id = 0;
+        MeshInstanceDataPtr instance;
+        uint32_t frame_written = ~0u;
+    };
+
+    uint32_t writeMesh(MeshData *mesh);
+    uint32_t writeInstance(MeshInstanceData *inst);
+    void writeChunk(CaptureChunkType type, const std::vector<char>& payload);
+    void endFrameImpl();
+
+    std::mutex m_mutex;
+    std::atomic_bool m_capturing{ false };
+    FILE *m_file = nullptr;
+    std::map<MeshData*, MeshRecord> m_meshes;
+    std::map<MeshInstanceData*, InstanceRecord> m_instances;
+    uint32_t m_frame = 0;
+    bool m_frame_has_scene = false;
+    nanosec m_begin_time = 0;
+};
+
+} // namespace rths
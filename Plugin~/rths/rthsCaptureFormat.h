@@ -0,0 +1,136 @@
+#pragma once
+#include <cstdint>
+
+// binary scene capture written by rthsCaptureBegin() / rthsCaptureEnd().
+// this header has no dependencies so that replayers can include it with rths.h.
+//
+// file: CaptureFileHeader followed by chunks. each chunk is CaptureChunkHeader and its payload.
+// all values are little endian. chunks and arrays in them are aligned to kCaptureAlignment, so geometry can be
+// passed to rthsMeshSetCPUBuffers() directly from a memory mapped file.
+//
+// a frame is a sequence of Mesh, Instance and Scene chunks terminated by a FrameEnd chunk.
+// Mesh and Instance chunks appear before the first Scene chunk that refers to them, and again when they change.
+// static meshes are written once. dynamic meshes are written in every frame they are rendered.
+
+namespace rths {
+
+static const char kCaptureMagic[8] = { 'R', 'T', 'H', 'S', 'C', 'A', 'P', '\0' };
+static const uint32_t kCaptureVersion = 1;
+static const uint32_t kCaptureAlignment = 16;
+
+enum class CaptureChunkType : uint32_t
+{
+    Mesh = 1,
+    Instance = 2,
+    Scene = 3,
+    FrameEnd = 4,
+};
+
+struct CaptureFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size; // sizeof(CaptureFileHeader). chunks start here
+};
+
+struct CaptureChunkHeader
+{
+    CaptureChunkType type;
+    uint32_t reserved;
+    uint64_t size; // payload size. multiple of kCaptureAlignment
+};
+
+// array in a chunk. offset is from the beginning of the payload
+struct CaptureArray
+{
+    uint64_t offset;
+    uint32_t count;
+    uint32_t reserved;
+};
+
+// following CaptureArray members are arrays of the commented types
+struct CaptureMesh
+{
+    uint32_t id;
+    uint32_t is_dynamic;
+    int32_t vertex_stride;
+    int32_t vertex_count;
+    int32_t index_stride;
+    int32_t index_count;
+    CaptureArray name;        // char. not null terminated
+    CaptureArray vertices;    // uint8_t. vertex_stride * vertex_count bytes. vertex_offset of the source is applied
+    CaptureArray indices;     // uint8_t. index_stride * index_count bytes. index_offset of the source is applied
+    CaptureArray bindposes;   // float[16]
+    CaptureArray bone_counts; // uint8_t
+    CaptureArray weights;     // BoneWeight1
+    CaptureArray blendshape_frames; // CaptureBlendshapeFrame
+    uint32_t blendshape_count;
+    uint32_t reserved;
+};
+
+struct CaptureBlendshapeFrame
+{
+    uint32_t blendshape_index;
+    float weight;
+    CaptureArray delta; // float[3]. vertex_count elements
+};
+
+struct CaptureInstance
+{
+    uint32_t id;
+    uint32_t mesh_id;
+    uint32_t flags; // InstanceFlag
+    uint32_t layer;
+    float transform[16];
+    CaptureArray name;               // char. not null terminated
+    CaptureArray bones;              // float[16]
+    CaptureArray blendshape_weights; // float
+};
+
+struct CaptureCamera
+{
+    float position[3];
+    uint32_t layer_mask;
+    float view[16];
+    float proj[16];
+};
+
+struct CaptureView
+{
+    CaptureCamera camera;
+    int32_t width; // render target
+    int32_t height;
+    uint32_t format; // RenderTargetFormat
+    uint32_t output_format; // OutputFormat
+};
+
+struct CaptureLight
+{
+    uint32_t type; // 1: directional, 2: spot, 3: point, 4: reverse point
+    uint32_t layer_mask;
+    float position[3];
+    float range;
+    float direction[3];
+    float spot_angle; // in degree, as rthsRendererAddSpotLight()
+};
+
+// scene of a renderer in a frame
+struct CaptureScene
+{
+    uint32_t renderer_id;
+    uint32_t render_flags; // RenderFlag
+    float shadow_ray_offset;
+    float self_shadow_threshold;
+    CaptureArray views;     // CaptureView. [0]: camera and render target of the renderer. [1...]: multi-view
+    CaptureArray lights;    // CaptureLight
+    CaptureArray instances; // uint32_t. ids of instances in the order of rthsRendererAddMesh()
+};
+
+struct CaptureFrameEnd
+{
+    uint32_t frame;
+    uint32_t reserved;
+    uint64_t time; // nanoseconds since rthsCaptureBegin()
+};
+
+} // namespace rths
@@ -1,5 +1,6 @@
 #include "pch.h"
 #include "rthsRenderer.h"
+#include "rthsCapture.h"
 #include "Foundation/rthsLog.h"
 
 namespace rths {
@@ -102,6 +103,11 @@ void RendererBase::beginScene()
     m_scene_data.light_count = 0;
 
     m_meshes.clear();
+    m_mesh_indices.clear();
+    m_add_mesh_count = 0;
+    m_views.clear();
+    m_gbuffer_depth = nullptr;
+    m_gbuffer_instance_ids = nullptr;
 }
 
 void RendererBase::endScene()
@@ -110,8 +116,16 @@ void RendererBase::endScene()
         m_scene_data.output_format = (uint32_t)m_render_target->output_format;
 
     // setup object layer mask
-    for (auto& inst : m_meshes)
-        inst->layer_mask = 0x1 << inst->layer;
+    m_scene_data.instance_layer_mask = 0;
+    for (auto& inst : m_meshes) {
+        uint32_t layer_mask = 0x1 << inst->layer;
+        if (inst->layer_mask != layer_mask) {
+            // TLAS updates rely on update counts, so the mask change must be marked as an update
+            inst->layer_mask = layer_mask;
+            inst->markUpdated(UpdateFlag::Flags);
+        }
+        m_scene_data.instance_layer_mask |= inst->layer_mask;
+    }
 
     m_is_updating = false;
     m_ready_to_render = true;
@@ -138,11 +152,18 @@ void RendererBase::setRenderTarget(RenderTargetData *rt)
     m_render_target = rt;
 }
 
-void RendererBase::setCamera(const float3& pos, const float4x4& view, const float4x4& proj, uint32_t lmask)
+void RendererBase::setGBuffer(const float *depth, const uint32_t *instance_ids)
+{
+    m_gbuffer_depth = depth;
+    m_gbuffer_instance_ids = depth ? instance_ids : nullptr;
+}
+
+static CameraData MakeCameraData(const float3& pos, const float4x4& view, const float4x4& proj, uint32_t lmask)
 {
-    m_scene_data.camera.view = view;
-    m_scene_data.camera.proj = proj;
-    m_scene_data.camera.position = pos;
+    CameraData ret{};
+    ret.view = view;
+    ret.proj = proj;
+    ret.position = pos;
     {
         auto m22 = -proj[2][2];
         auto m32 = -proj[3][2];
@@ -150,10 +171,16 @@ void RendererBase::setCamera(const float3& pos, const float4x4& view, const floa
         auto tmp_far = std::abs(((m22 - 1.0f)*tmp_near) / (m22 + 1.0f));
         if (tmp_near > tmp_far)
             std::swap(tmp_near, tmp_far);
-        m_scene_data.camera.near_plane = tmp_near;
-        m_scene_data.camera.far_plane = tmp_far;
+        ret.near_plane = tmp_near;
+        ret.far_plane = tmp_far;
     }
-    m_scene_data.camera.layer_mask = lmask;
+    ret.layer_mask = lmask;
+    return ret;
+}
+
+void RendererBase::setCamera(const float3& pos, const float4x4& view, const float4x4& proj, uint32_t lmask)
+{
+    m_scene_data.camera = MakeCameraData(pos, view, proj, lmask);
 }
 
 void RendererBase::addDirectionalLight(const float3& dir, uint32_t lmask)
@@ -211,8 +238,99 @@ void RendererBase::addReversePointLight(const float3& pos, float range, uint32_t
 
 void RendererBase::addMesh(MeshInstanceDataPtr mesh)
 {
-    if (mesh->valid())
+    // invalid meshes are skipped, but still count for instance IDs of the G-buffer
+    if (mesh->valid()) {
         m_meshes.push_back(mesh);
+        m_mesh_indices.push_back(m_add_mesh_count);
+    }
+    ++m_add_mesh_count;
+}
+
+void RendererBase::addView(RenderTargetData *rt, const float3& pos, const float4x4& view, const float4x4& proj, uint32_t lmask)
+{
+    m_views.push_back({ MakeCameraData(pos, view, proj, lmask), rt });
+}
+
+// camera of a cube map face. axes follow the layout of D3D / Unity cube maps: the first row of a face is
+// its top edge (-up here as camera rays go from the bottom row). axes are exact and the field of view is
+// exactly 90 degrees, so texels on the edges of adjacent faces are symmetric about the shared edge.
+static CameraData MakeCubeFaceCamera(int face, const float3& pos, float near_plane, float far_plane, uint32_t lmask)
+{
+    static const float3 s_axes[6][3]{
+        // right, up, forward
+        { { 0, 0,-1}, { 0,-1, 0}, { 1, 0, 0} },
+        { { 0, 0, 1}, { 0,-1, 0}, {-1, 0, 0} },
+        { { 1, 0, 0}, { 0, 0, 1}, { 0, 1, 0} },
+        { { 1, 0, 0}, { 0, 0,-1}, { 0,-1, 0} },
+        { { 1, 0, 0}, { 0,-1, 0}, { 0, 0, 1} },
+        { {-1, 0, 0}, { 0,-1, 0}, { 0, 0,-1} },
+    };
+    auto& x = s_axes[face][0];
+    auto& y = s_axes[face][1];
+    auto z = -s_axes[face][2];
+    float4x4 view{ {
+        {x.x,          y.x,          z.x,          0},
+        {x.y,          y.y,          z.y,          0},
+        {x.z,          y.z,          z.z,          0},
+        {-dot(x, pos), -dot(y, pos), -dot(z, pos), 1}
+    } };
+    float4x4 proj{ {
+        {1, 0, 0, 0},
+        {0, 1, 0, 0},
+        {0, 0, -(far_plane + near_plane) / (far_plane - near_plane), -1},
+        {0, 0, -2.0f * far_plane * near_plane / (far_plane - near_plane), 0},
+    } };
+    auto ret = MakeCameraData(pos, view, proj, lmask);
+    // set exactly. calculating them back from proj loses precision
+    ret.near_plane = near_plane;
+    ret.far_plane = far_plane;
+    return ret;
+}
+
+void RendererBase::setCubeCamera(RenderTargetData **faces, const float3& pos, float near_plane, float far_plane, uint32_t lmask)
+{
+    for (int fi = 0; fi < 6; ++fi) {
+        if (!faces[fi] || faces[fi]->width != faces[fi]->height) {
+            SetErrorLog("cube map faces must be square render targets\n");
+            return;
+        }
+    }
+
+    m_render_target = faces[0];
+    m_scene_data.camera = MakeCubeFaceCamera(0, pos, near_plane, far_plane, lmask);
+    // replaces views added before, as setViews() does
+    m_views.clear();
+    for (int fi = 1; fi < 6; ++fi)
+        m_views.push_back({ MakeCubeFaceCamera(fi, pos, near_plane, far_plane, lmask), faces[fi] });
+}
+
+void RendererBase::setViews(const CameraData *cameras, RenderTargetData **render_targets, int count)
+{
+    if (count <= 0)
+        return;
+    for (int vi = 0; vi < count; ++vi) {
+        if (!render_targets[vi]) {
+            SetErrorLog("render target of view %d is null\n", vi);
+            return;
+        }
+    }
+
+    m_render_target = render_targets[0];
+    m_scene_data.camera = cameras[0];
+    m_views.clear();
+    for (int vi = 1; vi < count; ++vi)
+        m_views.push_back({ cameras[vi], render_targets[vi] });
+}
+
+void RendererBase::captureScene()
+{
+    auto& capture = SceneCapture::getInstance();
+    if (!capture.isCapturing())
+        return;
+
+    std::vector<ViewData> views{ { m_scene_data.camera, m_render_target } };
+    views.insert(views.end(), m_views.begin(), m_views.end());
+    capture.addScene(m_id, m_scene_data, views, m_meshes);
 }
 
 
@@ -234,11 +352,20 @@ void MarkFrameEnd()
         renderer->frameEnd();
     for (auto& cb : g_scene_callbacks_tmp)
         cb->frameEnd();
+    SceneCapture::getInstance().endFrame();
 }
 
 void RenderAll()
 {
     MarkFrameBegin();
+    // scene preparation is done once for all renderers (translating buffers, deforming and building BLAS).
+    // each instance is processed once per frame regardless of renderer count.
+    for (auto renderer : g_renderers_tmp)
+        renderer->shareScene();
+    for (auto *cb : g_scene_callbacks_tmp)
+        cb->prepareSharedScene();
+    // render() only submits work (command lists on DXR, tasks of the job system on CPU).
+    // so renderers run in parallel until finish().
     for (auto renderer : g_renderers_tmp)
         renderer->render();
     for (auto renderer : g_renderers_tmp)
@@ -10,6 +10,8 @@ public:
     virtual ~ISceneCallback();
 
     virtual void frameBegin() = 0;
+    // called by RenderAll() after shareScene() of all renderers. builds the scene of them at once
+    virtual void prepareSharedScene() = 0;
     virtual void frameEnd() = 0;
 
     virtual void onMeshDelete(MeshData *mesh) = 0;
@@ -35,25 +37,44 @@ public:
     virtual void setSelfShadowThreshold(float v) = 0;
 
     virtual void setRenderTarget(RenderTargetData *rt) = 0;
+    virtual void setGBuffer(const float *depth, const uint32_t *instance_ids) = 0;
     virtual void setCamera(const float3& pos, const float4x4& view, const float4x4& proj, uint32_t lmask) = 0;
     virtual void addDirectionalLight(const float3& dir, uint32_t lmask) = 0;
     virtual void addSpotLight(const float3& pos, const float3& dir, float range, float spot_angle, uint32_t lmask) = 0;
     virtual void addPointLight(const float3& pos, float range, uint32_t lmask) = 0;
     virtual void addReversePointLight(const float3& pos, float range, uint32_t lmask) = 0;
     virtual void addMesh(MeshInstanceDataPtr mesh) = 0;
+    // multi-view. the camera of setCamera() is view 0 and added views are 1, 2, ...
+    virtual void addView(RenderTargetData *rt, const float3& pos, const float4x4& view, const float4x4& proj, uint32_t lmask) = 0;
+    // omnidirectional camera. faces: render targets of +X, -X, +Y, -Y, +Z, -Z. face 0 becomes view 0 and others are added as views
+    virtual void setCubeCamera(RenderTargetData **faces, const float3& pos, float near_plane, float far_plane, uint32_t lmask) = 0;
+    // multi-view. cameras[0] and render_targets[0] become view 0 and others replace added views
+    virtual void setViews(const CameraData *cameras, RenderTargetData **render_targets, int count) = 0;
 
     virtual bool isRendering() const = 0;
     virtual void frameBegin() = 0; // called from render thread
+    virtual void shareScene() = 0; // called from render thread. adds the scene to the shared scene pass of RenderAll()
     virtual void render() = 0; // called from render thread
     virtual void finish() = 0; // called from render thread
     virtual void frameEnd() = 0; // called from render thread
 
     virtual bool readbackRenderTarget(void *dst) = 0;
+    virtual bool readbackViewRenderTarget(int view, void *dst) = 0; // view 0 is the same as readbackRenderTarget()
     virtual std::string getTimestampLog() = 0;
+    virtual std::string getMemoryReport() = 0; // memory usage of acceleration structures
+    // light bits of each screen tile in the last frame (bit n: lights[n] can reach the tile). dst can be null to get the size.
+    virtual bool readbackTileLights(int& tile_size, int& tiles_x, int& tiles_y, uint32_t *dst) = 0;
     virtual void* getRenderTexturePtr() = 0;
 };
 
 
+// camera and render target of a view of multi-view rendering
+struct ViewData
+{
+    CameraData camera{};
+    RenderTargetDataPtr render_target;
+};
+
 class RendererBase : public IRenderer, public SharedResource<RendererBase>
 {
 using ref_count = SharedResource<RendererBase>;
@@ -71,14 +92,21 @@ public:
     void setSelfShadowThreshold(float v) override;
 
     void setRenderTarget(RenderTargetData *rt) override;
+    void setGBuffer(const float *depth, const uint32_t *instance_ids) override;
     void setCamera(const float3& pos, const float4x4& view, const float4x4& proj, uint32_t lmask) override;
     void addDirectionalLight(const float3& dir, uint32_t lmask) override;
     void addSpotLight(const float3& pos, const float3& dir, float range, float spot_angle, uint32_t lmask) override;
     void addPointLight(const float3& dir, float range, uint32_t lmask) override;
     void addReversePointLight(const float3& dir, float range, uint32_t lmask) override;
     void addMesh(MeshInstanceDataPtr mesh) override;
+    void addView(RenderTargetData *rt, const float3& pos, const float4x4& view, const float4x4& proj, uint32_t lmask) override;
+    void setCubeCamera(RenderTargetData **faces, const float3& pos, float near_plane, float far_plane, uint32_t lmask) override;
+    void setViews(const CameraData *cameras, RenderTargetData **render_targets, int count) override;
 
 protected:
+    // writes the scene to the capture file if rthsCaptureBegin() has been called. must be called from render()
+    void captureScene();
+
     int m_id = 0;
     SceneData m_scene_data;
     RenderTargetDataPtr m_render_target;
@@ -88,9 +116,18 @@ protected:
     mutable std::atomic_bool m_is_rendering{ false };
 
     std::vector<MeshInstanceDataPtr> m_meshes;
+    std::vector<uint32_t> m_mesh_indices; // index of the addMesh() call of each element of m_meshes
+    uint32_t m_add_mesh_count = 0;
+
+    std::vector<ViewData> m_views; // multi-view. views other than view 0
+
+    // G-buffer input. not owned. null if camera rays are traced
+    const float *m_gbuffer_depth = nullptr;
+    const uint32_t *m_gbuffer_instance_ids = nullptr;
 };
 
 IRenderer* CreateRendererDXR();
+IRenderer* CreateRendererCPU();
 IRenderer* FindRendererByID(int id);
 
 void MarkFrameBegin();
@@ -1,5 +1,6 @@
 #include "pch.h"
 #include "rthsTypes.h"
+#include "Foundation/rthsParallel.h"
 
 namespace rths {
 
@@ -23,6 +24,16 @@ bool GlobalSettings::hasFlag(GlobalFlag v) const
     return (flags & (uint32_t)v) != 0;
 }
 
+void GlobalSettings::setThreadCount(int v)
+{
+    JobSystem::getInstance().setThreadCount(v);
+}
+
+int GlobalSettings::getThreadCount() const
+{
+    return JobSystem::getInstance().getThreadCount();
+}
+
 GlobalSettings& GetGlobals()
 {
     static GlobalSettings s_globals;
@@ -63,6 +74,44 @@ bool SkinData::valid() const
     return !bindposes.empty() && !bone_counts.empty() && !weights.empty();
 }
 
+void BlendshapeFrameData::setDelta(const float3 *src, int vertex_count)
+{
+    runs.clear();
+    delta.clear();
+    // exact zeros only. deltas of untouched vertices are usually zero exactly
+    auto is_zero = [](const float3& v) { return v.x == 0.0f && v.y == 0.0f && v.z == 0.0f; };
+    for (int vi = 0; vi < vertex_count; ) {
+        if (is_zero(src[vi])) {
+            ++vi;
+            continue;
+        }
+        BlendshapeDeltaRun run{ (uint32_t)vi, 0, (uint32_t)delta.size() };
+        for (; vi < vertex_count && !is_zero(src[vi]); ++vi)
+            delta.push_back(src[vi]);
+        run.vertex_count = (uint32_t)delta.size() - run.delta_offset;
+        runs.push_back(run);
+    }
+    runs.shrink_to_fit();
+    delta.shrink_to_fit();
+}
+
+void BlendshapeFrameData::getDelta(float3 *dst, int vertex_count) const
+{
+    std::fill(dst, dst + vertex_count, float3{});
+    for (auto& run : runs) {
+        if (run.vertex_offset >= (uint32_t)vertex_count)
+            break;
+        uint32_t n = std::min(run.vertex_count, (uint32_t)vertex_count - run.vertex_offset);
+        std::copy(&delta[run.delta_offset], &delta[run.delta_offset] + n, dst + run.vertex_offset);
+    }
+}
+
+size_t BlendshapeFrameData::getMemoryUsage() const
+{
+    return sizeof(BlendshapeDeltaRun) * runs.size() + sizeof(float3) * delta.size();
+}
+
+
 void CallOnMeshDelete(MeshData *mesh);
 void CallOnMeshInstanceDelete(MeshInstanceData *inst);
 void CallOnRenderTargetDelete(RenderTargetData *rt);
@@ -94,6 +143,23 @@ bool MeshData::isRelocated() const
     return device_data && device_data->isRelocated();
 }
 
+size_t MeshData::getBlendshapeMemoryUsage() const
+{
+    size_t ret = 0;
+    for (auto& bs : blendshapes)
+        for (auto& frame : bs.frames)
+            ret += frame.getMemoryUsage();
+    return ret;
+}
+
+size_t MeshData::getDenseBlendshapeMemoryUsage() const
+{
+    size_t ret = 0;
+    for (auto& bs : blendshapes)
+        ret += sizeof(float3) * vertex_count * bs.frames.size();
+    return ret;
+}
+
 
 MeshInstanceData::MeshInstanceData()
 {
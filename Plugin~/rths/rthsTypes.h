@@ -13,11 +13,21 @@ enum class DebugFlag : uint32_t
     Timestamp       = 0x01,
     ForceUpdateAS   = 0x02,
     PowerStableState= 0x04,
+    NoRayPackets    = 0x08, // CPU renderer: trace camera rays one by one
+    NoAVX2          = 0x10, // CPU renderer: use 4-wide ray packets even if AVX2 is available
+    NoOcclusionQuery= 0x20, // CPU renderer: trace shadow rays with closest hit traversal
+    BLASUpdateReport= 0x40, // CPU renderer: compare refit, LBVH and SAH rebuild of dynamic meshes. the result goes to the timestamp log
+    NoTriangleBlocks= 0x80, // CPU renderer: read triangles from the strided source buffers at trace time (for benchmarks). disables ray packets
+    NoLightCulling  = 0x100, // CPU renderer: evaluate all lights for each pixel instead of per-tile light lists
+    NoShadowRayBinning= 0x200, // CPU renderer: shoot shadow rays pixel by pixel instead of binning them by light and direction
+    NoF16C          = 0x400, // format conversions of readbacks: use the SSE2 path even if F16C is available
+    NoMatrixAVX     = 0x800, // batch matrix operations: use the SSE2 path even if AVX is available
 };
 
 enum class GlobalFlag : uint32_t
 {
     DeferredInitialization  = 0x01,
+    CompressBVH             = 0x02, // CPU renderer: store BLAS in the compressed layout (quantized 8-wide nodes, 16-bit indices)
 };
 
 enum class OutputFormat : uint32_t
@@ -36,6 +46,8 @@ enum class RenderFlag : uint32_t
     Transparent             = 0x00000020,
     AdaptiveSampling        = 0x00000100,
     Antialiasing            = 0x00000200,
+    TemporalReprojection    = 0x00000400, // CPU renderer: reuse the previous frame's shadow result for stable pixels (camera rays are still traced)
+    DirtyRegions            = 0x00000800, // CPU renderer: trace only screen regions that updated instances can affect
     GPUSkinning             = 0x00010000,
     ClampBlendShapeWights   = 0x00020000,
 };
@@ -122,7 +134,8 @@ struct SceneData
     uint32_t light_count;
     float shadow_ray_offset;
     float self_shadow_threshold;
-    float pad2[3];
+    uint32_t instance_layer_mask; // OR of layer_mask of all instances. set by endScene()
+    float pad2[2];
 
     CameraData camera;
     LightData lights[kMaxLights];
@@ -148,6 +161,10 @@ struct GlobalSettings
     bool hasDebugFlag(DebugFlag flag) const;
 
     bool hasFlag(GlobalFlag v) const;
+
+    // threads of the job system (Foundation/rthsParallel.h). 0: hardware concurrency
+    void setThreadCount(int v);
+    int getThreadCount() const;
 };
 
 GlobalSettings& GetGlobals();
@@ -201,10 +218,23 @@ struct SkinData
     bool valid() const;
 };
 
+// deltas of a blendshape frame are sparse. consecutive vertices with non-zero deltas are a run,
+// and vertices out of runs have zero deltas.
+struct BlendshapeDeltaRun
+{
+    uint32_t vertex_offset; // first vertex of the run
+    uint32_t vertex_count;
+    uint32_t delta_offset;  // index of the delta of the first vertex in BlendshapeFrameData::delta
+};
 struct BlendshapeFrameData
 {
-    std::vector<float3> delta;
+    std::vector<BlendshapeDeltaRun> runs; // sorted by vertex_offset
+    std::vector<float3> delta;            // non-zero deltas only
     float weight = 0.0f;
+
+    void setDelta(const float3 *src, int vertex_count); // dense -> sparse
+    void getDelta(float3 *dst, int vertex_count) const; // sparse -> dense
+    size_t getMemoryUsage() const;
 };
 struct BlendshapeData
 {
@@ -237,6 +267,8 @@ public:
     void release();
     bool valid() const;
     bool isRelocated() const;
+    size_t getBlendshapeMemoryUsage() const;      // sparse deltas
+    size_t getDenseBlendshapeMemoryUsage() const; // deltas of all vertices as before
 };
 using MeshDataPtr = ref_ptr<MeshData>;
 
@@ -133,6 +133,32 @@ namespace Unity.RaytracedHardShadow
             union.nativeArray = na;
             return union.pointer;
         }
+
+        [StructLayout(LayoutKind.Explicit)]
+        struct NAFloat
+        {
+            [FieldOffset(0)] public NativeArray<float> nativeArray;
+            [FieldOffset(0)] public IntPtr pointer;
+        }
+        public static IntPtr GetPointer(ref NativeArray<float> na)
+        {
+            var union = new NAFloat();
+            union.nativeArray = na;
+            return union.pointer;
+        }
+
+        [StructLayout(LayoutKind.Explicit)]
+        struct NAUInt
+        {
+            [FieldOffset(0)] public NativeArray<uint> nativeArray;
+            [FieldOffset(0)] public IntPtr pointer;
+        }
+        public static IntPtr GetPointer(ref NativeArray<uint> na)
+        {
+            var union = new NAUInt();
+            union.nativeArray = na;
+            return union.pointer;
+        }
 #endif
     }
 
@@ -142,12 +168,22 @@ namespace Unity.RaytracedHardShadow
         Timestamp       = 0x01,
         ForceUpdateAS   = 0x02,
         PowerStableState= 0x04,
+        NoRayPackets    = 0x08,
+        NoAVX2          = 0x10,
+        NoOcclusionQuery= 0x20,
+        BLASUpdateReport= 0x40,
+        NoTriangleBlocks= 0x80,
+        NoLightCulling  = 0x100,
+        NoShadowRayBinning= 0x200,
+        NoF16C          = 0x400,
+        NoMatrixAVX     = 0x800,
     }
 
     [Flags]
     internal enum rthsGlobalFlag : uint
     {
         DeferredInitialization = 0x01,
+        CompressBVH            = 0x02,
     };
 
     [Flags]
@@ -161,6 +197,8 @@ namespace Unity.RaytracedHardShadow
         Transparent             = 0x00000020,
         AdaptiveSampling        = 0x00000100,
         Antialiasing            = 0x00000200,
+        TemporalReprojection    = 0x00000400,
+        DirtyRegions            = 0x00000800,
         GPUSkinning             = 0x00010000,
         ClampBlendShapeWights   = 0x00020000,
     }
@@ -196,6 +234,13 @@ namespace Unity.RaytracedHardShadow
     };
 
 
+    internal struct rthsWorkerStats
+    {
+        public uint taskCount;
+        public uint stealCount;
+        public ulong busyTime; // in nanoseconds
+    }
+
     internal struct rthsGlobals {
         #region internal
         [DllImport(Lib.name)] static extern IntPtr rthsGetErrorLog();
@@ -204,6 +249,13 @@ namespace Unity.RaytracedHardShadow
         [DllImport(Lib.name)] static extern void rthsGlobalsSetDebugFlags(rthsDebugFlag v);
         [DllImport(Lib.name)] static extern rthsGlobalFlag rthsGlobalsGetFlags();
         [DllImport(Lib.name)] static extern void rthsGlobalsSetFlags(rthsGlobalFlag v);
+        [DllImport(Lib.name)] static extern int rthsGlobalsGetThreadCount();
+        [DllImport(Lib.name)] static extern void rthsGlobalsSetThreadCount(int v);
+        [DllImport(Lib.name)] static extern int rthsGlobalsGetWorkerStats(rthsWorkerStats[] dst, int maxCount);
+        [DllImport(Lib.name)] static extern void rthsGlobalsResetWorkerStats();
+        [DllImport(Lib.name)] static extern byte rthsCaptureBegin(string path);
+        [DllImport(Lib.name)] static extern void rthsCaptureEnd();
+        [DllImport(Lib.name)] static extern byte rthsCaptureIsCapturing();
         #endregion
 
         public static string errorLog
@@ -220,8 +272,31 @@ namespace Unity.RaytracedHardShadow
             get { return rthsGlobalsGetFlags(); }
             set { rthsGlobalsSetFlags(value); }
         }
+        // 0: hardware concurrency
+        public static int threadCount
+        {
+            get { return rthsGlobalsGetThreadCount(); }
+            set { rthsGlobalsSetThreadCount(value); }
+        }
 
         public static void ClearErrorLog() { rthsClearErrorLog(); }
+
+        // [0]: render thread and other threads that wait for tasks, [1...]: worker threads
+        public static rthsWorkerStats[] GetWorkerStats()
+        {
+            var ret = new rthsWorkerStats[rthsGlobalsGetWorkerStats(null, 0)];
+            rthsGlobalsGetWorkerStats(ret, ret.Length);
+            return ret;
+        }
+        public static void ResetWorkerStats() { rthsGlobalsResetWorkerStats(); }
+
+        // writes scenes that renderers render into path until CaptureEnd(). rths-cli replays it
+        public static bool CaptureBegin(string path) { return rthsCaptureBegin(path) != 0; }
+        public static void CaptureEnd() { rthsCaptureEnd(); }
+        public static bool isCapturing
+        {
+            get { return rthsCaptureIsCapturing() != 0; }
+        }
     }
 
     internal struct rthsMeshData
@@ -538,13 +613,19 @@ namespace Unity.RaytracedHardShadow
         [DllImport(Lib.name)] static extern void rthsRendererSetShadowRayOffset(IntPtr self, float v);
         [DllImport(Lib.name)] static extern void rthsRendererSetSelfShadowThreshold(IntPtr self, float v);
         [DllImport(Lib.name)] static extern void rthsRendererSetRenderTarget(IntPtr self, rthsRenderTarget rt);
+        [DllImport(Lib.name)] static extern void rthsRendererSetGBuffer(IntPtr self, IntPtr depth, IntPtr instanceIDs);
         [DllImport(Lib.name)] static extern void rthsRendererSetCamera(IntPtr self, Vector3 pos, Matrix4x4 view, Matrix4x4 proj, uint mask);
+        [DllImport(Lib.name)] static extern void rthsRendererAddView(IntPtr self, rthsRenderTarget rt, Vector3 pos, Matrix4x4 view, Matrix4x4 proj, uint mask);
+        [DllImport(Lib.name)] static extern void rthsRendererSetCubeCamera(IntPtr self, IntPtr[] faces, Vector3 pos, float nearPlane, float farPlane, uint mask);
         [DllImport(Lib.name)] static extern void rthsRendererAddDirectionalLight(IntPtr self, Vector3 dir, uint mask);
         [DllImport(Lib.name)] static extern void rthsRendererAddSpotLight(IntPtr self, Vector3 pos, Vector3 dir, float range, float spotAngle, uint mask);
         [DllImport(Lib.name)] static extern void rthsRendererAddPointLight(IntPtr self, Vector3 pos, float range, uint mask);
         [DllImport(Lib.name)] static extern void rthsRendererAddReversePointLight(IntPtr self, Vector3 pos, float range, uint mask);
         [DllImport(Lib.name)] static extern void rthsRendererAddMesh(IntPtr self, rthsMeshInstanceData mesh);
         [DllImport(Lib.name)] static extern IntPtr rthsRendererGetTimestampLog(IntPtr self);
+        [DllImport(Lib.name)] static extern IntPtr rthsRendererGetMemoryReport(IntPtr self);
+        [DllImport(Lib.name)] static extern byte rthsRendererReadbackTileLights(IntPtr self, ref int tileSize, ref int tilesX, ref int tilesY, uint[] dst);
+        [DllImport(Lib.name)] static extern byte rthsRendererReadbackViewRenderTarget(IntPtr self, int view, IntPtr dst);
 
         [DllImport(Lib.name)] static extern IntPtr rthsGetFlushDeferredCommands();
         [DllImport(Lib.name)] static extern IntPtr rthsGetRenderAll();
@@ -567,6 +648,10 @@ namespace Unity.RaytracedHardShadow
         {
             get { return Misc.CString(rthsRendererGetTimestampLog(self)); }
         }
+        public string memoryReport
+        {
+            get { return Misc.CString(rthsRendererGetMemoryReport(self)); }
+        }
         public bool initialized
         {
             get { return rthsRendererIsInitialized(self) != 0; }
@@ -582,7 +667,7 @@ namespace Unity.RaytracedHardShadow
 
         public static rthsRenderer Create()
         {
-            rthsGlobals.flags = rthsGlobalFlag.DeferredInitialization;
+            rthsGlobals.flags |= rthsGlobalFlag.DeferredInitialization;
             var ret = new rthsRenderer { self = rthsRendererCreate() };
             IssueFlushDeferredCommands();
             return ret;
@@ -600,6 +685,20 @@ namespace Unity.RaytracedHardShadow
             rthsRendererSetRenderTarget(self, rt);
         }
 
+        // G-buffer input. CPU renderer only. call between BeginScene() and EndScene().
+        // depth: view space depth of each pixel. instanceIDs: index of AddMesh() call of the receiver, or ~0 if unknown.
+        // buffers must be kept until rendering is finished.
+        public void SetGBuffer(IntPtr depth, IntPtr instanceIDs)
+        {
+            rthsRendererSetGBuffer(self, depth, instanceIDs);
+        }
+#if UNITY_2019_1_OR_NEWER
+        public void SetGBuffer(NativeArray<float> depth, NativeArray<uint> instanceIDs)
+        {
+            rthsRendererSetGBuffer(self, Misc.GetPointer(ref depth), instanceIDs.IsCreated ? Misc.GetPointer(ref instanceIDs) : IntPtr.Zero);
+        }
+#endif
+
         public void BeginScene()
         {
             rthsRendererBeginScene(self);
@@ -629,6 +728,27 @@ namespace Unity.RaytracedHardShadow
             rthsRendererSetCamera(self, cam.transform.position, cam.worldToCameraMatrix, cam.projectionMatrix, mask);
         }
 
+        // additional camera traced in the same pass as SetCamera(). CPU renderer only.
+        public void AddView(rthsRenderTarget rt, Camera cam, bool useCullingMask = true)
+        {
+            uint mask = useCullingMask ? (uint)cam.cullingMask : ~0u;
+            rthsRendererAddView(self, rt, cam.transform.position, cam.worldToCameraMatrix, cam.projectionMatrix, mask);
+        }
+
+        // 6 faces (+X, -X, +Y, -Y, +Z, -Z) traced in one pass. used instead of SetRenderTarget() and SetCamera(). CPU renderer only.
+        public void SetCubeCamera(rthsRenderTarget[] faces, Vector3 pos, float nearPlane, float farPlane, uint mask = ~0u)
+        {
+            if (faces == null || faces.Length != 6)
+            {
+                Debug.LogWarning("rthsShadowRenderer: SetCubeCamera() needs 6 faces");
+                return;
+            }
+            var ptrs = new IntPtr[6];
+            for (int i = 0; i < 6; ++i)
+                ptrs[i] = faces[i].self;
+            rthsRendererSetCubeCamera(self, ptrs, pos, nearPlane, farPlane, mask);
+        }
+
         public bool AddLight(Light light, bool useCullingMask = true)
         {
             uint mask = useCullingMask ? (uint)light.cullingMask : ~0u;
@@ -678,6 +798,24 @@ namespace Unity.RaytracedHardShadow
             rthsRendererAddMesh(self, mesh);
         }
 
+        // light bits of each screen tile in the last frame. CPU renderer only. returns null if not available.
+        public uint[] ReadbackTileLights(out int tileSize, out int tilesX, out int tilesY)
+        {
+            tileSize = tilesX = tilesY = 0;
+            if (rthsRendererReadbackTileLights(self, ref tileSize, ref tilesX, ref tilesY, null) == 0)
+                return null;
+            var ret = new uint[tilesX * tilesY];
+            if (rthsRendererReadbackTileLights(self, ref tileSize, ref tilesX, ref tilesY, ret) == 0)
+                return null;
+            return ret;
+        }
+
+        // copy the result of a view to dst. view 0 is the SetCamera() camera. returns false if not available.
+        public bool ReadbackViewRenderTarget(int view, IntPtr dst)
+        {
+            return rthsRendererReadbackViewRenderTarget(self, view, dst) != 0;
+        }
+
         public static void IssueFlushDeferredCommands()
         {
             GL.IssuePluginEvent(rthsGetFlushDeferredCommands(), 0);